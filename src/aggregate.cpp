@@ -0,0 +1,297 @@
+#include "aggregate.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "src/hash.h"
+#include "src/stats.h"
+#include "src/utils.h"
+
+namespace redbrouk
+{
+
+void ag_input(AggJob *job, TSet *tst, double weight) {
+	job->inputs.push_back({ tst, tst ? ts_size(tst) : 0, weight });
+}
+
+size_t ag_members(const AggJob *job) {
+	size_t n = 0;
+	for(const AggInput &in : job->inputs)
+		n += in.size;
+	return n;
+}
+
+namespace { // anonymous namespace
+	// one name of a partition, with what its inputs have added up to so far
+	struct agg_entry {
+		iHNode node;
+		std::string_view name;
+		double score;
+		size_t count; // inputs it was found in
+	};
+
+	bool entry_eq(const iHNode *a, const iHNode *b) {
+		return utils::container_of((iHNode *)a, &agg_entry::node)->name == utils::container_of((iHNode *)b, &agg_entry::node)->name;
+	}
+
+	double combine(AggFunc func, double acc, double score) {
+		switch(func) {
+			case AGG_MIN: return std::min(acc, score);
+			case AGG_MAX: return std::max(acc, score);
+			default:      return acc + score;
+		}
+	}
+
+	// a weighted member of an input, with its name's hash
+	struct agg_member {
+		std::string_view name;
+		double score;
+		size_t hval;
+	};
+
+	// one parallel() call, its indices handed out one at a time
+	struct pool_call {
+		void *fn;
+		void (*run)(void *fn, size_t i);
+		size_t n, next, finished;
+	};
+	// WORKER POOL - the threads parallel() calls run on next to the calling one, started as the calls need them and
+	// kept for the next. The loop's inline jobs and the aggregation thread's may share it at the same time
+	struct worker_pool {
+		std::mutex lock;
+		std::condition_variable_any wake; // a call has indices left
+		std::condition_variable done;     // a call's last index finished
+		std::deque<pool_call *> calls;
+
+		std::vector<std::jthread> threads; // last, so they're stopped and joined before the rest goes
+
+		void run(std::stop_token stop) {
+			std::unique_lock guard(lock);
+			while(wake.wait(guard, stop, [this] { return !calls.empty(); })) {
+				pool_call *call = calls.front();
+				const size_t i = call->next++;
+				if(call->next == call->n)
+					calls.pop_front();
+
+				guard.unlock();
+				call->run(call->fn, i);
+				guard.lock();
+				if(++call->finished == call->n)
+					done.notify_all();
+			}
+		}
+	};
+
+	worker_pool &workers() {
+		static worker_pool instance;
+		return instance;
+	}
+
+	// parallel: fn(0 .. n-1) on the pool's threads and the calling one, which takes what they haven't started
+	template <class Fn>
+	void parallel(size_t n, Fn &&fn) {
+		if(n <= 1) {
+			fn(0);
+			return;
+		}
+
+		worker_pool &pool = workers();
+		pool_call call{ &fn, [](void *f, size_t i) { (*(std::remove_reference_t<Fn> *)f)(i); }, n, 1, 0 };
+		{
+			std::lock_guard guard(pool.lock);
+			while(pool.threads.size() < n - 1)
+				pool.threads.emplace_back([&pool](std::stop_token stop) { pool.run(stop); });
+			pool.calls.push_back(&call);
+		}
+		pool.wake.notify_all();
+
+		fn(0);
+		std::unique_lock guard(pool.lock);
+		call.finished++;
+		while(call.next < call.n) {
+			const size_t i = call.next++;
+			if(call.next == call.n)
+				std::erase(pool.calls, &call);
+
+			guard.unlock();
+			fn(i);
+			guard.lock();
+			call.finished++;
+		}
+		pool.done.wait(guard, [&call] { return call.finished == call.n; });
+	}
+}
+
+void ag_run(AggJob *job) {
+	const size_t nparts = std::max<uint32_t>(1, job->nthreads);
+	const size_t ninputs = job->inputs.size();
+
+	// 1) every thread walks a share of the inputs in order, the biggest ones first to the thread with the least so
+	// far, and sorts their members by partition. Only the score tree is read: the loop may still look members up,
+	// which moves them between the buckets of the name table. The partition comes from the high bits of the hash,
+	// the low ones pick the bucket in the partition's table
+	std::vector<size_t> order(ninputs), load(nparts);
+	std::vector<std::vector<size_t>> shares(nparts);
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [job](size_t a, size_t b) { return job->inputs[a].size > job->inputs[b].size; });
+	for(size_t i : order) {
+		const size_t t = std::min_element(load.begin(), load.end()) - load.begin();
+		shares[t].push_back(i);
+		load[t] += job->inputs[i].size;
+	}
+
+	std::vector<std::vector<std::vector<agg_member>>> parts(nparts, std::vector<std::vector<agg_member>>(nparts));
+	parallel(nparts, [&](size_t t) {
+		for(std::vector<agg_member> &part : parts[t])
+			part.reserve(load[t] / nparts + 1);
+
+		for(size_t i : shares[t]) {
+			const AggInput &in = job->inputs[i];
+			for(TSTNode *node = in.size ? ts_min(in.tset) : nullptr; node; node = ts_walk(node, 1)) {
+				const size_t hval = genHash((const byte *)node->name.data(), node->name.size());
+				parts[t][(hval >> 40) % nparts].push_back({ node->name, node->tnode.key * in.weight, hval });
+			}
+		}
+		st_add(ST_AGG_MEMBERS, load[t]);
+	});
+
+	// 2) every thread combines one partition in a table of its own and keeps what the operation lets through
+	std::vector<std::vector<std::string_view>> names(nparts);
+	std::vector<std::vector<double>> scores(nparts);
+	parallel(nparts, [&](size_t p) {
+		size_t count = 0;
+		for(size_t t = 0; t < nparts; t++)
+			count += parts[t][p].size();
+
+		std::vector<agg_entry> entries;
+		entries.reserve(count); // never moves, the table points into it
+		iHSet table;
+		mk_ihset(&table);
+		ihs_reserve(&table, count);
+
+		for(size_t t = 0; t < nparts; t++) {
+			for(const agg_member &m : parts[t][p]) {
+				agg_entry key{ { nullptr, m.hval }, m.name, m.score, 1 };
+				if(iHNode *found = ihs_find(&table, &key.node, entry_eq)) {
+					agg_entry *e = utils::container_of(found, &agg_entry::node);
+					e->score = combine(job->func, e->score, m.score);
+					e->count++;
+				} else {
+					entries.push_back(key);
+					ihs_insert(&table, &entries.back().node);
+				}
+			}
+		}
+
+		for(const agg_entry &e : entries) {
+			if(job->op == AGG_INTER && e.count != ninputs)
+				continue;
+
+			names[p].push_back(e.name);
+			scores[p].push_back(std::isnan(e.score) ? 0 : e.score); // inf - inf
+		}
+		ihs_destroy(&table, nullptr);
+	});
+
+	// 3) one batch for the bulk path of ts_add, sorted on several threads when it's big
+	for(size_t p = 1; p < nparts; p++) {
+		names[0].insert(names[0].end(), names[p].begin(), names[p].end());
+		scores[0].insert(scores[0].end(), scores[p].begin(), scores[p].end());
+	}
+
+	job->result.reset(mk_tset());
+	size_t updated;
+	ts_add(job->result.get(), names[0], scores[0], updated);
+	st_add(ST_AGG_JOBS);
+}
+
+namespace { // anonymous namespace
+	struct aggregator {
+		std::mutex lock;
+		std::condition_variable_any wake;
+		std::deque<std::unique_ptr<AggJob>> queue;
+		std::deque<std::unique_ptr<AggJob>> done; // in the order they were submitted
+
+		std::atomic<size_t> running = 0;
+		const int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC); // readable while 'done' isn't empty
+
+		std::jthread thread; // last, so it's stopped and joined before the rest goes
+
+		void run(std::stop_token stop) {
+			while(true) {
+				std::unique_ptr<AggJob> job;
+				{
+					std::unique_lock guard(lock);
+					if(!wake.wait(guard, stop, [this] { return !queue.empty(); }))
+						return;
+					job = std::move(queue.front());
+					queue.pop_front();
+				}
+
+				ag_run(job.get());
+
+				std::lock_guard guard(lock);
+				done.push_back(std::move(job));
+				const uint64_t one = 1;
+				(void)!write(wake_fd, &one, sizeof(one));
+			}
+		}
+	};
+
+	aggregator &ag() {
+		workers(); // built first, so it outlives the thread running jobs on it
+		static aggregator instance;
+		return instance;
+	}
+}
+
+void ag_submit(std::unique_ptr<AggJob> job) {
+	aggregator &a = ag();
+	a.running.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard guard(a.lock);
+		if(!a.thread.joinable())
+			a.thread = std::jthread([&a](std::stop_token stop) { a.run(stop); });
+		a.queue.push_back(std::move(job));
+	}
+	a.wake.notify_one();
+}
+
+std::unique_ptr<AggJob> ag_poll() {
+	aggregator &a = ag();
+	if(a.running.load(std::memory_order_relaxed) == 0)
+		return nullptr;
+
+	std::lock_guard guard(a.lock);
+	if(a.done.empty())
+		return nullptr;
+
+	std::unique_ptr<AggJob> job = std::move(a.done.front());
+	a.done.pop_front();
+	if(a.done.empty()) { // the loop stops waking up for it
+		uint64_t count;
+		(void)!read(a.wake_fd, &count, sizeof(count));
+	}
+	a.running.fetch_sub(1, std::memory_order_relaxed);
+	return job;
+}
+
+size_t ag_running() {
+	return ag().running.load(std::memory_order_relaxed);
+}
+
+int ag_wake_fd() {
+	return ag().wake_fd;
+}
+
+} // namespace redbrouk
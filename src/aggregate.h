@@ -0,0 +1,79 @@
+#ifndef REDBROUK_AGGREGATE_H
+#define REDBROUK_AGGREGATE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "src/kvt_tset.h"
+
+namespace redbrouk
+{
+
+class Conn;
+
+/* TSET AGGREGATES - tunionstore/tinterstore combine weighted tsets into a new one. The job reads its inputs in
+ * place: the loop leaves them unchanged until it collects the job, copying a set before writing to it, so nothing
+ * is copied up front. Each worker thread walks a share of the inputs in order and sorts their members by name hash
+ * into partitions, then combines one partition in a table of its own, and the result is built through ts_add's
+ * bulk path: one sort and a linear tree build. The workers are a pool kept between jobs.
+ * Jobs too big to run inline go to a background thread through ag_submit, the loop collects them with ag_poll
+ * once ag_wake_fd turns readable.
+ */
+enum AggOp : uint8_t {
+	AGG_UNION,
+	AGG_INTER  // members present in every input
+};
+enum AggFunc : uint8_t {
+	AGG_SUM,
+	AGG_MIN,
+	AGG_MAX
+};
+
+typedef struct agg_input {
+	TSet *tset;    // nullptr for a missing key
+	size_t size;   // ts_size(tset), taken by the loop
+	double weight;
+} AggInput;
+
+typedef struct agg_job {
+	AggOp op = AGG_UNION;
+	AggFunc func = AGG_SUM;
+	uint32_t nthreads = 1;
+
+	std::vector<AggInput> inputs;
+
+	std::unique_ptr<TSet> result; // set by ag_run
+
+	// the loop's bookkeeping for a background job, the workers never look at these
+	std::string dest;
+	Conn *client = nullptr; // cleared when the client leaves first
+} AggJob;
+
+// An input of background jobs, lent by the loop until it collected them (see tset_lend in io.cpp)
+typedef struct tset_loan {
+	TSet *tset;
+	size_t jobs = 0; // running jobs that read it
+	std::unique_ptr<Valtype> orphan; // owns the set once a write or a delete took it out of its key
+} TSetLoan;
+
+// ag_input: adds 'tst' as the job's next input, nullptr for a missing key. The set must stay unchanged until the job ran
+void ag_input(AggJob *job, TSet *tst, double weight);
+size_t ag_members(const AggJob *job); // of every input, counting repeats
+// ag_run: computes job->result on up to job->nthreads threads, the calling one included
+void ag_run(AggJob *job);
+
+// ag_submit: queues the job on the aggregation thread, started on first use and joined at exit
+void ag_submit(std::unique_ptr<AggJob> job);
+// ag_poll: a finished job handed back to the loop, nullptr when there's none
+[[nodiscard]] std::unique_ptr<AggJob> ag_poll();
+
+size_t ag_running(); // jobs submitted and not handed back yet
+int ag_wake_fd(); // readable while a finished job waits for ag_poll, the loop polls it
+
+} // namespace redbrouk
+
+#endif
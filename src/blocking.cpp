@@ -0,0 +1,108 @@
+#include "blocking.h"
+
+#include <algorithm>
+
+#include "src/utils.h"
+
+namespace redbrouk
+{
+
+namespace { // anonymous namespace
+	struct name_key {
+		iHNode hook;
+		std::string_view name;
+	};
+	bool key_eq(const iHNode *a, const iHNode *b) {
+		const BkKey *key   = utils::container_of((iHNode *)a, &BkKey::hook);
+		const name_key *nk = utils::container_of((iHNode *)b, &name_key::hook);
+		return key->name == nk->name;
+	}
+	bool same_node(const iHNode *a, const iHNode *b) { return a == b; }
+
+	BkKey *find_key(Blocking *bk, std::string_view name) {
+		if(bk->keys.curr.size + bk->keys.prev.size == 0) // every write checks, nobody waits most of the time
+			return nullptr;
+
+		name_key nk{ { nullptr, genHash((const byte *)name.data(), name.size()) }, name };
+		iHNode *node = ihs_find(&bk->keys, &nk.hook, key_eq);
+		return node ? utils::container_of(node, &BkKey::hook) : nullptr;
+	}
+}
+
+void mk_blocking(Blocking *bk, uint64_t now_ms) {
+	mk_ihset(&bk->keys);
+	mk_twheel(&bk->timeouts, now_ms);
+}
+
+BkWait *bk_block(Blocking *bk, Conn *conn, std::span<const std::string_view> keys, bool max, uint64_t deadline_ms) {
+	BkWait *wait = new BkWait{ conn, max, {}, {} };
+	bk->nwaits++;
+
+	for(std::string_view name : keys) {
+		BkKey *key = find_key(bk, name);
+		if(!key) {
+			key = new BkKey{ { nullptr, genHash((const byte *)name.data(), name.size()) }, std::string(name) };
+			ihs_insert(&bk->keys, &key->hook);
+		} else if(std::any_of(wait->entries.begin(), wait->entries.end(), [key](BkEntry *e) { return e->key == key; })) {
+			continue; // named twice
+		}
+
+		BkEntry *entry = new BkEntry{ key, wait, key->tail, nullptr };
+		if(key->tail)
+			key->tail->next = entry;
+		else
+			key->head = entry;
+		key->tail = entry;
+		wait->entries.push_back(entry);
+	}
+
+	if(deadline_ms)
+		tw_add(&bk->timeouts, &wait->timeout, deadline_ms);
+	return wait;
+}
+
+void bk_unblock(Blocking *bk, BkWait *wait) {
+	for(BkEntry *entry : wait->entries) {
+		BkKey *key = entry->key;
+		(entry->prev ? entry->prev->next : key->head) = entry->next;
+		(entry->next ? entry->next->prev : key->tail) = entry->prev;
+		delete entry;
+
+		if(!key->head && !key->ready) { // a ready key is dropped once it's served
+			ihs_del(&bk->keys, &key->hook, same_node);
+			delete key;
+		}
+	}
+
+	tw_del(&bk->timeouts, &wait->timeout);
+	bk->nwaits--;
+	delete wait;
+}
+
+BkWait *bk_first(Blocking *bk, std::string_view name) {
+	BkKey *key = find_key(bk, name);
+	return key && key->head ? key->head->wait : nullptr;
+}
+
+void bk_served(Blocking *bk, std::string_view name) {
+	BkKey *key = find_key(bk, name);
+	if(!key)
+		return;
+
+	key->ready = false;
+	if(!key->head) { // its waiters were served, or left while it was queued
+		ihs_del(&bk->keys, &key->hook, same_node);
+		delete key;
+	}
+}
+
+void bk_signal(Blocking *bk, std::string_view name) {
+	BkKey *key = find_key(bk, name);
+	if(!key || key->ready)
+		return;
+
+	key->ready = true;
+	bk->ready.emplace_back(name);
+}
+
+} // namespace redbrouk
@@ -0,0 +1,68 @@
+#ifndef REDBROUK_BLOCKING_H
+#define REDBROUK_BLOCKING_H
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/connection.h"
+#include "src/hash.h"
+#include "src/twheel.h"
+#include "src/utils.h"
+
+namespace redbrouk
+{
+
+/* BLOCKED CLIENTS - clients parked by btpopmin/btpopmax until one of their keys gets members or their
+ * timeout passes. Keys with waiters live in an intrusive hash set, each holding a FIFO of its waiters so
+ * the longest waiting client is served first. A client waiting on several keys has one entry per key,
+ * all reachable from its BkWait: serving or dropping it unlinks it everywhere in time proportional
+ * to its own keys. Writes only mark a key ready, the loop serves it once the write is done.
+ */
+typedef struct bk_key {
+	iHNode hook; // in Blocking::keys
+	std::string name;
+	struct bk_entry *head = nullptr, *tail = nullptr;
+	bool ready = false; // already in Blocking::ready
+} BkKey;
+
+typedef struct bk_entry {
+	BkKey *key;
+	struct bk_wait *wait;
+	bk_entry *prev, *next; // the key's waiters, oldest first
+} BkEntry;
+
+typedef struct bk_wait {
+	Conn *conn;
+	bool max;       // btpopmax
+	TWNode timeout; // unarmed when the client waits for good
+	std::vector<BkEntry *> entries; // one per key, in the order the client named them
+} BkWait;
+
+typedef struct blocking {
+	iHSet keys;
+	std::vector<std::string> ready; // keys that got members since the loop last served them
+	TWheel timeouts;
+	size_t nwaits = 0;
+} Blocking;
+
+void mk_blocking(Blocking *bk, uint64_t now_ms);
+
+// bk_block: parks 'conn' on 'keys', 'deadline_ms' 0 for no timeout
+BkWait *bk_block(Blocking *bk, Conn *conn, std::span<const std::string_view> keys, bool max, uint64_t deadline_ms);
+// bk_unblock: unlinks the wait from all its keys and frees it
+void bk_unblock(Blocking *bk, BkWait *wait);
+
+// bk_first: the longest waiting client on 'key', nullptr if there's none
+[[nodiscard]] BkWait *bk_first(Blocking *bk, std::string_view key);
+// bk_signal: 'key' got members, queued in bk->ready once if anyone waits on it
+void bk_signal(Blocking *bk, std::string_view key);
+// bk_served: the loop is done serving a ready key, it can be queued again
+void bk_served(Blocking *bk, std::string_view key);
+
+inline BkWait *get_bkwait(TWNode *timeout) { return utils::container_of(timeout, &BkWait::timeout); }
+
+} // namespace redbrouk
+
+#endif
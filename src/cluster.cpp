@@ -0,0 +1,25 @@
+#include "cluster.h"
+
+#include <algorithm>
+
+namespace redbrouk
+{
+
+void mk_cluster(Cluster *cl, std::string_view host, uint16_t port) {
+	cl->nodes.assign(1, { std::string(host), port });
+	std::fill(std::begin(cl->owner), std::end(cl->owner), CL_NO_NODE);
+	std::fill(std::begin(cl->peer), std::end(cl->peer), CL_NO_NODE);
+	std::fill(std::begin(cl->state), std::end(cl->state), SLOT_STABLE);
+}
+
+uint16_t cl_node(Cluster *cl, std::string_view host, uint16_t port) {
+	for(size_t i = 0; i < cl->nodes.size(); i++) {
+		if(cl->nodes[i].host == host && cl->nodes[i].port == port)
+			return (uint16_t)i;
+	}
+
+	cl->nodes.push_back({ std::string(host), port });
+	return (uint16_t)(cl->nodes.size() - 1);
+}
+
+} // namespace redbrouk
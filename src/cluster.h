@@ -0,0 +1,76 @@
+#ifndef REDBROUK_CLUSTER_H
+#define REDBROUK_CLUSTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "src/hash.h"
+
+namespace redbrouk
+{
+
+/* CLUSTER SLOTS - the keyspace is split into CLUSTER_SLOTS hash slots, each served by one node.
+ * A key's slot comes from genHash of the key, or of its hash tag: the part between the first '{'
+ * and the next '}', when that isn't empty. Keys sharing a tag share a slot, so multi key commands
+ * can address them together. Without a tag the slot is the low bits of the keyspace hash itself.
+ */
+constexpr size_t   CLUSTER_SLOTS = 16384;
+constexpr uint16_t CL_NO_NODE    = UINT16_MAX;
+
+// cl_hash_tag: the part of 'key' that decides its slot
+[[nodiscard]] inline std::string_view cl_hash_tag(std::string_view key) {
+	const size_t open = key.find('{');
+	if(open == std::string_view::npos)
+		return key;
+
+	const size_t close = key.find('}', open + 1);
+	if(close == std::string_view::npos || close == open + 1)
+		return key;
+	return key.substr(open + 1, close - open - 1);
+}
+[[nodiscard]] inline uint16_t cl_key_slot(std::string_view key) {
+	const std::string_view tag = cl_hash_tag(key);
+	return (uint16_t)(genHash((const byte *)tag.data(), tag.size()) & (CLUSTER_SLOTS - 1));
+}
+// Same slot, with 'hval' = genHash(key) at hand the common untagged case doesn't hash again
+[[nodiscard]] inline uint16_t cl_key_slot(std::string_view key, size_t hval) {
+	const std::string_view tag = cl_hash_tag(key);
+	return tag.size() == key.size() ? (uint16_t)(hval & (CLUSTER_SLOTS - 1)) : cl_key_slot(key);
+}
+
+enum SlotState : uint8_t {
+	SLOT_STABLE,
+	SLOT_MIGRATING, // ours, keys are moving to 'peer': missing keys are asked for there
+	SLOT_IMPORTING  // 'peer's, keys are moving here: served to clients that sent 'asking'
+};
+
+typedef struct cluster_node {
+	std::string host; // numeric IPv4
+	uint16_t port;
+} ClusterNode;
+
+// Static slot map, the same on every node. Set with 'cluster addslots/setslots', migrations
+// update it on both ends and tell every other node they know of
+typedef struct cluster {
+	std::vector<ClusterNode> nodes;      // nodes[0] is this node
+	uint16_t  owner[CLUSTER_SLOTS];      // index in nodes, CL_NO_NODE while unassigned
+	uint16_t  peer[CLUSTER_SLOTS];       // migrating to / importing from
+	SlotState state[CLUSTER_SLOTS];
+	uint32_t  keys[CLUSTER_SLOTS];       // keys stored on this node per slot
+} Cluster;
+
+void mk_cluster(Cluster *cl, std::string_view host, uint16_t port);
+uint16_t cl_node(Cluster *cl, std::string_view host, uint16_t port); // index of the node, added if new
+
+[[nodiscard]] inline bool cl_mine(const Cluster *cl, uint16_t slot) { return cl->owner[slot] == 0; }
+[[nodiscard]] inline std::string cl_addr(const Cluster *cl, uint16_t node) {
+	return cl->nodes[node].host + ":" + std::to_string(cl->nodes[node].port);
+}
+
+} // namespace redbrouk
+
+#endif // ifndef REDBROUK_CLUSTER_H
@@ -0,0 +1,163 @@
+#include "config.h"
+
+#include <charconv>
+#include <span>
+
+#include "src/slowlog.h"
+
+namespace redbrouk
+{
+
+SrvConfig srv_cfg;
+
+namespace { // anonymous namespace
+	enum cfg_kind : uint8_t {
+		CFG_U32,   // plain integer
+		CFG_BYTES, // integer with an optional kb/mb/gb suffix
+		CFG_ENUM,  // one of 'names', stored as its index
+		CFG_STR    // a std::string, 'min' to 'max' bytes long
+	};
+
+	struct cfg_entry {
+		std::string_view name;
+		void *val;
+		cfg_kind kind;
+		uint64_t min, max;
+		std::span<const std::string_view> names = {};
+	};
+
+	constexpr std::string_view policy_names[] = {
+		"noeviction", "allkeys-lru", "allkeys-lfu", "volatile-ttl"
+	};
+
+	cfg_entry cfg_table[] = {
+		{ "hz",                &srv_cfg.hz,                CFG_U32, 1, 500 },
+		{ "expire-slice-us",   &srv_cfg.expire_slice_us,   CFG_U32, 1, 1000 * 1000 },
+		{ "maxmemory",         &srv_cfg.maxmemory,         CFG_BYTES, 0, UINT64_MAX },
+		{ "maxmemory-policy",  &srv_cfg.maxmemory_policy,  CFG_ENUM, 0, std::size(policy_names) - 1, policy_names },
+		{ "maxmemory-samples", &srv_cfg.maxmemory_samples, CFG_U32, 1, 64 },
+		{ "evict-budget-us",   &srv_cfg.evict_budget_us,   CFG_U32, 1, 1000 * 1000 },
+		{ "lfu-log-factor",    &srv_cfg.lfu_log_factor,    CFG_U32, 0, 1000 },
+		{ "lfu-decay-time",    &srv_cfg.lfu_decay_time,    CFG_U32, 0, 1000 },
+		{ "latency-tracking",  &srv_cfg.latency_tracking,  CFG_U32, 0, 1 },
+		{ "slowlog-log-slower-than", &srv_cfg.slowlog_log_slower_than, CFG_U32, 0, UINT32_MAX },
+		{ "slowlog-max-len",         &srv_cfg.slowlog_max_len,         CFG_U32, 0, SLOWLOG_CAP },
+		{ "watchdog-period",         &srv_cfg.watchdog_period,         CFG_U32, 0, 60 * 1000 },
+		{ "metrics-slice-us",        &srv_cfg.metrics_slice_us,        CFG_U32, 1, 1000 * 1000 },
+		{ "lazyfree-threshold",       &srv_cfg.lazyfree_threshold,       CFG_U32, 0, UINT32_MAX },
+		{ "lazyfree-lazy-user-del",   &srv_cfg.lazyfree_lazy_user_del,   CFG_U32, 0, 1 },
+		{ "lazyfree-lazy-server-del", &srv_cfg.lazyfree_lazy_server_del, CFG_U32, 0, 1 },
+		{ "client-output-normal-hard",         &srv_cfg.output_limits[CLIENT_NORMAL].hard,         CFG_BYTES, 0, UINT64_MAX },
+		{ "client-output-normal-soft",         &srv_cfg.output_limits[CLIENT_NORMAL].soft,         CFG_BYTES, 0, UINT64_MAX },
+		{ "client-output-normal-soft-seconds", &srv_cfg.output_limits[CLIENT_NORMAL].soft_seconds, CFG_U32, 0, 86400 },
+		{ "client-output-pubsub-hard",         &srv_cfg.output_limits[CLIENT_PUBSUB].hard,         CFG_BYTES, 0, UINT64_MAX },
+		{ "client-output-pubsub-soft",         &srv_cfg.output_limits[CLIENT_PUBSUB].soft,         CFG_BYTES, 0, UINT64_MAX },
+		{ "client-output-pubsub-soft-seconds", &srv_cfg.output_limits[CLIENT_PUBSUB].soft_seconds, CFG_U32, 0, 86400 },
+		{ "client-output-replica-hard",        &srv_cfg.output_limits[CLIENT_REPLICA].hard,        CFG_BYTES, 0, UINT64_MAX },
+		{ "client-output-replica-soft",        &srv_cfg.output_limits[CLIENT_REPLICA].soft,        CFG_BYTES, 0, UINT64_MAX },
+		{ "client-output-replica-soft-seconds", &srv_cfg.output_limits[CLIENT_REPLICA].soft_seconds, CFG_U32, 0, 86400 },
+		{ "client-output-pause",               &srv_cfg.output_pause,                              CFG_BYTES, 4096, UINT64_MAX },
+		{ "repl-backlog-size",                 &srv_cfg.repl_backlog_size,                         CFG_BYTES, 16 * 1024, UINT64_MAX },
+		{ "cluster-enabled",                   &srv_cfg.cluster_enabled,                           CFG_U32, 0, 1 },
+		{ "cluster-migrate-batch",             &srv_cfg.cluster_migrate_batch,                     CFG_U32, 1, 10000 },
+		{ "cluster-announce-ip",               &srv_cfg.cluster_announce_ip,                       CFG_STR, 7, 15 },
+		{ "agg-threads",                       &srv_cfg.agg_threads,                               CFG_U32, 1, 64 },
+		{ "agg-background-members",            &srv_cfg.agg_background_members,                    CFG_U32, 0, UINT32_MAX },
+	};
+
+	cfg_entry *cfg_lookup(std::string_view name) {
+		for(cfg_entry &e : cfg_table) {
+			if(e.name == name)
+				return &e;
+		}
+
+		return nullptr;
+	}
+
+	bool parse_bytes(std::string_view val, uint64_t &out) {
+		auto [end, ec] = std::from_chars(val.data(), val.data() + val.size(), out);
+		if(ec != std::errc{})
+			return false;
+
+		const std::string_view unit(end, val.data() + val.size());
+		uint64_t mul = 1;
+		if(unit == "kb")
+			mul = 1ull << 10;
+		else if(unit == "mb")
+			mul = 1ull << 20;
+		else if(unit == "gb")
+			mul = 1ull << 30;
+		else if(!unit.empty())
+			return false;
+
+		if(out > UINT64_MAX / mul)
+			return false;
+
+		out *= mul;
+		return true;
+	}
+}
+
+bool cfg_set(std::string_view name, std::string_view val) {
+	cfg_entry *e = cfg_lookup(name);
+	if(!e)
+		return false;
+
+	uint64_t parsed = 0;
+	switch(e->kind) {
+		case CFG_U32: {
+			auto [end, ec] = std::from_chars(val.data(), val.data() + val.size(), parsed);
+			if(ec != std::errc{} || end != val.data() + val.size())
+				return false;
+			break;
+		}
+		case CFG_BYTES:
+			if(!parse_bytes(val, parsed))
+				return false;
+			break;
+		case CFG_ENUM:
+			while(parsed < e->names.size() && e->names[parsed] != val)
+				parsed++;
+			break;
+		case CFG_STR:
+			if(val.size() < e->min || val.size() > e->max)
+				return false;
+			*(std::string *)e->val = val;
+			return true;
+	}
+
+	if(parsed < e->min || parsed > e->max)
+		return false;
+
+	if(e->kind == CFG_BYTES)
+		*(uint64_t *)e->val = parsed;
+	else
+		*(uint32_t *)e->val = (uint32_t)parsed;
+
+	return true;
+}
+
+bool cfg_get(std::string_view name, std::string &out) {
+	cfg_entry *e = cfg_lookup(name);
+	if(!e)
+		return false;
+
+	switch(e->kind) {
+		case CFG_U32:
+			out = std::to_string(*(uint32_t *)e->val);
+			break;
+		case CFG_BYTES:
+			out = std::to_string(*(uint64_t *)e->val);
+			break;
+		case CFG_ENUM:
+			out = e->names[*(uint32_t *)e->val];
+			break;
+		case CFG_STR:
+			out = *(std::string *)e->val;
+			break;
+	}
+
+	return true;
+}
+
+} // namespace redbrouk
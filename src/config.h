@@ -0,0 +1,80 @@
+#ifndef REDBROUK_CONFIG_H
+#define REDBROUK_CONFIG_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace redbrouk
+{
+
+enum class EvictPolicy : uint32_t {
+	NOEVICTION = 0, // refuse writes that may grow memory once over the limit
+	ALLKEYS_LRU,    // longest idle key first
+	ALLKEYS_LFU,    // least frequently used key first
+	VOLATILE_TTL    // key closest to its deadline first, only keys with a ttl are candidates
+};
+
+// Client classes, each with its own output buffer limits
+enum ClientClass : uint32_t {
+	CLIENT_NORMAL = 0,
+	CLIENT_PUBSUB,     // subscribed to at least one channel or pattern
+	CLIENT_REPLICA,    // a replica of this server, its output is the replication stream
+	CLIENT_CLASSES
+};
+// Bytes of pending output, 0 for no limit. Over 'hard' a client is disconnected at once,
+// over 'soft' once it has stayed there for 'soft_seconds'
+typedef struct output_limit {
+	uint64_t hard;
+	uint64_t soft;
+	uint32_t soft_seconds;
+} OutputLimit;
+
+// Server wide tunables, readable and writable at runtime through 'config get/set'
+typedef struct srv_config {
+	uint32_t hz              = 10;   // background cycles per second (active expiry, ...)
+	uint32_t expire_slice_us = 1000; // cpu budget of a single active expiry cycle
+
+	uint64_t maxmemory       = 0;    // bytes, 0 means no limit
+	EvictPolicy maxmemory_policy = EvictPolicy::NOEVICTION;
+	uint32_t maxmemory_samples   = 5;   // keys sampled per eviction round
+	uint32_t evict_budget_us     = 500; // cpu budget of the evictions ahead of a single write
+	uint32_t lfu_log_factor      = 10;  // higher makes the lfu counter saturate slower
+	uint32_t lfu_decay_time      = 1;   // minutes for the lfu counter to decay by one
+
+	uint32_t latency_tracking    = 1;   // 0/1, per phase and per command latency histograms
+	uint32_t slowlog_log_slower_than = 10000; // us, commands running at least this long are logged, 0 logs all
+	uint32_t slowlog_max_len         = 128;   // entries kept, at most SLOWLOG_CAP
+	uint32_t watchdog_period         = 0;     // ms, a loop iteration running this long is reported, 0 turns it off
+	uint32_t metrics_slice_us        = 5;     // cpu budget per loop iteration for rendering /metrics scrapes
+
+	uint32_t lazyfree_threshold       = 64; // values freeing more allocations than this go to the reclaimer thread
+	uint32_t lazyfree_lazy_user_del   = 0;  // 0/1, del behaves like unlink
+	uint32_t lazyfree_lazy_server_del = 1;  // 0/1, overwrites and expiry go lazy too, eviction frees inline
+
+	OutputLimit output_limits[CLIENT_CLASSES] = {
+		{ 512ull << 20, 128ull << 20, 60 }, // normal
+		{ 32ull << 20,  8ull << 20,   60 }, // pubsub
+		{ 256ull << 20, 64ull << 20,  60 }, // replica
+	};
+	uint64_t output_pause = 1ull << 20; // pending output past which a client's pipelined requests wait for it to drain
+
+	uint64_t repl_backlog_size = 1ull << 20; // write stream kept for partial resyncs, a change applies to the next backlog
+
+	uint32_t cluster_enabled       = 0;  // 0/1, keyed commands are checked against the slot map and redirected
+	uint32_t cluster_migrate_batch = 64; // keys a slot migration moves per cycle
+	std::string cluster_announce_ip = "127.0.0.1"; // the address MOVED/ASK and other nodes are given for this one
+
+	uint32_t agg_threads            = 4;       // worker threads of a tunionstore/tinterstore
+	uint32_t agg_background_members = 1 << 16; // input members from which one runs off the loop, 0 never does
+} SrvConfig;
+
+extern SrvConfig srv_cfg;
+
+// Returns false on an unknown name or a malformed value
+bool cfg_set(std::string_view name, std::string_view val);
+bool cfg_get(std::string_view name, std::string &out);
+
+} // namespace redbrouk
+
+#endif
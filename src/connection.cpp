@@ -1,12 +1,69 @@
+#include <algorithm>
 #include <cstdlib>
 #include <errno.h>
+#include <sys/uio.h>
 
 #include "connection.h"
 #include "network.h"
+#include "mem.h"
 
 namespace redbrouk
 {
 
+namespace { // anonymous namespace
+	constexpr size_t CONN_BUF_MIN = 4 * 1024;
+	constexpr int    CONN_IOV_MAX = 32; // iovecs per flush, the rest go on the next one
+	constexpr size_t CONN_BUF_KEEP = 64 * 1024; // drained buffers above this are freed by shrink()
+
+	byte *buf_reserve(byte *&buf, size_t &cap, off_t &start, off_t &end, size_t n) {
+		if(start == end)
+			start = end = 0;
+		if(cap - (size_t)end >= n)
+			return buf + end;
+
+		const size_t used = (size_t)(end - start);
+		if(start > 0 && cap - used >= n) {
+			memmove(buf, buf + start, used);
+			start = 0;
+			end = (off_t)used;
+			return buf + end;
+		}
+
+		size_t ncap = cap ? cap * 2 : CONN_BUF_MIN;
+		while(ncap - used < n)
+			ncap *= 2;
+
+		byte *nbuf = (byte *)mem_malloc(ncap);
+		if(used)
+			memcpy(nbuf, buf + start, used);
+		mem_free(buf);
+
+		buf = nbuf;
+		cap = ncap;
+		start = 0;
+		end = (off_t)used;
+		return buf + end;
+	}
+}
+
+byte *Conn::in_reserve(size_t n) { return buf_reserve(in_buff, in_cap, in_start, in_end, n); }
+byte *Conn::ot_reserve(size_t n) { return buf_reserve(ot_buff, ot_cap, ot_start, ot_end, n); }
+
+void Conn::shrink() {
+	if(in_start == in_end && in_cap > CONN_BUF_KEEP) {
+		mem_free(in_buff);
+		in_buff = nullptr;
+		in_cap = 0;
+		in_start = in_end = 0;
+	}
+	if(ot_start == ot_end && ot_cap > CONN_BUF_KEEP) { // no private bytes left means no chain entry waits on them
+		mem_free(ot_buff);
+		ot_buff = nullptr;
+		ot_cap = 0;
+		ot_start = ot_end = 0;
+	}
+}
+
 int Conn::recv(byte *ibuff, size_t len) {
 	ssize_t n = read(m_fd, ibuff, len);
 
@@ -103,6 +160,97 @@ void Conn::setPeerAddr(const sockaddr_in& peer_addr) {
 	peer_ep = new endpoint{ .port = pport, .addr = buff };
 }
 
-Conn::~Conn() { delete peer_ep; }
+SharedBuf *sb_make(size_t len) {
+	SharedBuf *sb = (SharedBuf *)mem_malloc(sizeof(SharedBuf) + len);
+	sb->refs = 1;
+	sb->len  = (uint32_t)len;
+	return sb;
+}
+void sb_unref(SharedBuf *sb) {
+	if(--sb->refs == 0)
+		mem_free(sb);
+}
+
+void Conn::ot_share(SharedBuf *sb) {
+	const size_t gap = (size_t)ot_size() - ot_chain_gaps;
+
+	sb_ref(sb);
+	ot_chain.push_back({ sb, gap });
+	ot_chain_gaps  += gap;
+	ot_chain_bytes += sb->len;
+}
+
+int Conn::flush() {
+	if(ot_chain.empty())
+		return send(ot_data(), ot_size());
+
+	iovec iov[CONN_IOV_MAX];
+	int niov = 0;
+	size_t priv = 0; // private bytes covered so far
+	size_t ref_sent = ot_ref_sent;
+
+	bool whole = true; // every chain entry made it in, the private tail may follow
+	for(const ot_ref &r : ot_chain) {
+		if(niov + 2 > CONN_IOV_MAX) {
+			whole = false;
+			break;
+		}
+
+		if(r.gap)
+			iov[niov++] = { ot_data() + priv, r.gap };
+		iov[niov++] = { r.buf->data() + ref_sent, r.buf->len - ref_sent };
+
+		priv += r.gap;
+		ref_sent = 0;
+	}
+	if(whole && niov < CONN_IOV_MAX && (size_t)ot_size() > ot_chain_gaps)
+		iov[niov++] = { ot_data() + ot_chain_gaps, (size_t)ot_size() - ot_chain_gaps };
+
+	ssize_t n = writev(m_fd, iov, niov);
+	if(n < 0) {
+		if(errno == EAGAIN)
+			return 0;
+
+		state = ConnState::CLOSED | ConnState::ERR;
+		return -1;
+	}
+
+	// hand the written bytes back out in the same order they were gathered
+	for(size_t left = (size_t)n; left > 0; ) {
+		if(ot_chain.empty()) {
+			ot_start += left;
+			break;
+		}
+
+		ot_ref &front = ot_chain.front();
+		const size_t priv_done = std::min(left, front.gap);
+		ot_start += priv_done;
+		front.gap -= priv_done;
+		ot_chain_gaps -= priv_done;
+		left -= priv_done;
+
+		const size_t ref_done = std::min(left, front.buf->len - ot_ref_sent);
+		ot_ref_sent += ref_done;
+		ot_chain_bytes -= ref_done;
+		left -= ref_done;
+
+		if(front.gap == 0 && ot_ref_sent == front.buf->len) {
+			sb_unref(front.buf);
+			ot_chain.pop_front();
+			ot_ref_sent = 0;
+		}
+	}
+
+	return (int)n;
+}
+
+Conn::~Conn() {
+	delete peer_ep;
+	mem_free(in_buff);
+	mem_free(ot_buff);
+
+	for(ot_ref &r : ot_chain)
+		sb_unref(r.buf);
+}
 
 } // namespace redbrouk
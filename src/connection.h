@@ -1,7 +1,12 @@
 #ifndef REDBROUK_CONNECTION_H
 #define REDBROUK_CONNECTION_H
 
+#include <deque>
+#include <memory>
 #include <span>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <cassert>
 #include <cstring>
@@ -28,10 +33,51 @@ enum class ConnState : uint8_t {
 
 using std::span;
 struct endpoint;
+struct ps_sub;
+struct repl_peer;
+struct bk_wait;
+struct mx_scrape;
+
+/* SHARED BUFFER - one encoded reply queued on many connections at once (pub/sub fan-out) instead
+ * of being copied into each of their output buffers. Freed by the last unref, single threaded.
+ */
+typedef struct shared_buf {
+	uint32_t refs;
+	uint32_t len;
+
+	[[nodiscard]] byte *data() { return (byte *)(this + 1); }
+} SharedBuf;
+
+SharedBuf *sb_make(size_t len); // one reference, held by the caller
+inline void sb_ref(SharedBuf *sb) { sb->refs++; }
+void sb_unref(SharedBuf *sb);
+
+/* TRANSACTION STATE - commands queued between multi and exec, checked against watched keys.
+ * Arguments are copied into one arena as they're queued and only addressed by offset, so the
+ * arena may grow freely; exec turns them back into views for the whole batch at once.
+ */
+typedef struct multi_state {
+	bool active = false; // between multi and exec/discard
+	bool dirty  = false; // a command was refused while queueing, exec aborts
+
+	std::string arena;                                // every queued argument, back to back
+	std::vector<std::pair<uint32_t, uint32_t>> args;  // offset and length in the arena
+	std::vector<uint32_t> argc;                       // arguments of each queued command
+
+	std::vector<std::pair<std::string, uint64_t>> watched; // key and its version when watched, 0 if missing
+
+	void clear_queue() {
+		arena.clear();
+		args.clear();
+		argc.clear();
+		active = dirty = false;
+	}
+} MultiState;
 
 class Conn {
 public:
 	Conn(socket_t _m_fd = -1) : m_fd(_m_fd) {}
+	Conn(const Conn &) = delete;
 	~Conn();
 
 	int recv(byte *ibuff, size_t len);
@@ -49,19 +95,67 @@ public:
 
 	ConnState state = ConnState::NONE;
 
-	byte *in_buff;
-	byte *ot_buff;
+	// Per connection buffers, allocated on first use and grown on demand
+	byte *in_buff = nullptr;
+	byte *ot_buff = nullptr;
+	size_t in_cap = 0, ot_cap = 0;
 
 	off_t in_start = 0, in_end = 0;
 	off_t ot_start = 0, ot_end = 0;
 
+	// Room for at least 'n' more bytes at in_end/ot_end. Drained buffers rewind, partially
+	// consumed ones are compacted before growing.
+	byte *in_reserve(size_t n);
+	byte *ot_reserve(size_t n);
+
 	byte* in_data() { return in_buff + in_start; }
 	byte* ot_data() { return ot_buff + ot_start; }
 	const off_t in_size() const { return in_end - in_start; }
 	const off_t ot_size() const { return ot_end - ot_start; }
 
+	std::unique_ptr<MultiState> multi; // created by the first multi or watch
+
+	// Shared replies, queued in order with the private bytes of ot_buff: each entry goes out once the
+	// 'gap' private bytes queued ahead of it have, private bytes past the last entry go out last
+	struct ot_ref {
+		SharedBuf *buf;
+		size_t gap;
+	};
+	std::deque<ot_ref> ot_chain;
+	size_t ot_chain_gaps  = 0; // private bytes owed to chain entries
+	size_t ot_chain_bytes = 0; // shared bytes not sent yet
+	size_t ot_ref_sent    = 0; // of ot_chain.front()
+
+	void ot_share(SharedBuf *sb); // queues behind everything queued so far, takes a reference
+	[[nodiscard]] size_t ot_pending() const { return (size_t)ot_size() + ot_chain_bytes; }
+	int flush(); // sends private and shared bytes in order, one writev
+
+	// Pub/sub subscriptions of this client, see pubsub.h
+	ps_sub *subs = nullptr;
+	uint32_t nchannels = 0, npatterns = 0;
+
+	repl_peer *peer = nullptr; // set when the client is a replica of this server, see repl.h
+
+	// Cluster mode, see cluster.h
+	uint64_t asking_for = UINT64_MAX; // 'ncmds' of the request an 'asking' lets into an importing slot
+	bool cluster_import = false;      // a migrating node's link, its keys skip the slot checks
+	uint16_t cluster_link = 0;        // a link this node opened to another, that node's index in the slot map
+
+	bool blocked = false; // waiting on a background aggregation or a blocking pop, later requests stay in the input buffer
+	bk_wait *bwait = nullptr; // parked by btpopmin/btpopmax, see blocking.h
+	bool loan_wait = false;   // its next request writes a tset a background aggregation reads, it reruns once that's done
+
+	mx_scrape *scrape = nullptr; // set on connections to the metrics listener, see metrics.h
+
+	// Bookkeeping for output limits and 'client list', monotonic ms
+	uint64_t created_ms = 0, last_cmd_ms = 0;
+	uint64_t soft_since_ms = 0; // when pending output went over the soft limit, 0 while under it
+	uint64_t ncmds = 0;
+
+	void shrink(); // frees drained buffers that grew past what an idle client keeps
+
 private:
-	endpoint* peer_ep;
+	endpoint* peer_ep = nullptr;
 	socket_t m_fd; // socket file descriptor
 };
 
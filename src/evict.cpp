@@ -0,0 +1,123 @@
+#include "evict.h"
+#include "src/config.h"
+
+#include <new>
+#include <random>
+#include <utility>
+
+namespace redbrouk
+{
+
+uint64_t lru_idle_ms(uint32_t lru, uint64_t now_ms) {
+	const uint32_t clock = lru_clock(now_ms);
+	const uint64_t ticks = clock >= lru ? clock - lru : (LRU_CLOCK_MAX - lru) + clock;
+
+	return ticks * LRU_CLOCK_RES_MS;
+}
+
+namespace { // anonymous namespace
+	inline uint16_t lfu_minutes(uint64_t now_ms) { return (uint16_t)(now_ms / (60 * 1000)); }
+
+	inline uint32_t lfu_pack(uint16_t minutes, uint8_t counter) { return (uint32_t)minutes << 8 | counter; }
+
+	uint8_t lfu_decayed(uint32_t lru, uint64_t now_ms) {
+		const uint16_t last    = lru >> 8;
+		const uint8_t  counter = lru & 0xff;
+		const uint16_t now     = lfu_minutes(now_ms);
+		const uint16_t elapsed = now >= last ? now - last : 0xffff - last + now;
+
+		if(srv_cfg.lfu_decay_time == 0)
+			return counter;
+
+		const uint32_t periods = elapsed / srv_cfg.lfu_decay_time;
+		return periods > counter ? 0 : counter - periods;
+	}
+
+	// The more hits a counter has, the less likely the next one is to bump it: ~1M hits saturate it at factor 10
+	uint8_t lfu_log_incr(uint8_t counter) {
+		static thread_local std::minstd_rand rng{ std::random_device{}() };
+
+		if(counter == 0xff)
+			return counter;
+
+		const double base = counter > LFU_INIT_VAL ? counter - LFU_INIT_VAL : 0;
+		const double p    = 1.0 / (base * srv_cfg.lfu_log_factor + 1);
+		const double r    = (double)rng() / rng.max();
+
+		return r < p ? counter + 1 : counter;
+	}
+}
+
+uint32_t lfu_init(uint64_t now_ms) {
+	return lfu_pack(lfu_minutes(now_ms), LFU_INIT_VAL);
+}
+uint32_t lfu_touch(uint32_t lru, uint64_t now_ms) {
+	return lfu_pack(lfu_minutes(now_ms), lfu_log_incr(lfu_decayed(lru, now_ms)));
+}
+uint8_t lfu_counter(uint32_t lru, uint64_t now_ms) {
+	return lfu_decayed(lru, now_ms);
+}
+
+EvictPool *mk_evpool(EvictPool *place) {
+	EvictPool *out = place ? new (place) EvictPool : new EvictPool;
+
+	for(EvictEntry &e : out->entries)
+		e.key.reserve(EVPOOL_KEY_SIZE);
+
+	return out;
+}
+
+void evp_insert(EvictPool *pool, uint64_t score, std::string_view key) {
+	EvictEntry *entries = pool->entries;
+
+	// already pooled from an earlier round, just refresh its score
+	for(size_t i = 0; i < pool->size; i++) {
+		if(entries[i].key == key) {
+			entries[i].score = score;
+			while(i > 0 && entries[i - 1].score > entries[i].score) {
+				std::swap(entries[i - 1], entries[i]);
+				i--;
+			}
+			while(i + 1 < pool->size && entries[i + 1].score < entries[i].score) {
+				std::swap(entries[i + 1], entries[i]);
+				i++;
+			}
+			return;
+		}
+	}
+
+	size_t pos = 0;
+	while(pos < pool->size && entries[pos].score < score)
+		pos++;
+
+	if(pool->size < EVPOOL_SIZE) {
+		for(size_t i = pool->size; i > pos; i--) // shift right, swaps keep the reserved strings in the pool
+			std::swap(entries[i], entries[i - 1]);
+		pool->size++;
+	} else {
+		if(pos == 0) // worse than everything pooled
+			return;
+
+		pos--; // drop the worst candidate, shift left
+		for(size_t i = 0; i < pos; i++)
+			std::swap(entries[i], entries[i + 1]);
+	}
+
+	entries[pos].score = score;
+	entries[pos].key.assign(key);
+}
+
+bool evp_pop(EvictPool *pool, std::string &key) {
+	if(pool->size == 0)
+		return false;
+
+	EvictEntry &best = pool->entries[--pool->size];
+	key.assign(best.key);
+	return true;
+}
+
+void evp_clear(EvictPool *pool) {
+	pool->size = 0;
+}
+
+} // namespace redbrouk
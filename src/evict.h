@@ -0,0 +1,51 @@
+#ifndef REDBROUK_EVICT_H
+#define REDBROUK_EVICT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace redbrouk
+{
+
+/* ACCESS METADATA - 24 bits packed into KVObj next to its type tag.
+ * LRU: a clock in LRU_CLOCK_RES_MS units, wrapping every ~194 days.
+ * LFU: 16 bits of minutes since the counter last decayed, 8 bits logarithmic access counter.
+ */
+constexpr uint32_t LRU_CLOCK_MAX    = (1u << 24) - 1;
+constexpr uint64_t LRU_CLOCK_RES_MS = 1000;
+constexpr uint8_t  LFU_INIT_VAL     = 5; // new keys get a chance to collect hits before they become victims
+
+inline uint32_t lru_clock(uint64_t now_ms) { return (uint32_t)(now_ms / LRU_CLOCK_RES_MS) & LRU_CLOCK_MAX; }
+uint64_t lru_idle_ms(uint32_t lru, uint64_t now_ms);
+
+uint32_t lfu_init(uint64_t now_ms);
+uint32_t lfu_touch(uint32_t lru, uint64_t now_ms);   // decays then logarithmically increments the counter
+uint8_t  lfu_counter(uint32_t lru, uint64_t now_ms); // counter after decay, without touching it
+
+/* EVICTION POOL - best candidates seen over several sampling rounds, sorted by ascending score
+ * (higher means a better victim). Keys are copied into pre-reserved strings rather than pointing
+ * at objects, so entries stay valid when their object is deleted or its slot reused between writes.
+ */
+constexpr size_t EVPOOL_SIZE     = 16;
+constexpr size_t EVPOOL_KEY_SIZE = 64; // keys up to this size are cached without allocating
+
+typedef struct evict_entry {
+	uint64_t score = 0;
+	std::string key;
+} EvictEntry;
+
+typedef struct evict_pool {
+	EvictEntry entries[EVPOOL_SIZE];
+	size_t size = 0;
+} EvictPool;
+
+EvictPool *mk_evpool(EvictPool *place = nullptr);
+void evp_insert(EvictPool *pool, uint64_t score, std::string_view key);
+bool evp_pop(EvictPool *pool, std::string &key); // takes the best candidate, false when empty
+void evp_clear(EvictPool *pool);
+
+} // namespace redbrouk
+
+#endif
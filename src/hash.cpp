@@ -1,5 +1,8 @@
 #include "hash.h"
 
+#include <algorithm>
+#include <initializer_list>
+
 namespace redbrouk
 {
 
@@ -65,6 +68,40 @@ iHNode *ihs_find(const iHSet *hs, const iHNode *key, bfunc<const iHNode*, const
 
 	return match ? *match : nullptr;
 }
+void ihs_find_batch(const iHSet *hs, const iHNode *const *keys, iHNode **out, size_t n,
+		bfunc<const iHNode*, const iHNode*> eq) {
+	ihs_prehash(const_cast<iHSet *>(hs));
+
+	const iHTab *tabs[2] = { &hs->curr, &hs->prev };
+	const size_t ntabs = hs->prev.buckets ? 2 : 1;
+	if(!hs->curr.buckets) {
+		std::fill(out, out + n, nullptr);
+		return;
+	}
+
+	for(size_t base = 0; base < n; base += IHS_BATCH) {
+		const size_t m = std::min(IHS_BATCH, n - base);
+		const iHNode *const *group = keys + base;
+
+		for(size_t i = 0; i < m; i++) {
+			for(size_t t = 0; t < ntabs; t++)
+				__builtin_prefetch(&tabs[t]->buckets[group[i]->hval & tabs[t]->mask]);
+		}
+		for(size_t i = 0; i < m; i++) {
+			for(size_t t = 0; t < ntabs; t++) {
+				if(const iHNode *head = tabs[t]->buckets[group[i]->hval & tabs[t]->mask])
+					__builtin_prefetch(head);
+			}
+		}
+		for(size_t i = 0; i < m; i++) {
+			iHNode **match = iht_get(&hs->curr, group[i], eq);
+			if(!match && ntabs == 2)
+				match = iht_get(&hs->prev, group[i], eq);
+
+			out[base + i] = match ? *match : nullptr;
+		}
+	}
+}
 iHNode *ihs_del(iHSet *hs, iHNode *key, bfunc<const iHNode*, const iHNode*> eq) {
 	iHNode **match;
 
@@ -99,7 +136,7 @@ void ihs_prehash(iHSet *hs) { // specifies when rehashing ends
 
 	while(work_done < prehash_work && hs->prev.size > 0) {
 		iHNode **bucket_head = &hs->prev.buckets[hs->migrate_pos];
-		if(!bucket_head) {
+		if(!*bucket_head) {
 			hs->migrate_pos++;
 			continue;
 		}
@@ -109,9 +146,119 @@ void ihs_prehash(iHSet *hs) { // specifies when rehashing ends
 	}
 
 	if(hs->prev.size == 0 && hs->prev.buckets) { // no more elts in prev, all moved to curr, free prev's memory
-		free(hs->prev.buckets);
+		mem_free(hs->prev.buckets);
 		hs->prev = {};
 	}
 }
 
+void ihs_reserve(iHSet *hs, size_t n) {
+	size_t nbuckets = hs->curr.buckets ? hs->curr.nbuckets + 1 : 8;
+	while(nbuckets * ihs_load < n)
+		nbuckets *= 2;
+	if(hs->curr.buckets && nbuckets == hs->curr.nbuckets + 1)
+		return;
+
+	iHTab grown;
+	mk_ihtable(&grown, nbuckets, nullptr);
+	for(iHTab *ht : { &hs->curr, &hs->prev }) {
+		for(size_t i = 0; ht->buckets && i <= ht->mask; i++) {
+			while(ht->buckets[i])
+				iht_insert(&grown, iht_del(ht, &ht->buckets[i]));
+		}
+
+		mem_free(ht->buckets);
+		*ht = {};
+	}
+
+	hs->curr = grown;
+	hs->migrate_pos = 0;
+}
+
+size_t ihs_sample(const iHSet *hs, iHNode **out, size_t n, size_t seed) {
+	size_t mask = hs->curr.mask;
+	if(hs->prev.buckets && hs->prev.mask > mask)
+		mask = hs->prev.mask;
+
+	size_t found = 0, steps = n * 10;
+	size_t pos = seed & mask;
+
+	while(found < n && steps-- > 0) {
+		for(const iHTab *ht : { &hs->curr, &hs->prev }) {
+			if(!ht->buckets || ht->size == 0 || pos > ht->mask)
+				continue;
+
+			for(iHNode *node = ht->buckets[pos]; node && found < n; node = node->next)
+				out[found++] = node;
+		}
+		pos = (pos + 1) & mask;
+	}
+
+	return found;
+}
+
+namespace { // anonymous namespace
+	static_assert(sizeof(size_t) == 8);
+	inline size_t rev_bits(size_t v) {
+		v = ((v >> 1) & 0x5555555555555555) | ((v & 0x5555555555555555) << 1);
+		v = ((v >> 2) & 0x3333333333333333) | ((v & 0x3333333333333333) << 2);
+		v = ((v >> 4) & 0x0F0F0F0F0F0F0F0F) | ((v & 0x0F0F0F0F0F0F0F0F) << 4);
+		return __builtin_bswap64(v);
+	}
+	// increments the bits of 'cursor' under 'mask' from the top down, the bits above it are dropped
+	inline size_t scan_next(size_t cursor, size_t mask) {
+		return rev_bits(rev_bits(cursor | ~mask) + 1);
+	}
+	inline void scan_bucket(const iHTab *ht, size_t pos, const std::function<void(iHNode *)> &visit) {
+		for(iHNode *node = ht->buckets[pos & ht->mask]; node; ) {
+			iHNode *next = node->next;
+			visit(node);
+			node = next;
+		}
+	}
+}
+size_t ihs_scan(const iHSet *hs, size_t cursor, const std::function<void(iHNode *)> &visit) {
+	const iHTab *small = &hs->curr, *large = &hs->prev;
+	if(!small->buckets)
+		std::swap(small, large);
+	if(!small->buckets)
+		return 0;
+
+	if(!large->buckets) {
+		scan_bucket(small, cursor, visit);
+		return scan_next(cursor, small->mask);
+	}
+	if(small->mask > large->mask)
+		std::swap(small, large);
+
+	// the small table's bucket, then every large table bucket sharing its low bits
+	scan_bucket(small, cursor, visit);
+	do {
+		scan_bucket(large, cursor, visit);
+		cursor = scan_next(cursor, large->mask);
+	} while(cursor & (small->mask ^ large->mask));
+
+	return cursor;
+}
+
+void ihs_destroy(iHSet *hs, void (*release)(iHNode *)) {
+	for(iHTab *ht : { &hs->curr, &hs->prev }) {
+		if(!ht->buckets)
+			continue;
+
+		for(size_t i = 0; release && i <= ht->mask; i++) {
+			iHNode *node = ht->buckets[i];
+			while(node) {
+				iHNode *next = node->next;
+				release(node);
+				node = next;
+			}
+		}
+
+		mem_free(ht->buckets);
+		*ht = {};
+	}
+
+	hs->migrate_pos = 0;
+}
+
 } // namespace redbrouk
@@ -10,6 +10,8 @@
 #define XXH_INLINE_ALL
 #include "lib/xxhash.h"
 
+#include "src/mem.h"
+
 namespace redbrouk
 {
 
@@ -48,13 +50,13 @@ static inline iHTab *mk_ihtable(iHTab *place, size_t _size, iHNode **bplace) { /
 	assert(_size !=  0 && ((_size - 1) & _size) == 0); // _size is a power of 2
 
 	if(!place) {
-		place = (iHTab *)malloc(sizeof(iHTab));
+		place = (iHTab *)mem_malloc(sizeof(iHTab));
 		// place = new iHTab
 	}
 	if(bplace) {
 		memset(bplace, 0, _size);
 	} else {
-		bplace = (iHNode**)calloc(_size, sizeof(iHNode *));
+		bplace = (iHNode**)mem_calloc(_size, sizeof(iHNode *));
 		// bplace = new iHNode*[_size](0);
 	}
 	place->buckets = bplace;
@@ -84,6 +86,35 @@ iHNode *ihs_find(const iHSet *hs, const iHNode *key, bfunc<const iHNode*, const
 void ihs_insert(iHSet *hs, iHNode *node);
 iHNode *ihs_del(iHSet *hs, iHNode *key, bfunc<const iHNode*, const iHNode*> eq);
 void ihs_prehash(iHSet *hs);
+// ihs_reserve: room for 'n' nodes under the load factor, grown in a single rehash instead of doubling along the way.
+// Finishes an incremental rehash that's under way, meant for bulk inserts
+void ihs_reserve(iHSet *hs, size_t n);
+// ihs_sample: collects up to 'n' nodes starting at bucket 'seed' and walking on through the following buckets
+// of both tables, visiting at most n * 10 buckets so a sparse table can't make it run away
+size_t ihs_sample(const iHSet *hs, iHNode **out, size_t n, size_t seed);
+// bucket arrays of both tables, as handed out by the allocator
+inline size_t ihs_bucket_mem(const iHSet *hs) {
+	size_t out = 0;
+	if(hs->curr.buckets)
+		out += mem_alloc_size((hs->curr.nbuckets + 1) * sizeof(iHNode *));
+	if(hs->prev.buckets)
+		out += mem_alloc_size((hs->prev.nbuckets + 1) * sizeof(iHNode *));
+	return out;
+}
+// ihs_find_batch: ihs_find for 'n' keys, out[i] is the match for keys[i] or nullptr. Keys are taken in groups of
+// IHS_BATCH: the bucket heads of a whole group are prefetched, then the first node of every chain, and only then
+// are chains compared, so the group's cache misses overlap instead of queueing behind each other
+constexpr size_t IHS_BATCH = 16;
+void ihs_find_batch(const iHSet *hs, const iHNode *const *keys, iHNode **out, size_t n,
+		bfunc<const iHNode*, const iHNode*> eq);
+// ihs_scan: one step of a cursor walk over both tables, start at cursor 0 and stop once 0 comes back. 'visit' gets the
+// nodes of the cursor's bucket in the smaller table and of every bucket it splits into in the larger one. The cursor
+// counts with its bits reversed, so when a table doubles the buckets a bucket splits into all lie ahead of or behind
+// the cursor together: a node present for the whole walk is visited at least once (maybe twice), however far
+// ihs_prehash got between steps. 'visit' must not modify the set
+size_t ihs_scan(const iHSet *hs, size_t cursor, const std::function<void(iHNode *)> &visit);
+// ihs_destroy: hands every node to 'release' (if given) and frees the bucket arrays, leaving an empty set
+void ihs_destroy(iHSet *hs, void (*release)(iHNode *));
 
 } // namespace redbrouk
 
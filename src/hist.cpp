@@ -0,0 +1,94 @@
+#include "hist.h"
+
+#include <ctime>
+
+#include "src/utils.h"
+
+namespace redbrouk
+{
+
+namespace { // anonymous namespace
+	double ticks_per_ns = 1.0;
+	double overhead_ns  = 0.0;
+}
+
+void tsc_calibrate() {
+	const uint64_t ns0  = utils::mono_us() * 1000;
+	const uint64_t tsc0 = tsc_now();
+
+	timespec nap{ 0, 20 * 1000 * 1000 };
+	nanosleep(&nap, nullptr);
+
+	const uint64_t ns1  = utils::mono_us() * 1000;
+	const uint64_t tsc1 = tsc_now();
+	if(ns1 > ns0 && tsc1 > tsc0)
+		ticks_per_ns = (double)(tsc1 - tsc0) / (double)(ns1 - ns0);
+
+	// what instrumenting a section costs: one timer read and a record on top of the read the section needs anyway
+	constexpr size_t rounds = 100000;
+	static HdrHist scratch;
+	const uint64_t start = tsc_now();
+	for(size_t i = 0; i < rounds; i++)
+		hist_record(&scratch, tsc_now() - start);
+
+	overhead_ns = tsc_to_ns(tsc_now() - start) / rounds;
+}
+
+double tsc_per_ns() { return ticks_per_ns; }
+double hist_overhead_ns() { return overhead_ns; }
+
+uint64_t hist_value(size_t index) {
+	if(index < HIST_SUB)
+		return index;
+
+	const size_t exp = index / HIST_SUB + HIST_SUB_BITS - 1;
+	const uint64_t sub = index % HIST_SUB + HIST_SUB;
+	const uint64_t low = sub << (exp - HIST_SUB_BITS);
+
+	return low + (1ull << (exp - HIST_SUB_BITS)) - 1;
+}
+
+uint64_t hist_percentile(const HdrHist *h, double pct) {
+	const uint64_t total = h->total.load(std::memory_order_relaxed);
+	if(total == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t)(pct / 100.0 * total + 0.5);
+	if(rank == 0)
+		rank = 1;
+
+	uint64_t seen = 0;
+	for(size_t i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->counts[i].load(std::memory_order_relaxed);
+		if(seen >= rank) {
+			const uint64_t max = h->max.load(std::memory_order_relaxed);
+			const uint64_t val = hist_value(i);
+			return val < max ? val : max;
+		}
+	}
+
+	return h->max.load(std::memory_order_relaxed);
+}
+
+void hist_reset(HdrHist *h) {
+	for(auto &c : h->counts)
+		c.store(0, std::memory_order_relaxed);
+
+	h->total.store(0, std::memory_order_relaxed);
+	h->sum.store(0, std::memory_order_relaxed);
+	h->max.store(0, std::memory_order_relaxed);
+}
+
+void hist_merge(HdrHist *into, const HdrHist *from) {
+	for(size_t i = 0; i < HIST_BUCKETS; i++)
+		hist_detail::bump(into->counts[i], from->counts[i].load(std::memory_order_relaxed));
+
+	hist_detail::bump(into->total, from->total.load(std::memory_order_relaxed));
+	hist_detail::bump(into->sum, from->sum.load(std::memory_order_relaxed));
+
+	const uint64_t max = from->max.load(std::memory_order_relaxed);
+	if(max > into->max.load(std::memory_order_relaxed))
+		into->max.store(max, std::memory_order_relaxed);
+}
+
+} // namespace redbrouk
@@ -0,0 +1,85 @@
+#ifndef REDBROUK_HIST_H
+#define REDBROUK_HIST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace redbrouk
+{
+
+/* CYCLE TIMER - raw tsc reads, converted to ns only when reporting.
+ * Not serializing: fine at the us granularity of loop phases and commands.
+ * Measured at -O2 on a VM (rdtsc itself ~20ns there, single digit ns on bare metal): a timed
+ * section, one extra read plus a hist_record, costs ~26ns; 'latency' reports it live.
+ * Turn it off with 'config set latency-tracking 0', which leaves a single branch. Commands stay timed
+ * for the slowlog unless 'slowlog-max-len' is 0 too.
+ */
+inline uint64_t tsc_now() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void   tsc_calibrate(); // once at startup, measures tsc ticks per ns against CLOCK_MONOTONIC
+double tsc_per_ns();
+inline double tsc_to_ns(uint64_t ticks) { return ticks / tsc_per_ns(); }
+
+/* HDR HISTOGRAM - log-linear buckets: 32 linear sub-buckets per power of two, so any
+ * recorded value is reported within ~3% over the whole 64 bit range, in a fixed 15KB.
+ * Single writer, any number of readers: the writer uses plain relaxed load/store pairs
+ * (no locked instructions), readers see a consistent enough snapshot without locks.
+ */
+constexpr size_t HIST_SUB_BITS = 5;
+constexpr size_t HIST_SUB      = 1 << HIST_SUB_BITS;
+constexpr size_t HIST_BUCKETS  = (64 - HIST_SUB_BITS + 1) * HIST_SUB;
+
+typedef struct hdr_hist {
+	std::atomic<uint64_t> counts[HIST_BUCKETS] = {};
+	std::atomic<uint64_t> total = 0;
+	std::atomic<uint64_t> sum   = 0;
+	std::atomic<uint64_t> max   = 0;
+} HdrHist;
+
+namespace hist_detail {
+	inline void bump(std::atomic<uint64_t> &c, uint64_t by) {
+		c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+	}
+}
+
+inline size_t hist_index(uint64_t v) {
+	if(v < HIST_SUB)
+		return v;
+
+	const size_t exp = 63 - __builtin_clzll(v);
+	const size_t sub = (v >> (exp - HIST_SUB_BITS)) - HIST_SUB;
+	return (exp - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+uint64_t hist_value(size_t index); // highest value that maps to 'index'
+
+inline void hist_record(HdrHist *h, uint64_t v) {
+	hist_detail::bump(h->counts[hist_index(v)], 1);
+	hist_detail::bump(h->total, 1);
+	hist_detail::bump(h->sum, v);
+	if(v > h->max.load(std::memory_order_relaxed))
+		h->max.store(v, std::memory_order_relaxed);
+}
+
+uint64_t hist_percentile(const HdrHist *h, double pct); // pct in [0, 100]
+void     hist_reset(HdrHist *h);
+void     hist_merge(HdrHist *into, const HdrHist *from); // both quiescent, e.g. per thread histograms after a run
+
+double hist_overhead_ns(); // cost of tsc_now() + hist_record(), measured by tsc_calibrate
+
+} // namespace redbrouk
+
+#endif
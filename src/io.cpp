@@ -1,10 +1,31 @@
+#include <algorithm>
 #include <charconv>
+#include <cmath>
 #include <cstdlib>
 #include <memory>
+#include <random>
 #include <signal.h>
+#include <stack>
 #include <string>
 
+#include <sys/wait.h>
+
+#include "src/aggregate.h"
+#include "src/blocking.h"
+#include "src/cluster.h"
+#include "src/config.h"
+#include "src/evict.h"
+#include "src/hist.h"
 #include "src/kvobj.h"
+#include "src/lazyfree.h"
+#include "src/mem.h"
+#include "src/metrics.h"
+#include "src/profiler.h"
+#include "src/pubsub.h"
+#include "src/repl.h"
+#include "src/slowlog.h"
+#include "src/stats.h"
+#include "src/watchdog.h"
 #include "src/network.h"
 
 #include "src/io.h"
@@ -25,11 +46,136 @@ void sigint_handler(int sig_num) {
     exit(0);
 }
 
-void io_context::init(uint16_t _port) {
+// Latency tracking: each phase of a main_loop iteration and each command get a histogram of tsc ticks
+enum LAT_PHASE : uint8_t {
+	PHASE_POLL,  // waiting in poll
+	PHASE_CYCLE, // run_cycle background work
+	PHASE_READ,  // recv
+	PHASE_PARSE, // parse_req
+	PHASE_EXEC,  // do_request dispatch, every command
+	PHASE_WRITE, // send
+	PHASE_COUNT
+};
+static constexpr std::string_view phase_names[] = { "poll", "cycle", "read", "parse", "exec", "write" };
+static HdrHist phase_lat[PHASE_COUNT];
+static Slowlog slowlog;
+
+static Conn *cur_client = nullptr; // connection whose request is being executed
+static uint64_t started_ms = 0;    // when init ran, info's uptime
+static std::vector<Conn *> connections; // indexed by fd
+
+// Replication state, see the Replication section
+enum ReplRole : uint8_t { ROLE_PRIMARY, ROLE_REPLICA };
+enum LinkState : uint8_t {
+	LINK_NONE,      // no connection to the primary, repl_cron retries
+	LINK_HANDSHAKE, // psync sent, waiting for the primary's answer
+	LINK_LOADING,   // applying the snapshot
+	LINK_STREAMING  // applying the stream
+};
+static struct {
+	ReplRole role = ROLE_PRIMARY;
+	std::string replid;           // the history this server's stream belongs to
+	ReplBacklog backlog;          // its offset is this server's stream offset, in either role
+	std::vector<Conn *> replicas; // primary, every client that sent psync
+	bool in_exec   = false;       // an exec is running its queued commands
+	bool exec_open = false;       // and a multi went out ahead of its first write
+
+	std::string host;             // replica, the primary's address
+	uint16_t port = 0;
+	Conn *link = nullptr;         // connection to the primary
+	LinkState link_state = LINK_NONE;
+	uint64_t retry_ms = 0, ack_ms = 0;
+} repl;
+// from_primary: the running command came down the replication link
+static inline bool from_primary() { return cur_client && cur_client == repl.link; }
+
+static Cluster cluster; // slot map and per slot key counts, see the Cluster section
+
+static std::vector<AggJob *> agg_jobs; // running on the aggregation thread, see the TSet section
+static std::vector<TSetLoan> tset_loans; // tsets those jobs read in place, see the TSet section
+static std::vector<Conn *> loan_waits;   // clients parked by a write to one of them, see loan_held
+static Blocking blocking;              // clients parked by btpopmin/btpopmax, see the TSet section
+static bool bk_woken = false;          // a client was unblocked after this iteration's pollfds were built
+static std::vector<Conn *> scrapes;    // connections to the metrics listener, see the Metrics section
+
+// Output buffer limits, see OutputLimit
+static struct {
+	uint64_t hard, soft;
+} output_disconnects;
+
+static ClientClass client_class(const Conn *conn) {
+	if(conn->peer)
+		return CLIENT_REPLICA;
+	return conn->nchannels + conn->npatterns > 0 ? CLIENT_PUBSUB : CLIENT_NORMAL;
+}
+// enforce_output_limits: checks a client's pending output against its class limits, closing it when over.
+// Returns true when the client was closed
+static bool enforce_output_limits(Conn *conn, uint64_t now_ms) {
+	const OutputLimit &lim = srv_cfg.output_limits[client_class(conn)];
+	const size_t pending = conn->ot_pending();
+	const char *over = nullptr;
+
+	if(lim.hard && pending > lim.hard) {
+		over = "hard";
+		output_disconnects.hard++;
+	} else if(lim.soft && pending > lim.soft) {
+		if(!conn->soft_since_ms)
+			conn->soft_since_ms = now_ms;
+		else if(now_ms - conn->soft_since_ms >= (uint64_t)lim.soft_seconds * 1000) {
+			over = "soft";
+			output_disconnects.soft++;
+		}
+	} else {
+		conn->soft_since_ms = 0;
+	}
+
+	if(!over)
+		return false;
+
+	std::println("[WARN] client fd {} over its {} output limit with {} bytes pending, disconnecting",
+			conn->get_socket(), over, pending);
+	conn->state = ConnState::CLOSED | ConnState::ERR;
+	return true;
+}
+
+namespace {
+	// Times its scope into 'h', nothing but a branch when latency-tracking is off
+	struct lat_timer {
+		HdrHist *hist;
+		uint64_t start;
+
+		explicit lat_timer(HdrHist *h)
+			: hist(srv_cfg.latency_tracking ? h : nullptr), start(hist ? tsc_now() : 0) {}
+		~lat_timer() {
+			if(hist)
+				hist_record(hist, tsc_now() - start);
+		}
+	};
+
+	// Replies are formatted straight into the Response, whose bytes the loop reuses from one request to the
+	// next (see req_res), so a reply only allocates when it outgrows every earlier one
+	template <class... Args>
+	void reply(Response &out, uint32_t status, std::format_string<Args...> s, Args&&... args) {
+		out.data.clear();
+		std::format_to(std::back_inserter(out.data), s, std::forward<Args>(args)...);
+		out.status = status;
+	}
+	template <class... Args>
+	void reply_append(Response &out, std::format_string<Args...> s, Args&&... args) {
+		std::format_to(std::back_inserter(out.data), s, std::forward<Args>(args)...);
+	}
+	void reply_append(Response &out, sview s) {
+		out.data.insert(out.data.end(), s.begin(), s.end());
+	}
+}
+
+void io_context::init(uint16_t _port, uint16_t _metrics_port) {
 	socket_t listen_fd = make_listener(_port);
 	if(listen_fd == -1) {
 		return;
 	}
+	if(_metrics_port)
+		metrics_fd = make_listener(_metrics_port);
 	if (signal(SIGINT, sigint_handler) == SIG_ERR) {
         perror("Error setting up signal handler");
         return;
@@ -42,21 +188,36 @@ void io_context::init(uint16_t _port) {
         perror("Error setting up signal handler");
         return;
     }
+	signal(SIGPIPE, SIG_IGN); // a peer gone mid write shows up as EPIPE instead of killing the server
 
 	pfds.resize(1);
 	pfds.reserve(8);
 	pfds[0] = { .fd = listen_fd, .events = POLLIN, .revents = 0 };
+
+	tsc_calibrate();
+	if(metrics_fd != -1)
+		mx_init();
+	db_init();
+	started_ms = utils::mono_ms();
+	repl.replid = rp_make_replid();
+	mk_cluster(&cluster, srv_cfg.cluster_announce_ip, _port);
+	mk_blocking(&blocking, utils::mono_ms());
 }
 void io_context::main_loop() {
-	std::vector<Conn *> connections;
-
 	struct pollfd listener = pfds[0];
+	struct pollfd metrics  = { .fd = metrics_fd, .events = POLLIN, .revents = 0 };
+	struct pollfd agg_wake = { .fd = ag_wake_fd(), .events = POLLIN, .revents = 0 }; // run_cycle's agg_cron collects
+	const size_t nlisteners = metrics_fd == -1 ? 1 : 2;
+	const size_t nfixed = nlisteners + 1;
 	while(true) {
 		if(!running)
 			return;
 
 		pfds.clear();
 		pfds.push_back(listener);
+		if(nlisteners == 2)
+			pfds.push_back(metrics);
+		pfds.push_back(agg_wake);
 
 		for(Conn *conn : connections) {
 			if(!conn)
@@ -72,7 +233,19 @@ void io_context::main_loop() {
 			pfds.push_back(pfd);
 		}
 
-		ssize_t rv = poll(pfds.data(), (nfds_t)pfds.size(), -1);
+		int timeout;
+		{
+			lat_timer t(&phase_lat[PHASE_CYCLE]);
+			timeout = run_cycle();
+		}
+
+		ssize_t rv;
+		{
+			lat_timer t(&phase_lat[PHASE_POLL]);
+			wd_idle();
+			rv = poll(pfds.data(), (nfds_t)pfds.size(), timeout);
+			wd_busy();
+		}
 		if(rv < 0) {
 			if(errno == EINTR)
 				continue;
@@ -90,28 +263,44 @@ void io_context::main_loop() {
 
 				assert(!connections[fd]);
 				connections[fd] = conn;
-				conn->in_buff = recv_buf;
-				conn->ot_buff = send_buf;
+				conn->created_ms = conn->last_cmd_ms = utils::mono_ms();
+				st_add(ST_CONNECTIONS);
+			}
+		}
+		if(nlisteners == 2 && pfds[1].revents) {
+			if(Conn *conn = Accept(metrics_fd)) {
+				const socket_t fd = conn->get_socket();
+				if(connections.size() <= (size_t)fd) {
+					connections.resize(fd + 1);
+				}
+
+				assert(!connections[fd]);
+				connections[fd] = conn;
+				conn->created_ms = conn->last_cmd_ms = utils::mono_ms();
+				conn->scrape = new MxScrape;
+				scrapes.push_back(conn);
 			}
 		}
 
-		for(size_t i = 1; i < pfds.size(); i++) {
+		for(size_t i = nfixed; i < pfds.size(); i++) {
 			uint32_t ready = pfds[i].revents;
 
-			if(ready == 0)
+			Conn *conn = connections[pfds[i].fd];
+			if(!conn)
+				continue;
+			if(ready == 0 && !(bool)(conn->state & ConnState::CLOSED)) // may be closed by another client's publish
 				continue;
 
-			Conn *conn = connections[pfds[i].fd];
-			if (ready & POLLIN) {
-				assert(conn->state & ConnState::RECVING);
+			// another client's publish may have switched this one to sending since the poll
+			if ((ready & POLLIN) && (bool)(conn->state & ConnState::RECVING)) {
 				handle_read(conn);  // application logic
 			}
-			if (ready & POLLOUT) {
-				assert(conn->state & ConnState::SENDING);
+			if ((ready & POLLOUT) && (bool)(conn->state & ConnState::SENDING)) {
 				handle_write(conn); // application logic
 			}
 
 			if((ready & POLLERR) || (bool)(conn->state & ConnState::CLOSED)) {
+				drop_client(conn);
 				conn->Close();
 				connections[conn->get_socket()] = nullptr;
 				delete conn;
@@ -121,8 +310,12 @@ void io_context::main_loop() {
 }
 
 static void handle_read(Conn *conn) {
-	static std::byte buf[64 * 1024];
-	ssize_t rv = conn->recv(buf, sizeof(buf));
+	constexpr size_t read_size = 16 * 1024;
+	ssize_t rv;
+	{
+		lat_timer t(&phase_lat[PHASE_READ]);
+		rv = conn->recv(conn->in_reserve(read_size), read_size); // appends at in_end
+	}
 
 	if (rv < 0 && errno == EAGAIN)
 		return;
@@ -145,19 +338,41 @@ static void handle_read(Conn *conn) {
 		return; // want close
 	}
 
-	memcpy(conn->in_data(), buf, (size_t)rv);
+	st_add(ST_NET_INPUT, (uint64_t)rv);
+	process_input(conn);
+}
+// process_input: every complete frame in the buffer runs back to back with its reply appended to the output
+// buffer, a pipelining client then gets one send for the whole batch instead of one per request. Past
+// 'client-output-pause' bytes of pending output the remaining frames wait in the input buffer until the
+// client has read its replies (handle_write picks them up), so a pipeline can't pile up unbounded output
+static void process_input(Conn *conn) {
+	if (conn == repl.link) // the primary's input is the replication stream, not requests
+		return link_input(conn);
+	if (conn->cluster_link) // replies to what this node sent another
+		return cluster_link_input(conn);
+	if (conn->scrape)
+		return scrape_input(conn);
 
-	while (try_request(conn));
+	while (!conn->blocked && conn->ot_pending() < srv_cfg.output_pause && try_request(conn));
 
-	if (conn->ot_size() > 0) {    // has a response
-		conn->state &= ~ConnState::RECVING;
+	if ((bool)(conn->state & ConnState::CLOSED)) // over an output limit
+		return;
+	if (conn->peer && conn->peer->state == PEER_SNAPSHOT) // the snapshot child owns the socket for now
+		return;
+	if (conn->ot_pending() > 0) { // has a response
+		if (!conn->peer) // a replica keeps reading acks while its stream goes out
+			conn->state &= ~ConnState::RECVING;
 		conn->state |=  ConnState::SENDING;
 
 		return handle_write(conn);
 	}
 }
 static void handle_write(Conn *conn) {
-	ssize_t rv = conn->send(conn->ot_data(), conn->ot_size());
+	ssize_t rv;
+	{
+		lat_timer t(&phase_lat[PHASE_WRITE]);
+		rv = conn->flush();
+	}
 
 	if (rv < 0 && errno == EAGAIN)
 		return;
@@ -167,10 +382,19 @@ static void handle_write(Conn *conn) {
 		std::println("[ERROR] handle_read: {}", strerror(errno));
 		return;
 	}
+	st_add(ST_NET_OUTPUT, (uint64_t)rv);
 
-	if (conn->ot_start == conn->ot_end) {   // all data written
+	if (conn->ot_pending() == 0) {   // all data written
+		if (conn->scrape) {          // scrape_cron renders the next chunk, or the scrape is over
+			conn->state = conn->scrape->done ? ConnState::CLOSED : conn->state & ~ConnState::SENDING;
+			return;
+		}
 		conn->state &= ~ConnState::SENDING;
 		conn->state |=  ConnState::RECVING;
+		conn->shrink();
+
+		if (conn->in_size() > 0)      // requests held back by client-output-pause
+			process_input(conn);
 	}
 }
 
@@ -180,12 +404,67 @@ static struct {
 	iHMap kvs; // key-value store
 	KVObj data[1024 * 16];
 	size_t data_idx;
+	std::stack<KVObj *> free_slots; // slots released by del/expiry, reused before data_idx grows
+	uint64_t version_clock;         // last version handed to a written object
+
+	TWheel expires; // deadlines of every volatile key
+
+	EvictPool evpool;
+	EvictPolicy evpool_policy; // policy the pooled scores were computed under
+	std::string victim_key;    // reused buffer for keys popped off the pool
+
+	struct {
+		size_t keys;
+		MemUsage mem;
+	} types[(size_t)KVTYPE::TSET + 1]; // per KVTYPE totals, kept in step through mem_sub/mem_add
 } db;
+constexpr sview kvtype_names[] = { "init", "string", "hash", "tset" }; // indexed by KVTYPE
+
+static void db_init() {
+	mk_twheel(&db.expires, utils::mono_ms());
+	mk_evpool(&db.evpool);
+}
+
+namespace {
+	// Bracket every mutation of an object's size with these, KVObj::mem_usage is O(1) for all types
+	inline void mem_sub(const KVObj *obj) { db.types[(size_t)obj->type()].mem -= obj->mem_usage(); }
+	inline void mem_add(const KVObj *obj) { db.types[(size_t)obj->type()].mem += obj->mem_usage(); }
+	// Every write to a key, its value or its ttl ends with this, watch compares the versions
+	inline void bump_version(KVObj *obj) { obj->set_version(++db.version_clock); }
+
+	// fresh access metadata, lfu counters start above zero so new keys aren't evicted straight away
+	inline uint32_t initial_lru(uint64_t now_ms) {
+		return srv_cfg.maxmemory_policy == EvictPolicy::ALLKEYS_LFU ? lfu_init(now_ms) : lru_clock(now_ms);
+	}
+	inline void touch_kvobj(KVObj *obj, uint64_t now_ms) {
+		if(srv_cfg.maxmemory_policy == EvictPolicy::ALLKEYS_LFU)
+			obj->set_lru(lfu_touch(obj->lru(), now_ms));
+		else
+			obj->set_lru(lru_clock(now_ms));
+	}
+}
 
+// Returns nullptr once every slot of db.data is in use
 inline KVObj *emplace_kvobj(std::string_view _key, KVTYPE _type) {
-	KVObj *obj = new (&db.data[db.data_idx++]) KVObj(_type);
+	KVObj *slot;
+	if(!db.free_slots.empty()) {
+		slot = db.free_slots.top();
+		db.free_slots.pop();
+	} else if(db.data_idx < std::size(db.data)) {
+		slot = &db.data[db.data_idx++];
+	} else {
+		return nullptr;
+	}
+
+	KVObj *obj = new (slot) KVObj(_type);
 	obj->set_key(std::string(_key));
+	obj->set_lru(initial_lru(utils::mono_ms()));
 	ihs_insert(&db.kvs.table, obj->hook());
+
+	db.types[(size_t)_type].keys++;
+	cluster.keys[cl_key_slot(obj->get_key(), obj->hook()->hval)]++;
+	mem_add(obj);
+	bump_version(obj);
 	return obj;
 }
 
@@ -196,43 +475,553 @@ namespace {
 	
 		return obj.get_key() == lookup->key;
 	}
+	bool same_node(const iHNode *a, const iHNode *b) { return a == b; }
 }
 
-static void do_request(std::vector<sview> &cmd, Response &out) {
-	using req_func = void(std::vector<sview>&, Response&);
-	req_func get_val, set_val, del_val,
-			do_add_tset, do_range_tset;
+// drop_kvobj: unlinks 'obj' from the keyspace and the expiry wheel, releases its value and recycles the slot.
+// A 'lazy' drop leaves a big value to the reclaimer thread, see lazyfree.h
+static void drop_kvobj(KVObj *obj, bool lazy = srv_cfg.lazyfree_lazy_server_del) {
+	ihs_del(&db.kvs.table, obj->hook(), same_node);
+	tw_del(&db.expires, obj->ttl_hook());
 
-	const size_t cmd_len = cmd.size();
+	db.types[(size_t)obj->type()].keys--;
+	cluster.keys[cl_key_slot(obj->get_key(), obj->hook()->hval)]--;
+	mem_sub(obj);
 
-	if (cmd_len == 2 && cmd[0] == "get") {
-		get_val(cmd, out);
-		if(out.status == RES_NX)
-			return;
+	tset_release(obj);
+	if(lazy)
+		lf_release(obj->type(), obj->take_val());
+
+	obj->~KVObj();
+	new (obj) KVObj(); // keep the slot a live object, db.data is destroyed as a whole on exit
+	db.free_slots.push(obj);
+}
+
+// find_kvobj: raw keyspace lookup, no expiry check and no access tracking
+static KVObj *find_kvobj(sview key) {
+	LookupDummy dummy{
+		.hook = { nullptr, genHash((const byte *)key.data(), key.length()) },
+		.key  = key
+	};
+
+	iHNode *node = ihs_find(&db.kvs.table, &dummy.hook, lookup_eq);
+	return node ? get_kvobj(node) : nullptr;
+}
+
+// expire_kvobj: drops an object whose deadline has passed. Replicas don't expire keys themselves, they get a del
+static void expire_kvobj(KVObj *obj) {
+	const sview del[] = { "del", obj->get_key() };
+	propagate(del);
+	drop_kvobj(obj);
+	st_add(ST_EXPIRED);
+}
+
+// access_kvobj: lazily reaps a found object whose deadline has passed, otherwise records the access.
+// On a replica an expired object only reads as missing until the primary's del arrives, and the
+// primary's own commands still see it
+static KVObj *access_kvobj(KVObj *obj, uint64_t now_ms) {
+	if(!obj)
+		return nullptr;
+
+	if(obj->expired(now_ms)) {
+		if(repl.role == ROLE_REPLICA)
+			return from_primary() ? obj : nullptr;
+		expire_kvobj(obj);
+		return nullptr;
+	}
+
+	touch_kvobj(obj, now_ms);
+	return obj;
+}
+
+// lookup_kvobj: finds the object stored under 'key', lazily reaping it if its deadline has passed
+static KVObj *lookup_kvobj(sview key) {
+	return access_kvobj(find_kvobj(key), utils::mono_ms());
+}
+
+// find_kvobj_batch: find_kvobj for up to IHS_BATCH keys, every 'stride'-th element of 'args'. All hashes are
+// computed before the first lookup, so ihs_find_batch can overlap the lookups' cache misses
+static void find_kvobj_batch(const sview *args, size_t stride, size_t n, KVObj **out) {
+	assert(n <= IHS_BATCH);
+	LookupDummy dummies[IHS_BATCH];
+	const iHNode *hooks[IHS_BATCH];
+	iHNode *found[IHS_BATCH];
+
+	for(size_t i = 0; i < n; i++) {
+		const sview key = args[i * stride];
+		dummies[i] = { .hook = { nullptr, genHash((const byte *)key.data(), key.length()) }, .key = key };
+		hooks[i] = &dummies[i].hook;
+	}
+
+	ihs_find_batch(&db.kvs.table, hooks, found, n, lookup_eq);
+	for(size_t i = 0; i < n; i++)
+		out[i] = found[i] ? get_kvobj(found[i]) : nullptr;
+}
+
+// run_cycle: background work done once per main_loop iteration, returns the poll timeout (ms) until it's needed again.
+// Active expiry reaps keys nobody looks up anymore. It's bounded by srv_cfg.expire_slice_us so a mass expiry
+// can't stall the loop, whatever is left stays on the due list for the next iteration.
+namespace {
+	// clients_cron: soft output limits need time to pass without new output, and idle buffers shrink
+	// here. Returns whether a client is over its soft limit, so the loop keeps waking up for it
+	bool clients_cron(uint64_t now_ms) {
+		static uint64_t last_ms = 0;
+		static bool soft_pending = false;
+		if(now_ms - last_ms < 1000 / srv_cfg.hz)
+			return soft_pending;
+		last_ms = now_ms;
+
+		soft_pending = false;
+		for(Conn *conn : connections) {
+			if(!conn || (bool)(conn->state & ConnState::CLOSED))
+				continue;
+
+			if(!enforce_output_limits(conn, now_ms))
+				soft_pending |= conn->soft_since_ms != 0;
+			if(!(bool)(conn->state & ConnState::SENDING))
+				conn->shrink();
+		}
+
+		return soft_pending;
+	}
+}
+
+static int run_cycle() {
+	const uint64_t start = utils::mono_us();
+	wd_configure(srv_cfg.watchdog_period);
+	st_sample(start / 1000);
+	const bool soft_pending = clients_cron(start / 1000);
+	const bool repl_pending = repl_cron(start / 1000);
+	agg_cron();
+	const bool bk_pending   = bk_cron(start / 1000);
+	const bool mx_pending   = scrape_cron();
+
+	bool expire_due = false, expire_pending = false;
+	if(repl.role != ROLE_REPLICA) { // a replica's keys expire through the primary's dels
+		tw_advance(&db.expires, start / 1000);
+
+		size_t reaped = 0;
+		while(TWNode *due = tw_pop_due(&db.expires)) {
+			expire_kvobj(get_kvobj_t(due));
+
+			if(++reaped % 16 == 0 && utils::mono_us() - start >= srv_cfg.expire_slice_us)
+				break;
+		}
+		expire_due = tw_has_due(&db.expires);
+		expire_pending = db.expires.size > 0;
+	}
+	// after expiry, so a migration's batch doesn't carry keys that are already due
+	const int cl_wait = cluster_cron(start / 1000);
+
+	const bool woken = bk_woken; // an unblocked client's reply needs a pollfd with POLLOUT, built next iteration
+	bk_woken = false;
+	if(expire_due || mx_pending || cl_wait == 0 || woken)
+		return 0;
+	if(expire_pending || soft_pending || repl_pending || bk_pending || cl_wait > 0)
+		return 1000 / srv_cfg.hz;
+	return -1;
+}
+
+namespace {
+	// parse_ttl: reads a relative ttl given in 'unit_ms' milliseconds
+	bool parse_ttl(sview num, int64_t unit_ms, int64_t &ttl_ms) {
+		int64_t ttl;
+		auto [end, ec] = std::from_chars(num.data(), num.data() + num.size(), ttl);
+		if(ec != std::errc{} || end != num.data() + num.size())
+			return false;
+		if(ttl > INT64_MAX / unit_ms || ttl < INT64_MIN / unit_ms)
+			return false;
+
+		ttl_ms = ttl * unit_ms;
+		return true;
+	}
+	// parse_deadline: reads an absolute unix time in milliseconds as the ttl left until it, negative once it passed
+	bool parse_deadline(sview num, int64_t &ttl_ms) {
+		int64_t at;
+		auto [end, ec] = std::from_chars(num.data(), num.data() + num.size(), at);
+		if(ec != std::errc{} || end != num.data() + num.size() || at < 0)
+			return false;
+
+		ttl_ms = at - (int64_t)utils::unix_ms();
+		return true;
+	}
+	// unix_deadline: a key's monotonic deadline as unix milliseconds, what goes to replicas and migration targets
+	int64_t unix_deadline(uint64_t mono) {
+		return (int64_t)utils::unix_ms() + ((int64_t)mono - (int64_t)utils::mono_ms());
+	}
+}
+
+//---------------------------------------------------------------------------------------
+// Eviction
+//---------------------------------------------------------------------------------------
+// evict_select: feeds a fresh sample of candidates into the pool and returns the best one that's still alive.
+// Pooled keys may have been deleted or changed since they were scored, those are skipped.
+static KVObj *evict_select(uint64_t now_ms) {
+	static std::minstd_rand rng{ std::random_device{}() };
+	const EvictPolicy policy = srv_cfg.maxmemory_policy;
+	const size_t samples = srv_cfg.maxmemory_samples;
+
+	if(db.evpool_policy != policy) {
+		evp_clear(&db.evpool);
+		db.evpool_policy = policy;
+	}
+
+	for(int round = 0; round < 16; round++) {
+		size_t sampled;
+
+		if(policy == EvictPolicy::VOLATILE_TTL) { // the wheel hands out the nearest deadlines directly
+			TWNode *ttls[64];
+			sampled = tw_sample(&db.expires, ttls, samples);
+
+			for(size_t i = 0; i < sampled; i++) {
+				KVObj *obj = get_kvobj_t(ttls[i]);
+				evp_insert(&db.evpool, UINT64_MAX - obj->expire_at(), obj->get_key());
+			}
+		} else {
+			iHNode *nodes[64];
+			sampled = ihs_sample(&db.kvs.table, nodes, samples, rng());
+
+			for(size_t i = 0; i < sampled; i++) {
+				KVObj *obj = get_kvobj(nodes[i]);
+				const uint64_t score = (policy == EvictPolicy::ALLKEYS_LFU) ?
+					255 - lfu_counter(obj->lru(), now_ms) : lru_idle_ms(obj->lru(), now_ms);
+
+				evp_insert(&db.evpool, score, obj->get_key());
+			}
+		}
+
+		while(evp_pop(&db.evpool, db.victim_key)) {
+			KVObj *victim = find_kvobj(db.victim_key);
+			if(victim && (policy != EvictPolicy::VOLATILE_TTL || victim->has_ttl()))
+				return victim;
+		}
+
+		if(sampled == 0) // nothing left that the policy may evict
+			return nullptr;
+	}
+
+	return nullptr;
+}
+
+// evict_for_write: frees memory ahead of a command that may grow it, while used memory is above maxmemory.
+// Bounded by srv_cfg.evict_budget_us: a write that runs out of budget still goes through and the writes
+// after it carry on evicting. Returns false when the write has to be refused.
+static bool evict_for_write() {
+	if(srv_cfg.maxmemory == 0 || mem_used() <= srv_cfg.maxmemory)
+		return true;
+	if(srv_cfg.maxmemory_policy == EvictPolicy::NOEVICTION)
+		return false;
+
+	const uint64_t start = utils::mono_us();
+	while(mem_used() > srv_cfg.maxmemory) {
+		KVObj *victim = evict_select(start / 1000);
+		if(!victim)
+			return false;
+
+		const sview del[] = { "del", victim->get_key() }; // replicas ignore maxmemory, they follow the primary
+		propagate(del);
+		drop_kvobj(victim, false); // inline, the loop needs mem_used() to drop as it goes
+		st_add(ST_EVICTED);
+		if(utils::mono_us() - start >= srv_cfg.evict_budget_us)
+			break;
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------------
+// Command table
+//---------------------------------------------------------------------------------------
+using req_func = void(std::vector<sview>&, Response&);
+req_func get_val, set_val, del_val,
+		do_add_tset, do_range_tset, do_rangebylex_tset, do_tsetstore, do_tpop, do_btpop,
+		do_hset, do_hget, do_hdel, do_hlen,
+		do_expire, do_ttl, do_persist, do_config,
+		do_memory, do_latency, do_slowlog, do_profile, do_watchdog, do_info,
+		do_mget, do_mset, do_mdel, do_unlink, do_flushdb,
+		do_scan, do_tscan, do_hscan,
+		do_multi, do_exec, do_discard, do_watch, do_unwatch,
+		do_subscribe, do_unsubscribe, do_publish,
+		do_client,
+		do_psync, do_replconf, do_replicaof, do_role,
+		do_cluster, do_asking;
+
+enum CMD_FLAGS : uint8_t {
+	CMD_READ    = 0,
+	CMD_WRITE   = (1 << 0), // modifies the keyspace
+	CMD_DENYOOM = (1 << 1), // may grow memory, refused over maxmemory when eviction can't make room
+	CMD_TXN     = (1 << 2), // transaction control, runs right away instead of being queued after multi
+};
+
+struct command {
+	sview name;
+	int32_t arity; // argument count including the name, -n means at least n
+	uint8_t flags;
+	req_func *proc;
+	// key positions for the cluster slot checks: first to last every 'key_step', a negative 'last_key'
+	// counts from the end. first_key 0 is a keyless command
+	int8_t first_key = 0, last_key = 0, key_step = 0;
+};
 
-	} else if (cmd_len == 3 && cmd[0] == "set") {
-		set_val(cmd, out);
-	} else if (cmd_len == 2 && cmd[0] == "del") {
-		del_val(cmd, out);
-	} else if (cmd_len >= 4 && cmd[0] == "tadd") {
-		do_add_tset(cmd, out);
-	} else if (cmd_len == 4 && cmd[0] == "trange") {
-		do_range_tset(cmd, out);
+static const command cmd_table[] = {
+	{ "get",     2,  CMD_READ,                get_val, 1, 1, 1 },
+	{ "set",     -3, CMD_WRITE | CMD_DENYOOM, set_val, 1, 1, 1 },
+	{ "del",     2,  CMD_WRITE,               del_val, 1, 1, 1 },
+	{ "mget",    -2, CMD_READ,                do_mget, 1, -1, 1 },
+	{ "mset",    -3, CMD_WRITE | CMD_DENYOOM, do_mset, 1, -2, 2 },
+	{ "mdel",    -2, CMD_WRITE,               do_mdel, 1, -1, 1 },
+	{ "unlink",  -2, CMD_WRITE,               do_unlink, 1, -1, 1 },
+	{ "flushdb", -1, CMD_WRITE,               do_flushdb },
+	{ "scan",    -2, CMD_READ,                do_scan },
+	{ "tscan",   -3, CMD_READ,                do_tscan, 1, 1, 1 },
+	{ "hscan",   -3, CMD_READ,                do_hscan, 1, 1, 1 },
+	{ "hset",    -4, CMD_WRITE | CMD_DENYOOM, do_hset, 1, 1, 1 },
+	{ "hget",    3,  CMD_READ,                do_hget, 1, 1, 1 },
+	{ "hdel",    -3, CMD_WRITE,               do_hdel, 1, 1, 1 },
+	{ "hlen",    2,  CMD_READ,                do_hlen, 1, 1, 1 },
+	{ "tadd",    -4, CMD_WRITE | CMD_DENYOOM, do_add_tset, 1, 1, 1 },
+	{ "trange",  4,  CMD_READ,                do_range_tset, 1, 1, 1 },
+	{ "trangebylex", -4, CMD_READ,            do_rangebylex_tset, 1, 1, 1 },
+	{ "tunionstore", -4, CMD_WRITE | CMD_DENYOOM, do_tsetstore, 1, 1, 1 }, // the sources' slots are checked by the handler
+	{ "tinterstore", -4, CMD_WRITE | CMD_DENYOOM, do_tsetstore, 1, 1, 1 },
+	{ "tpopmin", -2, CMD_WRITE,               do_tpop, 1, 1, 1 },
+	{ "tpopmax", -2, CMD_WRITE,               do_tpop, 1, 1, 1 },
+	{ "btpopmin", -3, CMD_WRITE,              do_btpop, 1, -2, 1 },
+	{ "btpopmax", -3, CMD_WRITE,              do_btpop, 1, -2, 1 },
+	{ "expire",  3,  CMD_WRITE,               do_expire, 1, 1, 1 },
+	{ "pexpire", 3,  CMD_WRITE,               do_expire, 1, 1, 1 },
+	{ "pexpireat", 3, CMD_WRITE,              do_expire, 1, 1, 1 },
+	{ "ttl",     2,  CMD_READ,                do_ttl, 1, 1, 1 },
+	{ "pttl",    2,  CMD_READ,                do_ttl, 1, 1, 1 },
+	{ "persist", 2,  CMD_WRITE,               do_persist, 1, 1, 1 },
+	{ "config",  -3, CMD_READ,                do_config },
+	{ "memory",  -2, CMD_READ,                do_memory },
+	{ "latency", -1, CMD_READ,                do_latency },
+	{ "slowlog", -2, CMD_READ,                do_slowlog },
+	{ "profile", -1, CMD_READ,                do_profile },
+	{ "watchdog", -1, CMD_READ,               do_watchdog },
+	{ "info",    -1, CMD_READ,                do_info },
+	{ "multi",   1,  CMD_TXN,                 do_multi },
+	{ "exec",    1,  CMD_TXN,                 do_exec },
+	{ "discard", 1,  CMD_TXN,                 do_discard },
+	{ "watch",   -2, CMD_TXN,                 do_watch, 1, -1, 1 },
+	{ "unwatch", 1,  CMD_TXN,                 do_unwatch },
+	{ "subscribe",    -2, CMD_READ,           do_subscribe },
+	{ "psubscribe",   -2, CMD_READ,           do_subscribe },
+	{ "unsubscribe",  -1, CMD_READ,           do_unsubscribe },
+	{ "punsubscribe", -1, CMD_READ,           do_unsubscribe },
+	{ "publish",      3,  CMD_READ,           do_publish },
+	{ "client",       2,  CMD_READ,           do_client },
+	{ "psync",        3,  CMD_READ,           do_psync },
+	{ "replconf",     -2, CMD_READ,           do_replconf },
+	{ "replicaof",    3,  CMD_READ,           do_replicaof },
+	{ "role",         1,  CMD_READ,           do_role },
+	{ "cluster",      -2, CMD_READ,           do_cluster },
+	{ "asking",       1,  CMD_READ,           do_asking },
+};
+static HdrHist cmd_lat[std::size(cmd_table)]; // indexed like cmd_table
+static_assert(std::size(cmd_table) <= ST_CMDS, "st_call counts commands by their cmd_table index");
+
+static const command *lookup_command(sview name) {
+	for(const command &c : cmd_table) {
+		if(c.name == name)
+			return &c;
+	}
+
+	return nullptr;
+}
+
+// cluster_route: in cluster mode every key of a command has to hash to the same slot, one this node serves.
+// Otherwise 'out' gets the error or the redirection the client follows and false comes back:
+//   MOVED slot addr  the slot belongs to another node, clients update their map
+//   ASK slot addr    the slot is migrating and a key isn't here anymore, retry there once after 'asking'
+// Commands from the primary or from a migrating node's link are never redirected
+static bool cluster_route(const command *c, const std::vector<sview> &cmd, Response &out) {
+	if(from_primary() || (cur_client && cur_client->cluster_import))
+		return true;
+
+	const int32_t last = c->last_key < 0 ? (int32_t)cmd.size() + c->last_key : c->last_key;
+	int32_t slot = -1;
+	for(int32_t i = c->first_key; i <= last; i += c->key_step) {
+		const int32_t s = cl_key_slot(cmd[i]);
+		if(slot >= 0 && s != slot) {
+			reply(out, RES_ERR, "[ERROR: CROSSSLOT] Keys in request don't hash to the same slot");
+			return false;
+		}
+		slot = s;
+	}
+	if(slot < 0)
+		return true;
+
+	const uint16_t owner = cluster.owner[slot];
+	if(owner == CL_NO_NODE) {
+		reply(out, RES_ERR, "[ERROR: CLUSTERDOWN] Hash slot {} not served", slot);
+	} else if(owner == 0) {
+		if(cluster.state[slot] != SLOT_MIGRATING)
+			return true;
+
+		// keys still here are served here, the ones already moved (or never created) at the target
+		const uint64_t now = utils::mono_ms();
+		size_t here = 0, keys = 0;
+		for(int32_t i = c->first_key; i <= last; i += c->key_step, keys++) {
+			const KVObj *obj = find_kvobj(cmd[i]);
+			here += obj && !obj->expired(now);
+		}
+
+		if(here == keys)
+			return true;
+		if(here > 0)
+			reply(out, RES_ERR, "[ERROR: TRYAGAIN] Multiple keys request during rehashing of slot");
+		else
+			reply(out, RES_ERR, "[ASK] {} {}", slot, cl_addr(&cluster, cluster.peer[slot]));
+	} else if(cluster.state[slot] == SLOT_IMPORTING && cur_client && cur_client->asking_for == cur_client->ncmds) {
+		return true;
 	} else {
+		reply(out, RES_ERR, "[MOVED] {} {}", slot, cl_addr(&cluster, owner));
+	}
+
+	return false;
+}
+// loan_held: a client's write to a tset a background aggregation still reads waits in the input buffer, parked
+// like a blocking pop until agg_cron collects a job, so the loop never copies the set from under the job
+static bool loan_held(const command *c, std::span<const sview> cmd) {
+	if(tset_loans.empty() || !(c->flags & CMD_WRITE) || !c->first_key)
+		return false;
+
+	const int32_t last = c->last_key < 0 ? (int32_t)cmd.size() + c->last_key : c->last_key;
+	for(int32_t i = c->first_key; i <= last; i += c->key_step) {
+		const KVObj *obj = find_kvobj(cmd[i]);
+		if(obj && obj->type() == KVTYPE::TSET && std::any_of(tset_loans.begin(), tset_loans.end(),
+				[obj](const TSetLoan &l) { return l.tset == obj->val_p(); }))
+			return true;
+	}
+	return false;
+}
+static void loan_park(Conn *conn, Response &out) {
+	conn->loan_wait = true;
+	conn->blocked = true;
+	loan_waits.push_back(conn);
+	out.status = RES_NOREPLY;
+}
+
+namespace {
+	// txn_queue: copies a command's arguments into the client's transaction arena
+	void txn_queue(MultiState *txn, const std::vector<sview> &cmd) {
+		for(sview arg : cmd) {
+			txn->args.emplace_back((uint32_t)txn->arena.size(), (uint32_t)arg.size());
+			txn->arena.append(arg);
+		}
+		txn->argc.push_back((uint32_t)cmd.size());
+	}
+	// txn_held: a queued command writes a lent tset, the exec waits for the loan like that command would alone
+	bool txn_held(const MultiState *txn) {
+		if(tset_loans.empty())
+			return false;
+
+		std::vector<sview> args;
+		size_t next_arg = 0;
+		for(size_t i = 0; i < txn->argc.size(); i++) {
+			args.clear();
+			for(uint32_t a = 0; a < txn->argc[i]; a++, next_arg++) {
+				const auto [off, len] = txn->args[next_arg];
+				args.emplace_back(txn->arena.data() + off, len);
+			}
+			if(loan_held(lookup_command(args[0]), args))
+				return true;
+		}
+		return false;
+	}
+}
+
+static void do_request(std::vector<sview> &cmd, Response &out) {
+	const command *c = cmd.empty() ? nullptr : lookup_command(cmd[0]);
+	const int32_t argc = (int32_t)cmd.size();
+
+	MultiState *txn = cur_client ? cur_client->multi.get() : nullptr;
+	const bool queueing = txn && txn->active && !(c && (c->flags & CMD_TXN));
+
+	if(!c || (c->arity >= 0 ? argc != c->arity : argc < -c->arity)) {
+		if(queueing)
+			txn->dirty = true;
 		out.status = RES_ERR;
+		return;
+	}
+
+	if((c->flags & CMD_WRITE) && repl.role == ROLE_REPLICA && !from_primary()) {
+		if(queueing)
+			txn->dirty = true;
+		reply(out, RES_ERR, "[ERROR: READONLY] You can't write against a replica");
+		return;
+	}
+
+	if(srv_cfg.cluster_enabled && c->first_key && !cluster_route(c, cmd, out)) {
+		if(queueing)
+			txn->dirty = true;
+		return;
+	}
+
+	if(queueing) {
+		txn_queue(txn, cmd);
+
+		reply(out, RES_OK, "[QUEUED] {}", c->name);
+		return;
+	}
+
+	// a replica's stream, a transaction's commands and a migration's link can't wait, tset_write copies for them
+	if(cur_client && !from_primary() && !repl.in_exec && !cur_client->cluster_import && loan_held(c, cmd))
+		return loan_park(cur_client, out);
+
+	if((c->flags & CMD_DENYOOM) && !from_primary() && !evict_for_write()) {
+		reply(out, RES_ERR, "[ERROR: OOM] Command not allowed when used memory > 'maxmemory'");
+		return;
+	}
+
+	const uint32_t outer_tag = pf_tag.load(std::memory_order_relaxed); // exec's, around its queued commands
+	pf_tag.store((uint32_t)(c - cmd_table) + 1, std::memory_order_relaxed); // profiler samples and stall reports name it
+	wd_fd.store(cur_client ? cur_client->get_socket() : -1, std::memory_order_relaxed);
+	const bool timed = srv_cfg.latency_tracking || srv_cfg.slowlog_max_len > 0; // neither wants it, no tsc reads
+	const uint64_t start = timed ? tsc_now() : 0;
+	c->proc(cmd, out);
+	const uint64_t ticks = timed ? tsc_now() - start : 0;
+	st_add(ST_COMMANDS);
+	st_call((size_t)(c - cmd_table));
+
+	if((c->flags & CMD_WRITE) && out.status != RES_ERR && out.status != RES_NOREPLY) // a background job replicates its result itself
+		propagate_command(cmd);
+
+	if(srv_cfg.latency_tracking) {
+		hist_record(&phase_lat[PHASE_EXEC], ticks);
+		hist_record(&cmd_lat[c - cmd_table], ticks);
 	}
+
+	const uint64_t us = timed ? (uint64_t)(tsc_to_ns(ticks) / 1000.0) : 0;
+	if(timed && us >= srv_cfg.slowlog_log_slower_than)
+		sl_push(&slowlog, cmd, us, cur_client ? cur_client->get_socket() : -1, srv_cfg.slowlog_max_len);
+
+	if(!blocking.ready.empty() && !repl.in_exec) // after the write went out, an exec's after all of it
+		serve_blocked();
+	pf_tag.store(outer_tag, std::memory_order_relaxed);
+	if(!outer_tag)
+		wd_fd.store(-1, std::memory_order_relaxed);
 }
 
 namespace {
-	static void make_response(const Response &res, byte *out, off_t &offset) {
+	// Reused by every request: the argument array and the reply keep their capacity, and handlers format
+	// straight into the reply (see reply), so a pipelined batch of data commands runs without allocating for
+	// either. The admin commands (info, config, memory ...) still build a std::string first
+	std::vector<sview> req_args;
+	Response req_res;
+
+	static void make_response(const Response &res, Conn *conn) {
 		uint32_t rlen = 4 + (uint32_t)res.data.size();
+		byte *out = conn->ot_reserve(sizeof(rlen) + rlen);
 
-		memcpy(out + offset, (byte *)&rlen, sizeof(rlen));
-		offset += sizeof(rlen);
-		memcpy(out + offset, (byte *)&res.status, sizeof(res.status));
-		offset += sizeof(res.status);
-		memcpy(out + offset, (byte *)res.data.data(), res.data.size());
-		offset += res.data.size();
+		memcpy(out, (byte *)&rlen, sizeof(rlen));
+		out += sizeof(rlen);
+		memcpy(out, (byte *)&res.status, sizeof(res.status));
+		out += sizeof(res.status);
+		memcpy(out, (byte *)res.data.data(), res.data.size());
+		conn->ot_end += sizeof(rlen) + rlen;
 	}
 }
 
@@ -242,8 +1031,7 @@ static int try_request(Conn *conn) {
 
 	uint32_t len = 0;
 	memcpy(&len, conn->in_data(), sizeof(len));
-	if(len > 20000) {
-		std::println("too long");
+	if(len > MAX_FRAME) { // a migration splits its frames to fit too, see tadd_frames
 		conn->state = ConnState::CLOSED;
 
 		return false;
@@ -254,20 +1042,34 @@ static int try_request(Conn *conn) {
 
 	const byte *request = conn->in_data() + 4;
 
-	std::vector<sview> cmd;
-	if(parse_req(request, len, cmd) < 0) {
+	req_args.clear();
+	int32_t parsed;
+	{
+		lat_timer t(&phase_lat[PHASE_PARSE]);
+		parsed = parse_req(request, len, req_args);
+	}
+	if(parsed < 0) {
 		std::println("Bad request");
 		conn->state = ConnState::CLOSED;
 
 		return false;
 	}
 
-	Response res;
-	do_request(cmd, res);
-	make_response(res, conn->ot_buff, conn->ot_end);
+	req_res.status = RES_OK;
+	req_res.data.clear();
+
+	cur_client = conn;
+	do_request(req_args, req_res);
+	cur_client = nullptr;
+	if(conn->loan_wait) // the frame stays for the rerun
+		return false;
+	if(req_res.status != RES_NOREPLY)
+		make_response(req_res, conn);
 
 	conn->in_start += 4 + len;
-	return true;
+	conn->ncmds++;
+	conn->last_cmd_ms = utils::mono_ms();
+	return !enforce_output_limits(conn, conn->last_cmd_ms);
 }
 
 static int32_t parse_req(const byte *data, size_t len, std::vector<sview>& out) {
@@ -282,6 +1084,7 @@ static int32_t parse_req(const byte *data, size_t len, std::vector<sview>& out)
 
 	if(nstr > 20000)
 		return -1;
+	out.reserve(std::min<size_t>(nstr, (end - data) / sizeof(uint32_t))); // a frame can't claim more strings than it has length fields
 
 	while(out.size() < nstr) {
 		uint32_t str_len = 0;
@@ -307,84 +1110,2496 @@ static int32_t parse_req(const byte *data, size_t len, std::vector<sview>& out)
 // String val type functions
 //---------------------------------------------------------------------------------------
 void get_val(vector<sview> &cmds, Response &out) { // get command from cmds vector
-	LookupDummy dummy{
-		.hook = { nullptr, genHash((const byte *)cmds[1].data(), cmds[1].length()) },
-		.key  = cmds[1]
-	};
-
-	iHNode *node = ihs_find(&db.kvs.table, &dummy.hook, lookup_eq);
+	KVObj *container = lookup_kvobj(cmds[1]);
 
-	if(!node) {
+	if(!container) {
 		out.status = RES_NX;
 		return;
 	}
 
-	std::string res;
-	KVObj &container = get_kvobj_v(node);
-
-	if(container.type() != KVTYPE::STRING) {
-		res = "[ERROR: TYPE_MM] Was expecting STRING type";
-		out.data.assign(res.begin(), res.end());
-	} else {
-		res = "[GET] Key: " + std::string(cmds[1]) + " Val: " + (String&)container.val();
+	if(container->type() != KVTYPE::STRING) {
+		reply(out, RES_OK, "[ERROR: TYPE_MM] Was expecting STRING type");
+		return;
 	}
 
-	out.data.assign(res.begin(), res.end());
+	reply(out, RES_OK, "[GET] Key: {} Val: ", cmds[1]);
+	reply_append(out, (String&)container->val());
 }
+// set key val [ex seconds | px milliseconds | pxat unix-milliseconds], a plain set makes the key persistent again.
+// A deadline that passed already leaves the key to the next expiry cycle
 void set_val(vector<sview> &cmds, Response &out) {
-	LookupDummy dummy{
-		.hook = { nullptr, genHash((const byte *)cmds[1].data(), cmds[1].length()) },
-		.key  = cmds[1]
-	};
-	std::string res;
-	KVObj *entry;
-	iHNode *_hook;
+	int64_t ttl = 0;
 
-	_hook = ihs_find(&db.kvs.table, &dummy.hook, lookup_eq);
-	if(!_hook) {
-		entry = emplace_kvobj(dummy.key, KVTYPE::STRING);
-		entry->make_val<KVTYPE::STRING>(std::move(cmds[2]));
-	}
-	else if(get_kvobj_v(_hook).type() != KVTYPE::STRING) {
-		res = "[ERROR: TYPE_MM] Was expecting STRING type";
-		out.data.assign(res.begin(), res.end());
-		out.status = RES_ERR;
+	if(cmds.size() == 4 || cmds.size() > 5) {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'set key val [ex <seconds> | px <milliseconds> | pxat <unix-ms>]'");
 		return;
 	}
+	if(cmds.size() == 5) {
+		if(cmds[3] == "pxat" && parse_deadline(cmds[4], ttl)) {
+			ttl = std::max<int64_t>(ttl, 1);
+		} else {
+			const bool valid = (cmds[3] == "ex" && parse_ttl(cmds[4], 1000, ttl)) ||
+			                   (cmds[3] == "px" && parse_ttl(cmds[4], 1, ttl));
+			if(!valid || ttl <= 0) {
+				reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'ex <seconds>' or 'px <milliseconds>' with a positive ttl, or 'pxat <unix-ms>'");
+				return;
+			}
+		}
+	}
 
-	res = "[SET] Key: " + entry->get_key() + " Val: " + (String&)entry->val();
+	KVObj *entry = lookup_kvobj(cmds[1]);
+	if(entry && entry->type() != KVTYPE::STRING) { // replaced whatever it holds, a big value is freed lazily
+		drop_kvobj(entry);
+		entry = nullptr;
+	}
+	if(!entry) {
+		if( !(entry = emplace_kvobj(cmds[1], KVTYPE::STRING)) ) {
+			reply(out, RES_ERR, "[ERROR: DB_FULL] No free object slots left");
+			return;
+		}
+	}
+	mem_sub(entry);
+	((String&)entry->val()).assign(cmds[2]);
+	mem_add(entry);
+	bump_version(entry);
 
-	out.data.assign(res.begin(), res.end());
-	out.status = RES_OK;
+	if(ttl > 0)
+		tw_add(&db.expires, entry->ttl_hook(), utils::mono_ms() + ttl);
+	else
+		tw_del(&db.expires, entry->ttl_hook());
+
+	reply(out, RES_OK, "[SET] Key: {} Val: ", entry->get_key());
+	reply_append(out, (String&)entry->val());
 }
 void del_val(vector<sview> &cmds, Response &out) {
-	LookupDummy dummy{
-		.hook = { nullptr, genHash((const byte*)cmds[1].data(), cmds[1].length()) },
-		.key  = cmds[1]
-	};
-
-	iHNode *del_node = ihs_find(&db.kvs.table, &dummy.hook, lookup_eq);
-	if(!del_node) {
+	KVObj *container = lookup_kvobj(cmds[1]);
+	if(!container) {
 		out.status = RES_NX;
 		return;
 	}
 
-	ihs_del(&db.kvs.table, &dummy.hook, lookup_eq);
-
-	std::string res;
-	KVObj &container = get_kvobj_v(del_node);
-
-	if(container.type() != KVTYPE::STRING) {
-		res = "[ERROR: TYPE_MM] Was expecting STRING type";
-		out.status = RES_ERR;
-	} else {
-		res = "[DEL] Key: " + container.get_key() + " Val: " + (String&)container.val();
+	reply(out, RES_OK, "[DEL] Key: {}", container->get_key());
+	if(container->type() == KVTYPE::STRING) {
+		reply_append(out, " Val: ");
+		reply_append(out, (String&)container->val());
 	}
-
+	drop_kvobj(container, srv_cfg.lazyfree_lazy_user_del);
+}
+//---------------------------------------------------------------------------------------
+// Multi key functions, keys are looked up IHS_BATCH at a time through find_kvobj_batch
+//---------------------------------------------------------------------------------------
+namespace {
+	// Index of the first key of the chunk equal to key 'i', a repeated key reuses whatever its first
+	// occurrence left behind instead of a lookup result that went stale within the chunk
+	size_t batch_first(const sview *args, size_t stride, size_t i) {
+		for(size_t j = 0; j < i; j++) {
+			if(args[j * stride] == args[i * stride])
+				return j;
+		}
+		return i;
+	}
+}
+// mget key [key ...]
+void do_mget(vector<sview> &cmds, Response &out) {
+	const size_t nkeys = cmds.size() - 1;
+	const uint64_t now = utils::mono_ms();
+	KVObj *objs[IHS_BATCH];
+	reply(out, RES_OK, "[MGET] Keys: {}\n", nkeys);
+
+	for(size_t base = 0; base < nkeys; base += IHS_BATCH) {
+		const size_t n = std::min(IHS_BATCH, nkeys - base);
+		const sview *keys = &cmds[1 + base];
+		find_kvobj_batch(keys, 1, n, objs);
+
+		for(size_t i = 0; i < n; i++) {
+			const size_t first = batch_first(keys, 1, i);
+			KVObj *obj = objs[i] = first != i ? objs[first] : access_kvobj(objs[i], now);
+
+			reply_append(out, "Key: ");
+			reply_append(out, keys[i]);
+			if(obj && obj->type() == KVTYPE::STRING) {
+				reply_append(out, " Val: ");
+				reply_append(out, (String&)obj->val());
+				reply_append(out, "\n");
+			} else {
+				reply_append(out, " [NULL]\n");
+			}
+		}
+	}
+}
+namespace {
+	// new_keys: the distinct keys of an mset without an object yet, each takes a free slot. Keys that exist keep
+	// theirs, an expired or a replaced one gives its slot back before it takes one
+	size_t new_keys(const vector<sview> &cmds) {
+		vector<sview> missing;
+		for(size_t i = 1; i < cmds.size(); i += 2) {
+			if(!find_kvobj(cmds[i]))
+				missing.push_back(cmds[i]);
+		}
+		std::sort(missing.begin(), missing.end());
+		return std::unique(missing.begin(), missing.end()) - missing.begin();
+	}
+}
+// mset key val [key val ...], like a plain set per pair except that values of other types are replaced. All or
+// nothing: a partial mset would be an error reply, which never reaches the replicas
+void do_mset(vector<sview> &cmds, Response &out) {
+	if(cmds.size() % 2 == 0) {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'mset key val [key val ...]'");
+		return;
+	}
+
+	const size_t npairs = (cmds.size() - 1) / 2;
+	const size_t free_slots = db.free_slots.size() + (std::size(db.data) - db.data_idx);
+	if(npairs > free_slots) { // only then can the new keys not fit
+		const size_t needed = new_keys(cmds);
+		if(needed > free_slots) {
+			reply(out, RES_ERR, "[ERROR: DB_FULL] No free object slots left, {} new keys and {} free slots", needed, free_slots);
+			return;
+		}
+	}
+
+	const uint64_t now = utils::mono_ms();
+	KVObj *objs[IHS_BATCH];
+
+	for(size_t base = 0; base < npairs; base += IHS_BATCH) {
+		const size_t n = std::min(IHS_BATCH, npairs - base);
+		const sview *args = &cmds[1 + base * 2];
+		find_kvobj_batch(args, 2, n, objs);
+
+		for(size_t i = 0; i < n; i++) {
+			const size_t first = batch_first(args, 2, i);
+			KVObj *obj = first != i ? objs[first] : access_kvobj(objs[i], now);
+
+			if(obj && obj->type() != KVTYPE::STRING) {
+				drop_kvobj(obj);
+				obj = nullptr;
+			}
+			if(!obj)
+				obj = emplace_kvobj(args[i * 2], KVTYPE::STRING); // there's a slot for it, see new_keys
+
+			mem_sub(obj);
+			((String&)obj->val()).assign(args[i * 2 + 1]);
+			mem_add(obj);
+			bump_version(obj);
+			tw_del(&db.expires, obj->ttl_hook());
+
+			objs[i] = obj;
+		}
+	}
+
+	reply(out, RES_OK, "[MSET] Keys: {}", npairs);
+}
+namespace {
+	// multi_del: drops every existing key of cmds[1..], returns how many there were
+	size_t multi_del(vector<sview> &cmds, bool lazy) {
+		const size_t nkeys = cmds.size() - 1;
+		const uint64_t now = utils::mono_ms();
+		size_t deleted = 0;
+		KVObj *objs[IHS_BATCH];
+
+		for(size_t base = 0; base < nkeys; base += IHS_BATCH) {
+			const size_t n = std::min(IHS_BATCH, nkeys - base);
+			const sview *keys = &cmds[1 + base];
+			find_kvobj_batch(keys, 1, n, objs);
+
+			for(size_t i = 0; i < n; i++) {
+				if(batch_first(keys, 1, i) != i)
+					continue; // already gone
+
+				if(KVObj *obj = access_kvobj(objs[i], now)) {
+					drop_kvobj(obj, lazy);
+					deleted++;
+				}
+			}
+		}
+
+		return deleted;
+	}
+}
+// mdel key [key ...], deletes keys of any type
+void do_mdel(vector<sview> &cmds, Response &out) {
+	reply(out, RES_OK, "[MDEL] Deleted: {}", multi_del(cmds, srv_cfg.lazyfree_lazy_user_del));
+}
+// unlink key [key ...], mdel that always leaves big values to the reclaimer thread
+void do_unlink(vector<sview> &cmds, Response &out) {
+	reply(out, RES_OK, "[UNLINK] Unlinked: {}", multi_del(cmds, true));
+}
+namespace {
+	// flush_dataset: drops every key, a lazy flush hands every value to the reclaimer in a single batch
+	size_t flush_dataset(bool lazy) {
+		// every live object sits in db.data below data_idx, freed slots hold valueless INIT objects
+		std::vector<std::unique_ptr<Valtype>> vals;
+		size_t flushed = 0;
+		for(size_t i = 0; i < db.data_idx; i++) {
+			KVObj *obj = &db.data[i];
+			if(obj->type() == KVTYPE::INIT)
+				continue;
+
+			tw_del(&db.expires, obj->ttl_hook());
+			tset_release(obj);
+			if(lazy)
+				vals.push_back(obj->take_val());
+
+			obj->~KVObj();
+			new (obj) KVObj();
+			flushed++;
+		}
+
+		ihs_destroy(&db.kvs.table, nullptr);
+		db.free_slots = {};
+		db.data_idx = 0;
+		for(auto &t : db.types)
+			t = {};
+		std::fill(std::begin(cluster.keys), std::end(cluster.keys), 0);
+		lf_release_all(std::move(vals));
+		return flushed;
+	}
+}
+// flushdb [async | sync]
+void do_flushdb(vector<sview> &cmds, Response &out) {
+	bool lazy = srv_cfg.lazyfree_lazy_user_del;
+
+	if(cmds.size() == 2 && (cmds[1] == "async" || cmds[1] == "sync")) {
+		lazy = cmds[1] == "async";
+	} else if(cmds.size() != 1) {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'flushdb [async | sync]'");
+		return;
+	}
+
+	const size_t flushed = flush_dataset(lazy);
+	reply(out, RES_OK, "[FLUSHDB] Keys: {}{}", flushed, lazy ? ", freeing in the background" : "");
+}
+//---------------------------------------------------------------------------------------
+// Hash valtype functions
+//---------------------------------------------------------------------------------------
+namespace {
+	// find_hash: the hash at 'key' in 'hash', false if the key holds another type. 'hash' is nullptr when there's no key
+	bool find_hash(sview key, KVObj *&obj, Hash *&hash, Response &out) {
+		obj  = lookup_kvobj(key);
+		hash = obj && obj->type() == KVTYPE::HASH ? (Hash *)obj->val_p() : nullptr;
+		if(!obj || hash)
+			return true;
+
+		reply(out, RES_ERR, "[ERROR: TYPE_MM] Was expecting HASH type");
+		return false;
+	}
+}
+// hset key field value [field value ...]
+void do_hset(vector<sview> &cmds, Response &out) {
+	if(cmds.size() % 2) {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'hset key field value [field value ...]'");
+		return;
+	}
+
+	KVObj *obj;
+	Hash *hash;
+	if(!find_hash(cmds[1], obj, hash, out))
+		return;
+	if(!obj) {
+		if( !(obj = emplace_kvobj(cmds[1], KVTYPE::HASH)) ) {
+			reply(out, RES_ERR, "[ERROR: DB_FULL] No free object slots left");
+			return;
+		}
+		hash = (Hash *)obj->val_p();
+	}
+
+	mem_sub(obj);
+	size_t inserted = 0;
+	for(size_t i = 2; i < cmds.size(); i += 2)
+		inserted += hm_set(hash, cmds[i], cmds[i + 1]);
+	mem_add(obj);
+	bump_version(obj);
+
+	reply(out, RES_OK, "[HSET] Inserted: {}, Updated: {}", inserted, (cmds.size() - 2) / 2 - inserted);
+}
+// hget key field
+void do_hget(vector<sview> &cmds, Response &out) {
+	KVObj *obj;
+	Hash *hash;
+	if(!find_hash(cmds[1], obj, hash, out))
+		return;
+
+	const iHMPair *pair = hash ? hm_find(hash, cmds[2]) : nullptr;
+	if(!pair) {
+		reply(out, RES_NX, "[NULL] No field {} in key {}", cmds[2], cmds[1]);
+		return;
+	}
+
+	reply(out, RES_OK, "[HGET] Field: {} Val: {}", pair->key, pair->val);
+}
+// hdel key field [field ...], the key goes once its last field does
+void do_hdel(vector<sview> &cmds, Response &out) {
+	KVObj *obj;
+	Hash *hash;
+	if(!find_hash(cmds[1], obj, hash, out))
+		return;
+
+	size_t deleted = 0;
+	if(hash) {
+		mem_sub(obj);
+		for(size_t i = 2; i < cmds.size(); i++)
+			deleted += hm_del(hash, cmds[i]);
+		mem_add(obj);
+		if(deleted)
+			bump_version(obj);
+		if(hm_size(hash) == 0)
+			drop_kvobj(obj);
+	}
+
+	reply(out, RES_OK, "[HDEL] Deleted: {}", deleted);
+}
+// hlen key
+void do_hlen(vector<sview> &cmds, Response &out) {
+	KVObj *obj;
+	Hash *hash;
+	if(!find_hash(cmds[1], obj, hash, out))
+		return;
+
+	reply(out, RES_OK, "[HLEN] {}", hash ? hm_size(hash) : 0);
+}
+//---------------------------------------------------------------------------------------
+// Scan functions, cursors come from ihs_scan and stay valid across rehashing
+//---------------------------------------------------------------------------------------
+namespace {
+	constexpr size_t scan_count_max = 100000;
+
+	struct scan_args {
+		size_t cursor = 0;
+		size_t count  = 10; // nodes wanted per call, the walk stops early after count * 10 steps
+		sview  match;       // empty to match everything
+		int    type   = -1; // KVTYPE to keep, -1 for any
+	};
+	// parse_scan: 'cursor [match pattern] [count n] [type name]' from cmds[first] on, type only if 'with_type'
+	bool parse_scan(const vector<sview> &cmds, size_t first, bool with_type, scan_args &args, std::string &err) {
+		const auto parse_num = [](sview num, size_t &val) {
+			auto [ptr, ec] = std::from_chars(num.data(), num.data() + num.size(), val);
+			return ec == std::errc{} && ptr == num.data() + num.size();
+		};
+
+		if(!parse_num(cmds[first], args.cursor)) {
+			err = "[ERROR: SYNTAX] Cursor must be a non-negative integer";
+			return false;
+		}
+
+		for(size_t i = first + 1; i < cmds.size(); i += 2) {
+			if(i + 1 == cmds.size()) {
+				err = fmt("[ERROR: SYNTAX] Missing value for '{}'", cmds[i]);
+				return false;
+			}
+
+			if(cmds[i] == "match") {
+				args.match = cmds[i + 1] == "*" ? sview{} : cmds[i + 1];
+			} else if(cmds[i] == "count") {
+				if(!parse_num(cmds[i + 1], args.count) || args.count == 0 || args.count > scan_count_max) {
+					err = fmt("[ERROR: SYNTAX] Count must be between 1 and {}", scan_count_max);
+					return false;
+				}
+			} else if(cmds[i] == "type" && with_type) {
+				const auto it = std::find(std::begin(kvtype_names) + 1, std::end(kvtype_names), cmds[i + 1]);
+				if(it == std::end(kvtype_names)) {
+					err = fmt("[ERROR: SYNTAX] Unknown type '{}'", cmds[i + 1]);
+					return false;
+				}
+				args.type = (int)(it - std::begin(kvtype_names));
+			} else {
+				err = fmt("[ERROR: SYNTAX] Unknown option '{}'", cmds[i]);
+				return false;
+			}
+		}
+
+		return true;
+	}
+	// scan_walk: steps the cursor until 'count' nodes are collected, the walk ends or the step budget runs out.
+	// Filters run on the collected nodes afterwards, so a sparse match can't stretch a call
+	size_t scan_walk(const iHSet *hs, size_t cursor, size_t count, vector<iHNode *> &found) {
+		size_t budget = count * 10;
+		do {
+			cursor = ihs_scan(hs, cursor, [&](iHNode *node) { found.push_back(node); });
+		} while(cursor && found.size() < count && --budget);
+
+		return cursor;
+	}
+	void scan_error(std::string &res, Response &out) {
+		out.data.assign(res.begin(), res.end());
+		out.status = RES_ERR;
+	}
+}
+// scan cursor [match pattern] [count n] [type string|hash|tset]
+void do_scan(vector<sview> &cmds, Response &out) {
+	std::string res;
+	scan_args args;
+	if(!parse_scan(cmds, 1, true, args, res))
+		return scan_error(res, out);
+
+	vector<iHNode *> found;
+	const size_t next = scan_walk(&db.kvs.table, args.cursor, args.count, found);
+	const uint64_t now = utils::mono_ms();
+
+	std::string keys;
+	size_t nkeys = 0;
+	for(iHNode *node : found) {
+		KVObj *obj = get_kvobj(node);
+		if(obj->expired(now)) { // reaped here like any lookup, but a scan doesn't count as an access
+			if(repl.role == ROLE_PRIMARY)
+				expire_kvobj(obj);
+			continue;
+		}
+		if(args.type >= 0 && (int)obj->type() != args.type)
+			continue;
+		if(!args.match.empty() && !utils::glob_match(args.match, obj->get_key()))
+			continue;
+
+		keys.append("Key: ").append(obj->get_key()).append("\n");
+		nkeys++;
+	}
+
+	res = fmt("[SCAN] Cursor: {} Keys: {}\n", next, nkeys) + keys;
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+// tscan key cursor [match pattern] [count n]
+void do_tscan(vector<sview> &cmds, Response &out) {
+	std::string res;
+	scan_args args;
+	if(!parse_scan(cmds, 2, false, args, res))
+		return scan_error(res, out);
+
+	KVObj *obj = lookup_kvobj(cmds[1]);
+	if(obj && obj->type() != KVTYPE::TSET) {
+		res = "[ERROR: TYPE_MM] Was expecting TSET type";
+		return scan_error(res, out);
+	}
+
+	vector<iHNode *> found;
+	const size_t next = !obj ? 0 : scan_walk(&((TSet&)obj->val()).mts_mp, args.cursor, args.count, found);
+
+	std::string members;
+	size_t nmembers = 0;
+	for(iHNode *node : found) {
+		const TSTNode *member = utils::container_of(node, &TSTNode::mpnode);
+		if(!args.match.empty() && !utils::glob_match(args.match, member->name))
+			continue;
+
+		members.append(fmt("{} {}\n", member->name, member->tnode.key));
+		nmembers++;
+	}
+
+	res = fmt("[TSCAN] Cursor: {} Members: {}\n", next, nmembers) + members;
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+// hscan key cursor [match pattern] [count n]
+void do_hscan(vector<sview> &cmds, Response &out) {
+	std::string res;
+	scan_args args;
+	if(!parse_scan(cmds, 2, false, args, res))
+		return scan_error(res, out);
+
+	KVObj *obj = lookup_kvobj(cmds[1]);
+	if(obj && obj->type() != KVTYPE::HASH) {
+		res = "[ERROR: TYPE_MM] Was expecting HASH type";
+		return scan_error(res, out);
+	}
+
+	vector<iHNode *> found;
+	const size_t next = !obj ? 0 : scan_walk(&((Hash&)obj->val()).table, args.cursor, args.count, found);
+
+	std::string fields;
+	size_t nfields = 0;
+	for(iHNode *node : found) {
+		const iHMPair *pair = utils::container_of(node, &iHMPair::node);
+		if(!args.match.empty() && !utils::glob_match(args.match, pair->key))
+			continue;
+
+		fields.append(fmt("Field: {} Val: {}\n", pair->key, pair->val));
+		nfields++;
+	}
+
+	res = fmt("[HSCAN] Cursor: {} Fields: {}\n", next, nfields) + fields;
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+//---------------------------------------------------------------------------------------
+// Expiry functions
+//---------------------------------------------------------------------------------------
+// expire key seconds / pexpire key milliseconds / pexpireat key unix-milliseconds, a ttl that's not positive (a
+// deadline that passed) deletes the key right away. Replicas get every form as pexpireat, see propagate_command
+void do_expire(vector<sview> &cmds, Response &out) {
+	int64_t ttl;
+
+	const bool valid = cmds[0] == "pexpireat" ? parse_deadline(cmds[2], ttl)
+	                                          : parse_ttl(cmds[2], cmds[0] == "pexpire" ? 1 : 1000, ttl);
+	if(!valid) {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] TTL is not an integer or out of range");
+		return;
+	}
+
+	KVObj *obj = lookup_kvobj(cmds[1]);
+	if(!obj) {
+		reply(out, RES_NX, "[NULL] No object with key {}", cmds[1]);
+		return;
+	}
+
+	if(ttl <= 0) {
+		reply(out, RES_OK, "[EXPIRE] Key: {} Expired", obj->get_key());
+		drop_kvobj(obj);
+	} else {
+		tw_add(&db.expires, obj->ttl_hook(), utils::mono_ms() + ttl);
+		bump_version(obj);
+		reply(out, RES_OK, "[EXPIRE] Key: {} TTL(ms): {}", obj->get_key(), ttl);
+	}
+}
+// ttl/pttl key: -2 if the key doesn't exist, -1 if it has no deadline
+void do_ttl(vector<sview> &cmds, Response &out) {
+	KVObj *obj = lookup_kvobj(cmds[1]);
+
+	if(!obj) {
+		reply(out, RES_NX, "[TTL] -2");
+		return;
+	}
+
+	int64_t remaining = -1;
+	if(obj->has_ttl()) {
+		remaining = (int64_t)(obj->expire_at() - utils::mono_ms());
+		if(cmds[0] == "ttl")
+			remaining = (remaining + 500) / 1000;
+	}
+
+	reply(out, RES_OK, "[TTL] Key: {} {}", obj->get_key(), remaining);
+}
+void do_persist(vector<sview> &cmds, Response &out) {
+	KVObj *obj = lookup_kvobj(cmds[1]);
+
+	if(!obj) {
+		reply(out, RES_NX, "[NULL] No object with key {}", cmds[1]);
+		return;
+	}
+
+	const bool had_ttl = obj->has_ttl();
+	tw_del(&db.expires, obj->ttl_hook());
+	if(had_ttl)
+		bump_version(obj);
+
+	reply(out, RES_OK, "[PERSIST] Key: {} Removed: {}", obj->get_key(), (int)had_ttl);
+}
+//---------------------------------------------------------------------------------------
+// Transaction functions, a transaction runs inside one exec so no other client interleaves
+//---------------------------------------------------------------------------------------
+namespace {
+	MultiState *txn_state(Conn *conn) {
+		if(!conn->multi)
+			conn->multi = std::make_unique<MultiState>();
+		return conn->multi.get();
+	}
+	// watched_version: what watch and exec compare, an expired key counts as missing
+	uint64_t watched_version(sview key, uint64_t now_ms) {
+		const KVObj *obj = find_kvobj(key);
+		return obj && !obj->expired(now_ms) ? obj->version() : 0;
+	}
+	void txn_error(sview msg, Response &out) {
+		out.data.assign(msg.begin(), msg.end());
+		out.status = RES_ERR;
+	}
+}
+// multi
+void do_multi(vector<sview> &cmds, Response &out) {
+	if(!cur_client)
+		return txn_error("[ERROR: TXN] No client to run a transaction for", out);
+
+	MultiState *txn = txn_state(cur_client);
+	if(txn->active)
+		return txn_error("[ERROR: TXN] multi calls can not be nested", out);
+
+	txn->active = true;
+	reply(out, RES_OK, "[MULTI] OK");
+}
+// exec, every queued reply comes back in this one, each as '<i>) status <s> bytes <n>' and its n bytes
+void do_exec(vector<sview> &cmds, Response &out) {
+	MultiState *txn = cur_client ? cur_client->multi.get() : nullptr;
+	if(!txn || !txn->active)
+		return txn_error("[ERROR: TXN] exec without multi", out);
+
+	std::string res;
+	const uint64_t now = utils::mono_ms();
+	const bool changed = std::any_of(txn->watched.begin(), txn->watched.end(),
+			[now](const auto &w) { return watched_version(w.first, now) != w.second; });
+
+	if(!txn->dirty && !changed && !from_primary() && !cur_client->cluster_import && txn_held(txn))
+		return loan_park(cur_client, out);
+
+	if(txn->dirty) {
+		res = "[ERROR: EXECABORT] Transaction discarded because of previous errors";
+		out.status = RES_ERR;
+	} else if(changed) {
+		res = "[NULL] Transaction aborted, a watched key changed";
+		out.status = RES_NX;
+	} else {
+		txn->active = false; // the queued commands run for real below
+		res = fmt("[EXEC] Replies: {}\n", txn->argc.size());
+
+		vector<sview> args;
+		Response reply;
+		size_t next_arg = 0;
+		repl.in_exec = true;
+		for(size_t i = 0; i < txn->argc.size(); i++) {
+			args.clear();
+			for(uint32_t a = 0; a < txn->argc[i]; a++, next_arg++) {
+				const auto [off, len] = txn->args[next_arg];
+				args.emplace_back(txn->arena.data() + off, len);
+			}
+
+			reply.status = RES_OK;
+			reply.data.clear();
+			do_request(args, reply);
+
+			res.append(fmt("{}) status {} bytes {}\n", i, reply.status, reply.data.size()));
+			res.append((const char *)reply.data.data(), reply.data.size()).append("\n");
+		}
+		repl.in_exec = false;
+		if(repl.exec_open) {
+			repl.exec_open = false;
+			const sview exec[] = { "exec" };
+			propagate(exec);
+		}
+		out.status = RES_OK;
+	}
+
+	txn->clear_queue();
+	txn->watched.clear();
+	out.data.assign(res.begin(), res.end());
+}
+// discard
+void do_discard(vector<sview> &cmds, Response &out) {
+	MultiState *txn = cur_client ? cur_client->multi.get() : nullptr;
+	if(!txn || !txn->active)
+		return txn_error("[ERROR: TXN] discard without multi", out);
+
+	txn->clear_queue();
+	txn->watched.clear();
+
+	reply(out, RES_OK, "[DISCARD] OK");
+}
+// watch key [key ...], exec aborts if any of them is written, deleted or created before it runs
+void do_watch(vector<sview> &cmds, Response &out) {
+	if(!cur_client)
+		return txn_error("[ERROR: TXN] No client to watch keys for", out);
+
+	MultiState *txn = txn_state(cur_client);
+	if(txn->active)
+		return txn_error("[ERROR: TXN] watch inside multi is not allowed", out);
+
+	const uint64_t now = utils::mono_ms();
+	for(size_t i = 1; i < cmds.size(); i++)
+		txn->watched.emplace_back(std::string(cmds[i]), watched_version(cmds[i], now));
+
+	reply(out, RES_OK, "[WATCH] Keys: {}", txn->watched.size());
+}
+// unwatch
+void do_unwatch(vector<sview> &cmds, Response &out) {
+	if(cur_client && cur_client->multi)
+		cur_client->multi->watched.clear();
+
+	reply(out, RES_OK, "[UNWATCH] OK");
+}
+//---------------------------------------------------------------------------------------
+// Pub/sub functions
+//---------------------------------------------------------------------------------------
+static PubSub pubsub;
+
+static void drop_client(Conn *conn) {
+	ps_unsubscribe_all(&pubsub, conn, false);
+	ps_unsubscribe_all(&pubsub, conn, true);
+
+	for(AggJob *job : agg_jobs) { // its result is still stored, nobody gets the reply
+		if(job->client == conn)
+			job->client = nullptr;
+	}
+	if(conn->loan_wait)
+		std::erase(loan_waits, conn);
+	if(conn->bwait) {
+		bk_unblock(&blocking, conn->bwait);
+		conn->bwait = nullptr;
+	}
+
+	if(conn == repl.link) {
+		std::println("[WARN] replication: lost the link to {}:{}, offset {}", repl.host, repl.port, repl.backlog.offset);
+		repl.link = nullptr;
+		repl.link_state = LINK_NONE;
+		repl.retry_ms = utils::mono_ms() + 1000;
+	}
+	cluster_drop(conn);
+	if(conn->scrape) {
+		std::erase(scrapes, conn);
+		delete conn->scrape;
+		conn->scrape = nullptr;
+	}
+	if(ReplPeer *peer = conn->peer) {
+		if(peer->child > 0)
+			kill(peer->child, SIGKILL); // reaped by repl_cron
+		std::erase(repl.replicas, conn);
+		delete peer;
+		conn->peer = nullptr;
+	}
+}
+
+namespace {
+	// publish_frame: a reply frame like make_response builds, in a buffer every receiver shares
+	SharedBuf *publish_frame(sview text) {
+		const uint32_t rlen = 4 + (uint32_t)text.size();
+		const uint32_t status = RES_OK;
+
+		SharedBuf *sb = sb_make(sizeof(rlen) + rlen);
+		byte *out = sb->data();
+		memcpy(out, &rlen, sizeof(rlen));
+		memcpy(out + sizeof(rlen), &status, sizeof(status));
+		memcpy(out + sizeof(rlen) + sizeof(status), text.data(), text.size());
+		return sb;
+	}
+	// deliver: queues 'msg' on a subscriber, a subscriber over its output limits is disconnected instead
+	bool deliver(Conn *conn, SharedBuf *msg) {
+		if((bool)(conn->state & ConnState::CLOSED))
+			return false;
+
+		conn->ot_share(msg);
+		if(enforce_output_limits(conn, utils::mono_ms()))
+			return false;
+
+		conn->state &= ~ConnState::RECVING;
+		conn->state |=  ConnState::SENDING;
+		return true;
+	}
+}
+// subscribe channel [channel ...] / psubscribe pattern [pattern ...]
+void do_subscribe(vector<sview> &cmds, Response &out) {
+	std::string res;
+	if(!cur_client) {
+		reply(out, RES_ERR, "[ERROR: PUBSUB] No client to subscribe");
+		return;
+	}
+
+	const bool pattern = cmds[0] == "psubscribe";
+	res = pattern ? "[PSUBSCRIBE]\n" : "[SUBSCRIBE]\n";
+	for(size_t i = 1; i < cmds.size(); i++) {
+		ps_subscribe(&pubsub, cur_client, cmds[i], pattern);
+		res.append(fmt("{}: {} Subscriptions: {}\n", pattern ? "Pattern" : "Channel", cmds[i],
+				cur_client->nchannels + cur_client->npatterns));
+	}
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+// unsubscribe [channel ...] / punsubscribe [pattern ...], all of them without arguments
+void do_unsubscribe(vector<sview> &cmds, Response &out) {
+	std::string res;
+	if(!cur_client) {
+		reply(out, RES_ERR, "[ERROR: PUBSUB] No client to unsubscribe");
+		return;
+	}
+
+	const bool pattern = cmds[0] == "punsubscribe";
+	std::vector<std::string> names;
+	if(cmds.size() == 1) {
+		ps_unsubscribe_all(&pubsub, cur_client, pattern, &names);
+	} else {
+		for(size_t i = 1; i < cmds.size(); i++) {
+			ps_unsubscribe(&pubsub, cur_client, cmds[i], pattern);
+			names.emplace_back(cmds[i]);
+		}
+	}
+
+	res = pattern ? "[PUNSUBSCRIBE]\n" : "[UNSUBSCRIBE]\n";
+	for(const std::string &name : names)
+		res.append(fmt("{}: {}\n", pattern ? "Pattern" : "Channel", name));
+	res.append(fmt("Subscriptions: {}\n", cur_client->nchannels + cur_client->npatterns));
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+// publish channel message, encoded once per channel or matching pattern and shared by all of its subscribers
+void do_publish(vector<sview> &cmds, Response &out) {
+	const sview channel = cmds[1], msg = cmds[2];
+	size_t receivers = 0;
+
+	ps_match(&pubsub, channel, [&](PsTarget *t) {
+		SharedBuf *sb = publish_frame(t->pattern ?
+				fmt("[PMESSAGE] Pattern: {} Channel: {} Msg: {}", t->name, channel, msg) :
+				fmt("[MESSAGE] Channel: {} Msg: {}", channel, msg));
+
+		for(PsSub *sub = t->subs; sub; sub = sub->next)
+			receivers += deliver(sub->conn, sb);
+		sb_unref(sb);
+	});
+
+	reply(out, RES_OK, "[PUBLISH] Receivers: {}", receivers);
+}
+//---------------------------------------------------------------------------------------
+// Replication, a primary streams its writes to replicas as request frames: every write command that
+// didn't fail, plus a del for each key it expires or evicts. A new replica first loads a snapshot
+// written by a forked child straight to its socket, a returning one resumes from the backlog
+//---------------------------------------------------------------------------------------
+namespace {
+	constexpr size_t REPL_FRAME_MAX = 64 << 20; // sanity bound on a frame from the primary
+
+	// queue_frame: a request frame in a connection's private output
+	void queue_frame(Conn *conn, std::span<const sview> args) {
+		const size_t len = rp_frame_len(args);
+		rp_encode(conn->ot_reserve(len), args);
+		conn->ot_end += len;
+	}
+	// reply_frame: the reply make_response would build for 'text', appended to 'out'
+	void reply_frame(std::string &out, uint32_t status, sview text) {
+		const uint32_t rlen = sizeof(status) + (uint32_t)text.size();
+		out.append((const char *)&rlen, sizeof(rlen));
+		out.append((const char *)&status, sizeof(status));
+		out.append(text);
+	}
+}
+
+static void propagate(std::span<const sview> args) {
+	if(repl.role != ROLE_PRIMARY || repl.backlog.buf.empty()) // no replica ever attached
+		return;
+	if(repl.in_exec && !repl.exec_open) { // an exec's writes reach the replicas as one transaction too
+		repl.exec_open = true;
+		const sview multi[] = { "multi" };
+		propagate(multi);
+	}
+
+	const size_t len = rp_frame_len(args);
+	SharedBuf *frame = sb_make(len);
+	rp_encode(frame->data(), args);
+	rbl_feed(&repl.backlog, frame->data(), len);
+
+	const uint64_t now = repl.replicas.empty() ? 0 : utils::mono_ms();
+	for(Conn *conn : repl.replicas) {
+		if((bool)(conn->state & ConnState::CLOSED))
+			continue;
+
+		conn->ot_share(frame);
+		if(enforce_output_limits(conn, now))
+			continue;
+		if(conn->peer->state == PEER_ONLINE)
+			conn->state |= ConnState::SENDING;
+	}
+	sb_unref(frame);
+}
+
+// propagate_command: a write as the replicas get it. Relative ttls are sent as the deadline they set here, so a
+// replica that applies them late (from a snapshot, a backlog replay or a lagging link) expires the key with us
+static void propagate_command(std::span<const sview> cmd) {
+	const bool expire = cmd[0] == "expire" || cmd[0] == "pexpire";
+	const bool set_ttl = cmd[0] == "set" && cmd.size() == 5 && cmd[3] != "pxat";
+	if((!expire && !set_ttl) || repl.role != ROLE_PRIMARY || repl.backlog.buf.empty())
+		return propagate(cmd);
+
+	const KVObj *obj = find_kvobj(cmd[1]);
+	if(!obj || !obj->has_ttl()) { // a ttl that wasn't positive deleted it, or there was no key
+		const sview del[] = { "del", cmd[1] };
+		return propagate(del);
+	}
+
+	const std::string at = std::to_string(unix_deadline(obj->expire_at()));
+	if(set_ttl) {
+		const sview set[] = { "set", cmd[1], cmd[2], "pxat", at };
+		propagate(set);
+	} else {
+		const sview pexpireat[] = { "pexpireat", cmd[1], at };
+		propagate(pexpireat);
+	}
+}
+
+namespace {
+	// write_all: the whole buffer to a non blocking socket, waiting out EAGAIN up to 'timeout_ms' at a time
+	bool write_all(socket_t fd, const char *data, size_t len, int timeout_ms = -1) {
+		while(len > 0) {
+			const ssize_t n = write(fd, data, len);
+			if(n < 0) {
+				if(errno == EINTR)
+					continue;
+				if(errno != EAGAIN)
+					return false;
+
+				pollfd pfd{ fd, POLLOUT, 0 };
+				if(poll(&pfd, 1, timeout_ms) == 0)
+					return false;
+				continue;
+			}
+			data += n;
+			len  -= (size_t)n;
+		}
+		return true;
+	}
+	// Frames rebuilding a collection hold up to a few hundred members, fewer when they would pass MAX_FRAME: a
+	// migration's go through a node's client path, which takes nothing bigger
+	constexpr size_t FRAME_MEMBERS = 256;
+	constexpr size_t frame_arg(size_t size) { return sizeof(uint32_t) + size; } // its share of rp_frame_len
+
+	// tadd_frames: the tadd commands rebuilding a tset, handed to 'emit'. Returns how many
+	size_t tadd_frames(sview key, const TSet *tset, const std::function<void(std::span<const sview>)> &emit) {
+		std::vector<std::string> scores;
+		std::vector<sview> args = { "tadd", key };
+		const size_t base = rp_frame_len(args) - sizeof(uint32_t);
+		size_t len = base, frames = 0;
+
+		auto flush = [&]() {
+			for(size_t i = 0; i < scores.size(); i++)
+				args[3 + i * 2] = scores[i];
+			emit(args);
+			scores.clear();
+			args.resize(2);
+			len = base;
+			frames++;
+		};
+
+		size_t cursor = 0;
+		do {
+			cursor = ihs_scan(&tset->mts_mp, cursor, [&](iHNode *node) {
+				const TSTNode *member = utils::container_of(node, &TSTNode::mpnode);
+				char num[32];
+				const auto [end, ec] = std::to_chars(num, num + sizeof(num), member->tnode.key); // shortest round trip
+
+				const size_t add = frame_arg(member->name.size()) + frame_arg(end - num);
+				if(!scores.empty() && len + add > MAX_FRAME)
+					flush();
+				scores.emplace_back(num, end);
+				args.push_back(member->name);
+				args.push_back({}); // the score, pointed at once 'scores' stops moving
+				len += add;
+				if(scores.size() == FRAME_MEMBERS)
+					flush();
+			});
+		} while(cursor != 0);
+
+		if(!scores.empty())
+			flush();
+		return frames;
+	}
+	// hset_frames: the hset commands rebuilding a hash, handed to 'emit'. Returns how many
+	size_t hset_frames(sview key, const Hash *hash, const std::function<void(std::span<const sview>)> &emit) {
+		std::vector<sview> args = { "hset", key };
+		const size_t base = rp_frame_len(args) - sizeof(uint32_t);
+		size_t len = base, frames = 0;
+
+		auto flush = [&]() {
+			emit(args);
+			args.resize(2);
+			len = base;
+			frames++;
+		};
+
+		size_t cursor = 0;
+		do {
+			cursor = ihs_scan(&hash->table, cursor, [&](iHNode *node) {
+				const iHMPair *pair = utils::container_of(node, &iHMPair::node);
+				const size_t add = frame_arg(pair->key.size()) + frame_arg(pair->val.size());
+				if(args.size() > 2 && len + add > MAX_FRAME)
+					flush();
+				args.push_back(pair->key);
+				args.push_back(pair->val);
+				len += add;
+				if(args.size() == 2 + FRAME_MEMBERS * 2)
+					flush();
+			});
+		} while(cursor != 0);
+
+		if(args.size() > 2) {
+			emit(args);
+			frames++;
+		}
+		return frames;
+	}
+	// encode_kvobj: the commands that rebuild 'obj', appended to 'buf'. Returns how many
+	size_t encode_kvobj(std::string &buf, const KVObj *obj) {
+		const sview key = obj->get_key();
+		size_t frames = 0;
+		if(obj->type() == KVTYPE::STRING) {
+			const sview set[] = { "set", key, (const String&)obj->val() };
+			rp_encode(buf, set);
+			frames++;
+		} else if(obj->type() == KVTYPE::TSET) {
+			frames += tadd_frames(key, (const TSet *)obj->val_p(), [&buf](std::span<const sview> args) { rp_encode(buf, args); });
+		} else if(obj->type() == KVTYPE::HASH) {
+			frames += hset_frames(key, (const Hash *)obj->val_p(), [&buf](std::span<const sview> args) { rp_encode(buf, args); });
+		}
+
+		if(obj->has_ttl()) { // absolute, the receiver may apply it long after this
+			const std::string at = std::to_string(unix_deadline(obj->expire_at()));
+			const sview pexpireat[] = { "pexpireat", key, at };
+			rp_encode(buf, pexpireat);
+			frames++;
+		}
+		return frames;
+	}
+	// snapshot_child: runs in the forked child of a full resync. Streams the dataset as it was at the fork
+	// to the replica on 'conn': a reply naming the history and offset, the commands that rebuild every key,
+	// then a 'replconf snapshot-end' marker. Returns the child's exit status
+	int snapshot_child(Conn *conn, uint64_t offset) {
+		const socket_t fd = conn->get_socket();
+		for(Conn *other : connections) { // clients leaving meanwhile aren't held open by the child
+			if(other && other != conn)
+				close(other->get_socket());
+		}
+
+		std::string buf;
+		reply_frame(buf, RES_OK, fmt("[FULLRESYNC] {} {}", repl.replid, offset));
+
+		const uint64_t now = utils::mono_ms();
+		for(size_t i = 0; i < db.data_idx; i++) {
+			const KVObj *obj = &db.data[i];
+			if(obj->type() == KVTYPE::INIT || obj->expired(now))
+				continue;
+
+			encode_kvobj(buf, obj);
+			if(buf.size() >= 64 * 1024) {
+				if(!write_all(fd, buf.data(), buf.size()))
+					return 1;
+				buf.clear();
+			}
+		}
+
+		const sview end[] = { "replconf", "snapshot-end" };
+		rp_encode(buf, end);
+		return write_all(fd, buf.data(), buf.size()) ? 0 : 1;
+	}
+}
+
+// repl_cron: reaps snapshot children, a replica (re)connects to its primary and acks its offset every second.
+// Returns whether it needs to run again soon
+static bool repl_cron(uint64_t now_ms) {
+	int status;
+	for(pid_t pid; (pid = waitpid(-1, &status, WNOHANG)) > 0;) {
+		for(Conn *conn : repl.replicas) {
+			ReplPeer *peer = conn->peer;
+			if(peer->child != pid)
+				continue;
+
+			peer->child = -1;
+			if(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+				std::println("[REPL] snapshot sent to replica fd {}, streaming {} queued bytes",
+						conn->get_socket(), conn->ot_pending());
+				peer->state = PEER_ONLINE;
+				if(conn->ot_pending() > 0)
+					conn->state |= ConnState::SENDING;
+			} else {
+				std::println("[WARN] replication: snapshot for replica fd {} failed", conn->get_socket());
+				conn->state = ConnState::CLOSED | ConnState::ERR;
+			}
+		}
+	}
+
+	bool pending = std::any_of(repl.replicas.begin(), repl.replicas.end(),
+			[](const Conn *conn) { return conn->peer->state == PEER_SNAPSHOT; });
+	if(repl.role != ROLE_REPLICA)
+		return pending;
+
+	if(!repl.link && now_ms >= repl.retry_ms) {
+		Conn *conn = Connect(repl.port, repl.host);
+		if(!conn) {
+			std::println("[WARN] replication: can't connect to {}:{}: {}", repl.host, repl.port, strerror(errno));
+			repl.retry_ms = now_ms + 1000;
+			return true;
+		}
+
+		const socket_t fd = conn->get_socket();
+		if(connections.size() <= (size_t)fd)
+			connections.resize(fd + 1);
+		connections[fd] = conn;
+		conn->created_ms = conn->last_cmd_ms = now_ms;
+		conn->state |= ConnState::RECVING;
+
+		// this server's own history and offset, the primary continues it if it's a prefix of its own
+		const std::string off = std::to_string(repl.backlog.offset);
+		const sview psync[] = { "psync", repl.replid, off };
+		queue_frame(conn, psync);
+
+		repl.link = conn;
+		repl.link_state = LINK_HANDSHAKE;
+	} else if(repl.link && repl.link_state == LINK_STREAMING && now_ms - repl.ack_ms >= 1000) {
+		const std::string off = std::to_string(repl.backlog.offset);
+		const sview ack[] = { "replconf", "ack", off };
+		queue_frame(repl.link, ack);
+
+		repl.link->state |= ConnState::SENDING;
+		repl.ack_ms = now_ms;
+	}
+
+	return true;
+}
+
+namespace {
+	// link_handshake: the primary's answer to psync, false if the link has to go
+	bool link_handshake(uint32_t status, sview text) {
+		// "[FULLRESYNC] <replid> <offset>" or "[CONTINUE] <replid> <offset>"
+		const size_t sp1 = text.find(' '), sp2 = text.rfind(' ');
+		uint64_t offset = 0;
+		const sview tag = text.substr(0, sp1);
+		if(status != RES_OK || sp1 == sview::npos || sp1 == sp2 ||
+				std::from_chars(text.data() + sp2 + 1, text.data() + text.size(), offset).ec != std::errc{}) {
+			std::println("[WARN] replication: primary refused psync: {}", text);
+			return false;
+		}
+
+		const sview replid = text.substr(sp1 + 1, sp2 - sp1 - 1);
+		if(tag == "[FULLRESYNC]") {
+			const size_t flushed = flush_dataset(true);
+			std::println("[REPL] full resync from {}:{} at offset {}, dropped {} keys", repl.host, repl.port, offset, flushed);
+
+			repl.replid = replid;
+			if(repl.backlog.buf.empty())
+				rbl_resize(&repl.backlog, srv_cfg.repl_backlog_size);
+			rbl_reset(&repl.backlog, offset);
+			repl.link_state = LINK_LOADING;
+		} else if(tag == "[CONTINUE]" && replid == repl.replid && offset == repl.backlog.offset) {
+			std::println("[REPL] partial resync from {}:{} at offset {}", repl.host, repl.port, offset);
+			repl.link_state = LINK_STREAMING;
+		} else {
+			std::println("[WARN] replication: unexpected psync answer: {}", text);
+			return false;
+		}
+
+		return true;
+	}
+}
+
+// link_input: applies every complete frame the primary sent, no replies go back. Frames of the stream
+// are fed to this server's own backlog as they're applied, so its offset is the primary's
+static void link_input(Conn *conn) {
+	while(!(bool)(conn->state & ConnState::CLOSED) && conn->in_size() >= 4) {
+		uint32_t len = 0;
+		memcpy(&len, conn->in_data(), sizeof(len));
+		if(len > REPL_FRAME_MAX) {
+			std::println("[WARN] replication: {} byte frame from the primary", len);
+			conn->state = ConnState::CLOSED | ConnState::ERR;
+			return;
+		}
+		if(len + sizeof(len) > (size_t)conn->in_size())
+			return;
+
+		const byte *frame = conn->in_data() + sizeof(len);
+		if(repl.link_state == LINK_HANDSHAKE) {
+			uint32_t status = RES_ERR;
+			if(len >= sizeof(status))
+				memcpy(&status, frame, sizeof(status));
+			const sview text((const char *)frame + sizeof(status), len >= sizeof(status) ? len - sizeof(status) : 0);
+
+			if(!link_handshake(status, text)) {
+				conn->state = ConnState::CLOSED | ConnState::ERR;
+				return;
+			}
+		} else {
+			req_args.clear();
+			if(parse_req(frame, len, req_args) < 0) {
+				std::println("[WARN] replication: bad frame from the primary");
+				conn->state = ConnState::CLOSED | ConnState::ERR;
+				return;
+			}
+
+			if(repl.link_state == LINK_LOADING && req_args.size() == 2 &&
+					req_args[0] == "replconf" && req_args[1] == "snapshot-end") {
+				std::println("[REPL] snapshot loaded, {} keys", db.data_idx - db.free_slots.size());
+				repl.link_state = LINK_STREAMING;
+			} else {
+				req_res.status = RES_OK;
+				req_res.data.clear();
+
+				cur_client = conn;
+				do_request(req_args, req_res);
+				cur_client = nullptr;
+				conn->ncmds++;
+
+				if(repl.link_state == LINK_STREAMING)
+					rbl_feed(&repl.backlog, conn->in_data(), sizeof(len) + len);
+			}
+		}
+
+		conn->in_start += sizeof(len) + len;
+		conn->last_cmd_ms = utils::mono_ms();
+	}
+}
+
+// psync replid offset, sent by a replica. Continues from 'offset' if it's in the backlog of the same history,
+// otherwise a forked child streams the replica a snapshot and the stream follows from where it was taken
+void do_psync(vector<sview> &cmds, Response &out) {
+	std::string res;
+	if(!cur_client || cur_client->peer || repl.role != ROLE_PRIMARY) {
+		reply(out, RES_ERR, "[ERROR: REPL] psync is for replicas connecting to a primary");
+		return;
+	}
+
+	if(repl.backlog.buf.empty()) // first replica, the stream starts here
+		rbl_resize(&repl.backlog, srv_cfg.repl_backlog_size);
+
+	Conn *conn = cur_client;
+	uint64_t off = 0;
+	const auto [end, ec] = std::from_chars(cmds[2].data(), cmds[2].data() + cmds[2].size(), off);
+	const bool partial = cmds[1] == repl.replid && ec == std::errc{} &&
+	                     end == cmds[2].data() + cmds[2].size() && rbl_has(&repl.backlog, off);
+
+	ReplPeer *peer = new ReplPeer;
+	if(partial) {
+		Response head;
+		res = fmt("[CONTINUE] {} {}", repl.replid, off);
+		head.data.assign(res.begin(), res.end());
+		make_response(head, conn);
+
+		const size_t n = (size_t)(repl.backlog.offset - off);
+		rbl_copy(&repl.backlog, off, conn->ot_reserve(n));
+		conn->ot_end += n;
+
+		peer->state = PEER_ONLINE;
+		peer->sync_off = off;
+	} else {
+		peer->sync_off = repl.backlog.offset;
+		peer->child = fork();
+		if(peer->child == 0)
+			_exit(snapshot_child(conn, peer->sync_off));
+
+		if(peer->child < 0) {
+			delete peer;
+			reply(out, RES_ERR, "[ERROR: REPL] Can't fork the snapshot: {}", strerror(errno));
+			return;
+		}
+	}
+
+	peer->ack_off = peer->sync_off;
+	peer->ack_ms = utils::mono_ms();
+	conn->peer = peer;
+	repl.replicas.push_back(conn);
+	std::println("[REPL] replica fd {} attached, {} resync at offset {}", conn->get_socket(),
+			partial ? "partial" : "full", peer->sync_off);
+
+	out.status = RES_NOREPLY; // the answer is already queued, or the child sends it
+}
+// replconf ack offset, a replica reporting how much of the stream it has applied. No reply
+void do_replconf(vector<sview> &cmds, Response &out) {
+	uint64_t off = 0;
+	if(cmds.size() == 3 && cmds[1] == "ack" && cur_client && cur_client->peer &&
+			std::from_chars(cmds[2].data(), cmds[2].data() + cmds[2].size(), off).ec == std::errc{}) {
+		cur_client->peer->ack_off = off;
+		cur_client->peer->ack_ms = utils::mono_ms();
+		out.status = RES_NOREPLY;
+		return;
+	}
+
+	reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'replconf ack <offset>' from a replica");
+}
+// replicaof host port / replicaof no one
+void do_replicaof(vector<sview> &cmds, Response &out) {
+	auto drop_link = []() {
+		if(repl.link)
+			repl.link->state = ConnState::CLOSED; // main_loop deletes it
+		repl.link = nullptr;
+		repl.link_state = LINK_NONE;
+	};
+
+	if(cmds[1] == "no" && cmds[2] == "one") {
+		if(repl.role == ROLE_REPLICA) {
+			drop_link();
+			repl.role = ROLE_PRIMARY;
+			repl.replid = rp_make_replid(); // a new history, the data and the offset carry on
+			std::println("[REPL] promoted to primary, offset {}", repl.backlog.offset);
+		}
+		reply(out, RES_OK, "[REPLICAOF] Primary, replid {} offset {}", repl.replid, repl.backlog.offset);
+		return;
+	}
+
+	const std::string host = cmds[1] == "localhost" ? "127.0.0.1" : std::string(cmds[1]);
+	in_addr addr;
+	uint16_t port = 0;
+	const auto [end, ec] = std::from_chars(cmds[2].data(), cmds[2].data() + cmds[2].size(), port);
+	if(inet_pton(AF_INET, host.c_str(), &addr) != 1 || ec != std::errc{} || end != cmds[2].data() + cmds[2].size() || !port) {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'replicaof <ipv4 address> <port>' or 'replicaof no one'");
+		return;
+	}
+
+	drop_link();
+	for(Conn *conn : repl.replicas) // no chained replication, replicas of this server have to go
+		conn->state = ConnState::CLOSED | ConnState::ERR;
+
+	repl.role = ROLE_REPLICA;
+	repl.host = host;
+	repl.port = port;
+	repl.retry_ms = 0; // connects on the next cycle
+
+	reply(out, RES_OK, "[REPLICAOF] Replicating {}:{}", host, port);
+}
+// role
+void do_role(vector<sview> &cmds, Response &out) {
+	std::string res;
+
+	if(repl.role == ROLE_PRIMARY) {
+		res = fmt("[ROLE] primary replid {} offset {} backlog {} of {}\n", repl.replid, repl.backlog.offset,
+				repl.backlog.histlen, repl.backlog.buf.size());
+		for(const Conn *conn : repl.replicas) {
+			const ReplPeer *peer = conn->peer;
+			res.append(fmt("replica fd={} state={} sync-offset={} ack-offset={} lag={}\n", conn->get_socket(),
+					peer->state == PEER_ONLINE ? "online" : "snapshot", peer->sync_off, peer->ack_off,
+					repl.backlog.offset - std::min(peer->ack_off, repl.backlog.offset)));
+		}
+	} else {
+		constexpr sview link_names[] = { "down", "handshake", "loading", "streaming" }; // indexed by LinkState
+		res = fmt("[ROLE] replica of {}:{} link {} replid {} offset {}\n", repl.host, repl.port,
+				link_names[repl.link_state], repl.replid, repl.backlog.offset);
+	}
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+//---------------------------------------------------------------------------------------
+// Cluster, the keyspace split in hash slots over several processes that each hold the whole slot map,
+// see cluster.h. A slot moves between nodes with 'cluster migrate', driven by its current owner
+//---------------------------------------------------------------------------------------
+// Running migration, source side. A batch of the range's keys goes to the target as the commands that
+// rebuild them, and once the target applied it the keys are deleted here, the next batch goes out the
+// cycle after. The link is a connection like any other, main_loop polls it and cluster_link_input takes
+// the target's replies. Meanwhile the range is MIGRATING here and IMPORTING there, keys not found here
+// are asked for at the target
+enum MigPhase : uint8_t {
+	MIG_IMPORT,   // 'cluster import' sent, the target has to accept the range first
+	MIG_IDLE,     // nothing in flight, cluster_cron sends the next batch
+	MIG_BATCH,    // a batch in flight
+	MIG_SETSLOTS  // every key moved, 'cluster setslots' sent
+};
+static struct {
+	Conn *link = nullptr;   // to the target, null while no migration runs
+	Conn *client = nullptr; // sent 'cluster migrate', answered once the target accepts the import
+	MigPhase phase = MIG_IMPORT;
+	uint16_t node = 0;      // the target
+	uint16_t first = 0, last = 0; // slot range
+	size_t cursor = 0;      // keyspace scan
+	uint64_t moved = 0;     // keys sent and deleted here so far
+	uint64_t start_ms = 0;
+
+	uint64_t sent_ms = 0;   // when what's in flight went out
+	size_t awaiting = 0;    // replies still due for it
+	size_t failed = 0;      // of those, errors
+	std::vector<std::pair<std::string, uint64_t>> sent; // the batch in flight, key and version when encoded
+	std::vector<std::string> gone; // keys of a batch deleted here before it was applied, the target's copy goes next
+} migration;
+
+namespace {
+	constexpr int CLUSTER_REPLY_TIMEOUT_MS = 5000; // for the replies to what a link sent
+	constexpr size_t CLUSTER_FRAME_MAX = 64 << 20; // sanity bound on a reply from another node
+
+	// cluster_dial: a connection to 'node' that main_loop polls, its input goes to cluster_link_input.
+	// Null if it failed straight away, a connect that fails later shows up as an error on the socket
+	Conn *cluster_dial(uint16_t node, uint64_t now_ms) {
+		const ClusterNode &to = cluster.nodes[node];
+		Conn *conn = Connect(to.port, to.host);
+		if(!conn)
+			return nullptr;
+
+		const socket_t fd = conn->get_socket();
+		if(connections.size() <= (size_t)fd)
+			connections.resize(fd + 1);
+		connections[fd] = conn;
+		conn->created_ms = conn->last_cmd_ms = now_ms;
+		conn->state |= ConnState::RECVING;
+		conn->cluster_link = node;
+		return conn;
+	}
+	// broadcast: one command to every node known here but 'skip', best effort. Nobody waits on the replies,
+	// each link is closed once its reply arrived
+	void broadcast(std::span<const sview> args, uint16_t skip, uint64_t now_ms) {
+		for(uint16_t i = 1; i < cluster.nodes.size(); i++) {
+			if(i == skip)
+				continue;
+
+			Conn *conn = cluster_dial(i, now_ms);
+			if(!conn) {
+				std::println("[WARN] cluster: couldn't update {}", cl_addr(&cluster, i));
+				continue;
+			}
+			queue_frame(conn, args);
+		}
+	}
+	// migration_answer: the reply to 'cluster migrate', its client's pipelined requests run after it
+	void migration_answer(uint32_t status, sview text) {
+		Conn *conn = migration.client;
+		if(!conn)
+			return;
+		migration.client = nullptr;
+
+		Response reply;
+		reply.status = status;
+		reply.data.assign(text.begin(), text.end());
+		make_response(reply, conn);
+		conn->blocked = false;
+		process_input(conn);
+	}
+	// migration_stop: drops the link. A failed migration leaves the range MIGRATING, keys that already
+	// moved stay reachable through ASK until 'cluster migrate' runs again and finishes the job
+	void migration_stop(const char *why) {
+		if(why)
+			std::println("[WARN] cluster: migration of slots {}-{} to {} stopped after {} keys: {}", migration.first,
+					migration.last, cl_addr(&cluster, migration.node), migration.moved, why);
+		migration.link->state = ConnState::CLOSED | ConnState::ERR;
+		migration.link = nullptr;
+		migration.sent.clear();
+		migration.gone.clear();
+
+		if(migration.phase == MIG_IMPORT) // last, its client's next request may be another migrate
+			migration_answer(RES_ERR, fmt("[ERROR: CLUSTER] Migration to {} failed: {}",
+					cl_addr(&cluster, migration.node), why ? why : "stopped"));
+	}
+	// migration_applied: the target applied the batch in flight. Its keys go here, unless they were written
+	// since they were encoded, then the next pass sends them again
+	void migration_applied() {
+		for(const auto &[key, version] : migration.sent) {
+			KVObj *obj = find_kvobj(key);
+			if(!obj) {
+				migration.gone.push_back(key);
+				continue;
+			}
+			if(obj->version() != version)
+				continue;
+
+			const sview del[] = { "del", key };
+			propagate(del);
+			drop_kvobj(obj);
+			migration.moved++;
+		}
+		migration.sent.clear();
+	}
+	// migration_finished: the target took the slots over, everyone else learns the new owner
+	void migration_finished(uint64_t now_ms) {
+		const ClusterNode &to = cluster.nodes[migration.node];
+		const std::string first = std::to_string(migration.first), last = std::to_string(migration.last);
+		const std::string port = std::to_string(to.port);
+		const sview setslots[] = { "cluster", "setslots", first, last, to.host, port };
+
+		for(size_t slot = migration.first; slot <= migration.last; slot++) {
+			cluster.owner[slot] = migration.node;
+			cluster.state[slot] = SLOT_STABLE;
+			cluster.peer[slot]  = CL_NO_NODE;
+		}
+		std::println("[CLUSTER] slots {}-{} migrated to {}: {} keys in {} ms", migration.first, migration.last,
+				cl_addr(&cluster, migration.node), migration.moved, now_ms - migration.start_ms);
+
+		migration_stop(nullptr);
+		broadcast(setslots, migration.node, now_ms);
+	}
+	// migration_reply: one reply of the target's, what it ends depends on the phase
+	void migration_reply(uint32_t status, sview text, uint64_t now_ms) {
+		if(migration.awaiting == 0)
+			return migration_stop("a reply nothing was sent for");
+		migration.failed += status == RES_ERR;
+		if(--migration.awaiting > 0)
+			return;
+
+		switch(migration.phase) {
+		case MIG_IMPORT:
+			if(migration.failed)
+				return migration_stop(fmt("the target refused the import: {}", text).c_str());
+
+			for(size_t slot = migration.first; slot <= migration.last; slot++) {
+				cluster.state[slot] = SLOT_MIGRATING;
+				cluster.peer[slot]  = migration.node;
+			}
+			migration.phase = MIG_IDLE;
+			migration_answer(RES_OK, fmt("[CLUSTER] Migrating slots {}-{} to {}", migration.first, migration.last,
+					cl_addr(&cluster, migration.node)));
+			break;
+		case MIG_BATCH:
+			if(migration.failed)
+				return migration_stop("the target refused keys");
+
+			migration_applied();
+			migration.phase = MIG_IDLE;
+			break;
+		case MIG_SETSLOTS:
+			if(migration.failed)
+				return migration_stop("the target didn't take the slots over");
+			migration_finished(now_ms);
+			break;
+		case MIG_IDLE: // nothing awaited
+			break;
+		}
+	}
+	// migration_send: 'n' request frames queued on the link, the phase waits for as many replies
+	void migration_send(MigPhase phase, size_t n, uint64_t now_ms) {
+		migration.phase = phase;
+		migration.awaiting = n;
+		migration.failed = 0;
+		migration.sent_ms = now_ms;
+		migration.link->state |= ConnState::SENDING;
+	}
+}
+
+// cluster_link_input: the replies on a link this node opened, the migration's or a broadcast's
+static void cluster_link_input(Conn *conn) {
+	while(!(bool)(conn->state & ConnState::CLOSED) && conn->in_size() >= 4) {
+		uint32_t len = 0, status = RES_ERR;
+		memcpy(&len, conn->in_data(), sizeof(len));
+		if(len < sizeof(status) || len > CLUSTER_FRAME_MAX) {
+			std::println("[WARN] cluster: {} byte reply from {}", len, cl_addr(&cluster, conn->cluster_link));
+			if(conn == migration.link)
+				return migration_stop("a bad reply from the target");
+			conn->state = ConnState::CLOSED | ConnState::ERR;
+			return;
+		}
+		if(len + sizeof(len) > (size_t)conn->in_size())
+			return;
+
+		const byte *frame = conn->in_data() + sizeof(len);
+		memcpy(&status, frame, sizeof(status));
+		const sview text((const char *)frame + sizeof(status), len - sizeof(status));
+		conn->in_start += sizeof(len) + len;
+		conn->last_cmd_ms = utils::mono_ms();
+
+		if(conn == migration.link) {
+			migration_reply(status, text, conn->last_cmd_ms);
+			continue;
+		}
+
+		if(status == RES_ERR)
+			std::println("[WARN] cluster: {} refused the update: {}", cl_addr(&cluster, conn->cluster_link), text);
+		conn->cluster_link = 0; // answered, drop_client has nothing to report
+		conn->state = ConnState::CLOSED;
+	}
+}
+
+static void cluster_drop(Conn *conn) {
+	if(conn == migration.client)
+		migration.client = nullptr;
+	if(conn == migration.link)
+		migration_stop("the link to the target broke");
+	else if(conn->cluster_link) // a broadcast's, closed before its reply
+		std::println("[WARN] cluster: couldn't update {}", cl_addr(&cluster, conn->cluster_link));
+}
+
+static int cluster_cron(uint64_t now_ms) {
+	if(!migration.link)
+		return -1;
+	if(migration.phase != MIG_IDLE) {
+		if(now_ms - migration.sent_ms >= CLUSTER_REPLY_TIMEOUT_MS) {
+			migration_stop("the target timed out");
+			return -1;
+		}
+		return 1;
+	}
+
+	Conn *link = migration.link;
+	if(migration.cursor == 0 && migration.gone.empty()) { // between passes, done once no key of the range is left
+		size_t left = 0;
+		for(size_t slot = migration.first; slot <= migration.last; slot++)
+			left += cluster.keys[slot];
+
+		if(left == 0) {
+			const ClusterNode &to = cluster.nodes[migration.node];
+			const std::string first = std::to_string(migration.first), last = std::to_string(migration.last);
+			const std::string port = std::to_string(to.port);
+			const sview setslots[] = { "cluster", "setslots", first, last, to.host, port };
+			queue_frame(link, setslots);
+			migration_send(MIG_SETSLOTS, 1, now_ms);
+			return 0;
+		}
+	}
+
+	// the next batch of the range's keys, the scan's step budget bounds the work when they're sparse
+	static std::vector<KVObj *> batch;
+	const size_t max = srv_cfg.cluster_migrate_batch;
+	size_t steps = max * 16;
+	batch.clear();
+	do {
+		migration.cursor = ihs_scan(&db.kvs.table, migration.cursor, [](iHNode *node) {
+			KVObj *obj = get_kvobj(node);
+			const uint16_t slot = cl_key_slot(obj->get_key(), node->hval);
+			if(slot >= migration.first && slot <= migration.last)
+				batch.push_back(obj);
+		});
+	} while(migration.cursor != 0 && batch.size() < max && --steps);
+
+	size_t nframes = 0;
+	for(const std::string &key : migration.gone) {
+		const sview del[] = { "del", key };
+		queue_frame(link, del);
+		nframes++;
+	}
+	migration.gone.clear();
+
+	std::string frames;
+	for(KVObj *obj : batch) {
+		if(obj->expired(now_ms)) {
+			expire_kvobj(obj);
+			continue;
+		}
+
+		const sview del[] = { "del", obj->get_key() }; // the copy replaces whatever the target has
+		rp_encode(frames, del);
+		nframes += 1 + encode_kvobj(frames, obj);
+		migration.sent.emplace_back(obj->get_key(), obj->version());
+	}
+	memcpy(link->ot_reserve(frames.size()), frames.data(), frames.size());
+	link->ot_end += frames.size();
+
+	if(nframes > 0) { // back right away, this iteration's pollfds don't wait for the link to take it
+		migration_send(MIG_BATCH, nframes, now_ms);
+		return 0;
+	}
+	return 0; // the step budget ran out before the scan found keys, or some were written while their batch was in flight
+}
+
+namespace {
+	void cluster_error(sview text, Response &out) {
+		out.data.assign(text.begin(), text.end());
+		out.status = RES_ERR;
+	}
+	template <class T>
+	bool parse_num(sview s, T &val) {
+		const auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), val);
+		return ec == std::errc{} && end == s.data() + s.size();
+	}
+	// parse_range: 'first' and 'last' slot at cmds[i], cmds[i + 1]
+	bool parse_range(const vector<sview> &cmds, size_t i, uint16_t &first, uint16_t &last) {
+		return cmds.size() > i + 1 && parse_num(cmds[i], first) && parse_num(cmds[i + 1], last) &&
+		       first <= last && last < CLUSTER_SLOTS;
+	}
+	// parse_node: the node at 'host port' in cmds[i], cmds[i + 1], added to the map if new
+	bool parse_node(const vector<sview> &cmds, size_t i, uint16_t &node) {
+		if(cmds.size() <= i + 1)
+			return false;
+
+		const std::string host = cmds[i] == "localhost" ? "127.0.0.1" : std::string(cmds[i]);
+		in_addr addr;
+		uint16_t port = 0;
+		if(inet_pton(AF_INET, host.c_str(), &addr) != 1 || !parse_num(cmds[i + 1], port) || !port)
+			return false;
+
+		node = cl_node(&cluster, host, port);
+		return true;
+	}
+	constexpr sview slot_state_names[] = { "", " migrating to ", " importing from " }; // indexed by SlotState
+}
+
+// cluster info | keyslot key | countkeysinslot slot | slots | nodes
+// cluster addslots first last                  serve the unassigned slots first..last here
+// cluster setslots first last host port        assign first..last to a node, this one included
+// cluster migrate first last host port         move first..last and their keys from here to another node
+// cluster import first last host port          sent by a migrating node, first..last are on their way here
+void do_cluster(vector<sview> &cmds, Response &out) {
+	std::string res;
+	const sview sub = cmds[1];
+	uint16_t first = 0, last = 0, node = 0;
+
+	if(sub == "info" && cmds.size() == 2) {
+		size_t assigned = 0, mine = 0, keys = 0;
+		for(size_t slot = 0; slot < CLUSTER_SLOTS; slot++) {
+			assigned += cluster.owner[slot] != CL_NO_NODE;
+			mine += cl_mine(&cluster, slot);
+			keys += cluster.keys[slot];
+		}
+
+		res = fmt("[CLUSTER] enabled {} myself {} nodes {} slots-assigned {} slots-mine {} keys {}\n",
+				srv_cfg.cluster_enabled, cl_addr(&cluster, 0), cluster.nodes.size(), assigned, mine, keys);
+		if(migration.link)
+			res.append(fmt("migrating {}-{} to {} moved {} keys\n", migration.first, migration.last,
+					cl_addr(&cluster, migration.node), migration.moved));
+	} else if(sub == "keyslot" && cmds.size() == 3) {
+		res = fmt("[CLUSTER] Slot: {}", cl_key_slot(cmds[2]));
+	} else if(sub == "countkeysinslot" && cmds.size() == 3) {
+		if(!parse_num(cmds[2], first) || first >= CLUSTER_SLOTS)
+			return cluster_error("[ERROR: CLUSTER] Invalid slot", out);
+		res = fmt("[CLUSTER] Keys: {}", cluster.keys[first]);
+	} else if(sub == "slots" && cmds.size() == 2) {
+		res = "[CLUSTER] Slots\n";
+		for(size_t slot = 0; slot < CLUSTER_SLOTS;) {
+			size_t end = slot;
+			while(end + 1 < CLUSTER_SLOTS && cluster.owner[end + 1] == cluster.owner[slot] &&
+					cluster.state[end + 1] == cluster.state[slot] && cluster.peer[end + 1] == cluster.peer[slot])
+				end++;
+
+			if(cluster.owner[slot] != CL_NO_NODE) {
+				res.append(fmt("{}-{} {}", slot, end, cl_addr(&cluster, cluster.owner[slot])));
+				if(cluster.state[slot] != SLOT_STABLE)
+					res.append(slot_state_names[cluster.state[slot]]).append(cl_addr(&cluster, cluster.peer[slot]));
+				res.append("\n");
+			}
+			slot = end + 1;
+		}
+	} else if(sub == "nodes" && cmds.size() == 2) {
+		std::vector<size_t> owned(cluster.nodes.size());
+		for(size_t slot = 0; slot < CLUSTER_SLOTS; slot++) {
+			if(cluster.owner[slot] != CL_NO_NODE)
+				owned[cluster.owner[slot]]++;
+		}
+
+		res = "[CLUSTER] Nodes\n";
+		for(uint16_t i = 0; i < cluster.nodes.size(); i++)
+			res.append(fmt("{}{} slots {}\n", cl_addr(&cluster, i), i == 0 ? " myself" : "", owned[i]));
+	} else if(sub == "addslots" && cmds.size() == 4) {
+		if(!parse_range(cmds, 2, first, last))
+			return cluster_error("[ERROR: CLUSTER] Expected 'cluster addslots <first> <last>'", out);
+		for(size_t slot = first; slot <= last; slot++) {
+			if(cluster.owner[slot] != CL_NO_NODE && !cl_mine(&cluster, slot))
+				return cluster_error(fmt("[ERROR: CLUSTER] Slot {} is already served by {}", slot,
+						cl_addr(&cluster, cluster.owner[slot])), out);
+		}
+
+		std::fill(cluster.owner + first, cluster.owner + last + 1, 0);
+		res = fmt("[CLUSTER] Serving slots {}-{}", first, last);
+	} else if(sub == "setslots" && cmds.size() == 6) {
+		if(!parse_range(cmds, 2, first, last) || !parse_node(cmds, 4, node))
+			return cluster_error("[ERROR: CLUSTER] Expected 'cluster setslots <first> <last> <ip> <port>'", out);
+		if(migration.link && first <= migration.last && last >= migration.first)
+			return cluster_error("[ERROR: CLUSTER] The slots are being migrated", out);
+
+		for(size_t slot = first; slot <= last; slot++) {
+			cluster.owner[slot] = node;
+			cluster.state[slot] = SLOT_STABLE;
+			cluster.peer[slot]  = CL_NO_NODE;
+		}
+		res = fmt("[CLUSTER] Slots {}-{} served by {}", first, last, cl_addr(&cluster, node));
+	} else if((sub == "migrate" || sub == "import") && cmds.size() == 6) {
+		if(!parse_range(cmds, 2, first, last) || !parse_node(cmds, 4, node) || node == 0)
+			return cluster_error(fmt("[ERROR: CLUSTER] Expected 'cluster {} <first> <last> <ip> <port>' of another node", sub), out);
+
+		if(sub == "import") {
+			for(size_t slot = first; slot <= last; slot++) {
+				if(cl_mine(&cluster, slot))
+					return cluster_error(fmt("[ERROR: CLUSTER] Slot {} is already served here", slot), out);
+			}
+			for(size_t slot = first; slot <= last; slot++) {
+				cluster.state[slot] = SLOT_IMPORTING;
+				cluster.peer[slot]  = node;
+			}
+			if(cur_client)
+				cur_client->cluster_import = true;
+			res = fmt("[CLUSTER] Importing slots {}-{} from {}", first, last, cl_addr(&cluster, node));
+		} else {
+			if(migration.link)
+				return cluster_error("[ERROR: CLUSTER] A migration is already running", out);
+			for(size_t slot = first; slot <= last; slot++) {
+				if(!cl_mine(&cluster, slot))
+					return cluster_error(fmt("[ERROR: CLUSTER] Slot {} isn't served here", slot), out);
+			}
+
+			const uint64_t now_ms = utils::mono_ms();
+			Conn *link = cluster_dial(node, now_ms);
+			if(!link)
+				return cluster_error(fmt("[ERROR: CLUSTER] Can't connect to {}", cl_addr(&cluster, node)), out);
+
+			const std::string port = std::to_string(cluster.nodes[0].port);
+			const sview import[] = { "cluster", "import", cmds[2], cmds[3], cluster.nodes[0].host, port };
+			queue_frame(link, import);
+
+			migration.link = link;
+			migration.node = node;
+			migration.first = first;
+			migration.last = last;
+			migration.cursor = 0;
+			migration.moved = 0;
+			migration.start_ms = now_ms;
+			migration_send(MIG_IMPORT, 1, now_ms);
+
+			// the answer waits for the target's, unless it can't be held up like the blocking commands
+			if(cur_client && !from_primary() && !repl.in_exec && !cur_client->cluster_import) {
+				migration.client = cur_client;
+				cur_client->blocked = true;
+				out.status = RES_NOREPLY;
+				return;
+			}
+			res = fmt("[CLUSTER] Asked {} to import slots {}-{}", cl_addr(&cluster, node), first, last);
+		}
+	} else {
+		return cluster_error("[ERROR: SYNTAX] Unknown cluster subcommand or wrong number of arguments", out);
+	}
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+// asking, the next command may use a slot this node is importing. Sent ahead of a command an ASK redirected
+void do_asking(vector<sview> &cmds, Response &out) {
+	if(cur_client)
+		cur_client->asking_for = cur_client->ncmds + 1;
+
+	reply(out, RES_OK, "[ASKING] OK");
+}
+//---------------------------------------------------------------------------------------
+// Server functions
+//---------------------------------------------------------------------------------------
+// config get name / config set name val
+void do_config(vector<sview> &cmds, Response &out) {
+	std::string res, val;
+
+	if(cmds.size() == 4 && cmds[1] == "set" && cmds[2] == "cluster-announce-ip") {
+		// node 0 is this one, the host redirections and setslots frames name it by; kept numeric like every other node
+		in_addr addr;
+		if(cmds[3] == "localhost")
+			cmds[3] = "127.0.0.1";
+		if(inet_pton(AF_INET, std::string(cmds[3]).c_str(), &addr) != 1) {
+			reply(out, RES_ERR, "[ERROR: CONFIG] cluster-announce-ip takes a numeric IPv4 address");
+			return;
+		}
+	}
+
+	if(cmds.size() == 3 && cmds[1] == "get" && cfg_get(cmds[2], val)) {
+		res = "[CONFIG] " + std::string(cmds[2]) + ": " + val;
+	} else if(cmds.size() == 4 && cmds[1] == "set" && cfg_set(cmds[2], cmds[3])) {
+		if(cmds[2] == "cluster-announce-ip")
+			cluster.nodes[0].host = srv_cfg.cluster_announce_ip;
+		res = "[CONFIG] " + std::string(cmds[2]) + " = " + std::string(cmds[3]);
+	} else {
+		reply(out, RES_ERR, "[ERROR: CONFIG] Unknown parameter, malformed value or subcommand");
+		return;
+	}
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+namespace {
+	// client_mem: heap held by a client's buffers, shared messages are counted for every client still holding them
+	size_t client_mem(const Conn *conn) {
+		return conn->in_cap + conn->ot_cap + conn->ot_chain_bytes;
+	}
+}
+// client list: one line per client, those holding the most buffer memory first
+void do_client(vector<sview> &cmds, Response &out) {
+	std::string res;
+
+	if(cmds[1] != "list") {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'client list'");
+		return;
+	}
+
+	std::vector<Conn *> list;
+	for(Conn *conn : connections)
+		if(conn && !(bool)(conn->state & ConnState::CLOSED))
+			list.push_back(conn);
+	std::ranges::sort(list, std::greater{}, client_mem);
+
+	constexpr sview class_names[] = { "normal", "pubsub", "replica" };
+	const uint64_t now = utils::mono_ms();
+
+	res = fmt("[CLIENT LIST] Clients: {} Disconnected: hard {} soft {}\n",
+			list.size(), output_disconnects.hard, output_disconnects.soft);
+	for(Conn *conn : list) {
+		char addr[INET6_ADDRSTRLEN] = "?";
+		uint16_t port = 0;
+		sockaddr_storage ss = {};
+		socklen_t len = sizeof(ss);
+		if(getpeername(conn->get_socket(), (sockaddr *)&ss, &len) == 0) {
+			if(ss.ss_family == AF_INET) {
+				const auto *in = (const sockaddr_in *)&ss;
+				inet_ntop(AF_INET, &in->sin_addr, addr, sizeof(addr));
+				port = ntohs(in->sin_port);
+			} else if(ss.ss_family == AF_INET6) {
+				const auto *in6 = (const sockaddr_in6 *)&ss;
+				inet_ntop(AF_INET6, &in6->sin6_addr, addr, sizeof(addr));
+				port = ntohs(in6->sin6_port);
+			}
+		}
+
+		res.append(fmt("fd={} addr={}:{} class={} age={} idle={} cmds={} "
+				"qbuf={} qbuf-cap={} obuf={} obuf-cap={} oshared={} orefs={} omem={} soft-over={} "
+				"sub={} psub={} multi={}\n",
+				conn->get_socket(), addr, port, class_names[client_class(conn)],
+				(now - conn->created_ms) / 1000, (now - conn->last_cmd_ms) / 1000, conn->ncmds,
+				conn->in_size(), conn->in_cap, conn->ot_size(), conn->ot_cap,
+				conn->ot_chain_bytes, conn->ot_chain.size(), client_mem(conn),
+				conn->soft_since_ms ? (now - conn->soft_since_ms) / 1000 : 0,
+				conn->nchannels, conn->npatterns,
+				conn->multi && conn->multi->active ? (int64_t)conn->multi->argc.size() : -1));
+	}
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+// memory usage key / memory stats
+void do_memory(vector<sview> &cmds, Response &out) {
+	std::string res;
+
+	if(cmds.size() == 3 && cmds[1] == "usage") {
+		KVObj *obj = lookup_kvobj(cmds[2]);
+		if(!obj) {
+			res = "[NULL] No object with key " + std::string(cmds[2]);
+			out.data.assign(res.begin(), res.end());
+			out.status = RES_NX;
+			return;
+		}
+
+		const MemUsage usage = obj->mem_usage();
+		res = fmt("[MEMORY] Key: {} Bytes: {} Overhead: {} Payload: {}",
+				obj->get_key(), usage.total(), usage.overhead, usage.payload);
+	} else if(cmds.size() == 2 && cmds[1] == "stats") {
+		MemUsage dataset;
+		for(auto &t : db.types)
+			dataset += t.mem;
+
+		// object slots live in the static db.data array, not on the heap, the rest of the heap is the server's own
+		const size_t slots   = (db.data_idx - db.free_slots.size()) * sizeof(KVObj);
+		const size_t buckets = ihs_bucket_mem(&db.kvs.table);
+		const size_t heap    = mem_used();
+		const size_t dataset_heap = dataset.total() - slots;
+
+		size_t nclients = 0, clients_in = 0, clients_out = 0;
+		for(Conn *conn : connections) {
+			if(!conn)
+				continue;
+			nclients++;
+			clients_in  += conn->in_cap;
+			clients_out += conn->ot_cap + conn->ot_chain_bytes;
+		}
+
+		res = fmt("[MEMORY STATS]\n"
+			"used_heap: {}\n"
+			"maxmemory: {}\n"
+			"dataset: {} ({} overhead, {} payload)\n"
+			"keyspace_buckets: {}\n"
+			"object_slots: {} of {} static\n"
+			"server_other: {}\n"
+			"lazyfree_pending: {} freed {}\n"
+			"clients: {} input {} output {}\n",
+			heap, srv_cfg.maxmemory,
+			dataset.total(), dataset.overhead, dataset.payload,
+			buckets,
+			slots, sizeof(db.data),
+			heap > dataset_heap + buckets ? heap - dataset_heap - buckets : 0,
+			lf_pending(), lf_freed(),
+			nclients, clients_in, clients_out);
+
+		for(size_t i = (size_t)KVTYPE::STRING; i < std::size(db.types); i++) {
+			const auto &t = db.types[i];
+			res.append(fmt("{}: keys {} bytes {} overhead {} payload {}\n",
+					kvtype_names[i], t.keys, t.mem.total(), t.mem.overhead, t.mem.payload));
+		}
+	} else {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'memory usage <key>' or 'memory stats'");
+		return;
+	}
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+namespace {
+	void lat_line(std::string &res, sview kind, sview name, const HdrHist *h) {
+		const auto us = [](uint64_t ticks) { return tsc_to_ns(ticks) / 1000.0; };
+
+		res.append(fmt("{} {}: calls {} p50 {:.2f} p99 {:.2f} p999 {:.2f} max {:.2f}\n",
+				kind, name, h->total.load(std::memory_order_relaxed),
+				us(hist_percentile(h, 50.0)), us(hist_percentile(h, 99.0)),
+				us(hist_percentile(h, 99.9)), us(h->max.load(std::memory_order_relaxed))));
+	}
+}
+// latency / latency reset
+void do_latency(vector<sview> &cmds, Response &out) {
+	std::string res;
+
+	if(cmds.size() == 1) {
+		res = fmt("[LATENCY] unit: us, tracking: {}, tsc: {:.3f} ticks/ns, overhead: {:.1f} ns per timed section\n",
+				srv_cfg.latency_tracking ? "on" : "off", tsc_per_ns(), hist_overhead_ns());
+
+		for(size_t i = 0; i < PHASE_COUNT; i++)
+			lat_line(res, "phase", phase_names[i], &phase_lat[i]);
+		for(size_t i = 0; i < std::size(cmd_table); i++) {
+			if(cmd_lat[i].total.load(std::memory_order_relaxed))
+				lat_line(res, "cmd", cmd_table[i].name, &cmd_lat[i]);
+		}
+	} else if(cmds.size() == 2 && cmds[1] == "reset") {
+		for(HdrHist &h : phase_lat)
+			hist_reset(&h);
+		for(HdrHist &h : cmd_lat)
+			hist_reset(&h);
+
+		res = "[LATENCY] reset";
+	} else {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'latency' or 'latency reset'");
+		return;
+	}
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+// slowlog get [count] / slowlog len / slowlog reset
+void do_slowlog(vector<sview> &cmds, Response &out) {
+	std::string res;
+	const size_t len = sl_size(&slowlog, srv_cfg.slowlog_max_len);
+
+	if(cmds[1] == "get" && cmds.size() <= 3) {
+		size_t count = len;
+		if(cmds.size() == 3) {
+			auto [ptr, ec] = std::from_chars(cmds[2].data(), cmds[2].data() + cmds[2].size(), count);
+			if(ec != std::errc{} || ptr != cmds[2].data() + cmds[2].size()) {
+				reply(out, RES_ERR, "[ERROR: SYNTAX] Count must be a non-negative integer");
+				return;
+			}
+		}
+		count = std::min(count, len);
+
+		res = fmt("[SLOWLOG] Entries: {}\n", count);
+		for(size_t i = 0; i < count; i++) {
+			const SlowlogEntry *e = sl_get(&slowlog, i);
+
+			res.append(fmt("#{} at {}.{:06} took {} us fd {}:", e->id,
+					e->unix_us / 1000000, e->unix_us % 1000000, e->duration_us, e->fd));
+			for(size_t a = 0; a < e->nargs; a++) {
+				const SlowlogArg &arg = e->args[a];
+				res.append(" ").append(arg.kept());
+				if(arg.len > SLOWLOG_ARG_LEN)
+					res.append(fmt("...({} more bytes)", arg.len - SLOWLOG_ARG_LEN));
+			}
+			if(e->argc > e->nargs)
+				res.append(fmt(" ...({} more arguments)", e->argc - e->nargs));
+			res.append("\n");
+		}
+	} else if(cmds[1] == "len" && cmds.size() == 2) {
+		res = fmt("[SLOWLOG] Len: {}", len);
+	} else if(cmds[1] == "reset" && cmds.size() == 2) {
+		sl_reset(&slowlog);
+		res = "[SLOWLOG] reset";
+	} else {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'slowlog get [count]', 'slowlog len' or 'slowlog reset'");
+		return;
+	}
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+namespace {
+	// cmd_tags: names of pf_tag's values, the command table's names after "loop" for outside of commands
+	std::span<const sview> cmd_tags() {
+		static vector<sview> tags;
+		if(tags.empty()) {
+			tags.push_back("loop");
+			for(const command &c : cmd_table)
+				tags.push_back(c.name);
+		}
+		return tags;
+	}
+}
+
+// profile [start [hz] | stop | dump | reset], cpu samples of the loop thread as folded stacks, each rooted at
+// the command it ran ("loop" outside of commands). dump replies with them, one per line after the header
+void do_profile(vector<sview> &cmds, Response &out) {
+	std::string res, err;
+	auto fail = [&](std::string msg) {
+		out.data.assign(msg.begin(), msg.end());
+		out.status = RES_ERR;
+	};
+
+	if(cmds.size() == 1) {
+		res = fmt("[PROFILE] running: {}, samples: {}, dropped: {}", pf_running() ? "on" : "off", pf_samples(), pf_dropped());
+	} else if(cmds[1] == "start" && cmds.size() <= 3) {
+		uint32_t hz = 99; // off the beat of anything running at round rates
+		if(cmds.size() == 3) {
+			auto [ptr, ec] = std::from_chars(cmds[2].data(), cmds[2].data() + cmds[2].size(), hz);
+			if(ec != std::errc{} || ptr != cmds[2].data() + cmds[2].size() || hz == 0 || hz > 10000)
+				return fail("[ERROR: SYNTAX] hz has to be between 1 and 10000");
+		}
+		if(pf_running())
+			return fail("[ERROR: BUSY] The profiler is already running");
+		if(!pf_start(hz, err))
+			return fail("[ERROR: PROFILE] " + err);
+		res = fmt("[PROFILE] started at {} Hz", hz);
+	} else if(cmds[1] == "stop" && cmds.size() == 2) {
+		pf_stop();
+		res = fmt("[PROFILE] stopped, samples: {}, dropped: {}", pf_samples(), pf_dropped());
+	} else if(cmds[1] == "dump" && cmds.size() == 2) {
+		std::string stacks;
+		const size_t samples = pf_samples();
+		const size_t count = pf_dump(cmd_tags(), stacks);
+		res = fmt("[PROFILE] Stacks: {} Samples: {}\n", count, samples);
+		res.append(stacks);
+	} else if(cmds[1] == "reset" && cmds.size() == 2) {
+		pf_reset();
+		res = "[PROFILE] reset";
+	} else {
+		return fail("[ERROR: SYNTAX] Expected 'profile', 'profile start [hz]', 'profile stop', 'profile dump' or 'profile reset'");
+	}
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+// watchdog / watchdog get [count] / watchdog reset, loop iterations that ran past 'watchdog-period', newest
+// first, each with the command and client it was serving and the loop's stack when it was caught
+void do_watchdog(vector<sview> &cmds, Response &out) {
+	std::string res;
+
+	if(cmds.size() == 1) {
+		res = fmt("[WATCHDOG] period: {} ms, stalls: {}, longest: {} ms, reports: {}",
+				srv_cfg.watchdog_period, wd_stalls(), wd_longest_ms(), wd_size());
+	} else if(cmds[1] == "get" && cmds.size() <= 3) {
+		size_t count = wd_size();
+		if(cmds.size() == 3) {
+			auto [ptr, ec] = std::from_chars(cmds[2].data(), cmds[2].data() + cmds[2].size(), count);
+			if(ec != std::errc{} || ptr != cmds[2].data() + cmds[2].size()) {
+				reply(out, RES_ERR, "[ERROR: SYNTAX] Count must be a non-negative integer");
+				return;
+			}
+		}
+		count = std::min(count, wd_size());
+
+		const std::span<const sview> tags = cmd_tags();
+		res = fmt("[WATCHDOG] Reports: {}\n", count);
+		for(size_t i = 0; i < count; i++) {
+			const WdReport *r = wd_get(i);
+			res.append(fmt("#{} at {}.{:06} caught after {} ms, ran {} ms in {} fd {}\n", r->id,
+					r->unix_us / 1000000, r->unix_us % 1000000, r->caught_ms, r->total_ms,
+					r->tag < tags.size() ? tags[r->tag] : "?", r->fd));
+
+			// innermost first, past the handler and the signal trampoline
+			for(uint32_t f = 2; f < r->depth; f++)
+				res.append(fmt("  {}\n", pf_symbol(f == 2 ? r->pcs[f] : (void *)((uintptr_t)r->pcs[f] - 1))));
+		}
+	} else if(cmds[1] == "reset" && cmds.size() == 2) {
+		wd_reset();
+		res = "[WATCHDOG] reset";
+	} else {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'watchdog', 'watchdog get [count]' or 'watchdog reset'");
+		return;
+	}
+
+	out.data.assign(res.begin(), res.end());
+	out.status = RES_OK;
+}
+namespace {
+	// info sections, each appends its "# Name" block. tsets walks every member of the big sets, so only
+	// 'info tsets' runs it
+	constexpr size_t INFO_TSET_BIG = 1024; // members, smaller sets aren't worth a line
+	constexpr size_t INFO_TSET_MAX = 16;   // the biggest ones listed
+
+	void info_server(std::string &res) {
+		res.append(fmt("# Server\nuptime_sec: {}\npid: {}\nhz: {}\nrole: {}\n",
+				(utils::mono_ms() - started_ms) / 1000, getpid(), srv_cfg.hz,
+				repl.role == ROLE_PRIMARY ? "primary" : "replica"));
+	}
+	void info_clients(std::string &res) {
+		size_t nclients = 0, nblocked = 0, in_used = 0, in_cap = 0, in_max = 0, ot_used = 0, ot_cap = 0, ot_max = 0;
+		for(Conn *conn : connections) {
+			if(!conn || conn->scrape)
+				continue;
+			nclients++;
+			nblocked += conn->blocked;
+			in_used  += conn->in_size();
+			in_cap   += conn->in_cap;
+			in_max    = std::max<size_t>(in_max, conn->in_size());
+			ot_used  += conn->ot_pending();
+			ot_cap   += conn->ot_cap + conn->ot_chain_bytes;
+			ot_max    = std::max<size_t>(ot_max, conn->ot_pending());
+		}
+
+		res.append(fmt("# Clients\nconnected_clients: {}\nblocked_clients: {}\nblocked_waits: {}\n"
+				"input_buffer: used {} capacity {} biggest {}\noutput_buffer: pending {} capacity {} biggest {}\n"
+				"output_disconnects: hard {} soft {}\n",
+				nclients, nblocked, blocking.nwaits, in_used, in_cap, in_max, ot_used, ot_cap, ot_max,
+				output_disconnects.hard, output_disconnects.soft));
+	}
+	void info_memory(std::string &res) {
+		MemUsage dataset;
+		for(auto &t : db.types)
+			dataset += t.mem;
+
+		res.append(fmt("# Memory\nused_heap: {}\nmaxmemory: {}\ndataset: {} ({} overhead, {} payload)\n"
+				"keyspace_buckets: {}\nobject_slots: {}\nlazyfree_pending: {} freed {}\n",
+				mem_used(), srv_cfg.maxmemory, dataset.total(), dataset.overhead, dataset.payload,
+				ihs_bucket_mem(&db.kvs.table), (db.data_idx - db.free_slots.size()) * sizeof(KVObj),
+				lf_pending(), lf_freed()));
+	}
+	void info_stats(std::string &res) {
+		res.append(fmt("# Stats\ntotal_commands: {}\nops_per_sec: {:.1f}\ntotal_connections: {}\n"
+				"net_input_bytes: {}\nnet_output_bytes: {}\nexpired_keys: {}\nevicted_keys: {}\n"
+				"aggregate_jobs: {} members {}\nwatchdog_stalls: {}\n",
+				st_sum(ST_COMMANDS), st_ops_per_sec(), st_sum(ST_CONNECTIONS),
+				st_sum(ST_NET_INPUT), st_sum(ST_NET_OUTPUT), st_sum(ST_EXPIRED), st_sum(ST_EVICTED),
+				st_sum(ST_AGG_JOBS), st_sum(ST_AGG_MEMBERS), wd_stalls()));
+	}
+	void info_commandstats(std::string &res) {
+		res.append("# Commandstats\n");
+		for(size_t i = 0; i < std::size(cmd_table); i++) {
+			const uint64_t calls = st_calls(i);
+			if(!calls)
+				continue;
+
+			// time comes from the latency histograms, so it's only there while latency tracking is on
+			const HdrHist &h = cmd_lat[i];
+			const uint64_t timed = h.total.load(std::memory_order_relaxed);
+			const double usec = tsc_to_ns(h.sum.load(std::memory_order_relaxed)) / 1000.0;
+			res.append(fmt("{}: calls {} usec {:.0f} usec_per_call {:.2f}\n",
+					cmd_table[i].name, calls, usec, timed ? usec / (double)timed : 0.0));
+		}
+	}
+	void info_keyspace(std::string &res) {
+		res.append(fmt("# Keyspace\nkeys: {}\nexpires: {}\n", db.kvs.table.curr.size + db.kvs.table.prev.size,
+				db.expires.size));
+		for(size_t i = (size_t)KVTYPE::STRING; i < std::size(db.types); i++)
+			res.append(fmt("{}: {}\n", kvtype_names[i], db.types[i].keys));
+	}
+	void info_hashtables(std::string &res) {
+		const iHSet &hs = db.kvs.table;
+		const bool rehashing = hs.prev.buckets != nullptr;
+		const size_t buckets = hs.curr.nbuckets + 1 + (rehashing ? hs.prev.nbuckets + 1 : 0);
+
+		res.append(fmt("# Hashtables\nkeyspace_buckets: {} (curr {} prev {})\nkeyspace_load_factor: {:.3f} (max {})\n"
+				"keyspace_rehashing: {}\nkeyspace_migrate_pos: {}\n",
+				buckets, hs.curr.nbuckets + 1, rehashing ? hs.prev.nbuckets + 1 : 0,
+				(double)(hs.curr.size + hs.prev.size) / (double)buckets, ihs_load,
+				rehashing ? "yes" : "no", hs.migrate_pos));
+	}
+
+	// rb_height: the longest root to leaf path, walked with an explicit stack
+	size_t rb_height(RBTNode *root) {
+		std::vector<std::pair<RBTNode *, size_t>> stack;
+		if(!IS_NULL(root))
+			stack.emplace_back(root, 1);
+
+		size_t height = 0;
+		while(!stack.empty()) {
+			auto [n, depth] = stack.back();
+			stack.pop_back();
+			height = std::max(height, depth);
+			for(RBTNode *child : n->children) {
+				if(!IS_NULL(child))
+					stack.emplace_back(child, depth + 1);
+			}
+		}
+		return height;
+	}
+	void info_tsets(std::string &res) {
+		std::vector<KVObj *> big;
+		for(size_t i = 0; i < db.data_idx; i++) {
+			KVObj *obj = &db.data[i];
+			if(obj->type() == KVTYPE::TSET && ts_size(&(TSet &)obj->val()) >= INFO_TSET_BIG)
+				big.push_back(obj);
+		}
+
+		auto size_of = [](KVObj *obj) { return ts_size(&(TSet &)obj->val()); };
+		const size_t listed = std::min(big.size(), INFO_TSET_MAX);
+		std::partial_sort(big.begin(), big.begin() + listed, big.end(),
+				[&](KVObj *a, KVObj *b) { return size_of(a) > size_of(b); });
+
+		res.append(fmt("# Tsets\nbig_tsets: {} (>= {} members)\n", big.size(), INFO_TSET_BIG));
+		for(size_t i = 0; i < listed; i++) {
+			TSet &tst = (TSet &)big[i]->val();
+			const size_t n = ts_size(&tst);
+			res.append(fmt("{}: members {} height {} (red black bound {:.0f}) rehashing {}\n",
+					big[i]->get_key(), n, rb_height(tst.stm_root), 2 * std::log2((double)n + 1),
+					tst.mts_mp.prev.buckets ? "yes" : "no"));
+		}
+	}
+
+	using info_section = void (*)(std::string &);
+	constexpr std::pair<sview, info_section> info_sections[] = {
+		{ "server", info_server }, { "clients", info_clients }, { "memory", info_memory }, { "stats", info_stats },
+		{ "commandstats", info_commandstats }, { "keyspace", info_keyspace }, { "hashtables", info_hashtables },
+		{ "tsets", info_tsets }
+	};
+}
+// info [section]: every section but tsets without one
+void do_info(vector<sview> &cmds, Response &out) {
+	std::string res = "[INFO]\n";
+
+	if(cmds.size() == 1) {
+		for(const auto &[name, section] : info_sections) {
+			if(section != info_tsets)
+				section(res);
+		}
+	} else if(cmds.size() == 2) {
+		const auto it = std::find_if(std::begin(info_sections), std::end(info_sections),
+				[&](const auto &s) { return s.first == cmds[1]; });
+		if(it == std::end(info_sections)) {
+			res = fmt("[ERROR: SYNTAX] Unknown section '{}', expected server, clients, memory, stats, commandstats, "
+					"keyspace, hashtables or tsets", cmds[1]);
+			out.data.assign(res.begin(), res.end());
+			out.status = RES_ERR;
+			return;
+		}
+		it->second(res);
+	} else {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected 'info [section]'");
+		return;
+	}
+
 	out.data.assign(res.begin(), res.end());
 	out.status = RES_OK;
 }
 //---------------------------------------------------------------------------------------
+// Metrics
+//---------------------------------------------------------------------------------------
+namespace {
+	// mx_family: one metric family of the /metrics page. 'render' renders item 'item' (a command, a phase, a
+	// type, ...), an item may render nothing. MX_END once 'item' is past the last one
+	struct mx_family {
+		sview name, type, help;
+		MxStep (*render)(std::string &out, sview name, size_t item, MxScrape *s);
+	};
+
+	std::string mx_label(sview key, sview val) {
+		return std::string(key).append("=\"").append(val).append("\"");
+	}
+
+	// mx_one: a family of a single unlabeled value
+	template <auto Get>
+	MxStep mx_one(std::string &out, sview name, size_t item, MxScrape *) {
+		if(item > 0)
+			return MX_END;
+		mx_sample(out, name, "", Get());
+		return MX_NEXT;
+	}
+
+	MxStep mx_command_calls(std::string &out, sview name, size_t item, MxScrape *) {
+		if(item >= std::size(cmd_table))
+			return MX_END;
+		if(const uint64_t calls = st_calls(item))
+			mx_sample(out, name, mx_label("cmd", cmd_table[item].name), calls);
+		return MX_NEXT;
+	}
+	MxStep mx_command_latency(std::string &out, sview name, size_t item, MxScrape *s) {
+		if(item >= std::size(cmd_table))
+			return MX_END;
+		if(!cmd_lat[item].total.load(std::memory_order_relaxed))
+			return MX_NEXT;
+		return mx_histogram(out, name, mx_label("cmd", cmd_table[item].name), &cmd_lat[item], s->hist);
+	}
+	MxStep mx_phase_latency(std::string &out, sview name, size_t item, MxScrape *s) {
+		if(item >= PHASE_COUNT)
+			return MX_END;
+		return mx_histogram(out, name, mx_label("phase", phase_names[item]), &phase_lat[item], s->hist);
+	}
+	MxStep mx_keys(std::string &out, sview name, size_t item, MxScrape *) {
+		const size_t type = (size_t)KVTYPE::STRING + item;
+		if(type >= std::size(db.types))
+			return MX_END;
+		mx_sample(out, name, mx_label("type", kvtype_names[type]), (uint64_t)db.types[type].keys);
+		return MX_NEXT;
+	}
+	MxStep mx_buckets(std::string &out, sview name, size_t item, MxScrape *) {
+		const iHTab *tables[] = { &db.kvs.table.curr, &db.kvs.table.prev };
+		if(item >= std::size(tables))
+			return MX_END;
+		const iHTab *t = tables[item];
+		mx_sample(out, name, item == 0 ? "table=\"curr\"" : "table=\"prev\"", t->buckets ? (uint64_t)t->nbuckets + 1 : 0);
+		return MX_NEXT;
+	}
+
+	uint64_t mx_clients() {
+		uint64_t n = 0;
+		for(Conn *conn : connections)
+			n += conn && !conn->scrape;
+		return n;
+	}
+	uint64_t mx_dataset() {
+		MemUsage dataset;
+		for(auto &t : db.types)
+			dataset += t.mem;
+		return dataset.total();
+	}
+
+	constexpr mx_family mx_families[] = {
+		{ "redbrouk_commands_total", "counter", "Commands run, by command", mx_command_calls },
+		{ "redbrouk_command_duration_seconds", "histogram", "Command run time, while latency tracking is on",
+				mx_command_latency },
+		{ "redbrouk_phase_duration_seconds", "histogram", "Time the loop spends per phase, while latency tracking is on",
+				mx_phase_latency },
+		{ "redbrouk_connected_clients", "gauge", "Clients connected, scrapes excluded",
+				mx_one<[] { return mx_clients(); }> },
+		{ "redbrouk_blocked_clients", "gauge", "Clients parked by a blocking pop or a background aggregation",
+				mx_one<[] { return (uint64_t)blocking.nwaits; }> },
+		{ "redbrouk_connections_received_total", "counter", "Clients accepted",
+				mx_one<[] { return st_sum(ST_CONNECTIONS); }> },
+		{ "redbrouk_net_input_bytes_total", "counter", "Bytes read from clients",
+				mx_one<[] { return st_sum(ST_NET_INPUT); }> },
+		{ "redbrouk_net_output_bytes_total", "counter", "Bytes written to clients",
+				mx_one<[] { return st_sum(ST_NET_OUTPUT); }> },
+		{ "redbrouk_expired_keys_total", "counter", "Keys deleted by their ttl",
+				mx_one<[] { return st_sum(ST_EXPIRED); }> },
+		{ "redbrouk_evicted_keys_total", "counter", "Keys deleted to stay under maxmemory",
+				mx_one<[] { return st_sum(ST_EVICTED); }> },
+		{ "redbrouk_memory_used_bytes", "gauge", "Heap in use",
+				mx_one<[] { return (uint64_t)mem_used(); }> },
+		{ "redbrouk_memory_max_bytes", "gauge", "maxmemory, 0 for no limit",
+				mx_one<[] { return srv_cfg.maxmemory; }> },
+		{ "redbrouk_memory_dataset_bytes", "gauge", "Memory held by keys and values",
+				mx_one<[] { return mx_dataset(); }> },
+		{ "redbrouk_lazyfree_pending_values", "gauge", "Values queued on the reclaimer thread",
+				mx_one<[] { return (uint64_t)lf_pending(); }> },
+		{ "redbrouk_keys", "gauge", "Keys, by type", mx_keys },
+		{ "redbrouk_keyspace_buckets", "gauge", "Keyspace hash table buckets, prev is non zero while rehashing",
+				mx_buckets },
+		{ "redbrouk_keyspace_rehashing", "gauge", "1 while the keyspace hash table rehashes",
+				mx_one<[] { return (uint64_t)(db.kvs.table.prev.buckets != nullptr); }> },
+		{ "redbrouk_keyspace_migrate_pos", "gauge", "Next bucket an incremental rehash moves",
+				mx_one<[] { return (uint64_t)db.kvs.table.migrate_pos; }> },
+		{ "redbrouk_watchdog_stalls_total", "counter", "Loop stalls the watchdog caught since its last reset",
+				mx_one<[] { return wd_stalls(); }> },
+	};
+
+	constexpr size_t MX_CHUNK = 16 * 1024; // rendered ahead of what the client has read
+	std::string mx_out; // reused by every chunk
+
+	// scrape_render: queues the scrape's next steps until the chunk is full or 'deadline' (tsc) passes
+	void scrape_render(Conn *conn, uint64_t deadline) {
+		MxScrape *s = conn->scrape;
+		mx_out.clear();
+		while(s->family < std::size(mx_families)) {
+			const mx_family &f = mx_families[s->family];
+			if(s->item == 0 && s->hist.pos == 0)
+				mx_header(mx_out, f.name, f.type, f.help);
+			switch(f.render(mx_out, f.name, s->item, s)) {
+			case MX_NEXT:
+				s->item++;
+				break;
+			case MX_AGAIN:
+				break;
+			case MX_END:
+				s->family++;
+				s->item = 0;
+				break;
+			}
+
+			if(mx_out.size() >= MX_CHUNK || tsc_now() >= deadline)
+				break;
+		}
+		s->done = s->family == std::size(mx_families);
+
+		memcpy(conn->ot_reserve(mx_out.size()), mx_out.data(), mx_out.size());
+		conn->ot_end += mx_out.size();
+	}
+}
+
+static void scrape_input(Conn *conn) {
+	MxScrape *s = conn->scrape;
+	size_t used = 0;
+	const MxRequest req = mx_parse_request(sview((const char *)conn->in_data(), conn->in_size()), used);
+	if(req == MX_INCOMPLETE)
+		return;
+
+	conn->in_start = conn->in_end; // one request per connection, whatever follows it is dropped
+	const sview head = mx_reply_head(req);
+	memcpy(conn->ot_reserve(head.size()), head.data(), head.size());
+	conn->ot_end += head.size();
+
+	s->rendering = req == MX_METRICS;
+	s->done = !s->rendering;
+	conn->state &= ~ConnState::RECVING;
+	conn->state |=  ConnState::SENDING;
+	handle_write(conn);
+}
+
+static bool scrape_cron() {
+	if(scrapes.empty())
+		return false;
+
+	const uint64_t deadline = tsc_now() + (uint64_t)(srv_cfg.metrics_slice_us * 1000.0 * tsc_per_ns());
+	bool pending = false;
+	for(Conn *conn : scrapes) {
+		MxScrape *s = conn->scrape;
+		if(!s->rendering || s->done || (bool)(conn->state & ConnState::CLOSED))
+			continue;
+		if(conn->ot_pending() >= MX_CHUNK) // a slow reader, POLLOUT brings it back
+			continue;
+		if(tsc_now() >= deadline) { // this iteration's budget is spent, the next one goes on
+			pending = true;
+			continue;
+		}
+
+		scrape_render(conn, deadline);
+		conn->state |= ConnState::SENDING;
+		handle_write(conn);
+		pending |= !s->done && conn->ot_pending() < MX_CHUNK;
+		pending |= (bool)(conn->state & ConnState::CLOSED); // all sent, the loop drops it after its poll
+	}
+	return pending;
+}
+//---------------------------------------------------------------------------------------
 // TSet valtype functons
 //---------------------------------------------------------------------------------------
 static const TSet NILTSET;
@@ -393,37 +3608,26 @@ static const TSet NILTSET;
 // 2) A pointer to NILTSET, meaning no kv object exists for that key yet
 // 3) A null pointer, meaning a kv object exists but is NOT of type TSet
 TSet *find_tset(std::string_view key) {
-	LookupDummy dummy{
-		nullptr, genHash((const byte *)key.data(), key.length()),
-		key
-	};
-
-	iHNode *_hook = ihs_find(&db.kvs.table, &dummy.hook, lookup_eq);
-	if(!_hook)
+	KVObj *container = lookup_kvobj(key);
+	if(!container)
 		return (TSet *)&NILTSET;
-	
-	KVObj &container = get_kvobj_v(_hook);
-	if(container.type() != KVTYPE::TSET)
+
+	if(container->type() != KVTYPE::TSET)
 		return nullptr;
 
-	return std::addressof((TSet&)container.val());
+	return std::addressof((TSet&)container->val());
 }
 void do_range_tset(vector<sview> &cmds, Response &out) {
-	std::string res = "[ERROR: TYPE_MM] Was expecting TSET type";
 	TSet *tset = find_tset(cmds[1]);
 
 	if(!tset) {
-		out.data.assign(res.begin(), res.end());
-		out.status = RES_ERR;
+		reply(out, RES_ERR, "[ERROR: TYPE_MM] Was expecting TSET type");
 		return;
 	}
 	if(tset == &NILTSET) {
-		res = "[NULL] No TSet object with key " + std::string(cmds[1]);
-		out.data.assign(res.begin(), res.end());
-		out.status = RES_NX;
+		reply(out, RES_NX, "[NULL] No TSet object with key {}", cmds[1]);
 		return;
 	}
-	res.clear();
 
 	ssize_t begin, end, tsize = ts_size(tset);
 	std::from_chars(cmds[2].data(), cmds[2].data() + cmds[2].size(), begin);
@@ -432,56 +3636,463 @@ void do_range_tset(vector<sview> &cmds, Response &out) {
 	if(end < 0)
 		end = tsize + end;
 	if(end >= tsize || end < 0) {
-		res = fmt("[ERROR: RANGE_OOB]: Specified range is outside the bounds 0 - {}", tsize - 1);
-		out.data.assign(res.begin(), res.end());
-		out.status = RES_ERR;
+		reply(out, RES_ERR, "[ERROR: RANGE_OOB]: Specified range is outside the bounds 0 - {}", tsize - 1);
 		return;
 	}
 
-	res.append("[TRANGE] " + std::to_string(end - begin + 1) + "\n");
+	reply(out, RES_OK, "[TRANGE] {}\n", end - begin + 1);
 	TSTNode *node = ts_at(tset, begin);
 
-	TSTNode *first = node; // to keep track of the first node in the same value list
-	for(int i = begin; i <= end && node; i++) {
-		res.append( fmt("{}) {}\n", i - begin, node->name) );
-		node = ts_walk(node, 1, first);
+	for(ssize_t i = begin; i <= end && node; i++) {
+		reply_append(out, "{}) {}\n", i - begin, node->name);
+		node = ts_walk(node, 1);
 	}
-	out.data.assign(res.begin(), res.end());
-	out.status = RES_OK;
+}
+
+// trangebylex key min max [limit offset count], members between two names in lex order. Like any lex range it
+// assumes the members share a score, the order within one score being the names'
+void do_rangebylex_tset(vector<sview> &cmds, Response &out) {
+	auto fail = [&](sview msg) {
+		reply(out, RES_ERR, "{}", msg);
+	};
+
+	TSLexBound min, max;
+	if(!ts_parse_lex_bound(cmds[2], min) || !ts_parse_lex_bound(cmds[3], max))
+		return fail("[ERROR: SYNTAX] min and max start with '[' or '(', or are - or +");
+
+	size_t offset = 0;
+	int64_t count = -1; // all of them
+	if(cmds.size() != 4) {
+		if(cmds.size() != 7 || cmds[4] != "limit")
+			return fail("[ERROR: SYNTAX] Expected 'trangebylex key min max [limit offset count]'");
+
+		auto [oend, oec] = std::from_chars(cmds[5].data(), cmds[5].data() + cmds[5].size(), offset);
+		auto [cend, cec] = std::from_chars(cmds[6].data(), cmds[6].data() + cmds[6].size(), count);
+		if(oec != std::errc{} || oend != cmds[5].data() + cmds[5].size() || cec != std::errc{} || cend != cmds[6].data() + cmds[6].size())
+			return fail("[ERROR: SYNTAX] offset has to be a non-negative integer, count an integer");
+	}
+
+	TSet *tset = find_tset(cmds[1]);
+	if(!tset)
+		return fail("[ERROR: TYPE_MM] Was expecting TSET type");
+	if(tset == &NILTSET) {
+		reply(out, RES_NX, "[NULL] No TSet object with key {}", cmds[1]);
+		return;
+	}
+
+	TSTNode *node = ts_lex_first(tset, min);
+	for(; node && offset > 0; offset--)
+		node = ts_walk(node, 1);
+
+	// the upper bound is checked once per member, mostly on the prefix cached in the node
+	constexpr sview header = "[TRANGEBYLEX] ";
+	reply(out, RES_OK, "{}\n", header);
+	size_t nmembers = 0;
+	for(; node && count != 0 && !ts_lex_past(node, max); node = ts_walk(node, 1), count--) {
+		reply_append(out, "{}) {}\n", nmembers++, node->name);
+	}
+
+	char digits[20]; // the count goes in the header once it's known
+	const char *dend = std::to_chars(digits, digits + sizeof(digits), nmembers).ptr;
+	out.data.insert(out.data.begin() + header.size(), (const char *)digits, dend);
 }
 
 void do_add_tset(vector<sview> &cmds, Response &out) {
-	std::string res = "[ERROR: TYPE_MM] Was expecting TSET type";
 	const size_t size = cmds.size() - 1;
-	TSet *tset = find_tset(cmds[1]);
+	KVObj *obj = lookup_kvobj(cmds[1]);
 
-	if(!tset) {
+	if(obj && obj->type() != KVTYPE::TSET) {
+		reply(out, RES_ERR, "[ERROR: TYPE_MM] Was expecting TSET type");
+		return;
+	}
+	if(!obj) { // No kv object with this key found, create new object of type tset w/ this key
+		if( !(obj = emplace_kvobj(cmds[1], KVTYPE::TSET)) ) {
+			reply(out, RES_ERR, "[ERROR: DB_FULL] No free object slots left");
+			return;
+		}
+	}
+	tset_write(obj);
+	TSet *tset = (TSet*)obj->val_p();
+	mem_sub(obj);
+
+	static vector<sview> names;
+	static vector<double> scores;
+	names.clear();
+	scores.clear();
+	for(size_t i = 2; i < size; i += 2) {
+		double _score = 0; // the longest valid prefix, like strtod, but never past the argument
+		std::from_chars(cmds[i + 1].data(), cmds[i + 1].data() + cmds[i + 1].size(), _score);
+
+		names.push_back(cmds[i]);
+		scores.push_back(_score);
+	}
+
+	size_t updated = 0;
+	const size_t inserted = ts_add(tset, names, scores, updated);
+	mem_add(obj);
+	bump_version(obj);
+	if(inserted > 0)
+		bk_signal(&blocking, cmds[1]);
+
+	reply(out, RES_OK, "[TADD] Inserted: {}, Updated: {}", inserted, updated);
+}
+
+// Loans: a background aggregation reads its input tsets in place until the loop collects it. The loop keeps them
+// as they were meanwhile: a client's write to one waits for the job (see loan_held), the rare writer that can't
+// wait goes to a copy that replaces it in the key, a deleted one is kept, and either way the original is freed
+// once the last job reading it is collected
+static void tset_lend(TSet *tset) {
+	if(!tset)
+		return;
+
+	auto loan = std::find_if(tset_loans.begin(), tset_loans.end(), [tset](const TSetLoan &l) { return l.tset == tset; });
+	if(loan == tset_loans.end())
+		tset_loans.push_back({ .tset = tset, .jobs = 1 });
+	else
+		loan->jobs++;
+}
+static void tset_return(TSet *tset) {
+	auto loan = std::find_if(tset_loans.begin(), tset_loans.end(), [tset](const TSetLoan &l) { return l.tset == tset; });
+	if(loan == tset_loans.end() || --loan->jobs > 0)
+		return;
+
+	if(loan->orphan)
+		lf_release(KVTYPE::TSET, std::move(loan->orphan));
+	tset_loans.erase(loan);
+}
+namespace {
+	TSetLoan *find_loan(const KVObj *obj) {
+		if(tset_loans.empty() || obj->type() != KVTYPE::TSET)
+			return nullptr;
+
+		auto loan = std::find_if(tset_loans.begin(), tset_loans.end(), [obj](const TSetLoan &l) { return l.tset == obj->val_p(); });
+		return loan == tset_loans.end() ? nullptr : &*loan;
+	}
+}
+static void tset_write(KVObj *obj) {
+	TSetLoan *loan = find_loan(obj);
+	if(!loan)
+		return;
+
+	mem_sub(obj);
+	std::unique_ptr<Valtype> copy(ts_clone(loan->tset));
+	loan->orphan = obj->take_val();
+	obj->put_val(std::move(copy));
+	mem_add(obj);
+}
+static void tset_release(KVObj *obj) {
+	if(TSetLoan *loan = find_loan(obj))
+		loan->orphan = obj->take_val();
+}
+
+namespace {
+	constexpr size_t AGG_WORKER_MIN = 16 * 1024; // input members per extra worker thread
+
+	// store_tset: 'tset' replaces whatever 'key' held, an empty one only deletes it. With 'replicate' the replicas
+	// get the result itself, a del and its tadd frames, instead of the command. False when no object slot is left
+	bool store_tset(sview key, std::unique_ptr<TSet> tset, bool replicate) {
+		if(KVObj *old = find_kvobj(key)) {
+			drop_kvobj(old);
+			if(replicate) {
+				const sview del[] = { "del", key };
+				propagate(del);
+			}
+		}
+		if(ts_size(tset.get()) == 0)
+			return true;
+
+		KVObj *obj = emplace_kvobj(key, KVTYPE::TSET);
+		if(!obj) {
+			lf_release(KVTYPE::TSET, std::move(tset));
+			return false;
+		}
+
+		mem_sub(obj);
+		obj->put_val(std::move(tset));
+		mem_add(obj);
+		if(replicate && repl.role == ROLE_PRIMARY && !repl.backlog.buf.empty()) // propagate drops them otherwise
+			tadd_frames(key, (const TSet *)obj->val_p(), [](std::span<const sview> args) { propagate(args); });
+		bk_signal(&blocking, key);
+		return true;
+	}
+	void store_reply(AggJob *job, size_t members, bool stored, Response &out) {
+		const std::string res = stored ? fmt("[{}] Members: {}", job->op == AGG_INTER ? "TINTERSTORE" : "TUNIONSTORE", members)
+		                               : std::string("[ERROR: DB_FULL] No free object slots left");
 		out.data.assign(res.begin(), res.end());
+		out.status = stored ? RES_OK : RES_ERR;
+	}
+}
+
+// tunionstore/tinterstore dest numkeys key [key ...] [weights w [w ...]] [aggregate sum|min|max]
+// Inputs with a lot of members are combined on the aggregation thread, the client waits for the reply while
+// the loop goes on serving everyone else, see agg_cron
+void do_tsetstore(vector<sview> &cmds, Response &out) {
+	auto fail = [&](std::string msg) {
+		out.data.assign(msg.begin(), msg.end());
 		out.status = RES_ERR;
-		return;
+	};
+
+	size_t nkeys = 0;
+	const auto [end, ec] = std::from_chars(cmds[2].data(), cmds[2].data() + cmds[2].size(), nkeys);
+	if(ec != std::errc{} || end != cmds[2].data() + cmds[2].size() || nkeys == 0 || nkeys > cmds.size() - 3)
+		return fail("[ERROR: SYNTAX] numkeys has to be between 1 and the number of keys given");
+
+	auto job = std::make_unique<AggJob>();
+	job->op = cmds[0] == "tinterstore" ? AGG_INTER : AGG_UNION;
+	vector<double> weights(nkeys, 1.0);
+	for(size_t i = 3 + nkeys; i < cmds.size();) {
+		if(cmds[i] == "weights" && i + nkeys < cmds.size()) {
+			for(size_t k = 0; k < nkeys; k++) {
+				const sview w = cmds[i + 1 + k];
+				const auto [wend, wec] = std::from_chars(w.data(), w.data() + w.size(), weights[k]);
+				if(wec != std::errc{} || wend != w.data() + w.size())
+					return fail(fmt("[ERROR: SYNTAX] Weight '{}' isn't a number", w));
+			}
+			i += 1 + nkeys;
+		} else if(cmds[i] == "aggregate" && i + 1 < cmds.size()) {
+			if(cmds[i + 1] == "sum")
+				job->func = AGG_SUM;
+			else if(cmds[i + 1] == "min")
+				job->func = AGG_MIN;
+			else if(cmds[i + 1] == "max")
+				job->func = AGG_MAX;
+			else
+				return fail("[ERROR: SYNTAX] aggregate is one of sum, min, max");
+			i += 2;
+		} else {
+			return fail(fmt("[ERROR: SYNTAX] Unexpected '{}'", cmds[i]));
+		}
+	}
+
+	if(srv_cfg.cluster_enabled && !from_primary() && !(cur_client && cur_client->cluster_import)) {
+		const uint16_t slot = cl_key_slot(cmds[1]);
+		for(size_t k = 0; k < nkeys; k++) {
+			if(cl_key_slot(cmds[3 + k]) != slot)
+				return fail("[ERROR: CROSSSLOT] Keys in request don't hash to the same slot");
+		}
+	}
+
+	vector<TSet *> sources(nkeys);
+	for(size_t k = 0; k < nkeys; k++) {
+		if(!(sources[k] = find_tset(cmds[3 + k])))
+			return fail("[ERROR: TYPE_MM] Was expecting TSET type");
 	}
-	if(tset == &NILTSET) { // No kv object with this key found, create new object of type tset w/ this key
-		tset = (TSet*)emplace_kvobj(cmds[1], KVTYPE::TSET)->val_p();
+	for(size_t k = 0; k < nkeys; k++)
+		ag_input(job.get(), sources[k] == &NILTSET ? nullptr : sources[k], weights[k]);
+
+	const size_t nmembers = ag_members(job.get());
+	job->nthreads = (uint32_t)std::min<size_t>(srv_cfg.agg_threads, 1 + nmembers / AGG_WORKER_MIN);
+
+	// a replica's stream, a transaction and a migration's link can't be held up, they always run inline
+	const bool background = srv_cfg.agg_background_members && nmembers >= srv_cfg.agg_background_members &&
+	                        cur_client && !from_primary() && !repl.in_exec && !cur_client->cluster_import;
+	if(background) {
+		job->dest = cmds[1];
+		job->client = cur_client;
+		cur_client->blocked = true;
+		for(const AggInput &in : job->inputs)
+			tset_lend(in.tset);
+		agg_jobs.push_back(job.get());
+		ag_submit(std::move(job));
+
+		out.status = RES_NOREPLY;
+		return;
 	}
 
-	double _score;
-	size_t inserted = 0, updated = 0;
-	for(size_t i = 2; i < size; i++) {
-		_score = strtod(cmds[i + 1].data(), nullptr);
+	ag_run(job.get());
+	const size_t members = ts_size(job->result.get());
+	store_reply(job.get(), members, store_tset(cmds[1], std::move(job->result), false), out);
+}
+
+static void agg_cron() {
+	while(std::unique_ptr<AggJob> job = ag_poll()) {
+		std::erase(agg_jobs, job.get());
+		for(const AggInput &in : job->inputs)
+			tset_return(in.tset);
 
-		if( TSTNode *found = ts_find(tset, cmds[i]) ) {
-			ts_update(tset, found, _score);
-			updated++;
+		Response reply;
+		const uint16_t slot = cl_key_slot(job->dest);
+		if(srv_cfg.cluster_enabled && !cl_mine(&cluster, slot)) { // migrated away while the job ran
+			const std::string res = fmt("[ERROR: TRYAGAIN] Slot {} moved while the aggregation ran", slot);
+			reply.data.assign(res.begin(), res.end());
+			reply.status = RES_ERR;
+			lf_release(KVTYPE::TSET, std::move(job->result));
 		} else {
-			ts_insertn(tset, std::string(cmds[i]), _score);
-			inserted++;
+			const size_t members = ts_size(job->result.get());
+			store_reply(job.get(), members, store_tset(job->dest, std::move(job->result), true), reply);
+		}
+
+		if(Conn *conn = job->client) {
+			make_response(reply, conn);
+			conn->blocked = false;
+			process_input(conn); // the requests it pipelined meanwhile, then the replies go out
 		}
-		i++;
+
+		std::vector<Conn *> waits; // rerun the writes parked on loans, those whose set is still lent park again
+		waits.swap(loan_waits);
+		for(Conn *conn : waits) {
+			conn->loan_wait = false;
+			conn->blocked = false;
+			process_input(conn);
+		}
+		if(!blocking.ready.empty())
+			serve_blocked();
 	}
+}
 
-	res = fmt("[TADD] Inserted: {}, Updated: {}", inserted, updated);
-	out.data.assign(res.begin(), res.end());
-	out.status = RES_OK;
+namespace {
+	// pop_member: takes the lowest (or highest) member off the tset in 'obj', deleting the key once it's empty
+	void pop_member(KVObj *obj, bool max, std::string &name, double &score) {
+		tset_write(obj);
+		TSet *tset = (TSet *)obj->val_p();
+		TSTNode *node = max ? ts_max(tset) : ts_min(tset);
+		name  = std::move(node->name);
+		score = node->tnode.key;
+
+		mem_sub(obj);
+		ts_delete(tset, node, true);
+		mem_add(obj);
+		bump_version(obj);
+		if(ts_size(tset) == 0)
+			drop_kvobj(obj);
+	}
+	// unblock: answers a client parked by btpopmin/btpopmax, the requests it pipelined meanwhile run
+	// once the reply is out, see handle_write
+	void unblock(BkWait *wait, uint32_t status, sview text) {
+		Conn *conn = wait->conn;
+		conn->bwait = nullptr;
+		conn->blocked = false;
+		bk_unblock(&blocking, wait);
+
+		Response reply;
+		reply.status = status;
+		reply.data.assign(text.begin(), text.end());
+		make_response(reply, conn);
+		conn->state &= ~ConnState::RECVING;
+		conn->state |=  ConnState::SENDING;
+		bk_woken = true;
+	}
+}
+
+// tpopmin/tpopmax key [count], 'count' members off the low (high) end of the order, lowest (highest) first
+void do_tpop(vector<sview> &cmds, Response &out) {
+	const bool max = cmds[0] == "tpopmax";
+
+	size_t count = 1;
+	if(cmds.size() > 3) {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] Expected '{} key [count]'", cmds[0]);
+		return;
+	}
+	if(cmds.size() == 3) {
+		const auto [end, ec] = std::from_chars(cmds[2].data(), cmds[2].data() + cmds[2].size(), count);
+		if(ec != std::errc{} || end != cmds[2].data() + cmds[2].size() || count == 0) {
+			reply(out, RES_ERR, "[ERROR: SYNTAX] count has to be a positive integer");
+			return;
+		}
+	}
+
+	KVObj *obj = lookup_kvobj(cmds[1]);
+	if(!obj) {
+		reply(out, RES_NX, "[NULL] No TSet object with key {}", cmds[1]);
+		return;
+	}
+	if(obj->type() != KVTYPE::TSET) {
+		reply(out, RES_ERR, "[ERROR: TYPE_MM] Was expecting TSET type");
+		return;
+	}
+
+	count = std::min(count, ts_size((TSet *)obj->val_p()));
+	reply(out, RES_OK, "[{}] {}\n", max ? "TPOPMAX" : "TPOPMIN", count);
+	std::string name;
+	double score;
+	for(size_t i = 0; i < count; i++) { // the last pop may delete 'obj'
+		pop_member(obj, max, name, score);
+		reply_append(out, "{}) {} {}\n", i, name, score);
+	}
+}
+
+// btpopmin/btpopmax key [key ...] timeout, in seconds, 0 waits for good. Pops one member of the first key that
+// has some, otherwise the client is parked until one of them gets members: clients parked on a key are served
+// oldest first, right after the write that filled it. Timeouts are checked every 1000 / hz ms
+void do_btpop(vector<sview> &cmds, Response &out) {
+	const bool max = cmds[0] == "btpopmax";
+
+	double timeout = -1;
+	const sview arg = cmds.back();
+	const auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), timeout);
+	if(ec != std::errc{} || end != arg.data() + arg.size() || !(timeout >= 0) || timeout > 1e9) {
+		reply(out, RES_ERR, "[ERROR: SYNTAX] timeout has to be a number of seconds, 0 or more");
+		return;
+	}
+
+	const std::span<const sview> keys(cmds.data() + 1, cmds.size() - 2);
+	KVObj *first = nullptr;
+	sview first_key;
+	for(sview key : keys) {
+		KVObj *obj = lookup_kvobj(key);
+		if(obj && obj->type() != KVTYPE::TSET) {
+			reply(out, RES_ERR, "[ERROR: TYPE_MM] Was expecting TSET type");
+			return;
+		}
+		if(obj && !first) {
+			first = obj;
+			first_key = key;
+		}
+	}
+
+	if(first) {
+		std::string name;
+		double score;
+		pop_member(first, max, name, score);
+
+		reply(out, RES_OK, "[{}] {} {} {}", max ? "BTPOPMAX" : "BTPOPMIN", first_key, name, score);
+		return;
+	}
+
+	// a replica's stream, a transaction and a migration's link can't wait
+	if(!cur_client || from_primary() || repl.in_exec || cur_client->cluster_import) {
+		reply(out, RES_NX, "[NULL] No member to pop");
+		return;
+	}
+
+	const uint64_t deadline = timeout > 0 ? utils::mono_ms() + std::max<uint64_t>(1, (uint64_t)(timeout * 1000)) : 0;
+	cur_client->bwait = bk_block(&blocking, cur_client, keys, max, deadline);
+	cur_client->blocked = true;
+	out.status = RES_NOREPLY; // unblock answers, and the pop goes to the replicas as a tpopmin/tpopmax
+}
+
+static void serve_blocked() {
+	std::vector<std::string> keys;
+	while(!blocking.ready.empty()) { // a served client's pop may not satisfy the next key's waiters
+		keys.clear();
+		keys.swap(blocking.ready);
+
+		for(const std::string &key : keys) {
+			while(BkWait *wait = bk_first(&blocking, key)) {
+				KVObj *obj = lookup_kvobj(key);
+				if(!obj || obj->type() != KVTYPE::TSET) // emptied, or overwritten, since it got members
+					break;
+
+				std::string name;
+				double score;
+				const bool max = wait->max;
+				pop_member(obj, max, name, score);
+
+				const sview pop[] = { max ? "tpopmax" : "tpopmin", key };
+				propagate(pop);
+				unblock(wait, RES_OK, fmt("[{}] {} {} {}", max ? "BTPOPMAX" : "BTPOPMIN", key, name, score));
+			}
+			bk_served(&blocking, key);
+		}
+	}
+}
+
+static bool bk_cron(uint64_t now_ms) {
+	tw_advance(&blocking.timeouts, now_ms);
+	while(TWNode *due = tw_pop_due(&blocking.timeouts))
+		unblock(get_bkwait(due), RES_NX, "[NULL] Timed out");
+
+	return blocking.timeouts.size > 0;
 }
 
 } // namespace redbrouk
@@ -1,6 +1,7 @@
 #ifndef REDBROUK_IO_H
 #define REDBROUK_IO_H
 
+#include <span>
 #include <vector>
 #include <string>
 #include <cstdlib>
@@ -16,8 +17,11 @@ using std::byte;
 using sview = std::string_view;
 
 class Conn;
+class KVObj;
+struct tset;
 
 constexpr size_t MAX_PFDS = 1024;
+constexpr size_t MAX_FRAME = 20000; // bytes of a request frame past its length, from any client or node
 enum ev_type {
 	NIL = 0,
 	CAN_RD,
@@ -32,16 +36,15 @@ struct fdEvent {
 typedef struct io_context {
 	std::vector<struct pollfd> pfds;
 
-	void init(uint16_t _port = 16000);
+	// a nonzero '_metrics_port' opens a second listener serving GET /metrics, see metrics.h
+	void init(uint16_t _port = 16000, uint16_t _metrics_port = 0);
 	void main_loop();
 
 	void stop() { running = false; }
 
 	bool running = true;
 	socket_t highFd = -1;
-
-	byte recv_buf[1024 * 4];
-	byte send_buf[1024 * 4];
+	socket_t metrics_fd = -1;
 } ioc; // struct io_context
 
 struct Response {
@@ -53,13 +56,34 @@ enum {
     RES_OK = 0,
     RES_ERR = 1,
     RES_NX = 2,
+    RES_NOREPLY = 3, // internal, the handler wrote whatever goes back itself
 };
 
 static void handle_read(Conn *conn);
 static void handle_write(Conn *conn);
+static void process_input(Conn *conn);
+static void drop_client(Conn *conn); // releases what the server holds for a client about to be deleted
+static void propagate(std::span<const std::string_view> args); // feeds a write to the backlog and the replicas
+static void propagate_command(std::span<const std::string_view> cmd); // propagate, with relative ttls made absolute
+static void link_input(Conn *conn); // replica side, applies what the primary sent
+static bool repl_cron(uint64_t now_ms);
+static void cluster_link_input(Conn *conn); // replies on a link this node opened to another
+static void cluster_drop(Conn *conn); // forgets a client the cluster code waits to answer, or a link it opened
+static int  cluster_cron(uint64_t now_ms); // sends a running slot migration's next batch. 0 when the loop has to come right back, 1 while replies are due, -1 with none running
+static void agg_cron(); // stores finished background aggregations and answers their clients
+static void tset_lend(tset *tst);     // the tset is read by a background aggregation until tset_return
+static void tset_return(tset *tst);
+static void tset_write(KVObj *obj);   // before a tset is changed: a copy replaces it while it's lent, for the writers loan_held lets through
+static void tset_release(KVObj *obj); // before a value is freed: a lent tset is kept until its return
+static bool bk_cron(uint64_t now_ms); // times out blocked pops, true while one has a timeout
+static void serve_blocked(); // pops for the clients parked on keys that got members
+static void scrape_input(Conn *conn); // reads a metrics scrape's http request and answers its header
+static bool scrape_cron(); // renders the next chunk of every scrape under way, true while one can go on
 static void do_request(std::vector<std::string> &cmd, Response &out);
 static int  try_request(Conn *conn);
 static int32_t parse_req(const std::byte*, size_t, std::vector<std::string_view>&);
+static void db_init();
+static int  run_cycle();
 
 void sigint_handler(int sig_num);
 } // namespace redbrouk
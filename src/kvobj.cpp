@@ -10,13 +10,13 @@ namespace redbrouk
 
 IKVValtype IKVValtype::NIL;
 
-KVObj::KVObj(KVTYPE _type) : m_type(_type) {
+KVObj::KVObj(KVTYPE _type) : m_type(_type), m_lru(0) {
 	switch(_type) {
 		case KVTYPE::STRING:
 			m_val = std::make_unique<String>();
 			break;
 		case KVTYPE::HASH:
-			m_val = std::make_unique<iHMap>();
+			m_val = std::make_unique<Hash>();
 			break;
 		case KVTYPE::TSET:
 			m_val = std::make_unique<TSet>();
@@ -26,4 +26,36 @@ KVObj::KVObj(KVTYPE _type) : m_type(_type) {
 	}
 }
 
+MemUsage KVObj::mem_usage() const {
+	MemUsage out{
+		.overhead = sizeof(KVObj) + mem_str_heap(m_key) - m_key.size(),
+		.payload  = m_key.size()
+	};
+
+	switch(m_type) {
+		case KVTYPE::STRING: {
+			const String &str = (const String&)val();
+			out.overhead += mem_alloc_size(sizeof(String)) + mem_str_heap(str) - str.size();
+			out.payload  += str.size();
+			break;
+		}
+		case KVTYPE::HASH: {
+			const Hash &hash = (const Hash&)val();
+			out.overhead += mem_alloc_size(sizeof(Hash)) + ihs_bucket_mem(&hash.table);
+			out += hash.pair_mem;
+			break;
+		}
+		case KVTYPE::TSET: {
+			const TSet &tset = (const TSet&)val();
+			out.overhead += mem_alloc_size(sizeof(TSet)) + ihs_bucket_mem(&tset.mts_mp);
+			out += tset.node_mem;
+			break;
+		}
+		default:
+			break;
+	}
+
+	return out;
+}
+
 } // namespace redbrouk
@@ -2,6 +2,7 @@
 #define REDBROUK_KVOBJ_H
 
 #include "src/hash.h"
+#include "src/twheel.h"
 #include "src/utils.h"
 
 #include <memory>
@@ -29,7 +30,7 @@ enum class KVTYPE : uint8_t {
 
 class KVObj {
 public:
-	KVObj() : m_type(KVTYPE::INIT) {}
+	KVObj() : m_type(KVTYPE::INIT), m_lru(0) {}
 	KVObj(KVTYPE);
 
 	void rehash_hook() {
@@ -53,6 +54,22 @@ public:
 	[[nodiscard]] const Valtype& val()         const { return (m_val.get() ? *m_val : Valtype::NIL); }
 	[[nodiscard]] Valtype* val_p()                   { return m_val.get(); }
 	[[nodiscard]] const Valtype* val_p()       const { return m_val.get(); }
+	// O(1) memory estimate of the slot, key and value (see mem.h), collections track their members as they change
+	[[nodiscard]] MemUsage mem_usage() const;
+
+	// Expiry, deadlines are absolute monotonic milliseconds (utils::mono_ms), 0 for persistent keys
+	[[nodiscard]] TWNode* ttl_hook()                 { return &m_ttl; }
+	[[nodiscard]] bool has_ttl()               const { return tw_armed(&m_ttl); }
+	[[nodiscard]] uint64_t expire_at()         const { return m_ttl.deadline; }
+	[[nodiscard]] bool expired(uint64_t now)   const { return has_ttl() && m_ttl.deadline <= now; }
+
+	// Access metadata for eviction, an lru clock or an lfu counter depending on the policy (see evict.h)
+	[[nodiscard]] uint32_t lru()               const { return m_lru; }
+	void set_lru(uint32_t lru) noexcept { m_lru = lru; }
+
+	// Version of the last write, from a db wide clock so a deleted and recreated key never repeats one (see watch)
+	[[nodiscard]] uint64_t version()           const { return m_version; }
+	void set_version(uint64_t version) noexcept { m_version = version; }
 
 	// Mutators
 	void set_key(std::string &new_key) noexcept {
@@ -63,6 +80,10 @@ public:
 		m_key = new_key;
 		rehash_hook();
 	}
+	// Leaves the object without a value, for freeing it elsewhere (see lazyfree.h)
+	[[nodiscard]] std::unique_ptr<Valtype> take_val() noexcept { return std::move(m_val); }
+	// Replaces the value with one built elsewhere, of the object's type (see aggregate.h)
+	void put_val(std::unique_ptr<Valtype> val) noexcept { m_val = std::move(val); }
 
 	/* cpp 17+
 	template <KVTYPE kvt>
@@ -78,6 +99,9 @@ public:
 private:
 	iHNode m_hook;
 	KVTYPE m_type;
+	uint32_t m_lru : 24; // packed into the padding after m_type
+	TWNode m_ttl;
+	uint64_t m_version = 0;
 
 	std::string m_key;
 	std::unique_ptr<Valtype> m_val;
@@ -85,12 +109,14 @@ private:
 	friend class iHMap;
 	friend KVObj* get_kvobj(iHNode*);
 	friend KVObj& get_kvobj_v(iHNode*);
+	friend KVObj* get_kvobj_t(TWNode*);
 };
 inline KVObj* get_kvobj(iHNode *hook)   { return utils::container_of(hook, &KVObj::m_hook); }
 inline KVObj& get_kvobj_v(iHNode *hook) { return *utils::container_of(hook, &KVObj::m_hook); }
+inline KVObj* get_kvobj_t(TWNode *ttl)  { return utils::container_of(ttl, &KVObj::m_ttl); }
 
 class String;
-class iHMap;
+class Hash;
 typedef struct tset TSet;
 
 template <KVTYPE _type, typename... Args>
@@ -102,7 +128,7 @@ auto KVObj::make_val(Args&&... args) -> std::pair<KVTYPE, Valtype*> {
 		m_val = std::make_unique<String>(std::forward<Args>(args)...);
 	}
 	if constexpr (_type == KVTYPE::HASH) {
-		m_val = std::make_unique<iHMap>(std::forward<Args>(args)...);
+		m_val = std::make_unique<Hash>(std::forward<Args>(args)...);
 	}
 	if constexpr (_type == KVTYPE::TSET) {
 		m_val = std::make_unique<TSet>(std::forward<Args>(args)...);
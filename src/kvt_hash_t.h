@@ -110,6 +110,7 @@ private:
 	inline void migrate();
 	void progress_rehash();
 	HashSetNode* table_find(Table &table, string_view _data);
+	Bucket* table_link(Table &table, string_view _data); // the link pointing at the match, for unlinking
 	static void destroy_table(Table &table);
 
 	static size_t max_load;
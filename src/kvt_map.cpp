@@ -9,6 +9,50 @@ namespace {
 	std::string nil = "";
 } // anonymous
 
+Hash::~Hash() {
+	ihs_destroy(&table, [](iHNode *n) { delete utils::container_of(n, &iHMPair::node); });
+}
+
+iHMPair *hm_find(Hash *h, std::string_view field) {
+	iHNode dummy{ nullptr, genHash((const byte *)field.data(), field.length()) };
+	auto eq = [&](const iHNode *a, const iHNode *) -> bool {
+		return utils::container_of((iHNode *)a, &iHMPair::node)->key == field;
+	};
+
+	iHNode *found = ihs_find(&h->table, &dummy, eq);
+	return found ? utils::container_of(found, &iHMPair::node) : nullptr;
+}
+
+bool hm_set(Hash *h, std::string_view field, std::string_view val) {
+	if(iHMPair *pair = hm_find(h, field)) {
+		h->pair_mem -= hmp_mem(pair);
+		pair->val.assign(val);
+		h->pair_mem += hmp_mem(pair);
+		return false;
+	}
+
+	iHMPair *pair = new iHMPair{ { nullptr, genHash((const byte *)field.data(), field.length()) }, string(field), string(val) };
+	ihs_insert(&h->table, &pair->node);
+	h->pair_mem += hmp_mem(pair);
+	return true;
+}
+
+bool hm_del(Hash *h, std::string_view field) {
+	iHNode dummy{ nullptr, genHash((const byte *)field.data(), field.length()) };
+	auto eq = [&](const iHNode *a, const iHNode *) -> bool {
+		return utils::container_of((iHNode *)a, &iHMPair::node)->key == field;
+	};
+
+	iHNode *found = ihs_del(&h->table, &dummy, eq);
+	if(!found)
+		return false;
+
+	iHMPair *pair = utils::container_of(found, &iHMPair::node);
+	h->pair_mem -= hmp_mem(pair);
+	delete pair;
+	return true;
+}
+
 [[nodiscard]]
 bool IntrusiveHashMap::find(std::string& key) const {
 	iHMPair entry;
@@ -18,6 +62,7 @@ bool IntrusiveHashMap::find(std::string& key) const {
 	iHNode *node = ihs_find(&m_table, &entry.node, [&](const iHNode *a, const iHNode *b) {
 		return *a == *b;
 	});
+	entry.key.swap(key);
 
 	return node;
 }
@@ -2,6 +2,7 @@
 #define REDBROUK_MAP_H
 
 #include <string>
+#include <string_view>
 #include <stack>
 
 #include "kvobj.h"
@@ -14,6 +15,8 @@ namespace redbrouk
 class alignas(64) iHMap : public Valtype {
 public:
 	using IKVValtype::IKVValtype;
+	~iHMap() { ihs_destroy(&table, nullptr); } // entries are intrusive, their owners release them
+
 	iHSet table;
 };
 
@@ -23,6 +26,28 @@ typedef struct ihm_pair { // string to string hash map entry pairs
 	string val;
 } iHMPair;
 
+/* HASH - the value of a hash key, field to value. Unlike the keyspace's iHMap it owns its pairs,
+ * each one allocated on its own by hm_set and freed by hm_del or the destructor
+*/
+class Hash : public iHMap {
+public:
+	~Hash(); // releases every pair
+
+	MemUsage pair_mem; // every pair owned by the hash, see hmp_mem
+};
+
+inline size_t hm_size(const Hash *h) {
+	return h->table.curr.size + h->table.prev.size;
+}
+iHMPair *hm_find(Hash *h, std::string_view field);
+bool hm_set(Hash *h, std::string_view field, std::string_view val); // true when 'field' is new
+bool hm_del(Hash *h, std::string_view field); // false when there's no 'field'
+// Memory of one pair: its node and both strings' heap buffers, of which the field and the value are payload
+inline MemUsage hmp_mem(const iHMPair *p) {
+	const size_t payload = p->key.size() + p->val.size();
+	return { mem_alloc_size(sizeof(iHMPair)) + mem_str_heap(p->key) + mem_str_heap(p->val) - payload, payload };
+}
+
 [[nodiscard]]
 constexpr bool operator==(const iHNode &a, const iHNode &b) {
 	iHMPair *first  = utils::container_of((iHNode *)&a, &iHMPair::node);
@@ -37,6 +62,7 @@ public:
 	IntrusiveHashMap() {
 		clear();
 	}
+	~IntrusiveHashMap() { ihs_destroy(&m_table, nullptr); } // entries live in m_elts
 
 	// hash function
 	std::function<size_t (const byte*, size_t)> hash_func = genHash;
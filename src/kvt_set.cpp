@@ -42,11 +42,11 @@ HashSetNode* HashSet::find(string_view _data) {
 
 HashSetNode *HashSet::del(string_view _data) {
 	progress_rehash();
-	if( HashSetNode *match = table_find(curr, _data) ) {
-		return curr.del(match);
+	if( Bucket *link = table_link(curr, _data) ) {
+		return curr.del(*link);
 	}
-	if( HashSetNode *match = table_find(prev, _data) ) {
-		return prev.del(match);
+	if( Bucket *link = table_link(prev, _data) ) {
+		return prev.del(*link);
 	}
 
 	return nullptr;
@@ -105,31 +105,35 @@ void HashSet::progress_rehash() {
 	size_t work_done = 0;
 
 	while(work_done < rehash_work && prev.size > 0) {
-		HashSetNode *node = prev.buckets[migrate_pos];
-		if(!node) {
+		Bucket &head = prev.buckets[migrate_pos];
+		if(!head) {
 			migrate_pos++;
 			continue;
 		}
 
-		curr.take(prev, node);
+		curr.take(prev, head); // unlinks the head from prev's bucket
 		work_done++;
 	}
 }
 
 HashSetNode* HashSet::table_find(Table &table, string_view _data) {
+	Bucket *link = table_link(table, _data);
+	return link ? *link : nullptr;
+}
+HashSet::Bucket* HashSet::table_link(Table &table, string_view _data) {
 	if(!table.buckets)
 		return nullptr;
 
 	NodeDummy dummy(_data);
 
 	const size_t pos = dummy.hash_val & table.mask;
-	Bucket curr_node = table.buckets[pos];
-	
-	while(curr_node) {
-		if(curr_node->hash_val == dummy.hash_val && curr_node->key == dummy.data)
-			return curr_node;
+	Bucket *link = &table.buckets[pos];
+
+	while(*link) {
+		if((*link)->hash_val == dummy.hash_val && (*link)->key == dummy.data)
+			return link;
 
-		curr_node = curr_node->next;
+		link = &(*link)->next;
 	};
 
 	return nullptr;
@@ -4,6 +4,13 @@
 #include "src/hash.h"
 #include "src/utils.h"
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <thread>
+#include <utility>
+#include <vector>
+
 namespace redbrouk
 {
 
@@ -14,6 +21,23 @@ bool tstn_hneq(const iHNode *a, const iHNode *b) {
 			utils::container_of((iHNode *)b, &TSTNode::mpnode)->name;
 }
 
+// (score, name) order of two members, the tree's tie break on equal scores
+int tstn_tiebreak(const RBTNode *a, const RBTNode *b) {
+	const TSTNode *na = utils::container_of((RBTNode *)a, &TSTNode::tnode);
+	const TSTNode *nb = utils::container_of((RBTNode *)b, &TSTNode::tnode);
+	return -ts_namecmp(nb, na->name, na->prefix);
+}
+bool tstn_less(const TSTNode *a, const TSTNode *b) {
+	if(a->tnode.key != b->tnode.key)
+		return a->tnode.key < b->tnode.key;
+	return ts_namecmp(a, b->name, b->prefix) < 0;
+}
+
+tset::~tset() {
+	ihs_destroy(&mts_mp, [](iHNode *n) { del_tstn(utils::container_of(n, &TSTNode::mpnode)); });
+	stm_root = stm_min = stm_max = nullptr;
+}
+
 TSTNode *ts_find(TSet *tst, std::string_view _name) {
 	iHNode dummy{ nullptr, genHash((const byte *)_name.data(), _name.length()) };
 
@@ -32,19 +56,14 @@ TSTNode *ts_find(TSet *tst, std::string_view _name) {
 }
 
 bool ts_insert(TSet *tst, TSTNode *node) {
-	RBTNode *inserted, **found = sbt_search(&tst->stm_root, node->tnode.key);
-
-	if(found) {
-		auto container  = utils::container_of(*found, &TSTNode::tnode);
-		container->next = node;
-		inserted = *found;
-	} else {
-		inserted = rbt_insert(&tst->stm_root, &node->tnode);
-	}
-
-	if(IS_NULL(inserted))
+	if(IS_NULL(rbt_insert(&tst->stm_root, &node->tnode, tstn_tiebreak)))
 		return false;
 
+	if(!tst->stm_min || tstn_less(node, ts_min(tst)))
+		tst->stm_min = &node->tnode;
+	if(!tst->stm_max || tstn_less(ts_max(tst), node))
+		tst->stm_max = &node->tnode;
+
 	ihs_insert(&tst->mts_mp, &node->mpnode);
 	return true;
 }
@@ -52,8 +71,10 @@ bool ts_insert(TSet *tst, TSTNode *node) {
 bool ts_insertn(TSet *tst, std::string &_name, double _score) {
 	TSTNode *in_node = mk_tstn(_name, _score);
 
-	if(ts_insert(tst, in_node))
+	if(ts_insert(tst, in_node)) {
+		tst->node_mem += tstn_mem(in_node);
 		return true;
+	}
 
 	delete in_node;
 	return false;
@@ -61,8 +82,10 @@ bool ts_insertn(TSet *tst, std::string &_name, double _score) {
 bool ts_insertn(TSet *tst, std::string &&_name, double _score) {
 	TSTNode *in_node = mk_tstn(_name, _score);
 
-	if(ts_insert(tst, in_node))
+	if(ts_insert(tst, in_node)) {
+		tst->node_mem += tstn_mem(in_node);
 		return true;
+	}
 
 	delete in_node;
 	return false;
@@ -73,24 +96,22 @@ bool ts_delete(TSet *tst, TSTNode *del_node, bool reclaim_mem = false) {
 
 	ihs_del(&tst->mts_mp, &del_node->mpnode, tstn_hneq);
 
-	if(del_node->next) {
-		if(&del_node->tnode == tst->stm_root)
-			tst->stm_root = &del_node->next->tnode;
+	if(tst->stm_min == &del_node->tnode)
+		tst->stm_min = sbt_walk(tst->stm_min, 1);
+	if(tst->stm_max == &del_node->tnode)
+		tst->stm_max = sbt_walk(tst->stm_max, ~1); // one step back
+	rbt_delete(&tst->stm_root, &del_node->tnode);
 
-		sbt_replace(&del_node->tnode, &del_node->next->tnode);
-		del_node->next = nullptr;
-	} else {
-		rbt_delete(&tst->stm_root, &del_node->tnode);
-	}
-
-	if(reclaim_mem)
+	if(reclaim_mem) {
+		tst->node_mem -= tstn_mem(del_node);
 		del_tstn(del_node);
+	}
 
 	return true;
 }
 bool ts_deleten(TSet *tst, std::string_view _name) {
 	TSTNode *del_node = ts_find(tst, _name);
-	return ts_delete(tst, del_node);
+	return ts_delete(tst, del_node, true);
 }
 
 bool ts_update(TSet *tst, TSTNode *node, double _score) {
@@ -100,13 +121,163 @@ bool ts_update(TSet *tst, TSTNode *node, double _score) {
 	node->tnode.key   = _score;
 	node->tnode.left  = &NILNODE;
 	node->tnode.right = &NILNODE;
-	node->tnode.color = RBTNode::RED;
+	node->tnode.set_color(RBTNode::RED);
 
 	ts_insert(tst, node);
 
 	return true;
 }
 
+namespace {
+	constexpr size_t TS_BULK_MIN     = 64;      // smaller batches always go in one by one
+	constexpr size_t TS_PAR_SORT_MIN = 1 << 16; // batches this big are sorted on several threads
+
+	// batch members sort as (score, node) pairs, the scores then sit together instead of one per node. Names
+	// only break ties, mostly on the prefix cached next to the tree node
+	using ScoredNode = std::pair<double, TSTNode *>;
+	bool score_less(const ScoredNode &a, const ScoredNode &b) {
+		if(a.first != b.first)
+			return a.first < b.first;
+		return ts_namecmp(a.second, b.second->name, b.second->prefix) < 0;
+	}
+
+	// sort_scores: big batches are cut in chunks sorted on up to 4 threads, then merged back pairwise
+	void sort_scores(std::vector<ScoredNode> &nodes) {
+		const size_t nthreads = std::min<size_t>(4, std::thread::hardware_concurrency());
+		if(nodes.size() < TS_PAR_SORT_MIN || nthreads < 2) {
+			std::sort(nodes.begin(), nodes.end(), score_less);
+			return;
+		}
+
+		const size_t chunk = (nodes.size() + nthreads - 1) / nthreads;
+		auto chunk_end = [&](size_t at) { return nodes.begin() + std::min(at, nodes.size()); };
+
+		std::vector<std::thread> workers;
+		for(size_t at = chunk; at < nodes.size(); at += chunk) // the first chunk is this thread's
+			workers.emplace_back([&, at] { std::sort(nodes.begin() + at, chunk_end(at + chunk), score_less); });
+		std::sort(nodes.begin(), chunk_end(chunk), score_less);
+		for(std::thread &w : workers)
+			w.join();
+
+		for(size_t width = chunk; width < nodes.size(); width *= 2) {
+			for(size_t lo = 0; lo + width < nodes.size(); lo += 2 * width)
+				std::inplace_merge(nodes.begin() + lo, nodes.begin() + lo + width, chunk_end(lo + 2 * width), score_less);
+		}
+	}
+
+	// build_balanced: the tree over heads[lo, hi), split at the middle. Every level but the deepest is full,
+	// so with the deepest level red and the rest black each path has the same number of black nodes
+	RBTNode *build_balanced(ScoredNode *heads, size_t lo, size_t hi, RBTNode *parent, size_t depth, size_t red_depth) {
+		if(lo == hi)
+			return &NILNODE;
+
+		const size_t mid = lo + (hi - lo) / 2;
+		RBTNode *node = &heads[mid].second->tnode;
+		*node = { parent, { &NILNODE, &NILNODE }, node->key, depth == red_depth ? RBTNode::RED : RBTNode::BLACK };
+		node->left  = build_balanced(heads, lo, mid, node, depth + 1, red_depth);
+		node->right = build_balanced(heads, mid + 1, hi, node, depth + 1, red_depth);
+		return node;
+	}
+
+	// ts_rebuild: the bulk path of ts_add
+	size_t ts_rebuild(TSet *tst, std::span<const std::string_view> names, std::span<const double> scores, size_t &updated) {
+		// every member in order, taken before any score changes
+		std::vector<ScoredNode> members;
+		members.reserve(ts_size(tst) + names.size());
+		for(RBTNode *n = tst->stm_min; n; n = sbt_walk(n, 1))
+			members.emplace_back(n->key, utils::container_of(n, &TSTNode::tnode));
+
+		// new members need a place in the order; rescored ones a new one, and leave their old
+		ihs_reserve(&tst->mts_mp, ts_size(tst) + names.size());
+		std::vector<TSTNode *> moved, rescored;
+		moved.reserve(names.size());
+		size_t inserted = 0;
+		for(size_t i = 0; i < names.size(); i++) {
+			if(TSTNode *found = ts_find(tst, names[i])) {
+				found->tnode.key = scores[i];
+				rescored.push_back(found);
+				updated++;
+				continue;
+			}
+
+			std::string name(names[i]);
+			TSTNode *node = mk_tstn(name, scores[i]);
+			ihs_insert(&tst->mts_mp, &node->mpnode);
+			tst->node_mem += tstn_mem(node);
+			moved.push_back(node);
+			inserted++;
+		}
+
+		// a rescored node can be one of this batch's new ones, already in 'moved', or named twice
+		if(!rescored.empty()) {
+			std::sort(moved.begin(), moved.end());
+			std::sort(rescored.begin(), rescored.end());
+			rescored.erase(std::unique(rescored.begin(), rescored.end()), rescored.end());
+			std::erase_if(members, [&](const ScoredNode &m) { return std::binary_search(rescored.begin(), rescored.end(), m.second); });
+			std::erase_if(rescored, [&](TSTNode *r) { return std::binary_search(moved.begin(), moved.end(), r); });
+			moved.insert(moved.end(), rescored.begin(), rescored.end());
+		}
+
+		std::vector<ScoredNode> batch;
+		batch.reserve(moved.size());
+		for(TSTNode *node : moved)
+			batch.emplace_back(node->tnode.key, node);
+		sort_scores(batch);
+
+		std::vector<ScoredNode> all(members.size() + batch.size());
+		std::merge(members.begin(), members.end(), batch.begin(), batch.end(), all.begin(), score_less);
+
+		tst->stm_root = tst->stm_min = tst->stm_max = nullptr;
+		if(!all.empty()) {
+			tst->stm_root = build_balanced(all.data(), 0, all.size(), nullptr, 0, std::bit_width(all.size()) - 1);
+			tst->stm_root->set_color(RBTNode::BLACK);
+			tst->stm_min = &all.front().second->tnode;
+			tst->stm_max = &all.back().second->tnode;
+		}
+		return inserted;
+	}
+}
+
+size_t ts_add(TSet *tst, std::span<const std::string_view> names, std::span<const double> scores, size_t &updated) {
+	const size_t n = ts_size(tst), b = names.size();
+	updated = 0;
+
+	// one by one costs about b * log(n) rebalancing steps, a rebuild about n + b * log(b): the rebuild wins once
+	// the batch is around n / log(n) members or more. NaN scores have no place in a sort
+	const bool bulk = b >= TS_BULK_MIN && b * std::bit_width(n + b) >= n &&
+	                  std::none_of(scores.begin(), scores.end(), [](double s) { return std::isnan(s); });
+	if(bulk)
+		return ts_rebuild(tst, names, scores, updated);
+
+	size_t inserted = 0;
+	for(size_t i = 0; i < b; i++) {
+		if(TSTNode *found = ts_find(tst, names[i])) {
+			ts_update(tst, found, scores[i]);
+			updated++;
+		} else {
+			ts_insertn(tst, std::string(names[i]), scores[i]);
+			inserted++;
+		}
+	}
+	return inserted;
+}
+
+TSet *ts_clone(TSet *tst) {
+	std::vector<std::string_view> names;
+	std::vector<double> scores;
+	names.reserve(ts_size(tst));
+	scores.reserve(ts_size(tst));
+	for(TSTNode *n = ts_min(tst); n; n = ts_walk(n, 1)) {
+		names.push_back(n->name);
+		scores.push_back(n->tnode.key);
+	}
+
+	TSet *out = mk_tset();
+	size_t updated;
+	ts_add(out, names, scores, updated);
+	return out;
+}
+
 TSTNode *ts_seek(TSet *tst, double _score) {
 	RBTNode *node = tst->stm_root;
 	RBTNode *out = nullptr;
@@ -127,50 +298,56 @@ TSTNode *ts_seek(TSet *tst, double _score) {
 	return nullptr;
 }
 
-TSTNode *ts_walk(TSTNode *n, ssize_t offset, TSTNode *head) {
-	RBTNode *sbt_walk_forw(RBTNode *);
-	RBTNode *sbt_walk_back(RBTNode *);
+TSTNode *ts_seek_lex(TSet *tst, std::string_view _name, bool exclusive) {
+	const uint64_t prefix = ts_prefix(_name);
+	RBTNode *node = tst->stm_root;
+	RBTNode *out  = nullptr;
 
-	RBTNode *found = &n->tnode;
-	RBTNode* (*walk_func) (RBTNode *) = &sbt_walk_forw;
-	// std::function<RBTNode* (RBTNode *)> walk_func = sbt_walk_forw;
-	if(offset < 0) {
-		offset = ~offset;
-		walk_func = &sbt_walk_back;
+	while(!IS_NULL(node)) {
+		const int cmp = ts_namecmp(utils::container_of(node, &TSTNode::tnode), _name, prefix);
+		if(cmp < 0 || (cmp == 0 && exclusive)) {
+			node = node->right;
+		} else {
+			out  = node;
+			node = node->left;
+		}
 	}
 
-	while(offset-- > 0) {
-		if(n->next) {
-			n = n->next;
-		} else {
-			if(head)
-				found = &head->tnode;
+	return out ? utils::container_of(out, &TSTNode::tnode) : nullptr;
+}
 
-			found = walk_func(found);
-			n = utils::container_of(found, &TSTNode::tnode);
-			if(head)
-				head = n;
-		}
+bool ts_parse_lex_bound(std::string_view arg, TSLexBound &out) {
+	if(arg == "-" || arg == "+") {
+		out.end = arg == "-" ? -1 : 1;
+		return true;
 	}
+	if(arg.empty() || (arg[0] != '[' && arg[0] != '('))
+		return false;
 
-	return found ? n : nullptr;
+	out.name = arg.substr(1);
+	out.prefix = ts_prefix(out.name);
+	out.exclusive = arg[0] == '(';
+	return true;
+}
+
+TSTNode *ts_lex_first(TSet *tst, const TSLexBound &min) {
+	if(min.end)
+		return min.end < 0 ? ts_min(tst) : nullptr;
+	return ts_seek_lex(tst, min.name, min.exclusive);
+}
+
+TSTNode *ts_walk(TSTNode *n, ssize_t offset) {
+	RBTNode *found = sbt_walk(&n->tnode, offset);
+	return found ? utils::container_of(found, &TSTNode::tnode) : nullptr;
 }
 
 TSTNode *ts_at(TSet *tst, ssize_t offset) {
-	TSTNode *node  = utils::container_of(tst->stm_root, &TSTNode::tnode);
-	RBTNode *tnode = &node->tnode;
 	size_t size = ts_size(tst);
 
 	assert(offset < size && "Offset less than size of tset");
 	assert((offset >= 0 || size + offset >= 0) && "Negative offset abs val less than size of tset");
 
-	while(!IS_NULL(tnode->left))
-		tnode = tnode->left;
-
-	node = utils::container_of(tnode, &TSTNode::tnode);
-	node = ts_walk(node, offset);
-
-	return node;
+	return ts_walk(ts_min(tst), offset);
 }
 
 } // namespace redbrouk
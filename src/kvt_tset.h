@@ -1,7 +1,13 @@
 #ifndef REDBROUK_TSET_H
 #define REDBROUK_TSET_H
 
+#include <algorithm>
+#include <bit>
+#include <span>
 #include <string>
+#include <string_view>
+
+#include <cstring>
 
 #include "kvobj.h"
 #include "src/sbtree.h"
@@ -10,21 +16,46 @@ namespace redbrouk
 {
 
 /* TSET NODE - Node for tset type, has intrusive nodes for balanced tree and hash kvt_map.
- * Can be indexed by score through tnode and by name through mpnode.
+ * Can be indexed by (score, name) through tnode and by name through mpnode. Equal scores are ordered
+ * by name, so every member is a tree node of its own and lex ranges can seek in the tree.
  * Needs constructor due to std::string usage, will change in future
 */
 typedef struct tst_node {
 	iHNode mpnode;
 	RBTNode tnode;
 
-	tst_node *next = nullptr;
+	uint64_t prefix = 0; // ts_prefix(name), most name compares end on it without touching the string
 	std::string name;
 } TSTNode;
 
+// ts_prefix: the first 8 bytes of 'name' big endian, zero padded. Unequal prefixes order like the names do
+inline uint64_t ts_prefix(std::string_view name) {
+	byte buf[8] = {};
+	std::memcpy(buf, name.data(), std::min<size_t>(name.size(), 8));
+
+	uint64_t out;
+	std::memcpy(&out, buf, 8);
+	return std::endian::native == std::endian::little ? std::byteswap(out) : out;
+}
+// ts_namecmp: n's name against 'name' (<0, 0, >0), 'prefix' being ts_prefix(name)
+inline int ts_namecmp(const TSTNode *n, std::string_view name, uint64_t prefix) {
+	if(n->prefix != prefix)
+		return n->prefix < prefix ? -1 : 1;
+
+	const size_t skip = std::min({ n->name.size(), name.size(), (size_t)8 }); // equal, the prefixes say
+	return std::string_view(n->name).substr(skip).compare(name.substr(skip));
+}
+
+int tstn_tiebreak(const RBTNode *a, const RBTNode *b); // the score tree's SBTTieBreak, names on equal scores
+
 typedef struct tset : Valtype {
 	using IKVValtype::IKVValtype;
+	~tset(); // releases every member node and both bucket arrays
+
 	RBTNode *stm_root = nullptr;
+	RBTNode *stm_min  = nullptr, *stm_max = nullptr; // ends of the score tree, kept by ts_insert/ts_delete
 	iHSet mts_mp;
+	MemUsage node_mem; // every member node owned by the set, see tstn_mem
 } TSet;
 
 inline size_t ts_size(TSet *tst) {
@@ -38,11 +69,40 @@ bool ts_insertn(TSet *tst, std::string &&_name, double _score);
 bool ts_delete(TSet *tst, TSTNode *node, bool);
 bool ts_deleten(TSet *tst, std::string_view _name);
 bool ts_update(TSet *tst, TSTNode *node, double _score);
+// ts_add: tadd's members, names[i] scored scores[i], a later duplicate wins. Returns how many were new, 'updated'
+// gets how many rescored an existing member. A batch large next to the set is sorted, merged with the members
+// in order and the tree rebuilt balanced in one pass, instead of rebalancing once per member
+size_t ts_add(TSet *tst, std::span<const std::string_view> names, std::span<const double> scores, size_t &updated);
+// ts_clone: a copy of 'tst' with nodes of its own, built in order through the bulk path of ts_add
+TSet *ts_clone(TSet *tst);
+
+// ends of the (score, name) order in O(1), nullptr when the set is empty
+inline TSTNode *ts_min(TSet *tst) { return tst->stm_min ? utils::container_of(tst->stm_min, &TSTNode::tnode) : nullptr; }
+inline TSTNode *ts_max(TSet *tst) { return tst->stm_max ? utils::container_of(tst->stm_max, &TSTNode::tnode) : nullptr; }
 
 TSTNode *ts_find(TSet *tst, std::string_view _name); // Find a node in a tset by name
 TSTNode *ts_seek(TSet *tst, double _score); // Find a node in a tset by score or closest score > '_score'
+// ts_seek_lex: the first member whose name is >= '_name' (> when 'exclusive'), nullptr past the end. Compares
+// names only, so like any lex range it assumes every member has the same score
+TSTNode *ts_seek_lex(TSet *tst, std::string_view _name, bool exclusive);
+
+// TSLexBound: a lex range bound, '[name' inclusive, '(name' exclusive, '-' and '+' the ends of the set
+struct TSLexBound {
+	std::string_view name;
+	uint64_t prefix = 0; // ts_prefix(name), the bound is mostly checked on it
+	bool exclusive = false;
+	int end = 0; // -1 for '-', 1 for '+', 0 for a name
+};
+bool ts_parse_lex_bound(std::string_view arg, TSLexBound &out); // false when it's none of the four forms
+TSTNode *ts_lex_first(TSet *tst, const TSLexBound &min); // first member inside 'min', nullptr if none
+inline bool ts_lex_past(const TSTNode *n, const TSLexBound &max) { // n lies beyond 'max'
+	if(max.end)
+		return max.end < 0;
+	const int cmp = ts_namecmp(n, max.name, max.prefix);
+	return cmp > 0 || (cmp == 0 && max.exclusive);
+}
 TSTNode *ts_at(TSet *tst, ssize_t offset); // Find a node by offset in order
-TSTNode *ts_walk(TSTNode *n, ssize_t offset, TSTNode *head = nullptr);
+TSTNode *ts_walk(TSTNode *n, ssize_t offset); // nullptr once it walks off either end
 
 static TSTNode *mk_tstn(std::string &_name, double _score, TSTNode *place = nullptr) {
 	TSTNode *out;
@@ -54,6 +114,7 @@ static TSTNode *mk_tstn(std::string &_name, double _score, TSTNode *place = null
 	out->tnode = { nullptr , { &NILNODE, &NILNODE }, _score, RBTNode::RED };
 	out->mpnode.next = nullptr;
 	out->mpnode.hval = genHash((const byte *)_name.data(), _name.length());
+	out->prefix = ts_prefix(_name);
 	out->name = std::move(_name);
 
 	return out;
@@ -61,6 +122,11 @@ static TSTNode *mk_tstn(std::string &_name, double _score, TSTNode *place = null
 inline void del_tstn(TSTNode *n) {
 	delete n;
 }
+// Memory of one member: its node and the name's heap buffer, of which the name and the score are payload
+inline MemUsage tstn_mem(const TSTNode *n) {
+	const size_t payload = n->name.size() + sizeof(double);
+	return { mem_alloc_size(sizeof(TSTNode)) + mem_str_heap(n->name) - payload, payload };
+}
 
 static tset *mk_tset(tset *place = nullptr, ih_node **bplace = nullptr) {
 	tset *out;
@@ -0,0 +1,96 @@
+#include "lazyfree.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "src/config.h"
+#include "src/kvt_map.h"
+#include "src/kvt_tset.h"
+
+namespace redbrouk
+{
+
+namespace { // anonymous namespace
+	struct reclaimer {
+		std::mutex lock;
+		std::condition_variable_any wake;
+		std::vector<std::unique_ptr<Valtype>> queue;
+
+		std::atomic<size_t>   pending = 0;
+		std::atomic<uint64_t> freed   = 0;
+
+		std::jthread thread; // last, so it's stopped and joined before the rest goes
+
+		void run(std::stop_token stop) {
+			std::vector<std::unique_ptr<Valtype>> batch;
+
+			while(true) {
+				{
+					std::unique_lock guard(lock);
+					if(!wake.wait(guard, stop, [this] { return !queue.empty(); }))
+						return; // stopping with nothing left
+					batch.swap(queue);
+				}
+
+				const size_t n = batch.size();
+				batch.clear(); // the destructors run here, off the loop
+				pending.fetch_sub(n, std::memory_order_relaxed);
+				freed.fetch_add(n, std::memory_order_relaxed);
+			}
+		}
+		void push(std::vector<std::unique_ptr<Valtype>> &vals) {
+			pending.fetch_add(vals.size(), std::memory_order_relaxed);
+			{
+				std::lock_guard guard(lock);
+				if(!thread.joinable())
+					thread = std::jthread([this](std::stop_token stop) { run(stop); });
+
+				if(queue.empty())
+					queue.swap(vals);
+				else
+					std::move(vals.begin(), vals.end(), std::back_inserter(queue));
+			}
+			wake.notify_one();
+		}
+	};
+
+	reclaimer &rc() {
+		static reclaimer instance;
+		return instance;
+	}
+}
+
+size_t lf_effort(KVTYPE type, const Valtype *val) {
+	if(!val)
+		return 0;
+
+	switch(type) {
+		case KVTYPE::TSET:
+			return 1 + ts_size((TSet *)val);
+		case KVTYPE::HASH:
+			return 1 + hm_size((Hash *)val);
+		default: // a string's one buffer
+			return 1;
+	}
+}
+
+void lf_release(KVTYPE type, std::unique_ptr<Valtype> val) {
+	if(lf_effort(type, val.get()) <= srv_cfg.lazyfree_threshold)
+		return; // 'val' goes out of scope here
+
+	std::vector<std::unique_ptr<Valtype>> one;
+	one.push_back(std::move(val));
+	rc().push(one);
+}
+
+void lf_release_all(std::vector<std::unique_ptr<Valtype>> &&vals) {
+	if(!vals.empty())
+		rc().push(vals);
+}
+
+size_t   lf_pending() { return rc().pending.load(std::memory_order_relaxed); }
+uint64_t lf_freed()   { return rc().freed.load(std::memory_order_relaxed); }
+
+} // namespace redbrouk
@@ -0,0 +1,32 @@
+#ifndef REDBROUK_LAZYFREE_H
+#define REDBROUK_LAZYFREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "src/kvobj.h"
+
+namespace redbrouk
+{
+
+/* LAZY FREE - values whose destruction would stall the loop are destroyed on a background thread.
+ * The effort of freeing a value is the number of allocations behind it: 1 + members for a tset, 1 for a
+ * string however long. Above 'lazyfree-threshold' the value is queued, below it freeing
+ * inline is cheaper than the handoff. The reclaimer starts on first use and is joined at exit.
+ * Only values travel to the thread: by then they are unlinked from everything the loop can reach.
+ */
+size_t lf_effort(KVTYPE type, const Valtype *val);
+
+// lf_release: frees 'val' now or queues it, by its effort against the threshold
+void lf_release(KVTYPE type, std::unique_ptr<Valtype> val);
+// lf_release_all: one handoff for a whole batch (flushdb), queued whatever the size of each value
+void lf_release_all(std::vector<std::unique_ptr<Valtype>> &&vals);
+
+size_t   lf_pending(); // values queued and not yet freed
+uint64_t lf_freed();   // values freed by the reclaimer since start
+
+} // namespace redbrouk
+
+#endif
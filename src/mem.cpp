@@ -0,0 +1,42 @@
+#include "mem.h"
+
+#include <new>
+
+namespace redbrouk
+{
+
+std::atomic<size_t> mem_allocated{ 0 };
+
+} // namespace redbrouk
+
+// Replacements of the global allocation functions, counted through redbrouk::mem_allocated
+namespace {
+	void *counted_new(size_t n) {
+		void *p = redbrouk::mem_malloc(n ? n : 1);
+		if(!p)
+			throw std::bad_alloc();
+		return p;
+	}
+	void *counted_new(size_t n, std::align_val_t al) {
+		void *p = aligned_alloc((size_t)al, (n + (size_t)al - 1) & ~((size_t)al - 1));
+		if(!p)
+			throw std::bad_alloc();
+
+		redbrouk::mem_allocated.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+		return p;
+	}
+}
+
+void *operator new(size_t n)                                { return counted_new(n); }
+void *operator new[](size_t n)                              { return counted_new(n); }
+void *operator new(size_t n, std::align_val_t al)           { return counted_new(n, al); }
+void *operator new[](size_t n, std::align_val_t al)         { return counted_new(n, al); }
+
+void operator delete(void *p) noexcept                      { redbrouk::mem_free(p); }
+void operator delete[](void *p) noexcept                    { redbrouk::mem_free(p); }
+void operator delete(void *p, size_t) noexcept              { redbrouk::mem_free(p); }
+void operator delete[](void *p, size_t) noexcept            { redbrouk::mem_free(p); }
+void operator delete(void *p, std::align_val_t) noexcept    { redbrouk::mem_free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept  { redbrouk::mem_free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept   { redbrouk::mem_free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { redbrouk::mem_free(p); }
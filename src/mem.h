@@ -0,0 +1,68 @@
+#ifndef REDBROUK_MEM_H
+#define REDBROUK_MEM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+
+#include <malloc.h>
+
+namespace redbrouk
+{
+
+/* MEMORY ACCOUNTING - every operator new/delete in the process and every C style allocation
+ * made through mem_malloc/mem_calloc/mem_free is counted by its usable size, so mem_used() is
+ * what the allocator actually handed out, not what was asked for.
+ * Relaxed atomics: background threads (lazy free, ...) allocate and free too.
+ */
+extern std::atomic<size_t> mem_allocated;
+
+[[nodiscard]] inline size_t mem_used() { return mem_allocated.load(std::memory_order_relaxed); }
+
+inline void *mem_malloc(size_t n) {
+	void *p = malloc(n);
+	if(p)
+		mem_allocated.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+	return p;
+}
+inline void *mem_calloc(size_t nmemb, size_t n) {
+	void *p = calloc(nmemb, n);
+	if(p)
+		mem_allocated.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+	return p;
+}
+inline void mem_free(void *p) {
+	if(!p)
+		return;
+
+	mem_allocated.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+	free(p);
+}
+
+/* SIZE CLASSES - what the allocator hands out for a request of 'n' bytes, without asking it.
+ * glibc chunks carry an 8 byte header and are 16 byte aligned with a 32 byte minimum.
+ */
+[[nodiscard]] constexpr size_t mem_alloc_size(size_t n) {
+	const size_t chunk = (n + 8 + 15) & ~(size_t)15;
+	return (chunk < 32 ? 32 : chunk) - 8;
+}
+// heap bytes behind a std::string, nothing while it fits in the small string buffer
+template <class Str>
+[[nodiscard]] constexpr size_t mem_str_heap(const Str &s) {
+	return s.capacity() > 15 ? mem_alloc_size(s.capacity() + 1) : 0;
+}
+
+// Memory attributed to a structure, split into bytes of user data and bytes spent around it
+typedef struct mem_usage {
+	size_t overhead = 0;
+	size_t payload  = 0;
+
+	[[nodiscard]] size_t total() const { return overhead + payload; }
+
+	mem_usage &operator+=(const mem_usage &o) { overhead += o.overhead; payload += o.payload; return *this; }
+	mem_usage &operator-=(const mem_usage &o) { overhead -= o.overhead; payload -= o.payload; return *this; }
+} MemUsage;
+
+} // namespace redbrouk
+
+#endif
@@ -0,0 +1,152 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <iterator>
+#include <utility>
+
+namespace redbrouk
+{
+
+namespace { // anonymous namespace
+	constexpr size_t MX_HEADER_MAX = 8 * 1024;
+
+	// histogram bounds in seconds, with their label spelled out so rendering doesn't format doubles
+	constexpr std::pair<double, std::string_view> mx_bounds[] = {
+		{ 0.000001, "0.000001" }, { 0.0000025, "0.0000025" }, { 0.000005, "0.000005" },
+		{ 0.00001, "0.00001" }, { 0.000025, "0.000025" }, { 0.00005, "0.00005" },
+		{ 0.0001, "0.0001" }, { 0.00025, "0.00025" }, { 0.0005, "0.0005" },
+		{ 0.001, "0.001" }, { 0.0025, "0.0025" }, { 0.005, "0.005" },
+		{ 0.01, "0.01" }, { 0.025, "0.025" }, { 0.05, "0.05" },
+		{ 0.1, "0.1" }, { 0.25, "0.25" }, { 0.5, "0.5" },
+		{ 1, "1" }, { 2.5, "2.5" }, { 5, "5" }, { 10, "10" }
+	};
+	static_assert(std::size(mx_bounds) == MX_BOUNDS);
+
+	// bound_of: the first bound each hdr bucket's highest value falls under, std::size(mx_bounds) past the last.
+	// Built by mx_init, once the tsc rate is known
+	const uint8_t *bound_of() {
+		static const auto table = [] {
+			std::array<uint8_t, HIST_BUCKETS> out;
+			size_t b = 0;
+			for(size_t i = 0; i < HIST_BUCKETS; i++) {
+				const double secs = tsc_to_ns(hist_value(i)) / 1e9;
+				while(b < std::size(mx_bounds) && secs > mx_bounds[b].first)
+					b++;
+				out[i] = (uint8_t)b;
+			}
+			return out;
+		}();
+		return table.data();
+	}
+
+	// values go through to_chars, a scrape renders thousands of them within a few microseconds per step
+	template <class T>
+	void value(std::string &out, T v) {
+		char buf[32];
+		const auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), v);
+		out.append(buf, end).append("\n");
+	}
+
+	void labeled(std::string &out, std::string_view name, std::string_view suffix, std::string_view labels) {
+		out.append(name).append(suffix);
+		if(!labels.empty())
+			out.append("{").append(labels).append("}");
+		out.append(" ");
+	}
+}
+
+MxRequest mx_parse_request(std::string_view in, size_t &used) {
+	size_t end = in.find("\r\n\r\n");
+	size_t sep = 4;
+	if(end == std::string_view::npos) {
+		end = in.find("\n\n");
+		sep = 2;
+	}
+	if(end == std::string_view::npos)
+		return in.size() > MX_HEADER_MAX ? MX_BAD : MX_INCOMPLETE;
+	used = end + sep;
+
+	// request line: method, target, version
+	const std::string_view line = in.substr(0, in.find_first_of("\r\n"));
+	const size_t sp1 = line.find(' '), sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+	if(sp2 == std::string_view::npos || !line.substr(sp2 + 1).starts_with("HTTP/"))
+		return MX_BAD;
+
+	if(line.substr(0, sp1) != "GET")
+		return MX_BAD_METHOD;
+	const std::string_view target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+	const std::string_view path = target.substr(0, target.find('?'));
+	return path == "/metrics" ? MX_METRICS : MX_NOT_FOUND;
+}
+
+std::string_view mx_reply_head(MxRequest req) {
+	switch(req) {
+	case MX_METRICS:
+		return "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nConnection: close\r\n\r\n";
+	case MX_NOT_FOUND:
+		return "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nOnly /metrics is served\n";
+	case MX_BAD_METHOD:
+		return "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n"
+			"Only GET is served\n";
+	default:
+		return "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nBad request\n";
+	}
+}
+
+void mx_init() {
+	(void)bound_of();
+}
+
+void mx_header(std::string &out, std::string_view name, std::string_view type, std::string_view help) {
+	out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void mx_sample(std::string &out, std::string_view name, std::string_view labels, uint64_t v) {
+	labeled(out, name, "", labels);
+	value(out, v);
+}
+void mx_sample(std::string &out, std::string_view name, std::string_view labels, double v) {
+	labeled(out, name, "", labels);
+	value(out, v);
+}
+
+MxStep mx_histogram(std::string &out, std::string_view name, std::string_view labels, const HdrHist *h,
+		MxHistScan &scan) {
+	const uint64_t total = h->total.load(std::memory_order_relaxed);
+	const uint8_t *bounds = bound_of();
+
+	const size_t end = std::min(scan.pos + MX_HIST_STEP, HIST_BUCKETS);
+	for(; scan.pos < end && scan.seen < total; scan.pos++) {
+		const uint64_t n = h->counts[scan.pos].load(std::memory_order_relaxed);
+		scan.counts[bounds[scan.pos]] += n;
+		scan.seen += n;
+	}
+	if(scan.pos < HIST_BUCKETS && scan.seen < total)
+		return MX_AGAIN;
+
+	uint64_t cum = 0;
+	auto bucket = [&](std::string_view le) {
+		out.append(name).append("_bucket{").append(labels).append(labels.empty() ? "" : ",");
+		out.append("le=\"").append(le).append("\"} ");
+		value(out, cum);
+	};
+	for(size_t b = 0; b < MX_BOUNDS; b++) {
+		cum += scan.counts[b];
+		bucket(mx_bounds[b].second);
+	}
+	cum += scan.counts[MX_BOUNDS];
+	bucket("+Inf");
+
+	labeled(out, name, "_sum", labels);
+	value(out, tsc_to_ns(h->sum.load(std::memory_order_relaxed)) / 1e9);
+	labeled(out, name, "_count", labels);
+	value(out, cum);
+
+	scan = {};
+	return MX_NEXT;
+}
+
+} // namespace redbrouk
@@ -0,0 +1,74 @@
+#ifndef REDBROUK_METRICS_H
+#define REDBROUK_METRICS_H
+
+#include <string>
+#include <string_view>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "src/hist.h"
+
+namespace redbrouk
+{
+
+/* METRICS EXPORTER - an optional second listener answering 'GET /metrics' in the Prometheus text format, from
+ * the same counters and histograms info and latency read. A scrape is a connection of its own: once its request
+ * is in, the loop renders the body in small steps within srv_cfg.metrics_slice_us per iteration and sends each
+ * chunk as it goes, so however many metrics there are, a scrape never holds the loop for longer than one step past
+ * its budget. A step is one value, or a slice of a histogram's buckets. The reply is HTTP/1.0 style, no length,
+ * the body ends when the server closes. Values are read step by step, a scrape isn't one snapshot.
+ */
+enum MxRequest : uint8_t {
+	MX_INCOMPLETE, // the header hasn't all arrived
+	MX_METRICS,    // GET /metrics
+	MX_NOT_FOUND,  // any other path
+	MX_BAD_METHOD, // anything but GET
+	MX_BAD         // not http, or a header too long to be a scrape
+};
+
+// MxStep: what rendering an item did
+enum MxStep : uint8_t {
+	MX_NEXT,  // the item is out, on to the next one
+	MX_AGAIN, // part of it is, it goes on in the next step
+	MX_END    // the family has no such item, on to the next family
+};
+
+constexpr size_t MX_BOUNDS    = 22;  // histogram bounds, 1us to 10s
+constexpr size_t MX_HIST_STEP = 128; // hdr buckets a histogram step reads, their 1KB is the bulk of its cost
+
+// mx_hist_scan: a histogram's counts gathered so far, folded per bound
+typedef struct mx_hist_scan {
+	uint64_t counts[MX_BOUNDS + 1] = {};
+	size_t pos = 0;    // next hdr bucket
+	uint64_t seen = 0; // values counted
+} MxHistScan;
+
+// mx_scrape: where a scrape connection's rendering is, the families themselves are the loop's
+typedef struct mx_scrape {
+	size_t family = 0, item = 0; // next item to render
+	MxHistScan hist;             // of the histogram being rendered
+	bool rendering = false;      // the request was read, the body goes out in steps
+	bool done = false;           // all of it is queued, the connection closes once it's sent
+} MxScrape;
+
+void mx_init(); // once at startup, after tsc_calibrate
+
+// mx_parse_request: looks at what a scrape connection sent so far, 'used' is the header's length once complete
+[[nodiscard]] MxRequest mx_parse_request(std::string_view in, size_t &used);
+// mx_reply_head: the status line and headers for 'req', with the whole body when it's an error
+[[nodiscard]] std::string_view mx_reply_head(MxRequest req);
+
+// the exposition format, appended to 'out'. 'labels' is the inside of the braces, empty for none
+void mx_header(std::string &out, std::string_view name, std::string_view type, std::string_view help);
+void mx_sample(std::string &out, std::string_view name, std::string_view labels, uint64_t value);
+void mx_sample(std::string &out, std::string_view name, std::string_view labels, double value);
+// mx_histogram: a tsc tick histogram as seconds, on fixed 1-2.5-5 bounds from 1us to 10s. The hdr buckets are
+// folded into the bound their highest value falls under, off by the hdr precision at most. Reads MX_HIST_STEP
+// buckets per call into 'scan' and returns MX_AGAIN until it has them all, then appends the lines
+[[nodiscard]] MxStep mx_histogram(std::string &out, std::string_view name, std::string_view labels, const HdrHist *h,
+		MxHistScan &scan);
+
+} // namespace redbrouk
+
+#endif
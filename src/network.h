@@ -66,6 +66,7 @@ static inline socket_t make_listener(uint16_t _port, sview interface = "0.0.0.0"
 	assert(sock_fd != -1);
 	// if(sock_fd == -1);
 		//log error
+	setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &sock_on, sizeof(sock_on)); // before bind, or a restart waits out TIME_WAIT
 
 	if(bind(sock_fd, (sockaddr *)&addr, sock_len) == -1) {
 		std::println("[ERROR] Couldn't bind to socket: {}", strerror(errno));
@@ -77,8 +78,6 @@ static inline socket_t make_listener(uint16_t _port, sview interface = "0.0.0.0"
 		exit(1);
 	}
 
-	setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &sock_on, sizeof(sock_on));
-
 	return sock_fd;
 }
 
@@ -105,23 +104,27 @@ static Conn *Accept(socket_t listen_fd, Conn* place = nullptr) {
 	return c;
 }
 
+// Non blocking, the connection completes (or fails) once the socket turns writable. '_addr' is a
+// numeric IPv4 address and must be null terminated. Returns nullptr if it failed straight away
 [[nodiscard]]
 static inline Conn *Connect(uint16_t _port, sview _addr, Conn *place = nullptr) {
-	socklen_t sock_len = sizeof(sockaddr_in);
 	socket_t sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if(sock_fd == -1)
+		return nullptr;
 
 	endpoint ep{ .port = _port, .addr = _addr };
 	sockaddr_in addr = make_addr(ep);
 
-	if(connect(sock_fd, (sockaddr *)&addr, sock_len) == -1) { // connection unsuccessful
-		/* LOG AND HANDLE ERROR */
+	if(connect(sock_fd, (sockaddr *)&addr, sock_len) == -1 && errno != EINPROGRESS) {
+		::close(sock_fd);
+		return nullptr;
 	}
 	setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &sock_on, sizeof(sock_on));
-	Conn *c;
 
+	Conn *c = place ? new (place) Conn(sock_fd) : new Conn(sock_fd);
 	c->state = ConnState::OPEN | ConnState::SENDING;
 
-	return nullptr;
+	return c;
 }
 
 } // namespace redbrouk
@@ -0,0 +1,218 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "src/utils.h"
+
+#ifndef sigev_notify_thread_id // older glibc only has the union member
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace redbrouk
+{
+
+using utils::fmt;
+
+namespace { // anonymous namespace
+	constexpr size_t PF_SKIP = 2; // the handler and the signal trampoline
+
+	struct profiler {
+		std::unique_ptr<PfSample[]> ring;
+		std::atomic<size_t> size = 0;    // the handler writes ring[size] and then publishes it
+		std::atomic<size_t> dropped = 0;
+
+		timer_t timer;
+		bool running = false;
+		bool handler = false; // installed once, a signal already pending when the timer goes must still land
+	} pf;
+
+	void on_sigprof(int) {
+		const int saved = errno; // backtrace can touch it, the interrupted code may be about to read it
+
+		const size_t n = pf.size.load(std::memory_order_relaxed);
+		if(!pf.ring || n >= PF_CAP) {
+			pf.dropped.store(pf.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		} else {
+			PfSample &s = pf.ring[n];
+			s.tag   = pf_tag.load(std::memory_order_relaxed);
+			s.depth = (uint32_t)std::max(0, backtrace(s.pcs, PF_DEPTH));
+			pf.size.store(n + 1, std::memory_order_release);
+		}
+
+		errno = saved;
+	}
+}
+
+void pf_prime_unwinder() {
+	void *prime[1];
+	backtrace(prime, 1);
+}
+
+bool pf_install_handler(int sig, void (*handler)(int), std::string &err) {
+	pf_prime_unwinder();
+
+	struct sigaction sa{};
+	sa.sa_handler = handler;
+	sa.sa_flags   = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if(sigaction(sig, &sa, nullptr) != 0) {
+		err = fmt("sigaction: {}", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+std::string pf_symbol(void *pc) {
+	Dl_info info{};
+	if(!dladdr(pc, &info))
+		return fmt("[{}]", pc);
+	if(!info.dli_sname) {
+		const char *mod = info.dli_fname ? strrchr(info.dli_fname, '/') : nullptr;
+		return fmt("[{}+{:#x}]", mod ? mod + 1 : info.dli_fname ? info.dli_fname : "?",
+				(uintptr_t)pc - (uintptr_t)info.dli_fbase);
+	}
+
+	int status;
+	char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+	std::string name = status == 0 ? demangled : info.dli_sname;
+	free(demangled);
+
+	// cut the parameter list, the first '(' outside template arguments that isn't operator()'s
+	int depth = 0;
+	for(size_t i = 0; i < name.size(); i++) {
+		if(name[i] == '<')
+			depth++;
+		else if(name[i] == '>')
+			depth--;
+		else if(name[i] == '(' && depth == 0) {
+			if(name.compare(i, 2, "()") == 0 && i >= 8 && name.compare(i - 8, 8, "operator") == 0) {
+				i++;
+				continue;
+			}
+			name.resize(i);
+			break;
+		}
+	}
+	std::replace(name.begin(), name.end(), ';', ':'); // the folded format's separator
+	return name;
+}
+
+bool pf_start(uint32_t hz, std::string &err) {
+	if(pf.running)
+		return true;
+
+	if(!pf.ring)
+		pf.ring = std::make_unique_for_overwrite<PfSample[]>(PF_CAP);
+
+	if(!pf.handler) {
+		if(!pf_install_handler(SIGPROF, on_sigprof, err))
+			return false;
+		pf.handler = true;
+	}
+
+	sigevent sev{};
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo  = SIGPROF;
+	sev.sigev_notify_thread_id = gettid();
+	if(timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &pf.timer) != 0) {
+		err = fmt("timer_create: {}", strerror(errno));
+		return false;
+	}
+
+	const long ns = 1000000000L / hz;
+	const itimerspec spec{ { ns / 1000000000L, ns % 1000000000L }, { ns / 1000000000L, ns % 1000000000L } };
+	if(timer_settime(pf.timer, 0, &spec, nullptr) != 0) {
+		err = fmt("timer_settime: {}", strerror(errno));
+		timer_delete(pf.timer);
+		return false;
+	}
+
+	pf.running = true;
+	return true;
+}
+
+void pf_stop() {
+	if(!pf.running)
+		return;
+
+	timer_delete(pf.timer);
+	pf.running = false;
+}
+
+void pf_reset() {
+	pf.size.store(0, std::memory_order_relaxed);
+	pf.dropped.store(0, std::memory_order_relaxed);
+	if(!pf.running)
+		pf.ring.reset();
+}
+
+bool pf_running() { return pf.running; }
+size_t pf_samples() { return pf.size.load(std::memory_order_acquire); }
+size_t pf_dropped() { return pf.dropped.load(std::memory_order_relaxed); }
+
+size_t pf_dump(std::span<const std::string_view> tags, std::string &out) {
+	// samples past 'n' may land while this runs, they wait for the next dump
+	const size_t n = pf_samples();
+
+	std::vector<const PfSample *> order(n);
+	for(size_t i = 0; i < n; i++)
+		order[i] = &pf.ring[i];
+
+	auto frames = [](const PfSample *s) {
+		const size_t depth = std::max<size_t>(s->depth, PF_SKIP);
+		return std::span<void *const>(s->pcs + PF_SKIP, depth - PF_SKIP);
+	};
+	auto less = [&](const PfSample *a, const PfSample *b) {
+		if(a->tag != b->tag)
+			return a->tag < b->tag;
+		const auto fa = frames(a), fb = frames(b);
+		return std::lexicographical_compare(fa.begin(), fa.end(), fb.begin(), fb.end());
+	};
+	auto same = [&](const PfSample *a, const PfSample *b) {
+		const auto fa = frames(a), fb = frames(b);
+		return a->tag == b->tag && std::equal(fa.begin(), fa.end(), fb.begin(), fb.end());
+	};
+	std::sort(order.begin(), order.end(), less);
+
+	std::unordered_map<void *, std::string> names; // every address is symbolized once
+	size_t stacks = 0;
+	for(size_t i = 0; i < n;) {
+		size_t j = i + 1;
+		while(j < n && same(order[i], order[j]))
+			j++;
+
+		const PfSample *s = order[i];
+		out.append(s->tag < tags.size() ? tags[s->tag] : std::string_view("?"));
+
+		const auto pcs = frames(s);
+		for(size_t f = pcs.size(); f-- > 0;) {
+			// return addresses point past their call, one byte back is still inside it. The innermost frame is
+			// where the signal landed, exact already
+			void *pc = f == 0 ? pcs[f] : (void *)((uintptr_t)pcs[f] - 1);
+			auto it = names.find(pc);
+			if(it == names.end())
+				it = names.emplace(pc, pf_symbol(pc)).first;
+			out.append(";").append(it->second);
+		}
+		out.append(fmt(" {}\n", j - i));
+		stacks++;
+		i = j;
+	}
+
+	return stacks;
+}
+
+} // namespace redbrouk
@@ -0,0 +1,58 @@
+#ifndef REDBROUK_PROFILER_H
+#define REDBROUK_PROFILER_H
+
+#include <atomic>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace redbrouk
+{
+
+/* SAMPLING PROFILER - SIGPROF from a timer on the loop thread's own cpu clock, so only time the loop spends
+ * on cpu is sampled and other threads never are. The handler copies the stack's return addresses and the tag
+ * of the running command into a ring allocated by pf_start; it never allocates or locks. When the ring is full
+ * samples are counted as dropped. pf_dump aggregates identical stacks and symbolizes every address once,
+ * appending folded stacks ("tag;outermost;...;leaf count" per line) for flamegraph.pl and friends.
+ * Function names come from dladdr, so they need the executable's symbols exported (-rdynamic). File local
+ * functions have no dynamic symbol and show as module+offset, for addr2line.
+ */
+constexpr size_t PF_DEPTH = 48;      // frames kept per sample, the outermost ones are cut
+constexpr size_t PF_CAP   = 1 << 14; // samples, ~6MB while allocated
+
+typedef struct pf_sample {
+	uint32_t tag;
+	uint32_t depth;
+	void *pcs[PF_DEPTH]; // innermost first, as backtrace() gives them
+} PfSample;
+
+// the running command's tag, set by the loop around each command, 0 outside of them. Read by the handler
+inline std::atomic<uint32_t> pf_tag = 0;
+
+// pf_start: samples the calling thread 'hz' times per cpu second, keeping what earlier runs collected
+bool pf_start(uint32_t hz, std::string &err);
+void pf_stop();
+// pf_reset: drops the samples, and the ring itself when stopped
+void pf_reset();
+
+[[nodiscard]] bool   pf_running();
+[[nodiscard]] size_t pf_samples();
+[[nodiscard]] size_t pf_dropped();
+
+// pf_prime_unwinder: backtrace's first call loads the unwinder, which must not happen in a signal handler
+void pf_prime_unwinder();
+// pf_install_handler: 'handler' for 'sig' with SA_RESTART, priming the unwinder first. Sets 'err' on failure
+bool pf_install_handler(int sig, void (*handler)(int), std::string &err);
+
+// pf_symbol: the function 'pc' is in without its parameters, or module+offset when it has no dynamic symbol
+std::string pf_symbol(void *pc);
+// pf_dump: appends the folded stacks to 'out', tag t named tags[t]. Returns the number of distinct stacks
+size_t pf_dump(std::span<const std::string_view> tags, std::string &out);
+
+} // namespace redbrouk
+
+#endif
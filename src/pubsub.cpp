@@ -0,0 +1,211 @@
+#include "pubsub.h"
+
+#include <algorithm>
+
+#include "src/utils.h"
+
+namespace redbrouk
+{
+
+namespace { // anonymous namespace
+	struct name_key {
+		iHNode hook;
+		std::string_view name;
+	};
+	bool channel_eq(const iHNode *a, const iHNode *b) {
+		const PsTarget *target = utils::container_of((iHNode *)a, &PsTarget::hook);
+		const name_key *key    = utils::container_of((iHNode *)b, &name_key::hook);
+		return target->name == key->name;
+	}
+	bool same_node(const iHNode *a, const iHNode *b) { return a == b; }
+
+	PsTarget *find_channel(PubSub *ps, std::string_view name) {
+		if(!ps->channels.curr.buckets)
+			return nullptr;
+
+		name_key key{ { nullptr, genHash((const byte *)name.data(), name.size()) }, name };
+		iHNode *node = ihs_find(&ps->channels, &key.hook, channel_eq);
+		return node ? utils::container_of(node, &PsTarget::hook) : nullptr;
+	}
+
+	// the part of a pattern before its first glob character
+	std::string_view literal_prefix(std::string_view pattern) {
+		return pattern.substr(0, std::min(pattern.find_first_of("*?[\\"), pattern.size()));
+	}
+	PsTrieNode *trie_child(PsTrieNode *node, char c) {
+		for(auto &[ch, child] : node->children) {
+			if(ch == c)
+				return child;
+		}
+		return nullptr;
+	}
+	// trie_path: the nodes from the root down to the end of 'prefix', created as needed when 'create'
+	bool trie_path(PsTrieNode *root, std::string_view prefix, bool create, std::vector<PsTrieNode *> &path) {
+		path.assign(1, root);
+		for(char c : prefix) {
+			PsTrieNode *child = trie_child(path.back(), c);
+			if(!child) {
+				if(!create)
+					return false;
+				child = new PsTrieNode;
+				path.back()->children.emplace_back(c, child);
+			}
+			path.push_back(child);
+		}
+		return true;
+	}
+	PsTarget *find_pattern(PsTrieNode *node, std::string_view name) {
+		for(PsTarget *t : node->patterns) {
+			if(t->name == name)
+				return t;
+		}
+		return nullptr;
+	}
+
+	void link_sub(PsSub *sub) {
+		PsTarget *t = sub->target;
+		sub->prev = nullptr;
+		sub->next = t->subs;
+		if(t->subs)
+			t->subs->prev = sub;
+		t->subs = sub;
+		t->nsubs++;
+
+		Conn *conn = sub->conn;
+		sub->conn_next = conn->subs;
+		conn->subs = sub;
+		(t->pattern ? conn->npatterns : conn->nchannels)++;
+	}
+	// unlink_sub: takes 'sub' out of its target's list, the caller takes it out of the client's
+	void unlink_sub(PsSub *sub) {
+		PsTarget *t = sub->target;
+		if(sub->prev)
+			sub->prev->next = sub->next;
+		else
+			t->subs = sub->next;
+		if(sub->next)
+			sub->next->prev = sub->prev;
+		t->nsubs--;
+
+		(t->pattern ? sub->conn->npatterns : sub->conn->nchannels)--;
+	}
+
+	// release_target: frees a target left without subscribers, pruning trie nodes left empty
+	void release_target(PubSub *ps, PsTarget *t) {
+		if(t->nsubs)
+			return;
+
+		if(!t->pattern) {
+			ihs_del(&ps->channels, &t->hook, same_node);
+			ps->nchannels--;
+			delete t;
+			return;
+		}
+
+		std::vector<PsTrieNode *> path;
+		trie_path(&ps->patterns, literal_prefix(t->name), false, path);
+
+		auto &pats = path.back()->patterns;
+		pats.erase(std::find(pats.begin(), pats.end(), t));
+		ps->npatterns--;
+		delete t;
+
+		for(size_t i = path.size() - 1; i > 0; i--) {
+			PsTrieNode *node = path[i];
+			if(!node->children.empty() || !node->patterns.empty())
+				break;
+
+			auto &siblings = path[i - 1]->children;
+			siblings.erase(std::find_if(siblings.begin(), siblings.end(),
+					[node](const auto &c) { return c.second == node; }));
+			delete node;
+		}
+	}
+
+	PsSub *conn_find(Conn *conn, std::string_view name, bool pattern) {
+		for(PsSub *sub = conn->subs; sub; sub = sub->conn_next) {
+			if(sub->target->pattern == pattern && sub->target->name == name)
+				return sub;
+		}
+		return nullptr;
+	}
+}
+
+bool ps_subscribe(PubSub *ps, Conn *conn, std::string_view name, bool pattern) {
+	if(conn_find(conn, name, pattern))
+		return false;
+
+	PsTarget *t;
+	if(!pattern) {
+		if(!(t = find_channel(ps, name))) {
+			t = new PsTarget{ .hook = { nullptr, genHash((const byte *)name.data(), name.size()) }, .name = std::string(name) };
+			ihs_insert(&ps->channels, &t->hook);
+			ps->nchannels++;
+		}
+	} else {
+		std::vector<PsTrieNode *> path;
+		trie_path(&ps->patterns, literal_prefix(name), true, path);
+
+		if(!(t = find_pattern(path.back(), name))) {
+			t = new PsTarget{ .name = std::string(name), .pattern = true };
+			path.back()->patterns.push_back(t);
+			ps->npatterns++;
+		}
+	}
+
+	link_sub(new PsSub{ .target = t, .conn = conn });
+	return true;
+}
+
+bool ps_unsubscribe(PubSub *ps, Conn *conn, std::string_view name, bool pattern) {
+	for(PsSub **link = &conn->subs; *link; link = &(*link)->conn_next) {
+		PsSub *sub = *link;
+		if(sub->target->pattern != pattern || sub->target->name != name)
+			continue;
+
+		*link = sub->conn_next;
+		unlink_sub(sub);
+		release_target(ps, sub->target);
+		delete sub;
+		return true;
+	}
+
+	return false;
+}
+
+void ps_unsubscribe_all(PubSub *ps, Conn *conn, bool pattern, std::vector<std::string> *names) {
+	for(PsSub **link = &conn->subs; *link; ) {
+		PsSub *sub = *link;
+		if(sub->target->pattern != pattern) {
+			link = &sub->conn_next;
+			continue;
+		}
+
+		*link = sub->conn_next;
+		if(names)
+			names->push_back(sub->target->name);
+		unlink_sub(sub);
+		release_target(ps, sub->target);
+		delete sub;
+	}
+}
+
+void ps_match(PubSub *ps, std::string_view channel, const std::function<void(PsTarget *)> &visit) {
+	if(PsTarget *t = find_channel(ps, channel))
+		visit(t);
+
+	if(ps->npatterns == 0)
+		return;
+
+	PsTrieNode *node = &ps->patterns;
+	for(size_t i = 0; node; i++) {
+		for(PsTarget *t : node->patterns) {
+			if(utils::glob_match(t->name, channel))
+				visit(t);
+		}
+
+		node = i < channel.size() ? trie_child(node, channel[i]) : nullptr;
+	}
+}
+
+} // namespace redbrouk
@@ -0,0 +1,60 @@
+#ifndef REDBROUK_PUBSUB_H
+#define REDBROUK_PUBSUB_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "src/connection.h"
+#include "src/hash.h"
+
+namespace redbrouk
+{
+
+/* PUB/SUB INDEX - who receives a message published on a channel.
+ * Channels live in an intrusive hash set, each holding an intrusive list of its subscriptions.
+ * Patterns live in a trie keyed by their literal prefix, the part before the first glob character:
+ * a publish walks the trie along the channel name and only glob matches the patterns whose prefix
+ * the channel starts with. Every subscription is linked into its client's list as well, so a
+ * client that goes away unsubscribes in time proportional to its own subscriptions.
+ */
+typedef struct ps_target { // a channel or a pattern
+	iHNode hook; // in PubSub::channels, channels only
+	std::string name;
+	struct ps_sub *subs = nullptr;
+	size_t nsubs = 0;
+	bool pattern = false;
+} PsTarget;
+
+typedef struct ps_sub {
+	PsTarget *target;
+	Conn *conn;
+	ps_sub *prev, *next; // the target's subscribers
+	ps_sub *conn_next;   // the client's subscriptions
+} PsSub;
+
+typedef struct ps_trie_node {
+	std::vector<std::pair<char, ps_trie_node *>> children;
+	std::vector<PsTarget *> patterns; // patterns whose literal prefix ends here
+} PsTrieNode;
+
+typedef struct pubsub {
+	iHSet channels;
+	PsTrieNode patterns;
+	size_t nchannels = 0, npatterns = 0;
+} PubSub;
+
+// Both return false when there was nothing to do: already subscribed / not subscribed
+bool ps_subscribe(PubSub *ps, Conn *conn, std::string_view name, bool pattern);
+bool ps_unsubscribe(PubSub *ps, Conn *conn, std::string_view name, bool pattern);
+// ps_unsubscribe_all: drops every channel (or pattern) subscription of 'conn', appending their names to 'names'
+void ps_unsubscribe_all(PubSub *ps, Conn *conn, bool pattern, std::vector<std::string> *names = nullptr);
+
+// ps_match: visits the channel's own target and then every pattern matching it, each with at least one subscriber
+void ps_match(PubSub *ps, std::string_view channel, const std::function<void(PsTarget *)> &visit);
+
+} // namespace redbrouk
+
+#endif
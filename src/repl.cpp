@@ -0,0 +1,99 @@
+#include "repl.h"
+
+#include <algorithm>
+#include <random>
+
+#include <cstring>
+
+namespace redbrouk
+{
+
+void rbl_resize(ReplBacklog *bl, size_t size) {
+	bl->buf.assign(size, byte{});
+	bl->buf.shrink_to_fit();
+	bl->idx = bl->histlen = 0;
+}
+void rbl_reset(ReplBacklog *bl, uint64_t offset) {
+	bl->idx = bl->histlen = 0;
+	bl->offset = offset;
+}
+
+void rbl_feed(ReplBacklog *bl, const byte *data, size_t len) {
+	const size_t size = bl->buf.size();
+	bl->offset += len;
+	if(size == 0)
+		return;
+
+	if(len > size) { // only the tail survives
+		data += len - size;
+		len = size;
+	}
+
+	while(len > 0) {
+		const size_t n = std::min(len, size - bl->idx);
+		memcpy(bl->buf.data() + bl->idx, data, n);
+
+		bl->idx = (bl->idx + n) % size;
+		data += n;
+		len  -= n;
+		bl->histlen = std::min(bl->histlen + n, size);
+	}
+}
+
+void rbl_copy(const ReplBacklog *bl, uint64_t off, byte *out) {
+	const size_t size = bl->buf.size();
+	size_t len = (size_t)(bl->offset - off);
+	size_t at  = (bl->idx + size - len) % size; // len <= histlen <= size
+
+	while(len > 0) {
+		const size_t n = std::min(len, size - at);
+		memcpy(out, bl->buf.data() + at, n);
+
+		at = (at + n) % size;
+		out += n;
+		len -= n;
+	}
+}
+
+size_t rp_frame_len(std::span<const std::string_view> args) {
+	size_t len = 2 * sizeof(uint32_t); // frame length and string count
+	for(std::string_view arg : args)
+		len += sizeof(uint32_t) + arg.size();
+	return len;
+}
+
+byte *rp_encode(byte *out, std::span<const std::string_view> args) {
+	const uint32_t len  = (uint32_t)(rp_frame_len(args) - sizeof(uint32_t));
+	const uint32_t nstr = (uint32_t)args.size();
+
+	memcpy(out, &len, sizeof(len));
+	out += sizeof(len);
+	memcpy(out, &nstr, sizeof(nstr));
+	out += sizeof(nstr);
+
+	for(std::string_view arg : args) {
+		const uint32_t slen = (uint32_t)arg.size();
+		memcpy(out, &slen, sizeof(slen));
+		out += sizeof(slen);
+		memcpy(out, arg.data(), arg.size());
+		out += arg.size();
+	}
+
+	return out;
+}
+void rp_encode(std::string &out, std::span<const std::string_view> args) {
+	const size_t at = out.size();
+	out.resize(at + rp_frame_len(args));
+	rp_encode((byte *)out.data() + at, args);
+}
+
+std::string rp_make_replid() {
+	static constexpr char hex[] = "0123456789abcdef";
+	std::random_device rd;
+	std::string id(40, '0');
+	for(char &c : id)
+		c = hex[rd() & 0xf];
+	return id;
+}
+
+} // namespace redbrouk
@@ -0,0 +1,65 @@
+#ifndef REDBROUK_REPL_H
+#define REDBROUK_REPL_H
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/types.h>
+
+namespace redbrouk
+{
+
+using std::byte;
+
+/* REPLICATION BACKLOG - the tail of the primary's write stream, addressed by stream offset.
+ * The stream is every write command as the request frame a client would send for it, the offset
+ * counts its bytes from the start of the replication history. A replica that reconnects at an offset
+ * still held here gets the rest from the backlog (partial resync) instead of a fresh snapshot.
+ */
+typedef struct repl_backlog {
+	std::vector<byte> buf; // circular, empty until the first replica attaches
+	size_t idx = 0;        // where the next byte goes
+	size_t histlen = 0;    // valid bytes before idx (wrapping), at most buf.size()
+	uint64_t offset = 0;   // stream offset just past the last byte fed
+} ReplBacklog;
+
+void rbl_resize(ReplBacklog *bl, size_t size); // drops the history, keeps the offset
+void rbl_reset(ReplBacklog *bl, uint64_t offset); // drops the history, the stream continues at 'offset'
+void rbl_feed(ReplBacklog *bl, const byte *data, size_t len);
+
+[[nodiscard]] inline uint64_t rbl_start(const ReplBacklog *bl) { return bl->offset - bl->histlen; }
+[[nodiscard]] inline bool rbl_has(const ReplBacklog *bl, uint64_t off) {
+	return !bl->buf.empty() && off >= rbl_start(bl) && off <= bl->offset;
+}
+// rbl_copy: the stream from 'off' up to the backlog's end into 'out', which has room for offset - off bytes
+void rbl_copy(const ReplBacklog *bl, uint64_t off, byte *out);
+
+// Replica of this server, hangs off its Conn (see Conn::peer) from psync until it disconnects
+enum ReplPeerState : uint8_t {
+	PEER_SNAPSHOT, // a forked child is writing the snapshot to the socket, the stream queues up meanwhile
+	PEER_ONLINE    // streaming
+};
+typedef struct repl_peer {
+	ReplPeerState state = PEER_SNAPSHOT;
+	pid_t child = -1;      // snapshot writer, while PEER_SNAPSHOT
+	uint64_t sync_off = 0; // offset the replica started streaming from
+	uint64_t ack_off = 0;  // last offset the replica reported applied
+	uint64_t ack_ms = 0;   // when, monotonic
+} ReplPeer;
+
+// Request frames, the format clients send and parse_req reads: length, string count, then each
+// string with its length. The stream and the snapshot are both made of these
+[[nodiscard]] size_t rp_frame_len(std::span<const std::string_view> args);
+byte *rp_encode(byte *out, std::span<const std::string_view> args); // returns the end of the frame
+void rp_encode(std::string &out, std::span<const std::string_view> args); // appends
+
+std::string rp_make_replid(); // 40 random hex characters naming a replication history
+
+} // namespace redbrouk
+
+#endif // ifndef REDBROUK_REPL_H
@@ -13,27 +13,19 @@ SBTNode *sbt_rotate(SBTNode *root);
 // SBT Helpers
 //-----------------------------------------
 
-inline bool is_black(SBTNode *n) { return IS_NULL(n) || n->color; }
+inline bool is_black(SBTNode *n) { return IS_NULL(n) || n->color(); }
 
-inline SBTNode* grandparent_of(SBTNode *n) { return n->parent->parent; }
+inline SBTNode* grandparent_of(SBTNode *n) { return n->parent()->parent(); }
 
 inline SBTNode* sibling_of(SBTNode *n) {
-	if(IS_NULL(n->parent))
+	if(IS_NULL(n->parent()))
 		return &NILNODE;
 
-	return n == n->parent->left ? n->parent->right : n->parent->left;
+	return n == n->parent()->left ? n->parent()->right : n->parent()->left;
 }
 
 inline SBTNode* uncle_of(SBTNode *n) {
-	return sibling_of(n->parent);
-}
-
-inline SBTNode* neice_of(SBTNode *n) {
-	return n == n->parent->left ? sibling_of(n)->left : sibling_of(n)->right;
-}
-
-inline SBTNode* nephew_of(SBTNode *n) {
-	return n == n->parent->right ? sibling_of(n)->left : sibling_of(n)->right;
+	return sibling_of(n->parent());
 }
 
 /*
@@ -43,20 +35,20 @@ SBTNode* rotate_left(SBTNode *root) {
 	SBTNode *rch = root->right;
 	root->right = rch->left;
 	if(!IS_NULL(rch->left))
-		rch->left->parent = root;
+		rch->left->set_parent(root);
 
 	if(!IS_NULL(rch))
-		rch->parent = root->parent;
-	if(root->parent) {
-		if(root == root->parent->left)
-			root->parent->left = rch;
+		rch->set_parent(root->parent());
+	if(root->parent()) {
+		if(root == root->parent()->left)
+			root->parent()->left = rch;
 		else
-			root->parent->right = rch;
+			root->parent()->right = rch;
 	}
 
 	if(!IS_NULL(rch))
 		rch->left = root;
-	root->parent = rch;
+	root->set_parent(rch);
 
 	return rch;
 }
@@ -68,20 +60,20 @@ SBTNode* rotate_right(SBTNode *root) {
 	root->left = lch->right;
 
 	if(!IS_NULL(lch->right))
-		lch->right->parent = root;
+		lch->right->set_parent(root);
 
 	if(!IS_NULL(lch))
-		lch->parent = root->parent;
-	if(root->parent) {
-		if(root == root->parent->right)
-			root->parent->right = lch;
+		lch->set_parent(root->parent());
+	if(root->parent()) {
+		if(root == root->parent()->right)
+			root->parent()->right = lch;
 		else
-			root->parent->left = lch;
+			root->parent()->left = lch;
 	}
 
 	if(!IS_NULL(lch))
 		lch->right = root;
-	root->parent = lch;
+	root->set_parent(lch);
 
 	return lch;
 }
@@ -101,25 +93,25 @@ SBTNode* rotate_rl(SBTNode *root) {
 * Otherwise, get's the direction relative to parent and grandparent
 */
 inline DIRECTION get_dir(SBTNode *node, bool single = 0) {
-	if( IS_NULL(node->parent) || (!single && IS_NULL(grandparent_of(node))) )
+	if( IS_NULL(node->parent()) || (!single && IS_NULL(grandparent_of(node))) )
 		return NONE;
 
 	return (DIRECTION)(
-		((!single && node->parent == grandparent_of(node)->right) &~ single) << 1 |
-		(node == node->parent->right) |
+		((!single && node->parent() == grandparent_of(node)->right) &~ single) << 1 |
+		(node == node->parent()->right) |
 		single << 2
 	);
 }
 inline void transplant(SBTNode *a, SBTNode *b) {
-	b->parent = a->parent;
-	if(IS_NULL(a->parent))
+	b->set_parent(a->parent());
+	if(IS_NULL(a->parent()))
 		return;
 
 	bool a_onleft = (get_dir(a, true) == L);
 	if( a_onleft )
-		a->parent->left  = b;
+		a->parent()->left  = b;
 	else
-		a->parent->right = b;
+		a->parent()->right = b;
 }
 
 //-----------------------------------------------------
@@ -140,7 +132,7 @@ SBTNode** sbt_search(SBTNode **root, double _key) {
 	return !IS_NULL(*root) ? root : nullptr;
 }
 
-SBTNode** sbt_insert(SBTNode **root, SBTNode *in_node) {
+SBTNode** sbt_insert(SBTNode **root, SBTNode *in_node, SBTTieBreak tie) {
 	if(!root) {
 		*root = in_node;
 		return root;
@@ -149,17 +141,16 @@ SBTNode** sbt_insert(SBTNode **root, SBTNode *in_node) {
 	SBTNode *parent = *root, *node;
 	double _key = in_node->key;
 
-	while(!IS_NULL( (node = *root) ) && node->key != _key) {
-		parent = *root;
-		if(node->key < _key)
-			root = &node->right;
-		else
-			root = &node->left;
+	while(!IS_NULL( (node = *root) )) { // NILNODE's own key doesn't count
+		const int side = node->key < _key ? 1 : node->key != _key ? -1 : tie ? tie(in_node, node) : 0;
+		if(side == 0) // an equal key, and tie (if any) found no order between them either
+			return nullptr;
+
+		parent = node;
+		root = side > 0 ? &node->right : &node->left;
 	}
-	if(node && node->key == _key)
-		return nullptr;
 
-	in_node->parent = parent;
+	in_node->set_parent(parent);
 	(*root) = in_node;
 	return root;
 }
@@ -186,9 +177,9 @@ SBTNode* sbt_detach(SBTNode *root) {
 	successor->right = root->right;
 
 	if(!IS_NULL(successor->left))
-		successor->left->parent = successor;
+		successor->left->set_parent(successor);
 	if(!IS_NULL(successor->right))
-		successor->right->parent = successor;
+		successor->right->set_parent(successor);
 
 	return X;
 }
@@ -204,13 +195,13 @@ void sbt_replace(SBTNode *oldn, SBTNode *newn) {
 
 	newn->left = oldn->left;
 	if( has_left )
-		newn->left->parent = newn;
+		newn->left->set_parent(newn);
 
 	newn->right = oldn->right;
 	if( has_right )
-		newn->right->parent = newn;
+		newn->right->set_parent(newn);
 
-	newn->color = oldn->color;
+	newn->set_color(oldn->color());
 }
 
 SBTNode* sbt_at(SBTNode *root, ssize_t offset) {
@@ -244,10 +235,10 @@ SBTNode* sbt_walk_forw(SBTNode* node) {
         return curr;
     }
 
-    SBTNode* p = node->parent;
+    SBTNode* p = node->parent();
     while(p && node == p->right) {
         node = p;
-        p = p->parent;
+        p = p->parent();
     }
 
     return p;
@@ -263,10 +254,10 @@ SBTNode* sbt_walk_back(SBTNode* node) {
         return curr;
     }
 
-    SBTNode* p = node->parent;
+    SBTNode* p = node->parent();
     while(p && node == p->left) {
         node = p;
-        p = p->parent;
+        p = p->parent();
     }
 
     return p;
@@ -293,14 +284,14 @@ SBTNode* sbt_rotate(SBTNode *root) {
 
 	switch(dir) {
 		case LR:
-			rotate_left(root->parent); // left rotate on parent node
+			rotate_left(root->parent()); // left rotate on parent node
 			root = root->left;
 		case LL:
 			rotate_right(grandparent_of(root)); //right rotate grandparent node
 			break;
 
 		case RL:
-			rotate_right(root->parent); // right rotate on parent
+			rotate_right(root->parent()); // right rotate on parent
 			root = root->right;
 		case RR:
 			rotate_left(grandparent_of(root)); // left rotate on grandparent
@@ -310,170 +301,158 @@ SBTNode* sbt_rotate(SBTNode *root) {
 			break;
 	}
 
-	return root->parent;
+	return root->parent();
 }
 
 //-----------------------------------------------------
 // RBTree functions (red-black tree functions)
 //-----------------------------------------------------
 void rbt_fix(RBTNode *node) {
-	if(node->color == RBTNode::BLACK)
+	if(node->color() == RBTNode::BLACK)
 		return;
 
-	while(!IS_NULL(node->parent) && node->parent->color == RBTNode::RED) {
+	while(!IS_NULL(node->parent()) && node->parent()->color() == RBTNode::RED) {
 		RBTNode *u = uncle_of(node);
 
-		if(!IS_NULL(u) && u->color == RBTNode::RED) {
+		if(!IS_NULL(u) && u->color() == RBTNode::RED) {
 			//RECOLOR(node)
-			node->parent->color = RBTNode::BLACK;
-			grandparent_of(node)->color = RBTNode::RED;
+			node->parent()->set_color(RBTNode::BLACK);
+			grandparent_of(node)->set_color(RBTNode::RED);
 
-			u->color = RBTNode::BLACK;
+			u->set_color(RBTNode::BLACK);
 			node = grandparent_of(node);
 		} else {
 			RBTNode *new_child = sbt_rotate(node);
-			new_child->color = RBTNode::BLACK;
-			new_child->left->color = RBTNode::RED;
-			new_child->right->color = RBTNode::RED;
+			new_child->set_color(RBTNode::BLACK);
+			new_child->left->set_color(RBTNode::RED);
+			new_child->right->set_color(RBTNode::RED);
 
 			break;
 		}
 	}
 }
 
-RBTNode* rbt_insert(RBTNode **root, RBTNode *in_node) {
-	RBTNode **inserted = sbt_insert(root, in_node);
+RBTNode* rbt_insert(RBTNode **root, RBTNode *in_node, SBTTieBreak tie) {
+	RBTNode **inserted = sbt_insert(root, in_node, tie);
 	if(!inserted)
 		return &NILNODE;
 
 	RBTNode *node = *inserted;
 	rbt_fix(node);
 
-	if((*root)->parent)
-		*root = (*root)->parent;
-	(*root)->color = RBTNode::BLACK;
+	if((*root)->parent())
+		*root = (*root)->parent();
+	(*root)->set_color(RBTNode::BLACK);
 
 	return node;
 }
 
-// NEEDS TO BE CLEANED UP
+// Rotates around 'node' and keeps 'root' pointing at the top of the tree
+inline void rbt_rotate(RBTNode *&root, RBTNode *node, bool left) {
+	RBTNode *top = left ? rotate_left(node) : rotate_right(node);
+	if(!top->parent())
+		root = top;
+}
+// Puts the subtree 'b' (possibly NIL) where 'a' hangs, or at the root
+inline void rbt_transplant(RBTNode **root, RBTNode *a, RBTNode *b) {
+	RBTNode *p = a->parent();
+	if(!p)
+		*root = b;
+	else if(a == p->left)
+		p->left = b;
+	else
+		p->right = b;
+
+	if(!IS_NULL(b))
+		b->set_parent(p);
+}
+
 void rbt_delete(RBTNode **root, RBTNode *del_node) {
-	bool del_node_isroot = (*root == del_node);
-	bool was_black = is_black(del_node);
-	RBTNode *X, *Y = del_node;
-
-	NILNODE.parent = Y;
-	if(IS_NULL(del_node->left) && IS_NULL(del_node->right)) {
-		Y = X = del_node->right;
-		transplant(del_node, del_node->right);
-	}
-	else if(IS_NULL(del_node->right)) {
-		Y = X = del_node->left;
-		transplant(del_node, del_node->left);
-		was_black = is_black(X);
-		X->color = del_node->color;
-	}
-	else if(IS_NULL(del_node->left)) {
-		Y = X = del_node->right;
-		transplant(del_node, del_node->right);
-		was_black = is_black(X);
-		X->color = del_node->color;
-	}
-	else {
-		Y = del_node->right;
+	RBTNode *X, *X_parent; // what moved into the vacated spot, and where it hangs
+	bool removed_black = is_black(del_node);
+
+	if(IS_NULL(del_node->left)) {
+		X = del_node->right;
+		X_parent = del_node->parent();
+		rbt_transplant(root, del_node, X);
+	} else if(IS_NULL(del_node->right)) {
+		X = del_node->left;
+		X_parent = del_node->parent();
+		rbt_transplant(root, del_node, X);
+	} else {
+		RBTNode *Y = del_node->right; // successor takes del_node's place and color
 		while(!IS_NULL(Y->left))
 			Y = Y->left;
 
+		removed_black = is_black(Y);
 		X = Y->right;
-		transplant(Y, X);
-		transplant(del_node, Y);
-
-		if(Y != del_node->right) {
+		if(Y->parent() == del_node) {
+			X_parent = Y;
+		} else {
+			X_parent = Y->parent();
+			rbt_transplant(root, Y, X);
 			Y->right = del_node->right;
-			Y->right->parent = Y;
+			Y->right->set_parent(Y);
 		}
-		Y->left = del_node->left;
-		Y->left->parent = Y;
 
-		was_black = is_black(Y);
-		Y->color = del_node->color;
+		rbt_transplant(root, del_node, Y);
+		Y->left = del_node->left;
+		Y->left->set_parent(Y);
+		Y->set_color(del_node->color());
 	}
 
-	if( was_black )
-		rbt_del_fix(*root, X);
-	else if( del_node_isroot )
-		*root = Y;
-}
+	del_node->set_parent(nullptr);
+	del_node->left = del_node->right = &NILNODE;
 
-void rbt_del_fix(RBTNode *&root, RBTNode *node) {
-	RBTNode *sib, *neice, *nephew;
-
-	while(!IS_NULL(node->parent) && node->color == RBTNode::BLACK) {
-		sib = sibling_of(node);
-		neice = neice_of(node);
-		nephew = nephew_of(node);
-
-		enum { LEFT, RIGHT } SIDE = ( get_dir(node, true) == L ? LEFT : RIGHT );
-		bool red_parent           = ( node->parent->color == RBTNode::RED );
-		bool red_sibling          = ( sib->color == RBTNode::RED );
-		bool double_black         = is_black(sib->left) && is_black(sib->right);
-		bool red_neice            = !is_black(neice);
-		bool red_nephew           = !is_black(nephew); // would be the same as saying 'else'
-
-		if( red_parent ) {
-			if( red_neice ) {
-				if(SIDE == LEFT) {
-					rotate_right(sib);
-					rotate_left(node->parent);
-				} else {
-					rotate_left(sib);
-					rotate_right(node->parent);
-				}
-				node->parent->color = RBTNode::BLACK;
-			}
-			else if(SIDE == LEFT) {
-				rotate_left(node->parent);
-			} else {
-				rotate_right(node->parent);
-			}
+	if(IS_NULL(*root)) {
+		*root = nullptr;
+		return;
+	}
+	if(removed_black)
+		rbt_del_fix(*root, X, X_parent);
+}
 
-			break;
-		}
-		if( red_sibling ) {
-			RBTNode *p = node->parent;
-			if(SIDE == LEFT) {
-				rotate_left(p);
-			} else {
-				rotate_right(p);
-			}
-
-			p->color = RBTNode::RED;
-			sib->color = RBTNode::BLACK;
-			break;
+// Pushes the extra black on X up until it lands on a red node or the root, rotating it away
+// where X's sibling subtree can spare one
+void rbt_del_fix(RBTNode *&root, RBTNode *X, RBTNode *X_parent) {
+	while(X != root && is_black(X) && X_parent) {
+		const bool left = IS_NULL(X) ? IS_NULL(X_parent->left) : X == X_parent->left;
+		RBTNode *sib = left ? X_parent->right : X_parent->left;
+
+		if(!is_black(sib)) {
+			sib->set_color(RBTNode::BLACK);
+			X_parent->set_color(RBTNode::RED);
+			rbt_rotate(root, X_parent, left);
+			sib = left ? X_parent->right : X_parent->left;
 		}
-		if( red_nephew ) {
-			if(SIDE == LEFT)
-				rotate_left(node->parent);
-			else
-				rotate_right(node->parent);
-			nephew->color = RBTNode::BLACK;
 
-			break;
+		RBTNode *near = left ? sib->left : sib->right;
+		RBTNode *far  = left ? sib->right : sib->left;
+		if(is_black(near) && is_black(far)) {
+			sib->set_color(RBTNode::RED);
+			X = X_parent;
+			X_parent = X->parent();
+			continue;
 		}
-		if( red_neice ) {
-			sbt_rotate(neice);
-			neice->color = RBTNode::BLACK;
-			break;
+
+		if(is_black(far)) {
+			near->set_color(RBTNode::BLACK);
+			sib->set_color(RBTNode::RED);
+			rbt_rotate(root, sib, !left);
+			sib = left ? X_parent->right : X_parent->left;
+			far = left ? sib->right : sib->left;
 		}
 
-		sib->color = RBTNode::RED;
-		node = grandparent_of(node);
-		if(IS_NULL(node))
-			return;
+		sib->set_color(X_parent->color());
+		X_parent->set_color(RBTNode::BLACK);
+		far->set_color(RBTNode::BLACK);
+		rbt_rotate(root, X_parent, left);
+		X = root;
+		break;
 	}
-	node->color = RBTNode::BLACK;
-	if(IS_NULL(node->parent))
-		root = node;
+
+	if(!IS_NULL(X))
+		X->set_color(RBTNode::BLACK);
 }
 
 } // namespace redbrouk
@@ -3,6 +3,7 @@
 #include <cassert>
 #include <print>
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <iomanip>
@@ -24,13 +25,24 @@ namespace redbrouk {
 enum DIRECTION : uint8_t { LL = 0, LR, RL, RR, L, R, NONE };
 
 /* BALANCED TREE NODE - implemented solely as red black for now, implement avl later.
- * Plan to use pointer tagging to combine parent and color enum.
- *  May explicitly alignas(32) for better simd and cache friendliness.
+ * The color lives in the low bit of the parent pointer, nodes are at least 8 byte aligned so the bit
+ * is always free. That takes the node from 40 bytes down to 32, half a cache line.
  * Can also do tight array intrusive rb tree May move key to
  * container as well
  */
 typedef struct sbt_node {
-	sbt_node *parent;
+	enum Color : uintptr_t { RED = 0, BLACK = 1 };
+
+	sbt_node() = default;
+	sbt_node(sbt_node *_parent, std::array<sbt_node *, 2> _children, double _key, Color _color)
+		: parent_color((uintptr_t)_parent | _color), children{ _children[0], _children[1] }, key(_key) {}
+
+	[[nodiscard]] sbt_node *parent() const { return (sbt_node *)(parent_color & ~(uintptr_t)BLACK); }
+	[[nodiscard]] Color color() const { return (Color)(parent_color & BLACK); }
+	void set_parent(sbt_node *p) { parent_color = (uintptr_t)p | color(); }
+	void set_color(Color c) { parent_color = (parent_color & ~(uintptr_t)BLACK) | c; }
+
+	uintptr_t parent_color = RED; // tagged parent pointer, use the accessors
 
 	union {
 		struct {
@@ -42,8 +54,8 @@ typedef struct sbt_node {
 	};
 
 	double key;
-	enum { RED, BLACK } color : 1 = RED;
 } SBTNode, RBTNode; // , AVLNode;
+static_assert(sizeof(SBTNode) == 32);
 
 [[nodiscard]]
 inline std::partial_ordering operator<=>(const SBTNode &a, const SBTNode &b) {
@@ -53,32 +65,37 @@ inline std::partial_ordering operator<=>(const SBTNode &a, const SBTNode &b) {
 inline SBTNode NILNODE{ nullptr, { nullptr, nullptr }, 0, sbt_node::BLACK };
 inline bool IS_NULL(SBTNode *N) { return !N || N == &NILNODE; }
 
+// SBTTieBreak: orders two nodes with equal keys (<0, 0, >0 like a <=> b), for trees keyed on more than a double.
+// Without one, equal keys are duplicates and the insert is refused
+using SBTTieBreak = int (*)(const SBTNode *a, const SBTNode *b);
+
 SBTNode** sbt_search(SBTNode **root, double _key);
-SBTNode** sbt_insert(SBTNode **root, SBTNode *in_node);
+SBTNode** sbt_insert(SBTNode **root, SBTNode *in_node, SBTTieBreak tie = nullptr);
 SBTNode*  sbt_detach(SBTNode  *root);
 SBTNode*  sbt_at(SBTNode *root, ssize_t offset);
 SBTNode*  sbt_at(SBTNode *root, ssize_t offset, size_t &index); 
 SBTNode*  sbt_walk(SBTNode *root, ssize_t offset);
 void      sbt_replace(SBTNode *oldn, SBTNode *newn);
 
+// leftmost/rightmost node of a non empty tree, leaves hang NILNODE so the walk stops at the last real node
 inline SBTNode* sbt_min(SBTNode *root) {
-	while(root->left)
+	while(!IS_NULL(root->left))
 		root = root->left;
 
 	return root;
 }
 inline SBTNode* sbt_max(SBTNode *root) {
-	while(root->right)
+	while(!IS_NULL(root->right))
 		root = root->right;
 
 	return root;
 }
 // can split search size in half by seeing how many nodes per subtree
 
-RBTNode *rbt_insert(RBTNode **root, RBTNode *in_node);
+RBTNode *rbt_insert(RBTNode **root, RBTNode *in_node, SBTTieBreak tie = nullptr);
 void rbt_delete(RBTNode **root, RBTNode *del_node);
 void rbt_fix(RBTNode *node);
-void rbt_del_fix(RBTNode *&root, RBTNode *X);
+void rbt_del_fix(RBTNode *&root, RBTNode *X, RBTNode *X_parent); // X may be NIL, hence its parent
 
 #define RED_COLOR "\033[31m"
 #define BLACK_COLOR "\033[0m"
@@ -93,7 +110,7 @@ static void print_sbt_help(SBTNode *node, int &count, int indent = 0) {
 	if (indent)
 		std::cout << std::setw(indent) << ' ';
 
-	std::cout << (!node->color ? "\033[31m" : "\033[97m") << '[' << count++ << "]. " << node->key << "\n";
+	std::cout << (node->color() == SBTNode::RED ? "\033[31m" : "\033[97m") << '[' << count++ << "]. " << node->key << "\n";
 
 	// Print left subtree (bottom of output)
 	print_sbt_help(node->left, count, indent + 4);
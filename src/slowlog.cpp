@@ -0,0 +1,49 @@
+#include "slowlog.h"
+
+#include <cstring>
+#include <ctime>
+
+namespace redbrouk
+{
+
+void sl_push(Slowlog *sl, std::span<const std::string_view> args, uint64_t duration_us, int32_t fd, size_t max_len) {
+	if(max_len > SLOWLOG_CAP)
+		max_len = SLOWLOG_CAP;
+	if(max_len == 0)
+		return;
+
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	SlowlogEntry &e = sl->entries[sl->head];
+	e.id          = sl->next_id++;
+	e.unix_us     = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+	e.duration_us = duration_us;
+	e.fd          = fd;
+	e.argc        = (uint32_t)args.size();
+	e.nargs       = (uint32_t)(args.size() < SLOWLOG_ARGS ? args.size() : SLOWLOG_ARGS);
+
+	for(size_t i = 0; i < e.nargs; i++) {
+		SlowlogArg &arg = e.args[i];
+		arg.len = (uint32_t)args[i].size();
+		memcpy(arg.data, args[i].data(), arg.kept().size());
+	}
+
+	sl->head = (sl->head + 1) % SLOWLOG_CAP;
+	sl->size = sl->size < max_len ? sl->size + 1 : max_len;
+}
+
+void sl_reset(Slowlog *sl) {
+	sl->head = 0;
+	sl->size = 0;
+}
+
+size_t sl_size(const Slowlog *sl, size_t max_len) {
+	return sl->size < max_len ? sl->size : max_len;
+}
+
+const SlowlogEntry *sl_get(const Slowlog *sl, size_t i) {
+	return &sl->entries[(sl->head + SLOWLOG_CAP - 1 - i) % SLOWLOG_CAP];
+}
+
+} // namespace redbrouk
@@ -0,0 +1,53 @@
+#ifndef REDBROUK_SLOWLOG_H
+#define REDBROUK_SLOWLOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace redbrouk
+{
+
+/* SLOWLOG - the last commands that ran over 'slowlog-log-slower-than', newest first.
+ * A fixed ring of fixed size entries: recording copies at most SLOWLOG_ARGS arguments of at most
+ * SLOWLOG_ARG_LEN bytes each and never allocates, the original counts are kept for rendering.
+ */
+constexpr size_t SLOWLOG_CAP     = 128;
+constexpr size_t SLOWLOG_ARGS    = 8;
+constexpr size_t SLOWLOG_ARG_LEN = 32;
+
+typedef struct slowlog_arg {
+	char data[SLOWLOG_ARG_LEN];
+	uint32_t len; // length of the original argument, more than SLOWLOG_ARG_LEN when truncated
+
+	[[nodiscard]] std::string_view kept() const { return { data, len < SLOWLOG_ARG_LEN ? len : SLOWLOG_ARG_LEN }; }
+} SlowlogArg;
+
+typedef struct slowlog_entry {
+	uint64_t id;
+	uint64_t unix_us;     // wall clock when the command finished
+	uint64_t duration_us;
+	int32_t  fd;          // client socket
+	uint32_t argc;        // arguments of the original command, more than nargs when truncated
+	uint32_t nargs;
+	SlowlogArg args[SLOWLOG_ARGS];
+} SlowlogEntry;
+
+typedef struct slowlog {
+	SlowlogEntry entries[SLOWLOG_CAP];
+	uint64_t next_id = 0;
+	size_t head = 0; // slot the next entry goes to
+	size_t size = 0;
+} Slowlog;
+
+// 'max_len' (at most SLOWLOG_CAP) lets the kept length shrink or grow at runtime
+void sl_push(Slowlog *sl, std::span<const std::string_view> args, uint64_t duration_us, int32_t fd, size_t max_len);
+void sl_reset(Slowlog *sl);
+
+[[nodiscard]] size_t sl_size(const Slowlog *sl, size_t max_len);
+[[nodiscard]] const SlowlogEntry *sl_get(const Slowlog *sl, size_t i); // 0 is the newest, i < sl_size()
+
+} // namespace redbrouk
+
+#endif
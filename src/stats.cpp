@@ -0,0 +1,93 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace redbrouk
+{
+
+namespace { // anonymous namespace
+	struct registry {
+		std::mutex lock;
+		std::vector<StatBlock *> blocks;
+		StatBlock retired; // what exited threads counted
+	};
+	registry &reg() {
+		static registry instance;
+		return instance;
+	}
+
+	// owner: a thread's block, registered on its first count and folded into 'retired' when it exits
+	struct owner {
+		StatBlock block;
+
+		owner() {
+			std::lock_guard guard(reg().lock);
+			reg().blocks.push_back(&block);
+		}
+		~owner() {
+			registry &r = reg();
+			std::lock_guard guard(r.lock);
+			for(size_t i = 0; i < ST_COUNT; i++)
+				st_detail::bump(r.retired.vals[i], block.vals[i].load(std::memory_order_relaxed));
+			for(size_t i = 0; i < ST_CMDS; i++)
+				st_detail::bump(r.retired.cmd_calls[i], block.cmd_calls[i].load(std::memory_order_relaxed));
+			std::erase(r.blocks, &block);
+			st_block = nullptr;
+		}
+	};
+
+	template <class Get>
+	uint64_t sum(Get get) {
+		registry &r = reg();
+		std::lock_guard guard(r.lock);
+		uint64_t out = get(r.retired).load(std::memory_order_relaxed);
+		for(StatBlock *b : r.blocks)
+			out += get(*b).load(std::memory_order_relaxed);
+		return out;
+	}
+
+	// ops per second over the last OPS_SAMPLES cron samples
+	constexpr size_t OPS_SAMPLES = 16;
+	struct ops_track {
+		uint64_t last_ms = 0, last_cmds = 0;
+		double rates[OPS_SAMPLES] = {};
+		size_t next = 0;
+	} ops;
+}
+
+StatBlock *st_attach() {
+	thread_local owner self;
+	st_block = &self.block;
+	return st_block;
+}
+
+uint64_t st_sum(StatId id) {
+	return sum([id](StatBlock &b) -> std::atomic<uint64_t> & { return b.vals[id]; });
+}
+uint64_t st_calls(size_t cmd) {
+	return sum([cmd](StatBlock &b) -> std::atomic<uint64_t> & { return b.cmd_calls[cmd]; });
+}
+
+void st_sample(uint64_t now_ms) {
+	if(now_ms - ops.last_ms < 100)
+		return;
+
+	const uint64_t cmds = st_detail::local()->vals[ST_COMMANDS].load(std::memory_order_relaxed); // the loop's own
+	if(ops.last_ms) {
+		ops.rates[ops.next] = (double)(cmds - ops.last_cmds) * 1000.0 / (double)(now_ms - ops.last_ms);
+		ops.next = (ops.next + 1) % OPS_SAMPLES;
+	}
+	ops.last_ms = now_ms;
+	ops.last_cmds = cmds;
+}
+
+double st_ops_per_sec() {
+	double total = 0;
+	for(double r : ops.rates)
+		total += r;
+	return total / OPS_SAMPLES;
+}
+
+} // namespace redbrouk
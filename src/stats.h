@@ -0,0 +1,58 @@
+#ifndef REDBROUK_STATS_H
+#define REDBROUK_STATS_H
+
+#include <atomic>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace redbrouk
+{
+
+/* SERVER STATS - counters kept per thread, so counting is a plain increment of a thread's own block: no locked
+ * instruction, no shared cache line. A thread's block is registered the first time it counts; readers (info)
+ * add every block up with st_sum, and a thread that exits folds its counts into a retired block first.
+ * Like the latency histograms, one writer per block and relaxed loads on the other side.
+ */
+enum StatId : uint16_t {
+	ST_COMMANDS,          // commands run, queued ones counting when exec runs them
+	ST_CONNECTIONS,       // clients accepted
+	ST_NET_INPUT,         // bytes read from clients
+	ST_NET_OUTPUT,        // bytes written to clients
+	ST_EXPIRED,           // keys deleted by their ttl, lazily or by the active cycle
+	ST_EVICTED,           // keys deleted to stay under maxmemory
+	ST_AGG_JOBS,          // tunionstore/tinterstore results computed
+	ST_AGG_MEMBERS,       // input members those went through, counted by the workers
+	ST_COUNT
+};
+
+constexpr size_t ST_CMDS = 128; // per command call counters, indexed like the command table
+
+typedef struct stat_block {
+	std::atomic<uint64_t> vals[ST_COUNT] = {};
+	std::atomic<uint64_t> cmd_calls[ST_CMDS] = {};
+} StatBlock;
+
+inline thread_local StatBlock *st_block = nullptr;
+StatBlock *st_attach(); // registers the calling thread's block
+
+namespace st_detail {
+	inline StatBlock *local() { return st_block ? st_block : st_attach(); }
+	inline void bump(std::atomic<uint64_t> &c, uint64_t by) {
+		c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+	}
+}
+
+inline void st_add(StatId id, uint64_t by = 1) { st_detail::bump(st_detail::local()->vals[id], by); }
+inline void st_call(size_t cmd) { st_detail::bump(st_detail::local()->cmd_calls[cmd], 1); }
+
+[[nodiscard]] uint64_t st_sum(StatId id);
+[[nodiscard]] uint64_t st_calls(size_t cmd);
+
+// st_sample: the loop's cron feeds the command total in, st_ops_per_sec averages the last samples' rate
+void st_sample(uint64_t now_ms);
+[[nodiscard]] double st_ops_per_sec();
+
+} // namespace redbrouk
+
+#endif
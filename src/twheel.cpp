@@ -0,0 +1,157 @@
+#include "twheel.h"
+
+#include <bit>
+#include <new>
+
+namespace redbrouk
+{
+
+namespace { // anonymous namespace
+	inline void list_init(TWNode *head) {
+		head->prev = head->next = head;
+	}
+	inline void list_push(TWNode *head, TWNode *node) {
+		node->prev = head->prev;
+		node->next = head;
+		head->prev->next = node;
+		head->prev = node;
+	}
+	inline void list_unlink(TWNode *node) {
+		node->prev->next = node->next;
+		node->next->prev = node->prev;
+		node->prev = node->next = nullptr;
+	}
+
+	// Places an armed node relative to the wheel's clock, without touching tw->size
+	void tw_place(TWheel *tw, TWNode *node) {
+		if(node->deadline <= tw->now) {
+			list_push(&tw->due, node);
+			return;
+		}
+
+		uint64_t when = node->deadline;
+		size_t level = (63 - std::countl_zero(when ^ tw->now)) / TW_BITS;
+		if(level >= TW_LEVELS) { // too far out, park it in the top level and re-cascade later
+			level = TW_LEVELS - 1;
+			when  = tw->now + (1ull << (TW_BITS * TW_LEVELS)) - 1;
+		}
+
+		const size_t slot = (when >> (TW_BITS * level)) & TW_MASK;
+		list_push(&tw->slots[level][slot], node);
+		tw->occupied[level] |= 1ull << slot;
+	}
+
+	void tw_cascade(TWheel *tw, size_t level, size_t slot) {
+		TWNode *head = &tw->slots[level][slot];
+		tw->occupied[level] &= ~(1ull << slot);
+
+		while(head->next != head) {
+			TWNode *node = head->next;
+			list_unlink(node);
+			tw_place(tw, node);
+		}
+	}
+
+	// Earliest tick after tw->now at which some slot has to be cascaded or expired
+	uint64_t tw_next_event(const TWheel *tw) {
+		uint64_t out = UINT64_MAX;
+
+		for(size_t level = 0; level < TW_LEVELS; level++) {
+			const size_t shift = TW_BITS * level;
+			const size_t idx   = (tw->now >> shift) & TW_MASK;
+			const uint64_t pending = tw->occupied[level] & ~((2ull << idx) - 1);
+
+			if(!pending)
+				continue;
+
+			const uint64_t window = (tw->now >> (shift + TW_BITS)) << (shift + TW_BITS);
+			const uint64_t when = window | ((uint64_t)std::countr_zero(pending) << shift);
+			if(when < out)
+				out = when;
+		}
+
+		return out;
+	}
+}
+
+TWheel *mk_twheel(TWheel *place, uint64_t now) {
+	TWheel *out = place ? new (place) TWheel : new TWheel;
+
+	for(auto &level : out->slots)
+		for(TWNode &head : level)
+			list_init(&head);
+	list_init(&out->due);
+	out->now = now;
+
+	return out;
+}
+
+void tw_add(TWheel *tw, TWNode *node, uint64_t deadline) {
+	if(tw_armed(node))
+		tw_del(tw, node);
+
+	node->deadline = deadline ? deadline : 1;
+	tw_place(tw, node);
+	tw->size++;
+}
+
+void tw_del(TWheel *tw, TWNode *node) {
+	if(!tw_armed(node))
+		return;
+
+	list_unlink(node);
+	node->deadline = 0;
+	tw->size--;
+}
+
+void tw_advance(TWheel *tw, uint64_t now) {
+	while(tw->now < now) {
+		const uint64_t next = tw_next_event(tw);
+		if(next > now) {
+			tw->now = now;
+			return;
+		}
+		tw->now = next;
+
+		// cascade from the top so a node dropping several levels lands in the right slot
+		for(size_t level = TW_LEVELS - 1; level > 0; level--) {
+			const size_t shift = TW_BITS * level;
+			if(next & ((1ull << shift) - 1))
+				continue;
+
+			const size_t slot = (next >> shift) & TW_MASK;
+			if(tw->occupied[level] & (1ull << slot))
+				tw_cascade(tw, level, slot);
+		}
+
+		const size_t slot = next & TW_MASK;
+		if(tw->occupied[0] & (1ull << slot))
+			tw_cascade(tw, 0, slot); // every node here is due, tw_place moves it onto tw->due
+	}
+}
+
+size_t tw_sample(const TWheel *tw, TWNode **out, size_t n) {
+	size_t found = 0;
+
+	for(TWNode *node = tw->due.next; node != &tw->due && found < n; node = node->next)
+		out[found++] = node;
+
+	// lower levels always hold earlier deadlines, and within a level the slots right after the clock come first
+	for(size_t level = 0; level < TW_LEVELS && found < n; level++) {
+		const size_t idx = (tw->now >> (TW_BITS * level)) & TW_MASK;
+
+		for(size_t i = 1; i <= TW_SLOTS && found < n; i++) {
+			const size_t slot = (idx + i) & TW_MASK;
+			if(!(tw->occupied[level] & (1ull << slot)))
+				continue;
+
+			const TWNode *head = &tw->slots[level][slot];
+			for(TWNode *node = head->next; node != head && found < n; node = node->next)
+				out[found++] = node;
+		}
+	}
+
+	return found;
+}
+
+} // namespace redbrouk
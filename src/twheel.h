@@ -0,0 +1,61 @@
+#ifndef REDBROUK_TWHEEL_H
+#define REDBROUK_TWHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace redbrouk
+{
+
+/* TIMING WHEEL NODE - intrusive, embedded in whatever owns the deadline.
+ * Lives on a circular doubly linked slot list so it can be unlinked in O(1)
+ * from anywhere (lazy expiry, persist, overwrite). deadline == 0 means unarmed.
+ */
+typedef struct tw_node {
+	tw_node *prev = nullptr;
+	tw_node *next = nullptr;
+	uint64_t deadline = 0; // absolute, in wheel ticks (ms)
+} TWNode;
+
+constexpr size_t TW_BITS   = 6;
+constexpr size_t TW_SLOTS  = 1 << TW_BITS;
+constexpr size_t TW_MASK   = TW_SLOTS - 1;
+constexpr size_t TW_LEVELS = 6; // 2^36 ticks (~2.2 years at 1ms), farther deadlines re-cascade from the top
+
+/* HIERARCHICAL TIMING WHEEL
+ * Level L slot s holds nodes whose deadline shares every bit above level L with
+ * the current tick. A slot cascades down a level once the clock reaches it, so
+ * insert/delete are O(1) and each node moves at most TW_LEVELS times.
+ * Occupancy bits are maintained lazily: a set bit means "maybe non-empty",
+ * deletion never clears it, processing an empty slot does.
+ */
+typedef struct tw_wheel {
+	TWNode slots[TW_LEVELS][TW_SLOTS]; // list sentinels
+	uint64_t occupied[TW_LEVELS] = {};
+	TWNode due;            // nodes whose deadline passed, waiting to be reaped by the owner
+	uint64_t now  = 0;     // last processed tick
+	size_t   size = 0;     // armed nodes, including the ones on the due list
+} TWheel;
+
+TWheel *mk_twheel(TWheel *place, uint64_t now);
+
+void tw_add(TWheel *tw, TWNode *node, uint64_t deadline);
+void tw_del(TWheel *tw, TWNode *node);
+void tw_advance(TWheel *tw, uint64_t now); // moves every node with deadline <= now onto tw->due
+// tw_sample: collects up to 'n' armed nodes in ascending deadline order, down to slot granularity
+size_t tw_sample(const TWheel *tw, TWNode **out, size_t n);
+
+inline bool tw_armed(const TWNode *node) { return node->deadline != 0; }
+inline bool tw_has_due(const TWheel *tw) { return tw->due.next != &tw->due; }
+inline TWNode *tw_pop_due(TWheel *tw) {
+	if(!tw_has_due(tw))
+		return nullptr;
+
+	TWNode *node = tw->due.next;
+	tw_del(tw, node);
+	return node;
+}
+
+} // namespace redbrouk
+
+#endif
@@ -4,6 +4,10 @@
 #include <iostream>
 #include <cstddef>
 #include <cstdio>
+#include <cstdint>
+#include <ctime>
+#include <string_view>
+#include <utility>
 
 // #define container_of(ptr, T, member) \
     // ((T *)( (char *)ptr - offsetof(T, member) ))
@@ -25,6 +29,98 @@ constexpr inline T *container_of(MType *ptr, MType T::*mem)
 	return (T *)((byte *)ptr - offset_of<T>(mem));
 }
 
+// Monotonic clock readings, unaffected by wall clock adjustments
+inline uint64_t mono_us() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+inline uint64_t mono_ms() { return mono_us() / 1000; }
+// Wall clock milliseconds since the epoch, for deadlines read by another process
+inline uint64_t unix_ms() {
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+namespace glob_detail {
+	// class_match: 'i' is just past the '[', left just past the closing ']'. False with 'i' untouched if there is none
+	inline bool class_match(std::string_view pat, size_t &i, char c, bool &matched) {
+		size_t j = i;
+		const bool negate = j < pat.size() && (pat[j] == '^' || pat[j] == '!');
+		if(negate)
+			j++;
+
+		bool hit = false;
+		for(bool first = true; j < pat.size() && (first || pat[j] != ']'); first = false) {
+			char lo = pat[j++];
+			if(lo == '\\' && j < pat.size())
+				lo = pat[j++];
+
+			char hi = lo;
+			if(j + 1 < pat.size() && pat[j] == '-' && pat[j + 1] != ']') {
+				hi = pat[j + 1];
+				j += 2;
+				if(hi == '\\' && j < pat.size())
+					hi = pat[j++];
+			}
+			if(lo > hi)
+				std::swap(lo, hi);
+			hit |= lo <= c && c <= hi;
+		}
+		if(j >= pat.size())
+			return false;
+
+		i = j + 1;
+		matched = hit != negate;
+		return true;
+	}
+}
+// glob_match: shell style match of the whole of 'str'. '*' any run, '?' any byte, '[a-z]' and '[^a-z]' classes,
+// '\' escapes the next byte. Linear backtracking to the last '*' only, so no pattern can blow up
+inline bool glob_match(std::string_view pat, std::string_view str) {
+	constexpr size_t npos = std::string_view::npos;
+	size_t p = 0, s = 0, star_p = npos, star_s = 0;
+
+	while(s < str.size()) {
+		if(p < pat.size()) {
+			size_t next = p + 1;
+			bool ok;
+
+			if(pat[p] == '*') {
+				star_p = next;
+				star_s = s;
+				p = next;
+				continue;
+			} else if(pat[p] == '?') {
+				ok = true;
+			} else if(pat[p] == '[') {
+				if(!glob_detail::class_match(pat, next, str[s], ok))
+					ok = str[s] == '['; // unterminated, a plain '['
+			} else if(pat[p] == '\\' && next < pat.size()) {
+				ok = pat[next++] == str[s];
+			} else {
+				ok = pat[p] == str[s];
+			}
+
+			if(ok) {
+				p = next;
+				s++;
+				continue;
+			}
+		}
+		if(star_p == npos)
+			return false;
+
+		p = star_p;
+		s = ++star_s;
+	}
+
+	while(p < pat.size() && pat[p] == '*')
+		p++;
+	return p == pat.size();
+}
+
 
 #define LOGGING_ON true
 // Check if compiling with c or c++
@@ -0,0 +1,149 @@
+#include "watchdog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <ctime>
+#include <mutex>
+#include <print>
+#include <thread>
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "src/utils.h"
+
+namespace redbrouk
+{
+
+namespace { // anonymous namespace
+	struct watchdog {
+		std::atomic<uint32_t> period_ms = 0;
+		pthread_t loop;
+		bool handler = false; // installed with the first start, a late signal must still land somewhere
+
+		// the stall being caught, from the watchdog thread before it sets wd_open
+		std::atomic<uint64_t> seen_ms = 0;   // when it first saw the iteration
+		std::atomic<uint64_t> caught_ms = 0;
+		std::atomic<uint64_t> unix_us = 0;
+		std::atomic<bool> captured = false;  // the handler or wd_close got to it, whichever ran first
+
+		// loop thread only. One slot past the listed ones, the one a stall is caught into
+		WdReport ring[WD_REPORTS + 1];
+		size_t head = 0, size = 0;
+		uint64_t next_id = 0, stalls = 0, longest_ms = 0;
+
+		std::mutex lock;
+		std::condition_variable_any wake;
+		std::jthread thread; // last, so it's stopped and joined before the rest goes
+
+		void run(std::stop_token stop) {
+			uint64_t last = wd_epoch.load(std::memory_order_acquire), seen = utils::mono_ms();
+			bool caught = false;
+
+			std::unique_lock guard(lock);
+			while(!stop.stop_requested()) {
+				const uint32_t period = period_ms.load(std::memory_order_relaxed);
+				wake.wait_for(guard, stop, std::chrono::milliseconds(std::max(1u, period / 4)), [] { return false; });
+
+				const uint64_t now = utils::mono_ms(), epoch = wd_epoch.load(std::memory_order_acquire);
+				if(epoch != last) {
+					last = epoch;
+					seen = now;
+					caught = false;
+					continue;
+				}
+				if(!(epoch & 1) || caught || now - seen < period || wd_open.load(std::memory_order_acquire))
+					continue;
+
+				timespec ts;
+				clock_gettime(CLOCK_REALTIME, &ts);
+				seen_ms.store(seen, std::memory_order_relaxed);
+				caught_ms.store(now - seen, std::memory_order_relaxed);
+				unix_us.store((uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000, std::memory_order_relaxed);
+				captured.store(false, std::memory_order_relaxed);
+				wd_open.store(true, std::memory_order_release);
+				caught = true;
+
+				pthread_kill(loop, SIGUSR2);
+				std::println("[WATCHDOG] The loop has been busy for {} ms", now - seen);
+			}
+		}
+	} wd;
+
+	void on_sigusr2(int) {
+		if(!wd_open.load(std::memory_order_acquire) || wd.captured.exchange(true))
+			return; // too late, the iteration ended already
+
+		const int saved = errno;
+		WdReport &r = wd.ring[wd.head];
+		r.tag   = pf_tag.load(std::memory_order_relaxed);
+		r.fd    = wd_fd.load(std::memory_order_relaxed);
+		r.depth = (uint32_t)std::max(0, backtrace(r.pcs, PF_DEPTH));
+		errno = saved;
+	}
+}
+
+void wd_configure(uint32_t period_ms) {
+	if(period_ms == wd.period_ms.load(std::memory_order_relaxed))
+		return;
+
+	if(!wd.handler) {
+		std::string err;
+		if(!pf_install_handler(SIGUSR2, on_sigusr2, err)) {
+			// without it the signal would kill the process, so no thread. Not retried until the period changes
+			std::println("[ERROR] watchdog: {}", err);
+			wd.period_ms.store(period_ms, std::memory_order_relaxed);
+			return;
+		}
+		wd.loop = pthread_self();
+		wd.handler = true;
+	}
+
+	wd.period_ms.store(period_ms, std::memory_order_relaxed);
+	if(period_ms == 0) {
+		wd.thread = {}; // stops and joins it
+	} else if(!wd.thread.joinable()) {
+		wd.thread = std::jthread([](std::stop_token stop) { wd.run(stop); });
+	} else {
+		wd.wake.notify_one(); // a shorter period shouldn't wait out the old one
+	}
+}
+
+void wd_close() {
+	WdReport &r = wd.ring[wd.head];
+	if(!wd.captured.exchange(true)) { // the signal hasn't landed, and won't do anything once it does
+		r.tag   = 0;
+		r.fd    = -1;
+		r.depth = 0;
+	}
+
+	r.id        = wd.next_id++;
+	r.unix_us   = wd.unix_us.load(std::memory_order_relaxed);
+	r.caught_ms = wd.caught_ms.load(std::memory_order_relaxed);
+	r.total_ms  = utils::mono_ms() - wd.seen_ms.load(std::memory_order_relaxed);
+
+	wd.stalls++;
+	wd.longest_ms = std::max(wd.longest_ms, r.total_ms);
+	wd.head = (wd.head + 1) % std::size(wd.ring);
+	wd.size = std::min(wd.size + 1, WD_REPORTS);
+	wd_open.store(false, std::memory_order_release);
+}
+
+uint64_t wd_stalls() { return wd.stalls; }
+uint64_t wd_longest_ms() { return wd.longest_ms; }
+size_t wd_size() { return wd.size; }
+
+const WdReport *wd_get(size_t i) {
+	return &wd.ring[(wd.head + std::size(wd.ring) - 1 - i) % std::size(wd.ring)];
+}
+
+void wd_reset() {
+	wd.size = 0;
+	wd.stalls = 0;
+	wd.longest_ms = 0;
+}
+
+} // namespace redbrouk
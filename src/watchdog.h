@@ -0,0 +1,63 @@
+#ifndef REDBROUK_WATCHDOG_H
+#define REDBROUK_WATCHDOG_H
+
+#include <atomic>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "src/profiler.h"
+
+namespace redbrouk
+{
+
+/* WATCHDOG - a thread that notices the loop stuck in one iteration, a long command or a page fault storm.
+ * The loop bumps wd_epoch around its poll, odd while it works. The watchdog looks every quarter period and
+ * calls a stall once it has seen the same odd epoch for a whole period. It then signals the loop thread
+ * (SIGUSR2), whose handler records the stack, the running command's tag and the client's fd. The loop closes
+ * the report with the iteration's full length on its way back to poll, and only then is it listed.
+ * Lengths are counted from when the watchdog first saw the iteration, so they're short by up to a quarter period.
+ */
+constexpr size_t WD_REPORTS = 16;
+
+typedef struct wd_report {
+	uint64_t id;
+	uint64_t unix_us;   // when the stall was caught
+	uint64_t caught_ms; // how long the iteration had run by then
+	uint64_t total_ms;  // the whole iteration
+	uint32_t tag;       // pf_tag when caught, 0 outside commands
+	int32_t  fd;        // the client being served, -1 for none
+	uint32_t depth;     // 0 when the iteration ended before the signal landed
+	void *pcs[PF_DEPTH];
+} WdReport;
+
+// odd while the loop works, which it does from the start, bumped by wd_busy/wd_idle. Read by the watchdog thread
+inline std::atomic<uint64_t> wd_epoch = 1;
+// the client whose command runs, set by the loop next to pf_tag. Read by the handler
+inline std::atomic<int32_t> wd_fd = -1;
+
+inline std::atomic<bool> wd_open = false; // a stall was caught and the loop hasn't finished its iteration yet
+void wd_close(); // the loop's side of a caught stall, see wd_idle
+
+// wd_configure: 0 stops the watchdog. Called by the loop thread every cycle, the first call marks it the one
+// to watch
+void wd_configure(uint32_t period_ms);
+
+inline void wd_busy() {
+	wd_epoch.store(wd_epoch.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+inline void wd_idle() {
+	if(wd_open.load(std::memory_order_acquire))
+		wd_close();
+	wd_epoch.store(wd_epoch.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+[[nodiscard]] uint64_t wd_stalls();     // stalls caught since the last reset
+[[nodiscard]] uint64_t wd_longest_ms(); // the longest of them
+[[nodiscard]] size_t   wd_size();       // reports kept, at most WD_REPORTS
+[[nodiscard]] const WdReport *wd_get(size_t i); // 0 is the newest, i < wd_size()
+void wd_reset();
+
+} // namespace redbrouk
+
+#endif
@@ -0,0 +1,202 @@
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <print>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "io.h"
+
+// Writes to the inputs of a background tunionstore, a tadd and an exec holding one, wait for the job instead
+// of copying the set on the loop: the result is the inputs as they were, the writes land after it, and the
+// loop keeps answering everyone else meanwhile
+
+constexpr uint16_t PORT = 16470;
+constexpr size_t N = 300000; // members per input, 'a' holds m0 .. m<N-1>, 'b' the upper half of those and N/2 more
+
+struct Reply {
+	uint32_t status = 0;
+	std::string text;
+};
+
+static int dial() {
+	for(int tries = 0; tries < 200; tries++) {
+		const int fd = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(PORT);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if(connect(fd, (const sockaddr *)&addr, sizeof(addr)) == 0)
+			return fd;
+
+		close(fd);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10)); // the server thread may not listen yet
+	}
+	std::abort();
+}
+
+static void write_all(int fd, const std::string &buf) {
+	for(size_t sent = 0; sent < buf.size();) {
+		const ssize_t rv = write(fd, buf.data() + sent, buf.size() - sent);
+		assert(rv > 0);
+		sent += (size_t)rv;
+	}
+}
+static void read_full(int fd, char *buf, size_t n) {
+	while(n > 0) {
+		const ssize_t rv = read(fd, buf, n);
+		assert(rv > 0);
+		buf += rv;
+		n -= (size_t)rv;
+	}
+}
+
+static void send_req(int fd, const std::vector<std::string> &cmd) {
+	std::string body(4, '\0');
+	const uint32_t nstr = (uint32_t)cmd.size();
+	memcpy(body.data(), &nstr, 4);
+	for(const std::string &arg : cmd) {
+		const uint32_t len = (uint32_t)arg.size();
+		body.append((const char *)&len, 4).append(arg);
+	}
+
+	const uint32_t len = (uint32_t)body.size();
+	write_all(fd, std::string((const char *)&len, 4) + body);
+}
+static Reply read_res(int fd) {
+	uint32_t len = 0;
+	read_full(fd, (char *)&len, 4);
+	assert(len >= 4);
+
+	std::string data(len, '\0');
+	read_full(fd, data.data(), len);
+
+	Reply res;
+	memcpy(&res.status, data.data(), 4);
+	res.text = data.substr(4);
+	return res;
+}
+static Reply req(int fd, const std::vector<std::string> &cmd) {
+	send_req(fd, cmd);
+	return read_res(fd);
+}
+
+static bool readable(int fd, int timeout_ms) {
+	pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+	return poll(&pfd, 1, timeout_ms) == 1;
+}
+
+// every member of 'key' and its score, as tscan lists them
+static std::vector<std::pair<std::string, std::string>> members(int fd, const std::string &key) {
+	std::vector<std::pair<std::string, std::string>> out;
+	std::string cursor = "0";
+	do {
+		const Reply res = req(fd, { "tscan", key, cursor, "count", "5000" });
+		assert(res.status == redbrouk::RES_OK);
+
+		std::string_view text = res.text;
+		const size_t at = text.find("Cursor: ") + 8;
+		cursor = std::string(text.substr(at, text.find(' ', at) - at));
+		text.remove_prefix(text.find('\n') + 1);
+		while(!text.empty()) {
+			const std::string_view line = text.substr(0, text.find('\n'));
+			const size_t space = line.find(' ');
+			out.emplace_back(std::string(line.substr(0, space)), std::string(line.substr(space + 1)));
+			text.remove_prefix(line.size() + 1);
+		}
+	} while(cursor != "0");
+	return out;
+}
+
+// waits until the server took in the job's request and parked its client on the background aggregation
+static void wait_job(int fd) {
+	while(req(fd, { "info" }).text.find("blocked_clients: 1\n") == std::string::npos)
+		;
+}
+
+static void load(int fd, const std::string &key, size_t first, size_t last) {
+	for(size_t i = first; i < last;) {
+		std::vector<std::string> cmd = { "tadd", key };
+		for(size_t end = std::min(i + 400, last); i < end; i++) {
+			cmd.push_back("m" + std::to_string(i));
+			cmd.push_back("1");
+		}
+		assert(req(fd, cmd).status == redbrouk::RES_OK);
+	}
+}
+
+int main() {
+	std::thread([] {
+		redbrouk::io_context iocon;
+		iocon.init(PORT);
+		iocon.main_loop();
+	}).detach();
+
+	const int job = dial(), writer = dial(), other = dial();
+	assert(req(job, { "config", "set", "agg-background-members", "1000" }).status == redbrouk::RES_OK);
+	assert(req(job, { "config", "set", "agg-threads", "1" }).status == redbrouk::RES_OK); // a long running job
+	load(job, "a", 0, N);
+	load(job, "b", N / 2, N + N / 2);
+	assert(req(other, { "set", "k", "v" }).status == redbrouk::RES_OK);
+
+	send_req(job, { "tunionstore", "dst", "2", "a", "b" });
+	wait_job(other);
+	send_req(writer, { "tadd", "a", "new1", "5", "m0", "9" }); // held until the job is collected
+	send_req(writer, { "multi" });
+
+	// the loop serves a client that doesn't touch the inputs while the writer waits
+	const auto start = std::chrono::steady_clock::now();
+	size_t served = 0;
+	double worst_ms = 0;
+	while(!readable(job, 0)) {
+		const auto t0 = std::chrono::steady_clock::now();
+		assert(req(other, { "get", "k" }).status == redbrouk::RES_OK);
+		assert(!readable(writer, 0) || readable(job, 1000)); // the held write is answered once the job is
+		worst_ms = std::max(worst_ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+		served++;
+	}
+	const double job_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	const Reply stored = read_res(job);
+	assert(stored.status == redbrouk::RES_OK && stored.text == "[TUNIONSTORE] Members: " + std::to_string(N + N / 2));
+	const Reply held = read_res(writer);
+	assert(held.status == redbrouk::RES_OK && held.text == "[TADD] Inserted: 1, Updated: 1");
+	assert(read_res(writer).text == "[MULTI] OK");
+
+	// the result is the inputs as they were when the job started, the held write isn't in it
+	const auto result = members(other, "dst");
+	assert(result.size() == N + N / 2);
+	for(const auto &[name, score] : result) {
+		const size_t i = std::stoul(name.substr(1));
+		assert(name[0] == 'm' && score == (i >= N / 2 && i < N ? "2" : "1"));
+	}
+	assert(req(other, { "tpopmax", "a", "2" }).text == "[TPOPMAX] 2\n0) m0 9\n1) new1 5\n");
+
+	// an exec whose commands write a lent set waits the same way, as a whole
+	assert(req(writer, { "tadd", "b", "x", "1" }).text == "[QUEUED] tadd");
+	send_req(job, { "tunionstore", "dst2", "2", "a", "b" });
+	wait_job(other);
+	send_req(writer, { "exec" });
+	assert(read_res(job).status == redbrouk::RES_OK);
+	const Reply exec = read_res(writer);
+	assert(exec.status == redbrouk::RES_OK && exec.text.find("[TADD] Inserted: 1, Updated: 0") != std::string::npos);
+	const auto result2 = members(other, "dst2");
+	assert(result2.size() == N + N / 2 - 1); // without m0
+	for(const auto &[name, score] : result2)
+		assert(name != "x");
+	assert(req(other, { "trangebylex", "b", "[x", "[x" }).text == "[TRANGEBYLEX] 1\n0) x\n");
+
+	std::println("held writes ok: job {:.1f} ms, {} requests served meanwhile, slowest {:.2f} ms", job_ms, served, worst_ms);
+	std::fflush(stdout);
+	std::_Exit(0); // the server thread never returns
+}
@@ -0,0 +1,55 @@
+#ifndef REDBROUK_BENCH_UTIL_H
+#define REDBROUK_BENCH_UTIL_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+
+// Helpers shared by the benchmark drivers, loadgen.cc and microbench.cc
+
+namespace redbrouk
+{
+
+inline uint64_t now_ns() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* ZIPF DIST - Gray et al. "Quickly Generating Billion-Record Synthetic Databases", as YCSB does it.
+ * Ranks in [0, n), rank 0 hottest, drawn from one uniform u in [0, 1).
+ * zeta(n) is computed once, O(n), so build one and share it between threads.
+*/
+struct zipf_dist {
+	uint64_t n;
+	double theta, alpha, zetan, eta;
+
+	zipf_dist(uint64_t _n, double _theta) : n(_n), theta(_theta) {
+		double zeta2 = 0;
+		zetan = 0;
+		for(uint64_t i = 1; i <= n; i++) {
+			zetan += 1.0 / std::pow((double)i, theta);
+			if(i == 2)
+				zeta2 = zetan;
+		}
+
+		alpha = 1.0 / (1.0 - theta);
+		eta = (1.0 - std::pow(2.0 / (double)n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+	}
+
+	uint64_t operator()(double u) const {
+		const double uz = u * zetan;
+		if(uz < 1.0)
+			return 0;
+		if(uz < 1.0 + std::pow(0.5, theta))
+			return 1;
+
+		const uint64_t r = (uint64_t)((double)n * std::pow(eta * u - eta + 1.0, alpha));
+		return std::min(r, n - 1);
+	}
+};
+
+} // namespace redbrouk
+
+#endif
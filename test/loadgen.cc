@@ -0,0 +1,549 @@
+// Load generator speaking the Redbrouk framing.
+//
+// Every thread drives its share of the connections through ppoll, keeping up to 'pipeline'
+// requests in flight per connection.
+//   closed loop (default): a new request goes out as soon as a reply frees a pipeline slot.
+//   open loop (-r rate):   requests are scheduled at a fixed total rate, and latency is measured
+//                          from the scheduled send time rather than the actual one, so a stalled
+//                          server is charged for the requests it kept us from sending
+//                          (coordinated omission correction).
+//
+// Example: ./Bench-LoadGen -t 4 -c 50 -P 16 -n 100000 -D zipf -m get:90,set:10 -d 64 -T 10 -l
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "src/hist.h"
+#include "test/bench_util.h"
+
+using redbrouk::HdrHist;
+using redbrouk::now_ns;
+using redbrouk::zipf_dist;
+
+namespace {
+
+enum op_kind : uint8_t { OP_GET, OP_SET, OP_DEL, OP_TADD, OP_TRANGE, OP_COUNT };
+constexpr const char *op_names[OP_COUNT] = { "get", "set", "del", "tadd", "trange" };
+
+struct options {
+	const char *host = "127.0.0.1";
+	uint16_t port    = 16000;
+	uint32_t threads = 1;
+	uint32_t conns   = 1;      // per thread
+	uint32_t pipeline = 1;
+	uint64_t keys    = 10000;
+	bool     zipf    = false;
+	double   zipf_s  = 0.99;
+	uint32_t value_size = 32;
+	uint32_t weights[OP_COUNT] = { 90, 10, 0, 0, 0 };
+	double   duration = 10;    // seconds
+	double   warmup   = 1;     // seconds not recorded
+	double   rate     = 0;     // total requests per second, 0 is closed loop
+	bool     preload  = false;
+	uint64_t seed     = 1;
+} opt;
+
+[[noreturn]] void die(const char *msg) {
+	fprintf(stderr, "[%d] %s: %s\n", errno, msg, strerror(errno));
+	exit(1);
+}
+
+const zipf_dist *zipf = nullptr;
+
+// Appends one request frame: [len][nstr]([slen][str])...
+void put_req(std::vector<char> &out, std::initializer_list<std::string_view> args) {
+	uint32_t len = 4;
+	for(std::string_view a : args)
+		len += 4 + (uint32_t)a.size();
+
+	const size_t at = out.size();
+	out.resize(at + 4 + len);
+	char *p = out.data() + at;
+
+	const uint32_t nstr = (uint32_t)args.size();
+	memcpy(p, &len, 4);
+	memcpy(p + 4, &nstr, 4);
+	p += 8;
+	for(std::string_view a : args) {
+		const uint32_t slen = (uint32_t)a.size();
+		memcpy(p, &slen, 4);
+		memcpy(p + 4, a.data(), a.size());
+		p += 4 + a.size();
+	}
+}
+
+int connect_to(const char *host, uint16_t port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0)
+		die("socket()");
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if(inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+		die("inet_pton()");
+	if(connect(fd, (const sockaddr *)&addr, sizeof(addr)))
+		die("connect()");
+
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	// non-blocking: a pipeline bigger than the socket buffers must not stall the write while the
+	// server waits on us to read its replies
+	if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK))
+		die("fcntl()");
+	return fd;
+}
+
+struct lg_conn {
+	int fd = -1;
+
+	std::vector<char> out; // requests not written yet
+	size_t out_off = 0;
+	std::vector<char> in;  // replies not parsed yet
+	size_t in_len = 0;
+
+	std::vector<uint64_t> starts; // ring of send (or scheduled) times, one per request in flight
+	size_t head = 0, inflight = 0;
+
+	uint64_t next_due = 0; // open loop schedule
+};
+
+struct lg_stats {
+	HdrHist lat;      // ns, only requests completed after warmup
+	uint64_t ops = 0; // after warmup
+	uint64_t errors = 0;
+};
+
+struct lg_thread {
+	uint32_t id;
+	std::vector<lg_conn> conns;
+	std::mt19937_64 rng;
+	std::string value;
+	std::string kbuf, tbuf, sbuf, mbuf;
+	uint32_t mix_total = 0;
+
+	lg_stats *stats;
+	uint64_t t_record = 0, t_end = 0;
+	uint64_t interval = 0; // ns between requests on one connection, open loop only
+};
+
+uint64_t pick_key(lg_thread &t) {
+	if(zipf)
+		return (*zipf)(std::uniform_real_distribution<double>(0.0, 1.0)(t.rng));
+	return std::uniform_int_distribution<uint64_t>(0, opt.keys - 1)(t.rng);
+}
+
+op_kind pick_op(lg_thread &t) {
+	uint32_t r = std::uniform_int_distribution<uint32_t>(0, t.mix_total - 1)(t.rng);
+	for(uint32_t i = 0; i < OP_COUNT; i++) {
+		if(r < opt.weights[i])
+			return (op_kind)i;
+		r -= opt.weights[i];
+	}
+	return OP_GET;
+}
+
+void queue_request(lg_thread &t, lg_conn &c, uint64_t start) {
+	const uint64_t key = pick_key(t);
+	const op_kind op = pick_op(t);
+
+	char num[32];
+	switch(op) {
+	case OP_GET:
+	case OP_SET:
+	case OP_DEL:
+		snprintf(num, sizeof(num), "key:%012llu", (unsigned long long)key);
+		t.kbuf = num;
+		if(op == OP_SET)
+			put_req(c.out, { "set", t.kbuf, t.value });
+		else
+			put_req(c.out, { op_names[op], t.kbuf });
+		break;
+	case OP_TADD:
+	case OP_TRANGE:
+		snprintf(num, sizeof(num), "tset:%012llu", (unsigned long long)key);
+		t.tbuf = num;
+		if(op == OP_TADD) {
+			snprintf(num, sizeof(num), "%u", (unsigned)(t.rng() % 1000000));
+			t.sbuf = num;
+			snprintf(num, sizeof(num), "m%u", (unsigned)(t.rng() % 1000));
+			t.mbuf = num;
+			put_req(c.out, { "tadd", t.tbuf, t.sbuf, t.mbuf });
+		} else {
+			put_req(c.out, { "trange", t.tbuf, "0", "-1" });
+		}
+		break;
+	default:
+		break;
+	}
+
+	c.starts[(c.head + c.inflight) % c.starts.size()] = start;
+	c.inflight++;
+}
+
+// Parses whole reply frames, returns false on a broken stream
+bool drain_replies(lg_thread &t, lg_conn &c, uint64_t now) {
+	size_t off = 0;
+	while(c.in_len - off >= 8) {
+		uint32_t len = 0, status = 0;
+		memcpy(&len, c.in.data() + off, 4);
+		if(len < 4)
+			return false;
+		if(c.in_len - off < 4 + (size_t)len)
+			break;
+
+		memcpy(&status, c.in.data() + off + 4, 4);
+		off += 4 + len;
+
+		if(c.inflight == 0)
+			return false;
+		const uint64_t start = c.starts[c.head];
+		c.head = (c.head + 1) % c.starts.size();
+		c.inflight--;
+
+		if(status == 1)
+			t.stats->errors++;
+		if(now >= t.t_record && start >= t.t_record) {
+			redbrouk::hist_record(&t.stats->lat, now > start ? now - start : 0);
+			t.stats->ops++;
+		}
+	}
+
+	if(off) {
+		memmove(c.in.data(), c.in.data() + off, c.in_len - off);
+		c.in_len -= off;
+	}
+	return true;
+}
+
+void fill(lg_thread &t, lg_conn &c, uint64_t now) {
+	if(!t.interval) {
+		while(c.inflight < opt.pipeline)
+			queue_request(t, c, now);
+		return;
+	}
+
+	// open loop: everything due goes out while the pipeline has room, the backlog keeps its scheduled times
+	while(c.inflight < opt.pipeline && c.next_due <= now) {
+		queue_request(t, c, c.next_due);
+		c.next_due += t.interval;
+	}
+}
+
+void run_thread(lg_thread *tp) {
+	lg_thread &t = *tp;
+	std::vector<pollfd> pfds(t.conns.size());
+
+	for(size_t i = 0; i < t.conns.size(); i++) {
+		lg_conn &c = t.conns[i];
+		c.starts.resize(opt.pipeline);
+		c.in.resize(64 * 1024);
+		// stagger open loop connections over one interval
+		c.next_due = now_ns() + (t.interval ? t.interval * (t.id * t.conns.size() + i) / (opt.threads * t.conns.size()) : 0);
+	}
+
+	while(true) {
+		uint64_t now = now_ns();
+		if(now >= t.t_end)
+			break;
+
+		uint64_t wake = t.t_end;
+		for(size_t i = 0; i < t.conns.size(); i++) {
+			lg_conn &c = t.conns[i];
+			fill(t, c, now);
+
+			if(c.out_off < c.out.size()) {
+				ssize_t rv = write(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off);
+				if(rv < 0 && errno != EAGAIN && errno != EINTR)
+					die("write()");
+				if(rv > 0)
+					c.out_off += (size_t)rv;
+				if(c.out_off == c.out.size()) {
+					c.out.clear();
+					c.out_off = 0;
+				}
+			}
+
+			pfds[i] = { c.fd, POLLIN, 0 };
+			if(c.out_off < c.out.size())
+				pfds[i].events |= POLLOUT;
+			if(t.interval && c.inflight < opt.pipeline && c.next_due < wake)
+				wake = c.next_due;
+		}
+
+		// ns resolution: an open loop schedule missed by the generator itself would be charged as latency
+		const uint64_t wait = wake > now ? wake - now : 0;
+		const timespec timeout{ (time_t)(wait / 1000000000), (long)(wait % 1000000000) };
+		if(ppoll(pfds.data(), pfds.size(), &timeout, nullptr) < 0 && errno != EINTR)
+			die("ppoll()");
+
+		now = now_ns();
+		for(size_t i = 0; i < t.conns.size(); i++) {
+			lg_conn &c = t.conns[i];
+			if(!(pfds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+				continue;
+
+			if(c.in.size() - c.in_len < 16 * 1024)
+				c.in.resize(c.in.size() * 2);
+
+			ssize_t rv = read(c.fd, c.in.data() + c.in_len, c.in.size() - c.in_len);
+			if(rv == 0) {
+				fprintf(stderr, "server closed the connection\n");
+				exit(1);
+			}
+			if(rv < 0) {
+				if(errno == EAGAIN || errno == EINTR)
+					continue;
+				die("read()");
+			}
+
+			c.in_len += (size_t)rv;
+			if(!drain_replies(t, c, now)) {
+				fprintf(stderr, "malformed reply stream\n");
+				exit(1);
+			}
+		}
+	}
+}
+
+// Sets every key once before the run, so gets hit
+void preload() {
+	const int fd = connect_to(opt.host, opt.port);
+	const std::string value(opt.value_size, 'x');
+	constexpr uint64_t batch = 256;
+
+	std::vector<char> out, in(64 * 1024);
+	char key[32];
+	for(uint64_t k = 0; k < opt.keys; k += batch) {
+		const uint64_t n = std::min(batch, opt.keys - k);
+
+		out.clear();
+		for(uint64_t i = 0; i < n; i++) {
+			snprintf(key, sizeof(key), "key:%012llu", (unsigned long long)(k + i));
+			put_req(out, { "set", key, value });
+		}
+		// writes and reads interleave, the replies to a big batch can fill the socket before it's all sent
+		size_t off = 0, have = 0, got = 0;
+		while(got < n) {
+			pollfd pfd = { fd, POLLIN, 0 };
+			if(off < out.size())
+				pfd.events |= POLLOUT;
+			if(poll(&pfd, 1, -1) < 0) {
+				if(errno == EINTR)
+					continue;
+				die("preload poll()");
+			}
+
+			if(pfd.revents & POLLOUT) {
+				ssize_t rv = write(fd, out.data() + off, out.size() - off);
+				if(rv < 0 && errno != EAGAIN && errno != EINTR)
+					die("preload write()");
+				if(rv > 0)
+					off += (size_t)rv;
+			}
+			if(!(pfd.revents & (POLLIN | POLLERR | POLLHUP)))
+				continue;
+
+			ssize_t rv = read(fd, in.data() + have, in.size() - have);
+			if(rv == 0)
+				die("preload read()");
+			if(rv < 0) {
+				if(errno == EAGAIN || errno == EINTR)
+					continue;
+				die("preload read()");
+			}
+			have += (size_t)rv;
+
+			// every reply is one frame, count them off
+			size_t roff = 0;
+			uint32_t len;
+			while(have - roff >= 4 && (memcpy(&len, in.data() + roff, 4), have - roff >= 4 + (size_t)len)) {
+				roff += 4 + len;
+				got++;
+			}
+			memmove(in.data(), in.data() + roff, have - roff);
+			have -= roff;
+		}
+	}
+
+	close(fd);
+}
+
+bool parse_mix(const char *arg) {
+	uint32_t weights[OP_COUNT] = {};
+	std::string_view rest(arg);
+
+	while(!rest.empty()) {
+		const size_t comma = rest.find(',');
+		std::string_view item = rest.substr(0, comma);
+		rest = comma == std::string_view::npos ? std::string_view{} : rest.substr(comma + 1);
+
+		const size_t colon = item.find(':');
+		if(colon == std::string_view::npos)
+			return false;
+
+		const std::string_view name = item.substr(0, colon);
+		uint32_t i = 0;
+		while(i < OP_COUNT && name != op_names[i])
+			i++;
+		if(i == OP_COUNT)
+			return false;
+
+		weights[i] = (uint32_t)strtoul(std::string(item.substr(colon + 1)).c_str(), nullptr, 10);
+	}
+
+	memcpy(opt.weights, weights, sizeof(weights));
+	return true;
+}
+
+void usage(const char *prog) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -h host        server address (127.0.0.1)\n"
+		"  -p port        server port (16000)\n"
+		"  -t threads     client threads (1)\n"
+		"  -c conns       connections per thread (1)\n"
+		"  -P depth       requests in flight per connection (1)\n"
+		"  -n keys        key space size (10000)\n"
+		"  -D dist        uniform | zipf (uniform)\n"
+		"  -s theta       zipf exponent, < 1 (0.99)\n"
+		"  -m mix         op weights, e.g. get:80,set:15,del:5,tadd:0,trange:0 (get:90,set:10)\n"
+		"  -d bytes       set value size (32)\n"
+		"  -T seconds     measured duration (10)\n"
+		"  -w seconds     warmup, not recorded (1)\n"
+		"  -r rate        open loop at this many requests/s in total, 0 is closed loop (0)\n"
+		"  -l             set every key once before the run\n"
+		"  -S seed        rng seed (1)\n", prog);
+	exit(1);
+}
+
+void report(lg_stats &total, double secs) {
+	using redbrouk::hist_percentile;
+	const auto us = [](uint64_t ns) { return (double)ns / 1000.0; };
+	const HdrHist *h = &total.lat;
+
+	printf("mode        %s\n", opt.rate > 0 ? "open loop" : "closed loop");
+	printf("connections %u x %u threads, pipeline %u\n", opt.conns, opt.threads, opt.pipeline);
+	printf("keys        %llu %s\n", (unsigned long long)opt.keys, opt.zipf ? "zipf" : "uniform");
+	printf("mix        ");
+	for(uint32_t i = 0; i < OP_COUNT; i++) {
+		if(opt.weights[i])
+			printf(" %s:%u", op_names[i], opt.weights[i]);
+	}
+	printf("\n");
+	printf("requests    %llu in %.2fs, %llu errors\n", (unsigned long long)total.ops, secs, (unsigned long long)total.errors);
+	printf("throughput  %.0f req/s\n", (double)total.ops / secs);
+	printf("latency us  avg %.2f p50 %.2f p90 %.2f p99 %.2f p999 %.2f p9999 %.2f max %.2f\n",
+		total.ops ? us(h->sum.load() / total.ops) : 0.0,
+		us(hist_percentile(h, 50)), us(hist_percentile(h, 90)), us(hist_percentile(h, 99)),
+		us(hist_percentile(h, 99.9)), us(hist_percentile(h, 99.99)), us(h->max.load()));
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	int ch;
+	while((ch = getopt(argc, argv, "h:p:t:c:P:n:D:s:m:d:T:w:r:lS:")) != -1) {
+		switch(ch) {
+		case 'h': opt.host = optarg; break;
+		case 'p': opt.port = (uint16_t)atoi(optarg); break;
+		case 't': opt.threads = (uint32_t)atoi(optarg); break;
+		case 'c': opt.conns = (uint32_t)atoi(optarg); break;
+		case 'P': opt.pipeline = (uint32_t)atoi(optarg); break;
+		case 'n': opt.keys = strtoull(optarg, nullptr, 10); break;
+		case 'D':
+			if(!strcmp(optarg, "zipf"))
+				opt.zipf = true;
+			else if(strcmp(optarg, "uniform"))
+				usage(argv[0]);
+			break;
+		case 's': opt.zipf_s = atof(optarg); break;
+		case 'm':
+			if(!parse_mix(optarg))
+				usage(argv[0]);
+			break;
+		case 'd': opt.value_size = (uint32_t)atoi(optarg); break;
+		case 'T': opt.duration = atof(optarg); break;
+		case 'w': opt.warmup = atof(optarg); break;
+		case 'r': opt.rate = atof(optarg); break;
+		case 'l': opt.preload = true; break;
+		case 'S': opt.seed = strtoull(optarg, nullptr, 10); break;
+		default: usage(argv[0]);
+		}
+	}
+
+	uint32_t mix_total = 0;
+	for(uint32_t w : opt.weights)
+		mix_total += w;
+	if(!opt.threads || !opt.conns || !opt.pipeline || !opt.keys || !mix_total
+		|| opt.zipf_s <= 0 || opt.zipf_s >= 1 || opt.duration <= 0)
+		usage(argv[0]);
+
+	if(opt.zipf)
+		zipf = new zipf_dist(opt.keys, opt.zipf_s);
+	if(opt.preload)
+		preload();
+
+	std::vector<lg_thread> threads(opt.threads);
+	std::vector<lg_stats> stats(opt.threads);
+	const uint64_t t_start  = now_ns();
+	const uint64_t t_record = t_start + (uint64_t)(opt.warmup * 1e9);
+	const uint64_t t_end    = t_record + (uint64_t)(opt.duration * 1e9);
+	const double total_conns = (double)opt.threads * opt.conns;
+
+	for(uint32_t i = 0; i < opt.threads; i++) {
+		lg_thread &t = threads[i];
+		t.id = i;
+		t.rng.seed(opt.seed * 1000003 + i);
+		t.value.assign(opt.value_size, 'x');
+		t.mix_total = mix_total;
+		t.stats = &stats[i];
+		t.t_record = t_record;
+		t.t_end = t_end;
+		t.interval = opt.rate > 0 ? (uint64_t)(1e9 * total_conns / opt.rate) : 0;
+
+		t.conns.resize(opt.conns);
+		for(lg_conn &c : t.conns)
+			c.fd = connect_to(opt.host, opt.port);
+	}
+
+	std::vector<std::thread> workers;
+	for(lg_thread &t : threads)
+		workers.emplace_back(run_thread, &t);
+	for(std::thread &w : workers)
+		w.join();
+
+	lg_stats total;
+	for(lg_stats &s : stats) {
+		redbrouk::hist_merge(&total.lat, &s.lat);
+		total.ops += s.ops;
+		total.errors += s.errors;
+	}
+	report(total, opt.duration);
+
+	for(lg_thread &t : threads) {
+		for(lg_conn &c : t.conns)
+			close(c.fd);
+	}
+	return 0;
+}
@@ -0,0 +1,516 @@
+// Data structure microbenchmarks: iHSet, HashSet, IntrusiveHashMap, the RB tree and TSet.
+//
+// For every structure x size x key distribution it runs four phases over the same keys:
+//   insert  every key once
+//   find    one lookup per key, drawn from the distribution
+//   walk    ordered structures only, one in order step per key, wrapping around at the end
+//   mixed   50% find, 25% insert of a fresh key, 25% delete of a present key
+//   delete  every key still present
+// and reports throughput, sampled per-op latency (1 op in 8 is timed with the tsc, so the
+// timer doesn't dominate ~50ns operations) and, when perf_event_open is allowed, cycles,
+// instructions, cache misses and branch misses per op. Results go out as one JSON document.
+//
+// Example: ./Bench-Micro -s 1000,100000,10000000 -k ihset,tset -d uniform,zipf -l $(git rev-parse --short HEAD) -o out.json
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/hash.h"
+#include "src/hist.h"
+#include "src/kvt_hash_t.h"
+#include "src/kvt_map.h"
+#include "src/kvt_tset.h"
+#include "src/sbtree.h"
+#include "src/utils.h"
+#include "test/bench_util.h"
+
+using namespace redbrouk;
+
+namespace {
+
+//---------------------------------------------------------------------------------------
+// Hardware counters
+//---------------------------------------------------------------------------------------
+enum counter : uint8_t { CTR_CYCLES, CTR_INSTRUCTIONS, CTR_CACHE_MISSES, CTR_BRANCH_MISSES, CTR_COUNT };
+constexpr const char *counter_names[CTR_COUNT] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+
+// One event group read in a single syscall; every fd stays -1 when the kernel refuses (containers, paranoid > 2)
+struct perf_group {
+	int fds[CTR_COUNT] = { -1, -1, -1, -1 };
+	bool ok = false;
+
+	void open() {
+		constexpr uint64_t configs[CTR_COUNT] = {
+			PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+		};
+
+		for(size_t i = 0; i < CTR_COUNT; i++) {
+			perf_event_attr attr = {};
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = configs[i];
+			attr.disabled = i == 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+
+			fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+			if(fds[i] < 0) {
+				fprintf(stderr, "perf_event_open(%s): %s, hardware counters disabled\n", counter_names[i], strerror(errno));
+				close_all();
+				return;
+			}
+		}
+		ok = true;
+	}
+	void close_all() {
+		for(int &fd : fds) {
+			if(fd >= 0)
+				close(fd);
+			fd = -1;
+		}
+		ok = false;
+	}
+
+	void start() {
+		if(!ok)
+			return;
+		ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	void stop(uint64_t out[CTR_COUNT]) {
+		if(!ok)
+			return;
+		ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+		uint64_t buf[1 + CTR_COUNT] = {};
+		if(read(fds[0], buf, sizeof(buf)) == (ssize_t)sizeof(buf))
+			memcpy(out, buf + 1, sizeof(uint64_t) * CTR_COUNT);
+	}
+} perf;
+
+//---------------------------------------------------------------------------------------
+// Keys and access patterns
+//---------------------------------------------------------------------------------------
+enum key_dist : uint8_t { DIST_SEQ, DIST_UNIFORM, DIST_ZIPF, DIST_COUNT };
+constexpr const char *dist_names[DIST_COUNT] = { "seq", "uniform", "zipf" };
+
+// Fixed width keys in one flat buffer, 100M keys stay a single 1.6GB allocation instead of 100M strings
+constexpr size_t KEY_LEN = 15;
+struct key_space {
+	std::unique_ptr<char[]> buf;
+	size_t n = 0;
+
+	void build(size_t _n) {
+		n = _n;
+		buf.reset(new char[n * (KEY_LEN + 1)]);
+		for(size_t i = 0; i < n; i++)
+			snprintf(&buf[i * (KEY_LEN + 1)], KEY_LEN + 1, "k%014zu", i);
+	}
+	std::string_view operator[](size_t i) const { return { &buf[i * (KEY_LEN + 1)], KEY_LEN }; }
+};
+
+enum mixed_op : uint8_t { MIX_FIND, MIX_INSERT, MIX_DELETE };
+
+// Everything a run needs, generated before any timing starts
+struct workload {
+	size_t n;
+	std::vector<uint32_t> insert_order; // permutation of [0, n)
+	std::vector<uint32_t> lookups;      // n keys in [0, n)
+	std::vector<uint8_t>  mixed;        // n ops
+	// mixed inserts take keys n, n+1, ...; mixed deletes take insert_order[0], [1], ...
+};
+
+void build_workload(workload &w, size_t n, key_dist dist, uint64_t seed) {
+	std::mt19937_64 rng(seed);
+	w.n = n;
+
+	w.insert_order.resize(n);
+	for(size_t i = 0; i < n; i++)
+		w.insert_order[i] = (uint32_t)i;
+	if(dist != DIST_SEQ)
+		std::shuffle(w.insert_order.begin(), w.insert_order.end(), rng);
+
+	w.lookups.resize(n);
+	if(dist == DIST_SEQ) {
+		for(size_t i = 0; i < n; i++)
+			w.lookups[i] = (uint32_t)i;
+	} else if(dist == DIST_UNIFORM) {
+		std::uniform_int_distribution<uint32_t> u(0, (uint32_t)n - 1);
+		for(uint32_t &l : w.lookups)
+			l = u(rng);
+	} else {
+		// hot ranks scattered over the key space through the insert permutation
+		zipf_dist z(n, 0.99);
+		std::uniform_real_distribution<double> u(0.0, 1.0);
+		for(uint32_t &l : w.lookups)
+			l = w.insert_order[z(u(rng))];
+	}
+
+	w.mixed.resize(n);
+	for(uint8_t &op : w.mixed) {
+		const uint64_t r = rng() % 4;
+		op = r < 2 ? MIX_FIND : r == 2 ? MIX_INSERT : MIX_DELETE;
+	}
+}
+
+//---------------------------------------------------------------------------------------
+// Structures under test, same interface: insert/find/erase by key index, clear
+//---------------------------------------------------------------------------------------
+struct bench_ihset {
+	static constexpr const char *name = "ihset";
+	static constexpr size_t max_size = SIZE_MAX;
+
+	struct node {
+		iHNode hn;
+		std::string_view key;
+	};
+
+	const key_space &keys;
+	iHSet set;
+	std::unique_ptr<node[]> nodes;
+
+	bench_ihset(const key_space &_keys) : keys(_keys), nodes(new node[_keys.n]) { mk_ihset(&set); }
+	~bench_ihset() { ihs_destroy(&set, nullptr); }
+
+	static bool eq(const iHNode *a, const iHNode *b) {
+		return utils::container_of((iHNode *)a, &node::hn)->key == utils::container_of((iHNode *)b, &node::hn)->key;
+	}
+
+	void insert(size_t i) {
+		node &n = nodes[i];
+		n.key = keys[i];
+		n.hn.next = nullptr;
+		n.hn.hval = genHash((const byte *)n.key.data(), n.key.size());
+		ihs_insert(&set, &n.hn);
+	}
+	bool find(size_t i) {
+		node probe{ { nullptr, 0 }, keys[i] };
+		probe.hn.hval = genHash((const byte *)probe.key.data(), probe.key.size());
+		return ihs_find(&set, &probe.hn, eq);
+	}
+	bool erase(size_t i) {
+		node probe{ { nullptr, 0 }, keys[i] };
+		probe.hn.hval = genHash((const byte *)probe.key.data(), probe.key.size());
+		return ihs_del(&set, &probe.hn, eq);
+	}
+};
+
+struct bench_hashset {
+	static constexpr const char *name = "hashset";
+	static constexpr size_t max_size = SIZE_MAX;
+
+	const key_space &keys;
+	HashSet set;
+
+	bench_hashset(const key_space &_keys) : keys(_keys) {}
+
+	void insert(size_t i) { set.emplace(std::string(keys[i])); }
+	bool find(size_t i)   { return set.find(keys[i]); }
+	bool erase(size_t i) {
+		HashSetNode *n = set.del(keys[i]);
+		delete n;
+		return n;
+	}
+};
+
+struct bench_ihmap {
+	static constexpr const char *name = "ihmap";
+	static constexpr size_t max_size = MAX_IMP_ELTS; // entries live in a fixed inline array
+
+	const key_space &keys;
+	std::unique_ptr<IntrusiveHashMap> map;
+	std::string scratch;
+
+	bench_ihmap(const key_space &_keys) : keys(_keys), map(new IntrusiveHashMap) {}
+
+	void insert(size_t i) { map->emplace(std::string(keys[i]), std::string("v")); }
+	bool find(size_t i) {
+		scratch.assign(keys[i]);
+		return map->find(scratch);
+	}
+	bool erase(size_t i) {
+		scratch.assign(keys[i]);
+		return map->remove(scratch);
+	}
+};
+
+struct bench_rbtree {
+	static constexpr const char *name = "rbtree";
+	static constexpr size_t max_size = SIZE_MAX;
+
+	RBTNode *root = nullptr;
+	std::unique_ptr<RBTNode[]> nodes;
+
+	bench_rbtree(const key_space &keys) : nodes(new RBTNode[keys.n]) {}
+
+	void insert(size_t i) {
+		nodes[i] = { nullptr, { &NILNODE, &NILNODE }, (double)i, RBTNode::RED };
+		rbt_insert(&root, &nodes[i]);
+	}
+	bool find(size_t i) { return root && sbt_search(&root, (double)i); }
+	bool erase(size_t i) {
+		RBTNode **found = root ? sbt_search(&root, (double)i) : nullptr;
+		if(!found)
+			return false;
+
+		rbt_delete(&root, *found);
+		return true;
+	}
+
+	RBTNode *cursor = nullptr;
+	bool walk_step() {
+		cursor = cursor ? sbt_walk(cursor, 1) : sbt_min(root);
+		return cursor;
+	}
+};
+
+struct bench_tset {
+	static constexpr const char *name = "tset";
+	static constexpr size_t max_size = SIZE_MAX;
+
+	const key_space &keys;
+	std::unique_ptr<TSet> set;
+
+	bench_tset(const key_space &_keys) : keys(_keys), set(mk_tset()) {}
+
+	void insert(size_t i) { ts_insertn(set.get(), std::string(keys[i]), (double)i); }
+	bool find(size_t i)   { return ts_find(set.get(), keys[i]); }
+	bool erase(size_t i)  { return ts_deleten(set.get(), keys[i]); }
+
+	TSTNode *cursor = nullptr;
+	bool walk_step() {
+		cursor = cursor ? ts_walk(cursor, 1) : ts_at(set.get(), 0);
+		return cursor;
+	}
+};
+
+//---------------------------------------------------------------------------------------
+// Runner
+//---------------------------------------------------------------------------------------
+struct phase_result {
+	const char *phase;
+	size_t ops;
+	uint64_t ns;
+	uint64_t hits; // finds that found something, keeps the work observable
+	HdrHist lat;   // tsc ticks of sampled ops
+	uint64_t ctr[CTR_COUNT];
+};
+
+constexpr size_t SAMPLE_MASK = 7; // time 1 op in 8
+
+template <class F>
+void run_phase(phase_result &r, const char *phase, size_t ops, F &&op) {
+	r.phase = phase;
+	r.ops = ops;
+	r.hits = 0;
+	hist_reset(&r.lat);
+	memset(r.ctr, 0, sizeof(r.ctr));
+
+	perf.start();
+	const uint64_t start = now_ns();
+	for(size_t i = 0; i < ops; i++) {
+		if(i & SAMPLE_MASK) {
+			r.hits += op(i);
+			continue;
+		}
+
+		const uint64_t t0 = tsc_now();
+		r.hits += op(i);
+		hist_record(&r.lat, tsc_now() - t0);
+	}
+	r.ns = now_ns() - start;
+	perf.stop(r.ctr);
+}
+
+FILE *out = stdout;
+bool first_result = true;
+
+void emit(const char *structure, size_t n, key_dist dist, const phase_result &r) {
+	const auto ns = [](uint64_t ticks) { return tsc_to_ns(ticks); };
+	const double ops = (double)r.ops;
+
+	fprintf(out, "%s\n    {\"struct\": \"%s\", \"size\": %zu, \"dist\": \"%s\", \"phase\": \"%s\", "
+		"\"ops\": %zu, \"hits\": %llu, \"ns_per_op\": %.2f, \"mops\": %.3f, "
+		"\"p50_ns\": %.1f, \"p99_ns\": %.1f, \"p999_ns\": %.1f, \"max_ns\": %.1f",
+		first_result ? "" : ",", structure, n, dist_names[dist], r.phase,
+		r.ops, (unsigned long long)r.hits, (double)r.ns / ops, ops * 1e3 / (double)r.ns,
+		ns(hist_percentile(&r.lat, 50)), ns(hist_percentile(&r.lat, 99)),
+		ns(hist_percentile(&r.lat, 99.9)), ns(r.lat.max.load()));
+
+	if(perf.ok) {
+		for(size_t i = 0; i < CTR_COUNT; i++)
+			fprintf(out, ", \"%s_per_op\": %.2f", counter_names[i], (double)r.ctr[i] / ops);
+		fprintf(out, ", \"ipc\": %.3f", r.ctr[CTR_CYCLES] ? (double)r.ctr[CTR_INSTRUCTIONS] / (double)r.ctr[CTR_CYCLES] : 0.0);
+	} else {
+		for(size_t i = 0; i < CTR_COUNT; i++)
+			fprintf(out, ", \"%s_per_op\": null", counter_names[i]);
+		fprintf(out, ", \"ipc\": null");
+	}
+	fprintf(out, "}");
+	first_result = false;
+}
+
+template <class S>
+void bench(const key_space &keys, const workload &w, key_dist dist) {
+	if(w.n > S::max_size) {
+		fprintf(stderr, "%s: skipping size %zu, over its capacity of %zu\n", S::name, w.n, S::max_size);
+		return;
+	}
+	fprintf(stderr, "%s size %zu %s\n", S::name, w.n, dist_names[dist]);
+
+	auto s = std::make_unique<S>(keys);
+	phase_result r;
+
+	run_phase(r, "insert", w.n, [&](size_t i) { s->insert(w.insert_order[i]); return 1; });
+	emit(S::name, w.n, dist, r);
+
+	run_phase(r, "find", w.n, [&](size_t i) { return (int)s->find(w.lookups[i]); });
+	emit(S::name, w.n, dist, r);
+
+	if constexpr(requires { s->walk_step(); }) {
+		run_phase(r, "walk", w.n, [&](size_t) { return (int)s->walk_step(); });
+		emit(S::name, w.n, dist, r);
+	}
+
+	// the mixed phase may only hold max_size keys at once, inserts and deletes are balanced on average
+	size_t next_fresh = w.n, next_victim = 0, live = w.n;
+	run_phase(r, "mixed", w.n, [&](size_t i) {
+		switch(w.mixed[i]) {
+		case MIX_INSERT:
+			if(next_fresh >= keys.n || live >= S::max_size)
+				return 0;
+			s->insert(next_fresh++);
+			live++;
+			return 1;
+		case MIX_DELETE:
+			if(next_victim >= w.n)
+				return 0;
+			live--;
+			return (int)s->erase(w.insert_order[next_victim++]);
+		default:
+			return (int)s->find(w.lookups[i]);
+		}
+	});
+	emit(S::name, w.n, dist, r);
+
+	// whatever the mixed phase left: the tail of the original keys and the fresh ones
+	const size_t remaining_orig = w.n - next_victim;
+	run_phase(r, "delete", remaining_orig + (next_fresh - w.n), [&](size_t i) {
+		return (int)s->erase(i < remaining_orig ? w.insert_order[next_victim + i] : w.n + (i - remaining_orig));
+	});
+	emit(S::name, w.n, dist, r);
+}
+
+bool has(const std::vector<std::string> &list, const char *name) {
+	return std::find(list.begin(), list.end(), name) != list.end();
+}
+std::vector<std::string> split(const char *arg) {
+	std::vector<std::string> out;
+	std::string_view rest(arg);
+	while(!rest.empty()) {
+		const size_t comma = rest.find(',');
+		out.emplace_back(rest.substr(0, comma));
+		rest = comma == std::string_view::npos ? std::string_view{} : rest.substr(comma + 1);
+	}
+	return out;
+}
+
+void usage(const char *prog) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -s sizes    comma separated element counts (1000,10000,100000,1000000), up to 100000000\n"
+		"  -k structs  ihset,hashset,ihmap,rbtree,tset (all)\n"
+		"  -d dists    seq,uniform,zipf (all)\n"
+		"  -S seed     rng seed (1)\n"
+		"  -l label    free form label stored in the output, e.g. a commit hash\n"
+		"  -o file     write JSON here instead of stdout\n", prog);
+	exit(1);
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	std::vector<std::string> sizes   = split("1000,10000,100000,1000000");
+	std::vector<std::string> structs = split("ihset,hashset,ihmap,rbtree,tset");
+	std::vector<std::string> dists   = split("seq,uniform,zipf");
+	uint64_t seed = 1;
+	const char *label = "";
+	const char *out_path = nullptr;
+
+	int ch;
+	while((ch = getopt(argc, argv, "s:k:d:S:l:o:")) != -1) {
+		switch(ch) {
+		case 's': sizes = split(optarg); break;
+		case 'k': structs = split(optarg); break;
+		case 'd': dists = split(optarg); break;
+		case 'S': seed = strtoull(optarg, nullptr, 10); break;
+		case 'l': label = optarg; break;
+		case 'o': out_path = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if(out_path && !(out = fopen(out_path, "w"))) {
+		perror(out_path);
+		return 1;
+	}
+
+	tsc_calibrate();
+	perf.open();
+
+	fprintf(out, "{\n  \"label\": \"%s\",\n  \"seed\": %llu,\n  \"tsc_ticks_per_ns\": %.4f,\n"
+		"  \"latency_sampling\": %zu,\n  \"perf_counters\": %s,\n  \"results\": [",
+		label, (unsigned long long)seed, tsc_per_ns(), SAMPLE_MASK + 1, perf.ok ? "true" : "false");
+
+	for(const std::string &size : sizes) {
+		const size_t n = strtoull(size.c_str(), nullptr, 10);
+		if(n < 8 || n > 100000000)
+			usage(argv[0]);
+
+		key_space keys;
+		keys.build(n + n / 4 + 1); // room for the mixed phase's fresh inserts
+
+		for(size_t d = 0; d < DIST_COUNT; d++) {
+			if(!has(dists, dist_names[d]))
+				continue;
+
+			workload w;
+			build_workload(w, n, (key_dist)d, seed);
+
+			if(has(structs, bench_ihset::name))
+				bench<bench_ihset>(keys, w, (key_dist)d);
+			if(has(structs, bench_hashset::name))
+				bench<bench_hashset>(keys, w, (key_dist)d);
+			if(has(structs, bench_ihmap::name))
+				bench<bench_ihmap>(keys, w, (key_dist)d);
+			if(has(structs, bench_rbtree::name))
+				bench<bench_rbtree>(keys, w, (key_dist)d);
+			if(has(structs, bench_tset::name))
+				bench<bench_tset>(keys, w, (key_dist)d);
+		}
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+	if(out != stdout)
+		fclose(out);
+	perf.close_all();
+	return 0;
+}
@@ -2,8 +2,15 @@
 #include "connection.h"
 #include "network.h"
 
-int main() {
+#include <cstdlib>
+
+int main(int argc, char **argv) {
+	// optional port, a second server on loopback can then replicate from the first
+	const uint16_t port = argc > 1 ? (uint16_t)std::atoi(argv[1]) : 16000;
+	// optional metrics port, serves GET /metrics
+	const uint16_t metrics_port = argc > 2 ? (uint16_t)std::atoi(argv[2]) : 0;
+
 	redbrouk::io_context iocon;
-	iocon.init();
+	iocon.init(port, metrics_port);
 	iocon.main_loop();
 }
@@ -0,0 +1,50 @@
+#ifndef REDBROUK_RBT_CHECK_H
+#define REDBROUK_RBT_CHECK_H
+
+#include <cassert>
+#include <cstddef>
+
+#include "src/sbtree.h"
+
+namespace redbrouk
+{
+
+namespace detail {
+	// black height of the subtree under n, asserting each rule on the way
+	inline size_t rbt_check_sub(const RBTNode *n, const RBTNode *parent, size_t &count, SBTTieBreak tie) {
+		if(IS_NULL((RBTNode *)n))
+			return 1;
+
+		count++;
+		assert(n->parent() == parent && "parent link broken");
+		if(n->color() == RBTNode::RED)
+			assert((IS_NULL(n->left) || n->left->color() == RBTNode::BLACK)
+				&& (IS_NULL(n->right) || n->right->color() == RBTNode::BLACK) && "red node with a red child");
+		if(!IS_NULL(n->left))
+			assert((n->left->key < n->key || (n->left->key == n->key && tie && tie(n->left, n) < 0)) && "left child out of order");
+		if(!IS_NULL(n->right))
+			assert((n->key < n->right->key || (n->key == n->right->key && tie && tie(n, n->right) < 0)) && "right child out of order");
+
+		const size_t lh = rbt_check_sub(n->left, n, count, tie);
+		const size_t rh = rbt_check_sub(n->right, n, count, tie);
+		assert(lh == rh && "black heights differ");
+		return lh + (n->color() == RBTNode::BLACK);
+	}
+}
+
+/* RBT CHECK - asserts every red black rule over the tree at 'root': a black root, no red node with a red child,
+ * one black height on every path, parent links matching child links and in order children, equal keys ordered
+ * by 'tie' when the tree has one. Only a node against its children: the in order walk is the caller's to check.
+ * Returns how many nodes it saw.
+*/
+inline size_t rbt_check(const RBTNode *root, SBTTieBreak tie = nullptr) {
+	size_t count = 0;
+	if(!IS_NULL((RBTNode *)root))
+		assert(root->color() == RBTNode::BLACK && "red root");
+	detail::rbt_check_sub(root, nullptr, count, tie);
+	return count;
+}
+
+} // namespace redbrouk
+
+#endif
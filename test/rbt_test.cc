@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <cassert>
 #include <print>
 #include <random>
+#include <vector>
 
 #include "sbtree.h"
 #include "kvt_tset.h"
+#include "test/rbt_check.h"
 
 using namespace redbrouk;
 
@@ -114,6 +117,52 @@ int main(int argc, char *argv[]) {
 	rbt_delete(&root, root->right);
 	print_sbt(root);
 	std::println("\n--------------------------------------------------------------------------------");
+
+	// mixed inserts and deletes on a fresh tree, every rule checked after each step: rbt_delete's fix up
+	// cases only show up once deletes interleave with inserts on a tree of some depth
+	{
+		std::vector<RBTNode> pool(4096);
+		std::vector<RBTNode *> live;
+		std::uniform_int_distribution<size_t> coin(0, 2);
+		RBTNode *mixed = nullptr;
+		size_t next = 0, steps = 0;
+
+		while(next < pool.size()) {
+			if(live.empty() || coin(gen)) {
+				RBTNode *n = &pool[next];
+				*n = RBTNode(nullptr, { &NILNODE, &NILNODE }, (double)(next++ * 7919 % 4096), RBTNode::RED); // distinct keys
+				rbt_insert(&mixed, n);
+				live.push_back(n);
+			} else {
+				const size_t at = std::uniform_int_distribution<size_t>(0, live.size() - 1)(gen);
+				rbt_delete(&mixed, live[at]);
+				live[at] = live.back();
+				live.pop_back();
+			}
+			assert(rbt_check(mixed) == live.size());
+			steps++;
+		}
+
+		// in order walk matches the live keys sorted
+		std::vector<double> keys;
+		for(RBTNode *n : live)
+			keys.push_back(n->key);
+		std::ranges::sort(keys);
+		RBTNode *n = IS_NULL(mixed) ? nullptr : sbt_min(mixed);
+		for(double k : keys) {
+			assert(n && n->key == k);
+			n = sbt_walk(n, 1);
+		}
+		assert(IS_NULL(n));
+
+		while(!live.empty()) {
+			rbt_delete(&mixed, live.back());
+			live.pop_back();
+			assert(rbt_check(mixed) == live.size());
+		}
+		assert(IS_NULL(mixed));
+		std::println("{} mixed steps, red black rules held after each", steps);
+	}
 	/*{
 		printf("%p\n", sbt_insert(&root, new sbt_node{ root, {0}, 1000, sbt_node::RED }));
 		printf("%p\n", sbt_insert(&root, new sbt_node{ root, {0}, 500, sbt_node::RED }));
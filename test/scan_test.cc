@@ -0,0 +1,112 @@
+#include <cassert>
+#include <print>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "hash.h"
+#include "utils.h"
+
+using namespace redbrouk;
+
+struct item {
+	iHNode node;
+	size_t id;
+};
+
+static void add(iHSet *hs, item &it) {
+	it.node = { nullptr, genHash((const byte *)&it.id, sizeof(it.id)) };
+	ihs_insert(hs, &it.node);
+}
+
+static void del(iHSet *hs, item &it) {
+	iHNode *found = ihs_del(hs, &it.node, [](const iHNode *a, const iHNode *b) { return a == b; });
+	assert(found == &it.node);
+}
+
+int main(int argc, char *argv[]) {
+	// glob_match, the MATCH filter of every scan
+	struct { const char *pat, *str; bool match; } globs[] = {
+		{ "", "", true }, { "", "a", false }, { "*", "", true }, { "*", "anything", true },
+		{ "key:*", "key:1", true }, { "key:*", "key", false }, { "*:1", "key:1", true }, { "*:1", "key:12", false },
+		{ "k?y", "key", true }, { "k?y", "ky", false }, { "a*b*c", "aXbYc", true }, { "a*b*c", "aXbY", false },
+		{ "a*a*a*a*b", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", false }, // backtracks to the last '*' only
+		{ "[abc]x", "bx", true }, { "[abc]x", "dx", false }, { "[a-c]x", "bx", true }, { "[^a-c]x", "bx", false },
+		{ "[^a-c]x", "dx", true }, { "[a-]", "-", true }, { "[]]", "]", true }, { "[ab", "[ab", true },
+		{ "\\*", "*", true }, { "\\*", "a", false }, { "a\\?", "a?", true }, { "a\\?", "ab", false },
+		{ "*\\", "a\\", true }, { "h*llo", "hello", true }, { "h*llo", "hllo", true },
+	};
+	for(const auto &g : globs) {
+		if(utils::glob_match(g.pat, g.str) != g.match) {
+			std::println("glob_match(\"{}\", \"{}\") != {}", g.pat, g.str, g.match);
+			assert(false);
+		}
+	}
+
+	// a cursor walk while the set keeps growing and losing members between steps, so ihs_prehash moves buckets
+	// from prev to curr under the cursor and the tables double more than once. Every item present from start to
+	// end has to come back at least once
+	std::random_device rd;
+	std::mt19937_64 gen(rd());
+	for(int round = 0; round < 50; round++) {
+		iHSet hs;
+		mk_ihset(&hs);
+
+		std::vector<item> items(20000);
+		for(size_t i = 0; i < items.size(); i++)
+			items[i].id = i;
+
+		const size_t stable = 1000 + gen() % 3000; // items [0, stable) stay for the whole walk
+		for(size_t i = 0; i < stable; i++)
+			add(&hs, items[i]);
+		size_t next = stable, doomed = next; // items [doomed, next) were added during the walk and may go again
+
+		std::set<size_t> seen;
+		size_t cursor = 0, steps = 0;
+		do {
+			cursor = ihs_scan(&hs, cursor, [&](iHNode *n) { seen.insert(utils::container_of(n, &item::node)->id); });
+			steps++;
+
+			for(int i = gen() % 40; i > 0 && next < items.size(); i--)
+				add(&hs, items[next++]);
+			if(doomed < next && gen() % 2)
+				del(&hs, items[doomed++]);
+		} while(cursor != 0);
+
+		for(size_t i = 0; i < stable; i++)
+			assert(seen.count(i) && "an item present for the whole walk was missed");
+		for(size_t id : seen)
+			assert(id < next && "visited an item that was never added");
+
+		ihs_destroy(&hs, nullptr);
+		if(round == 0)
+			std::println("{} steps over {} stable items, {} added meanwhile", steps, stable, next - stable);
+	}
+
+	// a cursor handed back by one walk resumes on a set that grew in the meantime, by at least one doubling
+	{
+		iHSet hs;
+		mk_ihset(&hs);
+		std::vector<item> items(4096);
+		for(size_t i = 0; i < items.size(); i++) {
+			items[i].id = i;
+			if(i < 512)
+				add(&hs, items[i]);
+		}
+
+		std::set<size_t> seen;
+		size_t cursor = 0;
+		for(int i = 0; i < 8; i++) // part of the way through
+			cursor = ihs_scan(&hs, cursor, [&](iHNode *n) { seen.insert(utils::container_of(n, &item::node)->id); });
+		for(size_t i = 512; i < items.size(); i++)
+			add(&hs, items[i]);
+		while(cursor != 0)
+			cursor = ihs_scan(&hs, cursor, [&](iHNode *n) { seen.insert(utils::container_of(n, &item::node)->id); });
+
+		for(size_t i = 0; i < 512; i++)
+			assert(seen.count(i));
+		ihs_destroy(&hs, nullptr);
+	}
+
+	std::println("glob patterns and rehash stable cursors hold");
+}
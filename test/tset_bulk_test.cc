@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <print>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "kvt_tset.h"
+#include "test/rbt_check.h"
+
+using namespace redbrouk;
+
+// Both sets hold the same members in the same order, and the bulk built one is a valid red black tree
+static void assert_same(TSet *one_by_one, TSet *bulk) {
+	assert(ts_size(one_by_one) == ts_size(bulk));
+	assert(rbt_check(bulk->stm_root) == ts_size(bulk));
+	assert(rbt_check(one_by_one->stm_root) == ts_size(one_by_one));
+
+	TSTNode *a = ts_min(one_by_one), *b = ts_min(bulk);
+	size_t seen = 0;
+	for(; a && b; a = ts_walk(a, 1), b = ts_walk(b, 1), seen++) {
+		assert(a->name == b->name && a->tnode.key == b->tnode.key);
+		assert(ts_find(bulk, b->name) == b);
+	}
+	assert(!a && !b && seen == ts_size(bulk));
+	assert(ts_max(one_by_one)->name == ts_max(bulk)->name);
+}
+
+int main(int argc, char *argv[]) {
+	std::random_device rd;
+	std::mt19937_64 gen(rd());
+
+	// distinct scores, drawn without replacement, so the trees need no tie break
+	std::vector<double> pool(40000);
+	std::iota(pool.begin(), pool.end(), 0.0);
+	std::shuffle(pool.begin(), pool.end(), gen);
+	size_t drawn = 0;
+
+	std::vector<std::string> names(8000);
+	for(size_t i = 0; i < names.size(); i++)
+		names[i] = "member:" + std::to_string(i);
+
+	TSet *one_by_one = mk_tset();
+	TSet *bulk = mk_tset();
+
+	// first batch: an empty set always takes the bulk path
+	std::vector<std::string_view> batch;
+	std::vector<double> scores;
+	for(size_t i = 0; i < 5000; i++) {
+		batch.push_back(names[i]);
+		scores.push_back(pool[drawn++]);
+		ts_insertn(one_by_one, std::string(names[i]), scores.back());
+	}
+	size_t updated = 0;
+	assert(ts_add(bulk, batch, scores, updated) == batch.size() && updated == 0);
+	assert_same(one_by_one, bulk);
+
+	// second batch, big enough next to the set to rebuild again: new members, rescored old ones, and names
+	// given twice, where the later score wins
+	batch.clear();
+	scores.clear();
+	std::uniform_int_distribution<size_t> pick(0, names.size() - 1);
+	for(size_t i = 0; i < 3000; i++) {
+		batch.push_back(names[pick(gen)]);
+		scores.push_back(pool[drawn++]);
+	}
+	size_t want_new = 0, want_updated = 0;
+	for(size_t i = 0; i < batch.size(); i++) {
+		if(TSTNode *found = ts_find(one_by_one, batch[i])) {
+			ts_update(one_by_one, found, scores[i]);
+			want_updated++;
+		} else {
+			ts_insertn(one_by_one, std::string(batch[i]), scores[i]);
+			want_new++;
+		}
+	}
+	assert(ts_add(bulk, batch, scores, updated) == want_new && updated == want_updated);
+	assert_same(one_by_one, bulk);
+
+	// the rebuilt tree takes ordinary inserts and deletes afterwards
+	for(size_t i = 0; i < 2000; i++) {
+		const std::string &name = names[pick(gen)];
+		if(i % 2) {
+			ts_deleten(one_by_one, name);
+			ts_deleten(bulk, name);
+		} else if(!ts_find(bulk, name)) {
+			const double score = pool[drawn++];
+			ts_insertn(one_by_one, std::string(name), score);
+			ts_insertn(bulk, std::string(name), score);
+		}
+	}
+	assert_same(one_by_one, bulk);
+
+	std::println("{} members, bulk built tree matches one by one inserts", ts_size(bulk));
+	delete one_by_one;
+	delete bulk;
+}
@@ -0,0 +1,142 @@
+#include <cassert>
+#include <iterator>
+#include <print>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "kvt_tset.h"
+#include "test/rbt_check.h"
+
+using namespace redbrouk;
+using namespace std::string_literals;
+
+// The set walks in exactly the model's (score, name) order, std::string ordering bytes as unsigned like ts_namecmp
+static void assert_order(TSet *t, const std::set<std::pair<double, std::string>> &model) {
+	assert(ts_size(t) == model.size());
+	assert(rbt_check(t->stm_root, tstn_tiebreak) == model.size());
+
+	TSTNode *n = ts_min(t);
+	for(const auto &[score, name] : model) {
+		assert(n && n->tnode.key == score && n->name == name);
+		n = ts_walk(n, 1);
+	}
+	assert(!n);
+	assert(model.empty() ? !ts_max(t) : ts_max(t)->name == model.rbegin()->second);
+}
+
+static bool lex_inside(const std::string &name, std::string_view bound, bool lower) {
+	if(bound == "-")
+		return lower;
+	if(bound == "+")
+		return !lower;
+
+	const std::string b(bound.substr(1));
+	const bool exclusive = bound[0] == '(';
+	if(lower)
+		return exclusive ? name > b : name >= b;
+	return exclusive ? name < b : name <= b;
+}
+
+int main(int argc, char *argv[]) {
+	std::random_device rd;
+	std::mt19937_64 gen(rd());
+
+	// names meant to land on the cached 8 byte prefix's edges: equal prefixes, names shorter than 8 bytes,
+	// names that are prefixes of others, a zero byte and bytes past 0x7f
+	std::vector<std::string> names = { "", "a", "ab", "abcdefg", "abcdefgh", "abcdefgh\0"s, "abcdefgi", "b", "\xff", "\x7f\x80" };
+	const char *stems[] = { "sharedpf", "sharedpf:", "sharedpg", "shared", "zz" };
+	for(const char *stem : stems) {
+		for(int i = 0; i < 12; i++)
+			names.push_back(stem + std::string(1, "a\0\x7f\xff-09AZaz"[i % 12]) + std::to_string(i / 3));
+	}
+	std::uniform_int_distribution<size_t> pick(0, names.size() - 1);
+
+	// equal scores: every member lands on one of three, so inserts, rescores and deletes all go through ties
+	{
+		TSet *t = mk_tset();
+		std::set<std::pair<double, std::string>> model;
+		std::vector<double> score_of(names.size(), -1); // -1 for absent
+
+		for(int step = 0; step < 20000; step++) {
+			const size_t i = pick(gen);
+			const double score = (double)(gen() % 3);
+			switch(gen() % 3) {
+			case 0: // insert, or rescore through ts_update when it's there
+			case 1:
+				if(TSTNode *found = ts_find(t, names[i])) {
+					model.erase({ score_of[i], names[i] });
+					ts_update(t, found, score);
+				} else {
+					ts_insertn(t, std::string(names[i]), score);
+				}
+				model.insert({ score, names[i] });
+				score_of[i] = score;
+				break;
+			default:
+				assert(ts_deleten(t, names[i]) == (score_of[i] >= 0));
+				model.erase({ score_of[i], names[i] });
+				score_of[i] = -1;
+			}
+			assert_order(t, model);
+		}
+
+		// the same ties through ts_add's bulk rebuild
+		std::vector<std::string_view> batch(names.begin(), names.end());
+		std::vector<double> scores(batch.size());
+		for(size_t i = 0; i < batch.size(); i++) {
+			scores[i] = (double)(gen() % 2);
+			if(score_of[i] >= 0)
+				model.erase({ score_of[i], names[i] });
+			model.insert({ scores[i], names[i] });
+		}
+		size_t updated;
+		ts_add(t, batch, scores, updated);
+		assert_order(t, model);
+		delete t;
+	}
+
+	// trangebylex bounds on members sharing one score, against a filter over every name
+	{
+		TSet *t = mk_tset();
+		std::set<std::string> in_set;
+		for(const std::string &name : names) {
+			if(gen() % 4) {
+				ts_insertn(t, std::string(name), 0);
+				in_set.insert(name);
+			}
+		}
+
+		std::vector<std::string> bounds = { "-", "+" };
+		for(const std::string &name : names) { // bounds on members and on names that aren't in the set
+			bounds.push_back("[" + name);
+			bounds.push_back("(" + name);
+		}
+
+		size_t ranges = 0;
+		for(const std::string &lo : bounds) {
+			for(const std::string &hi : bounds) {
+				TSLexBound min, max;
+				assert(ts_parse_lex_bound(lo, min) && ts_parse_lex_bound(hi, max));
+
+				std::vector<std::string> got, want;
+				for(TSTNode *n = ts_lex_first(t, min); n && !ts_lex_past(n, max); n = ts_walk(n, 1))
+					got.push_back(n->name);
+				for(const std::string &name : in_set) {
+					if(lex_inside(name, lo, true) && lex_inside(name, hi, false))
+						want.push_back(name);
+				}
+				assert(got == want);
+				ranges++;
+			}
+		}
+
+		TSLexBound bad;
+		assert(!ts_parse_lex_bound("", bad) && !ts_parse_lex_bound("name", bad) && !ts_parse_lex_bound("-x", bad));
+		std::println("{} lex ranges over {} members match", ranges, ts_size(t));
+		delete t;
+	}
+}
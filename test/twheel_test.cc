@@ -0,0 +1,49 @@
+#include <cassert>
+#include <print>
+#include <random>
+#include <vector>
+
+#include "twheel.h"
+
+using namespace redbrouk;
+
+int main(int argc, char *argv[]) {
+	std::random_device rd;
+	std::mt19937_64 gen(rd());
+	std::uniform_int_distribution<uint64_t> near(1, 5000);
+	std::uniform_int_distribution<uint64_t> far(5000, 1ull << 32);
+
+	const uint64_t start = 1000000;
+	TWheel *tw = mk_twheel(nullptr, start);
+
+	std::vector<TWNode> nodes(20000);
+	for(size_t i = 0; i < nodes.size(); i++)
+		tw_add(tw, &nodes[i], start + (i % 2 ? near(gen) : far(gen)));
+	assert(tw->size == nodes.size());
+
+	// every 3rd node is cancelled before it fires
+	for(size_t i = 0; i < nodes.size(); i += 3)
+		tw_del(tw, &nodes[i]);
+
+	size_t fired = 0;
+	uint64_t now = start;
+	while(tw->size > 0) {
+		now += near(gen) * 1024; // uneven jumps, crossing several cascade boundaries at once
+		tw_advance(tw, now);
+
+		while(TWNode *n = tw_pop_due(tw)) {
+			const size_t idx = n - nodes.data();
+			assert(idx % 3 != 0 && "cancelled node fired");
+			assert(n->prev == nullptr && !tw_armed(n));
+			fired++;
+		}
+		// nothing still armed may already be late
+		for(size_t i = 0; i < nodes.size(); i++)
+			if(i % 3 != 0 && nodes[i].next)
+				assert(nodes[i].deadline > now);
+	}
+
+	std::println("Fired {} of {} timers, final tick {}", fired, nodes.size(), now);
+	assert(fired == nodes.size() - (nodes.size() + 2) / 3);
+	delete tw;
+}